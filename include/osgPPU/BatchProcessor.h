@@ -0,0 +1,258 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_BATCH_PROCESSOR_H_
+#define _C_BATCH_PROCESSOR_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/Image>
+#include <osg/GraphicsContext>
+
+#include <osgPPU/Export.h>
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitTexture.h>
+
+#include <vector>
+#include <string>
+
+namespace osgPPU
+{
+
+//! Process sequences of images offline
+/**
+ * The batch processor streams images from a source through the unit graph of a processor
+ * and passes the output of one unit to a sink. No window is required, the processor is rendered
+ * into an offscreen context (pbuffer) unless a context is specified by setGraphicsContext().
+ * Hence contexts of headless platforms (i.e. OSMesa or EGL without surface) can be used too.
+ *
+ * The images are fed into the graph through the texture of an UnitTexture. Decoding, rendering
+ * and encoding overlap:
+ *  - The images are read from the source by a separate thread.
+ *  - The images are uploaded through a ring of pixel buffer objects (double or triple buffering),
+ *    hence the copy into the texture runs asynchronously to the rendering.
+ *  - The output is read back into a ring of pixel buffer objects. A fence is inserted behind every
+ *    read back, so up to K frames are in flight before the processor waits for the GPU.
+ *  - The read back images are passed to the sink by a separate thread in the order of the frames.
+ * If the context does not support pixel buffer objects, then the transfers are synchronous.
+ *
+ * All images of a sequence must have the size of the first image, others are skipped.
+ **/
+class OSGPPU_EXPORT BatchProcessor : public osg::Referenced
+{
+    public:
+
+        /**
+        * Source of the images to process.
+        **/
+        class OSGPPU_EXPORT Source : public osg::Referenced
+        {
+            public:
+                /**
+                * Read the next image of the sequence. The method is called from the decoding thread.
+                * @return NULL if there are no more images
+                **/
+                virtual osg::Image* read() = 0;
+
+            protected:
+                virtual ~Source() {}
+        };
+
+        /**
+        * Receiver of the processed images.
+        **/
+        class OSGPPU_EXPORT Sink : public osg::Referenced
+        {
+            public:
+                /**
+                * Write a processed image. The method is called from the encoding thread in the order
+                * of the frames. The image is not used by the batch processor anymore.
+                * @return false if the image could not be written
+                **/
+                virtual bool write(unsigned int frame, osg::Image* image) = 0;
+
+            protected:
+                virtual ~Sink() {}
+        };
+
+        /**
+        * Source reading a list of image files with osgDB.
+        **/
+        class OSGPPU_EXPORT ImageFileSource : public Source
+        {
+            public:
+                ImageFileSource(const std::vector<std::string>& files) : mFiles(files), mNext(0) {}
+
+                /**
+                * Create a source of all files of a directory, which have the given extension.
+                * The files are sorted by their names.
+                **/
+                static ImageFileSource* createFromDirectory(const std::string& directory, const std::string& extension);
+
+                virtual osg::Image* read();
+
+                //! Get list of files read
+                inline const std::vector<std::string>& getFiles() const { return mFiles; }
+
+            protected:
+                std::vector<std::string> mFiles;
+                unsigned int mNext;
+        };
+
+        /**
+        * Sink writing the images with osgDB into numbered files "path/prefix%04d.extension".
+        **/
+        class OSGPPU_EXPORT ImageFileSink : public Sink
+        {
+            public:
+                ImageFileSink(const std::string& path, const std::string& extension, const std::string& prefix = std::string()) :
+                    mPath(path), mExtension(extension), mPrefix(prefix) {}
+
+                virtual bool write(unsigned int frame, osg::Image* image);
+
+            protected:
+                std::string mPath;
+                std::string mExtension;
+                std::string mPrefix;
+        };
+
+        /**
+        * Statistics of the last run.
+        **/
+        struct OSGPPU_EXPORT Statistics
+        {
+            Statistics() : numFrames(0), numSkipped(0), numFailed(0), numStalls(0), seconds(0.0) {}
+
+            //! Number of frames passed to the sink
+            unsigned int numFrames;
+
+            //! Number of images, which were not processed since their size differs
+            unsigned int numSkipped;
+
+            //! Number of frames the sink failed to write
+            unsigned int numFailed;
+
+            //! Number of times the processor had to wait for the GPU to reuse a transfer buffer
+            unsigned int numStalls;
+
+            //! Time since the first image was read
+            double seconds;
+
+            //! Throughput in frames per second
+            inline double getFramesPerSecond() const { return seconds > 0.0 ? numFrames / seconds : 0.0; }
+        };
+
+        /**
+        * Create a batch processor.
+        * @param processor Processor to run
+        * @param input Unit, whose texture is replaced by the images of the source
+        * @param output Unit, whose output texture is passed to the sink
+        * @param mrt Index of the output texture of the output unit
+        **/
+        BatchProcessor(Processor* processor, UnitTexture* input, Unit* output, int mrt = 0);
+
+        /**
+        * Set the context to render into. The context is realized by the batch processor. If no context
+        * is set, then a pbuffer of the size of the first image is created.
+        **/
+        inline void setGraphicsContext(osg::GraphicsContext* gc) { mGraphicsContext = gc; }
+
+        /**
+        * Get the context rendered into.
+        **/
+        inline osg::GraphicsContext* getGraphicsContext() { return mGraphicsContext.get(); }
+
+        /**
+        * Set the number of pixel buffers used to upload the images, 2 for double buffering (default)
+        * or 3 for triple buffering.
+        **/
+        inline void setNumUploadBuffers(unsigned int num) { mNumUploadBuffers = num > 0 ? num : 1; }
+
+        /**
+        * Get the number of pixel buffers used to upload the images.
+        **/
+        inline unsigned int getNumUploadBuffers() const { return mNumUploadBuffers; }
+
+        /**
+        * Set the maximal number of frames rendered, but not read back yet (default 3).
+        **/
+        inline void setNumFramesInFlight(unsigned int num) { mNumFramesInFlight = num > 0 ? num : 1; }
+
+        /**
+        * Get the maximal number of frames in flight.
+        **/
+        inline unsigned int getNumFramesInFlight() const { return mNumFramesInFlight; }
+
+        /**
+        * Set the format and type of the images passed to the sink (default GL_RGBA and GL_UNSIGNED_BYTE).
+        * Use i.e. GL_FLOAT to read back HDR outputs.
+        **/
+        inline void setOutputFormat(GLenum format, GLenum type) { mOutputFormat = format; mOutputType = type; }
+
+        /**
+        * Get the format of the images passed to the sink.
+        **/
+        inline GLenum getOutputFormat() const { return mOutputFormat; }
+
+        /**
+        * Get the type of the images passed to the sink.
+        **/
+        inline GLenum getOutputType() const { return mOutputType; }
+
+        /**
+        * Set the interval in seconds, in which the throughput is reported. Set 0 to disable.
+        **/
+        inline void setReportInterval(double seconds) { mReportInterval = seconds; }
+
+        /**
+        * Get the interval in seconds, in which the throughput is reported.
+        **/
+        inline double getReportInterval() const { return mReportInterval; }
+
+        /**
+        * Process all images of the source. The method returns when all processed images
+        * were written by the sink.
+        * @return false if no image could be processed or if the sink failed
+        **/
+        bool run(Source* source, Sink* sink);
+
+        /**
+        * Get the statistics of the last run.
+        **/
+        inline const Statistics& getStatistics() const { return mStatistics; }
+
+    protected:
+        virtual ~BatchProcessor();
+
+        osg::ref_ptr<Processor> mProcessor;
+        osg::ref_ptr<UnitTexture> mInput;
+        osg::ref_ptr<Unit> mOutput;
+        int mOutputIndex;
+        osg::ref_ptr<osg::GraphicsContext> mGraphicsContext;
+        unsigned int mNumUploadBuffers;
+        unsigned int mNumFramesInFlight;
+        GLenum mOutputFormat;
+        GLenum mOutputType;
+        double mReportInterval;
+        Statistics mStatistics;
+};
+
+};
+
+#endif
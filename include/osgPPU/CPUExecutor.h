@@ -0,0 +1,277 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_CPU_EXECUTOR_H_
+#define _C_CPU_EXECUTOR_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/Image>
+#include <osg/Camera>
+#include <osg/Vec4>
+
+#include <osgPPU/Export.h>
+#include <osgPPU/Processor.h>
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+
+namespace osgPPU
+{
+
+class ShaderAttribute;
+
+//! Execute the units of a processor on the CPU
+/**
+ * The executor is a reference implementation of the unit semantics, which runs without
+ * any OpenGL context. Use it for batch jobs on machines without a GPU or to compute
+ * golden images for tests. The processor is set up by Processor::dryRun(), hence
+ * the attached camera must only provide a viewport and the attachments read by the pipeline.
+ *
+ * Every texture is represented by a RGBA float image incl. all its mipmap levels.
+ * The following units are supported:
+ *  - UnitBypass, UnitCameraAttachmentBypass, UnitDepthbufferBypass and UnitCamera pass
+ *    the images given by setInputImage() through.
+ *  - UnitTexture passes the image of its texture through.
+ *  - UnitInOut and UnitInResampleOut without a shader resample the input 0 bilinear to the output size.
+ *  - UnitInOut with a shader is computed by the kernel registered for the name of the shader,
+ *    all MRT outputs are passed to the kernel. @see registerKernel()
+ *  - UnitInMipmapOut computes its mipmap levels by the kernel of its shader or by a box filter.
+ *  - UnitInOutRepeat iterates its segment of the execution plan.
+ * Units which only output to the frame buffer (i.e. UnitOut) are not executed.
+ *
+ * Kernels for the shaders of the shipped pipelines (Data/glsl) are registered by default. They
+ * run on tiles of the output on a pool of threads and use SSE if available. The results
+ * match the OpenGL path within the precision of the output texture formats.
+ *
+ * Since fused shaders have no kernels, processors with shader fusion enabled are refused.
+ * Disable it by Processor::setUseShaderFusion(false) before executing the processor on the CPU.
+ **/
+class OSGPPU_EXPORT CPUExecutor : public osg::Referenced
+{
+    public:
+
+        //! All mipmap levels of a texture, level 0 first
+        typedef std::vector<osg::ref_ptr<osg::Image> > ImageLevels;
+
+        /**
+        * Inputs and outputs of a unit passed to a kernel.
+        **/
+        class OSGPPU_EXPORT Context
+        {
+            public:
+                Context(const Unit* unit, const ShaderAttribute* shader) : mUnit(unit), mShader(shader), mLevel(0), mNumLevels(1) {}
+
+                //! Get the executed unit
+                inline const Unit* getUnit() const { return mUnit; }
+
+                //! Get the shader the kernel stands in for
+                inline const ShaderAttribute* getShader() const { return mShader; }
+
+                /**
+                * Get the image of an input texture, the index is the texture unit the input is bound to.
+                * Levels which do not exist are clamped to the last level.
+                * @return NULL if there is no such input
+                **/
+                const osg::Image* getInput(int index, int level = 0) const;
+
+                //! Get number of mipmap levels of an input
+                int getNumInputLevels(int index) const;
+
+                /**
+                * Get the input bound to the sampler uniform of the given name. The uniform is
+                * searched on the unit first and then on the shader.
+                * @return NULL if there is no such sampler or input
+                **/
+                const osg::Image* getSampler(const std::string& name, int level = 0) const;
+
+                /**
+                * Get the texture unit the sampler uniform of the given name is bound to, -1 if none.
+                **/
+                int getSamplerIndex(const std::string& name) const;
+
+                /**
+                * Sample an input at the texture coordinates like texture2D() does,
+                * i.e. bilinear or nearest as specified by the filter of the input texture.
+                **/
+                osg::Vec4 sample(int index, float s, float t, int level = 0) const;
+
+                /**
+                * Get the value of a float uniform. The uniform is searched on the unit first
+                * and then on the shader.
+                **/
+                float getFloat(const std::string& name, float defaultValue = 0.0f) const;
+
+                //! Get output image for the given MRT index, NULL if there is no such output
+                osg::Image* getOutput(int mrt = 0) const;
+
+                //! Get number of outputs
+                inline int getNumOutputs() const { return (int)mOutputs.size(); }
+
+                //! Mipmap level currently computed, 0 for all units except UnitInMipmapOut
+                inline int getLevel() const { return mLevel; }
+
+                //! Number of mipmap levels of the output
+                inline int getNumLevels() const { return mNumLevels; }
+
+            protected:
+                friend class CPUExecutor;
+
+                struct Input
+                {
+                    Input() : levels(NULL), nearest(false) {}
+                    const ImageLevels* levels;
+                    bool nearest;
+                };
+
+                const Unit* mUnit;
+                const ShaderAttribute* mShader;
+                std::map<int, Input> mInputs;
+                std::vector<osg::Image*> mOutputs;
+                int mLevel;
+                int mNumLevels;
+        };
+
+        /**
+        * Kernel computing the outputs of a unit. It stands in for a shader on the CPU.
+        * The kernel is called for several tiles of the output at once from different threads,
+        * hence it must not change any state.
+        **/
+        class OSGPPU_EXPORT Kernel : public osg::Referenced
+        {
+            public:
+                /**
+                * Compute the output pixels [x0,x1)x[y0,y1) of all outputs.
+                **/
+                virtual void compute(const Context& context, int x0, int y0, int x1, int y1) const = 0;
+
+            protected:
+                virtual ~Kernel() {}
+        };
+
+        /**
+        * Create an executor for the given processor.
+        **/
+        CPUExecutor(Processor* processor);
+
+        /**
+        * Get the processor executed.
+        **/
+        inline Processor* getProcessor() { return mProcessor.get(); }
+
+        /**
+        * Set the number of threads used to run the kernels, 0 to use one thread per processor (default).
+        **/
+        void setNumThreads(unsigned int num);
+
+        /**
+        * Get the number of threads used to run the kernels.
+        **/
+        inline unsigned int getNumThreads() const { return mNumThreads; }
+
+        /**
+        * Set the size of the tiles the outputs are split into (default 64).
+        **/
+        inline void setTileSize(unsigned int size) { mTileSize = size > 0 ? size : 1; }
+
+        /**
+        * Get the size of the tiles.
+        **/
+        inline unsigned int getTileSize() const { return mTileSize; }
+
+        /**
+        * Set the image of a camera attachment, which is used as input to the pipeline.
+        * The image is converted to RGBA float on every execution, if it was modified.
+        **/
+        void setInputImage(osg::Camera::BufferComponent buffer, osg::Image* image);
+
+        /**
+        * Execute all units of the processor once. The outputs are kept until the next execution,
+        * hence units reading outputs of the previous frame work as on the GPU.
+        * @return false if some of the units could not be executed, because they are not supported
+        * or no kernel is registered for their shader. All other units are executed anyway.
+        * Nothing is executed and false is returned, if shader fusion of the processor is enabled.
+        **/
+        bool execute();
+
+        /**
+        * Get the image computed for the given texture.
+        * @return NULL if the texture was not computed yet
+        **/
+        osg::Image* getImage(const osg::Texture* texture, int level = 0) const;
+
+        /**
+        * Get the image computed for an output of a unit.
+        **/
+        osg::Image* getOutputImage(Unit* unit, int mrt = 0, int level = 0) const;
+
+        /**
+        * Register a kernel which stands in for all shaders of the given name.
+        * Specify NULL to remove the kernel.
+        **/
+        static void registerKernel(const std::string& shaderName, Kernel* kernel);
+
+        /**
+        * Get the kernel registered for the shaders of the given name, NULL if none.
+        **/
+        static Kernel* getKernel(const std::string& shaderName);
+
+        /**
+        * Sample a RGBA float image bilinear with clamping to edge like texture2D() does.
+        **/
+        static osg::Vec4 sample(const osg::Image* image, float s, float t);
+
+    protected:
+        virtual ~CPUExecutor();
+
+        //! Image levels of a texture and the image they were converted from
+        struct Surface
+        {
+            Surface() : modifiedCount(0) {}
+            ImageLevels levels;
+            osg::ref_ptr<const osg::Image> source;
+            unsigned int modifiedCount;
+        };
+
+        //! Inputs replaced during the iterations of repeatable segments
+        typedef std::map<const Unit*, const osg::Texture*> InputOverrides;
+
+        Surface* getSurface(const osg::Texture* texture);
+        void updateSurface(Surface& surface, const osg::Image* image);
+        void executePlan(const Processor::ExecutionPlan& plan, unsigned begin, unsigned end, InputOverrides& overrides);
+        bool executeUnit(Unit* unit, const InputOverrides& overrides);
+        void run(const Kernel& kernel, const Context& context, int width, int height);
+        void report(const Unit* unit, const std::string& message);
+
+        osg::ref_ptr<Processor> mProcessor;
+        std::map<osg::Camera::BufferComponent, osg::ref_ptr<osg::Image> > mInputImages;
+        std::map<const osg::Texture*, Surface> mSurfaces;
+        std::set<std::string> mReportedUnits;
+        std::vector<unsigned char> mSkipped;
+        osg::ref_ptr<osg::Referenced> mThreadPool;
+        unsigned int mNumThreads;
+        unsigned int mTileSize;
+        bool mSuccess;
+};
+
+};
+
+#endif
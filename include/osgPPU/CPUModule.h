@@ -0,0 +1,209 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_CPU_MODULE_H_
+#define _C_CPU_MODULE_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Matrixf>
+#include <osg/Vec4>
+#include <OpenThreads/Mutex>
+
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOutModule.h>
+
+#include <vector>
+#include <string>
+
+namespace osgPPU
+{
+
+//! Module processing the frames of a UnitInOutModule on the CPU
+/**
+ * The module runs a chain of kernels over the input 0 of the unit and writes the result
+ * into all outputs of the unit. The frames are processed asynchronously, @see UnitInOutModule::AsyncModule,
+ * hence the draw thread is not blocked while the kernels run.
+ *
+ * The input is converted into a RGBA float surface first. The channels of the input are mapped
+ * to RGBA in order, missing color channels are 0 and a missing alpha is 1. The textures may be
+ * of type GL_FLOAT, GL_HALF_FLOAT_ARB or GL_UNSIGNED_BYTE. Each pass of a kernel reads one surface
+ * and writes the other one. Outputs of another size than the input are resampled by the nearest pixel.
+ *
+ * Every stage is split into bands of rows which run on a pool of threads. Each thread works off
+ * its own share of the bands and steals bands of other threads, when it is done. The conversions
+ * and the built-in kernels use SSE, AVX and F16C, as far as the compiler enables them.
+ *
+ * The module is also available by the name "cpu" in UnitInOutModule::loadModule(), so that
+ * it can be used in .ppu files. The name may be followed by the kernels to run, i.e.
+ * "cpu blur 2.0 threshold 0.5 0.5 0.5 0 colormatrix m00 ... m33" with the matrix given row by row.
+ **/
+class OSGPPU_EXPORT CPUModule : public UnitInOutModule::AsyncModule
+{
+    public:
+
+        /**
+        * RGBA float image a kernel works on. The rows are tightly packed and bottom up.
+        **/
+        struct Surface
+        {
+            Surface() : data(NULL), width(0), height(0) {}
+
+            //! Get pixels of a row
+            inline float* row(int y) const { return data + (size_t)y * width * 4; }
+
+            float* data;
+            int width, height;
+        };
+
+        /**
+        * Kernel run by the module. The rows of a pass are computed by several threads at once,
+        * hence the kernel must not change any state.
+        **/
+        class OSGPPU_EXPORT Kernel : public osg::Referenced
+        {
+            public:
+                //! Get number of passes of the kernel, i.e. 2 for a separable filter
+                virtual unsigned int getNumPasses() const { return 1; }
+
+                /**
+                * Compute the rows [y0,y1) of the destination. Source and destination are of equal size.
+                * @param pass Index of the pass
+                **/
+                virtual void compute(unsigned int pass, const Surface& src, const Surface& dst, int y0, int y1) const = 0;
+
+            protected:
+                virtual ~Kernel() {}
+        };
+
+        /**
+        * Separable gaussian blur, the edges are clamped.
+        **/
+        class OSGPPU_EXPORT BlurKernel : public Kernel
+        {
+            public:
+                /**
+                * @param sigma Standard deviation in pixels
+                * @param radius Radius of the filter, 0 to use 3 sigma
+                **/
+                BlurKernel(float sigma, int radius = 0);
+
+                virtual unsigned int getNumPasses() const { return 2; }
+                virtual void compute(unsigned int pass, const Surface& src, const Surface& dst, int y0, int y1) const;
+
+                //! Get radius of the filter
+                inline int getRadius() const { return (int)mWeights.size() / 2; }
+
+            protected:
+                std::vector<float> mWeights;
+        };
+
+        /**
+        * Multiply each pixel by a matrix like osg::Vec4 * osg::Matrixf, i.e. the result is
+        * r * row0 + g * row1 + b * row2 + a * row3.
+        **/
+        class OSGPPU_EXPORT ColorMatrixKernel : public Kernel
+        {
+            public:
+                ColorMatrixKernel(const osg::Matrixf& matrix) : mMatrix(matrix) {}
+
+                virtual void compute(unsigned int pass, const Surface& src, const Surface& dst, int y0, int y1) const;
+
+                //! Get the matrix
+                inline const osg::Matrixf& getMatrix() const { return mMatrix; }
+
+            protected:
+                osg::Matrixf mMatrix;
+        };
+
+        /**
+        * Set all channels to 0 which are below the threshold of the channel.
+        **/
+        class OSGPPU_EXPORT ThresholdKernel : public Kernel
+        {
+            public:
+                ThresholdKernel(const osg::Vec4& threshold) : mThreshold(threshold) {}
+
+                virtual void compute(unsigned int pass, const Surface& src, const Surface& dst, int y0, int y1) const;
+
+                //! Get the thresholds
+                inline const osg::Vec4& getThreshold() const { return mThreshold; }
+
+            protected:
+                osg::Vec4 mThreshold;
+        };
+
+        /**
+        * Create the module.
+        * @param parent Unit the module is used by
+        * @param numThreads Number of threads, 0 to use one per processor
+        **/
+        CPUModule(UnitInOutModule* parent, unsigned int numThreads = 0);
+
+        /**
+        * Append a kernel to the chain. Without any kernel the input is copied to the outputs.
+        * The chain can be changed at any time, the change applies from the next frame on.
+        **/
+        void addKernel(Kernel* kernel);
+
+        //! Remove all kernels
+        void removeKernels();
+
+        //! Get number of kernels in the chain
+        unsigned int getNumKernels() const;
+
+        /**
+        * Set the number of rows of a band, the stages are split into (default 16).
+        **/
+        inline void setBandRows(unsigned int rows) { mBandRows = rows > 0 ? rows : 1; }
+
+        //! Get the number of rows of a band
+        inline unsigned int getBandRows() const { return mBandRows; }
+
+        //! Get number of threads processing the frames
+        inline unsigned int getNumThreads() const { return mNumThreads; }
+
+        virtual bool init();
+        virtual void process(const UnitInOutModule::Frame& frame);
+
+        /**
+        * Create a module for the unit from a description "kernel parameters ..." and set it.
+        * This is the entry point of the module name "cpu".
+        * @return false if the description could not be parsed
+        **/
+        static bool create(UnitInOutModule* parent, const std::string& arguments);
+
+    protected:
+        virtual ~CPUModule();
+
+        friend class CPUModulePool;
+
+        //! Run the chain of kernels over a frame, called by the threads of the pool
+        void processFrame(const UnitInOutModule::Frame& frame);
+
+        std::vector<osg::ref_ptr<Kernel> > mKernels;
+        mutable OpenThreads::Mutex mKernelMutex;
+        std::vector<float> mSurfaces[2];
+        unsigned int mNumThreads;
+        unsigned int mBandRows;
+        osg::ref_ptr<osg::Referenced> mPool;
+};
+
+};
+
+#endif
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_CAPTURE_SINK_H_
+#define _C_CAPTURE_SINK_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/Image>
+#include <OpenThreads/Mutex>
+
+#include <osgPPU/Export.h>
+
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <string>
+
+#ifndef GL_HALF_FLOAT_ARB
+    #define GL_HALF_FLOAT_ARB 0x140B
+#endif
+
+namespace osgPPU
+{
+
+//! Receiver of the frames captured by UnitOutCapture
+/**
+ * The frames are passed to the sink by the worker threads of the capture unit.
+ * The image passed to write() is usually a view on the mapped pixel buffer, the frame
+ * was read back into. Hence the frame is not copied before it reaches the sink, but the
+ * image is only valid during the call. Sinks which keep the frame have to copy it.
+ *
+ * The images are stored bottom up, as OpenGL reads them back.
+ **/
+class OSGPPU_EXPORT CaptureSink : public osg::Referenced
+{
+    public:
+        /**
+        * Write a captured frame.
+        * @param input Index of the input of the capture unit
+        * @param number Number of the captured frame of this input
+        * @param image Captured frame, only valid during the call
+        * @return false if the frame could not be written
+        **/
+        virtual bool write(int input, int number, const osg::Image& image) = 0;
+
+        /**
+        * Return true, if the frames must be written one after the other in the order they were captured.
+        * Otherwise write() is called from several threads at once.
+        **/
+        virtual bool isSequential() const { return false; }
+
+        /**
+        * Called when the capture unit was flushed, i.e. to flush file buffers.
+        **/
+        virtual void flush() {}
+
+    protected:
+        virtual ~CaptureSink() {}
+};
+
+//! Write every frame into its own image file
+/**
+ * The files are written with osgDB as "path/input_number.extension".
+ **/
+class OSGPPU_EXPORT ImageFileSink : public CaptureSink
+{
+    public:
+        ImageFileSink(const std::string& path, const std::string& extension) : mPath(path), mExtension(extension) {}
+
+        virtual bool write(int input, int number, const osg::Image& image);
+
+        //! Get path the files are written to
+        inline const std::string& getPath() const { return mPath; }
+
+        //! Get extension of the files
+        inline const std::string& getFileExtension() const { return mExtension; }
+
+    protected:
+        std::string mPath;
+        std::string mExtension;
+};
+
+//! Write every frame of a float texture into its own HDR file
+/**
+ * The frames are written without osgDB into either an OpenEXR scanline file or a raw file,
+ * at "path/input_number.exr" respectively "path/input_number.raw". The frames must be of
+ * type GL_HALF_FLOAT_ARB or GL_FLOAT, @see UnitOutCapture::setDataType(). Float frames are
+ * stored as half, unless setStoreHalf(false) was called. The rows are stored top down.
+ *
+ * The raw file starts with a header of six 32 bit little endian words: the magic 0x46555050
+ * ("PPUF"), the version 1, the width, the height, the number of channels and the number of
+ * bytes per channel (2 or 4). The interleaved little endian pixels follow.
+ *
+ * The compression of the OpenEXR files is split by blocks of rows over a pool of threads, so
+ * that a single frame is compressed on all cores. Since write() is called by several workers
+ * of the capture unit at once, the blocks of all frames in work share the pool.
+ **/
+class OSGPPU_EXPORT HDRFileSink : public CaptureSink
+{
+    public:
+        //! Format of the written files
+        enum Format
+        {
+            //! Header and uncompressed pixels
+            RAW,
+
+            //! OpenEXR scanline file
+            EXR
+        };
+
+        //! Compression of the OpenEXR files
+        enum Compression
+        {
+            NO_COMPRESSION = 0,
+            RLE_COMPRESSION = 1
+        };
+
+        /**
+        * Create the sink.
+        * @param path Directory the files are written to
+        * @param format Format of the files
+        * @param numThreads Number of threads compressing a frame, 0 to use one per core
+        **/
+        HDRFileSink(const std::string& path, Format format = EXR, unsigned int numThreads = 0);
+
+        virtual bool write(int input, int number, const osg::Image& image);
+
+        //! Set compression of the OpenEXR files (default RLE_COMPRESSION)
+        inline void setCompression(Compression compression) { mCompression = compression; }
+
+        //! Get compression of the OpenEXR files
+        inline Compression getCompression() const { return mCompression; }
+
+        //! Set if float frames are converted to half (default true)
+        inline void setStoreHalf(bool half) { mStoreHalf = half; }
+
+        //! Check if float frames are converted to half
+        inline bool getStoreHalf() const { return mStoreHalf; }
+
+        //! Get path the files are written to
+        inline const std::string& getPath() const { return mPath; }
+
+        //! Get format of the files
+        inline Format getFormat() const { return mFormat; }
+
+    protected:
+        virtual ~HDRFileSink();
+
+        std::string mPath;
+        Format mFormat;
+        Compression mCompression;
+        bool mStoreHalf;
+
+        //! Threads compressing the blocks of the frames
+        osg::ref_ptr<osg::Referenced> mPool;
+};
+
+//! Append the raw frames to a memory mapped file
+/**
+ * The file is preallocated for the given number of frames, when the first frame arrives.
+ * The frames are copied into the mapping without any header one after the other. All frames
+ * must have the size and format of the first frame. Frames which do not fit into the file anymore
+ * are not written. When the sink is released, the file is truncated to the written frames.
+ **/
+class OSGPPU_EXPORT MappedFileSink : public CaptureSink
+{
+    public:
+        MappedFileSink(const std::string& filename, unsigned int maxFrames);
+
+        virtual bool write(int input, int number, const osg::Image& image);
+        virtual bool isSequential() const { return true; }
+        virtual void flush();
+
+        //! Get size of one frame in bytes, 0 if no frame was written yet
+        inline unsigned int getFrameSize() const { return mFrameSize; }
+
+        //! Get number of frames written to the file
+        inline unsigned int getNumFrames() const { return mNumFrames; }
+
+    protected:
+        virtual ~MappedFileSink();
+
+        //! Map the file of the given size in bytes, fails if the size exceeds the address space or the file offsets
+        bool map(size_t size);
+        void unmap();
+
+        std::string mFilename;
+        unsigned int mMaxFrames;
+        unsigned int mFrameSize;
+        unsigned int mNumFrames;
+        unsigned char* mData;
+        size_t mSize;
+#ifdef WIN32
+        void* mFile;
+        void* mMapping;
+#else
+        int mFile;
+#endif
+};
+
+//! Stream the frames into a pipe, i.e. into an encoder process
+/**
+ * The frames are either written as they are (RAW) or as YUV4MPEG2 stream (Y4M). The
+ * Y4M stream has a header and 8 bit 4:4:4 frames, the rows are flipped to be top down.
+ * Y4M requires RGB or RGBA frames of type GL_UNSIGNED_BYTE. A Y4M stream can be encoded
+ * i.e. by the command "ffmpeg -y -i - video.mp4".
+ **/
+class OSGPPU_EXPORT StreamSink : public CaptureSink
+{
+    public:
+        //! Format of the stream
+        enum Format
+        {
+            //! Frames as they are read back
+            RAW,
+
+            //! YUV4MPEG2 stream
+            Y4M
+        };
+
+        /**
+        * Start a process with the given command and write into its standard input.
+        **/
+        StreamSink(const std::string& command, Format format, unsigned int framesPerSecond = 30);
+
+        /**
+        * Write into an already opened stream. The stream is not closed by the sink.
+        **/
+        StreamSink(FILE* stream, Format format, unsigned int framesPerSecond = 30);
+
+        virtual bool write(int input, int number, const osg::Image& image);
+        virtual bool isSequential() const { return true; }
+        virtual void flush();
+
+        //! Check whenever the stream is open
+        inline bool valid() const { return mStream != NULL; }
+
+    protected:
+        virtual ~StreamSink();
+
+        bool writeY4M(const osg::Image& image);
+
+        FILE* mStream;
+        bool mIsProcess;
+        Format mFormat;
+        unsigned int mFramesPerSecond;
+        bool mHeaderWritten;
+        int mWidth, mHeight;
+        std::vector<unsigned char> mPlanes;
+};
+
+//! Keep the last frames in memory, so that the application can poll them
+/**
+ * If the ring is full, then the oldest frame is replaced.
+ **/
+class OSGPPU_EXPORT RingSink : public CaptureSink
+{
+    public:
+        RingSink(unsigned int capacity);
+
+        virtual bool write(int input, int number, const osg::Image& image);
+        virtual bool isSequential() const { return true; }
+
+        /**
+        * Remove the oldest frame from the ring.
+        * @return false if the ring is empty
+        **/
+        bool poll(osg::ref_ptr<osg::Image>& image, int& input, int& number);
+
+        //! Get number of frames in the ring
+        unsigned int getNumFrames() const;
+
+        //! Get number of frames replaced before they were polled
+        unsigned int getNumOverwritten() const;
+
+    protected:
+        struct Entry
+        {
+            osg::ref_ptr<osg::Image> image;
+            int input;
+            int number;
+        };
+
+        unsigned int mCapacity;
+        std::deque<Entry> mFrames;
+        std::vector<osg::ref_ptr<osg::Image> > mFreeImages;
+        unsigned int mNumOverwritten;
+        mutable OpenThreads::Mutex mMutex;
+};
+
+};
+
+#endif
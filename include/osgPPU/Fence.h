@@ -0,0 +1,217 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_FENCE_H_
+#define _C_FENCE_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/GL>
+
+#include <osgPPU/Export.h>
+
+#include <vector>
+
+namespace osgPPU
+{
+
+//! Fence in the command stream of an OpenGL context
+/**
+ * A fence (GL_ARB_sync) is signaled as soon as the GPU has executed all commands
+ * issued before the fence. It is used to check whenever asynchronous transfers,
+ * i.e. into pixel buffer objects, are finished without stalling the pipeline.
+ *
+ * If the context does not support fences, then the fence is always signaled. The
+ * driver does synchronize on its own then, i.e. when a buffer is mapped.
+ * All methods must be called while the context is current.
+ **/
+class OSGPPU_EXPORT Fence : public osg::Referenced
+{
+    public:
+        Fence();
+
+        /**
+        * Check whenever the given context supports fences.
+        **/
+        static bool isSupported(unsigned int contextID);
+
+        /**
+        * Insert the fence behind all commands issued so far. A previously
+        * inserted fence is replaced.
+        **/
+        void insert(unsigned int contextID);
+
+        /**
+        * Check whenever the GPU has passed the fence, without waiting for it.
+        * @return true if the fence is passed or if no fence is inserted
+        **/
+        bool isSignaled() const;
+
+        /**
+        * Wait until the GPU has passed the fence.
+        * @return true if it was required to wait, false if the fence was already passed
+        **/
+        bool wait() const;
+
+        /**
+        * Delete the fence object. This is also done by insert().
+        **/
+        void release();
+
+        /**
+        * Hand the fence object over to be deleted, when a fence is inserted into its
+        * context the next time. Use this if the context is not current, i.e. in destructors.
+        **/
+        void releaseDeferred();
+
+        /**
+        * Delete the fence objects of the context handed over by releaseDeferred().
+        * This is done by insert() on its own.
+        **/
+        static void flushDeletedFences(unsigned int contextID);
+
+        /**
+        * Check whenever the fence is inserted and not released yet.
+        **/
+        inline bool valid() const { return mSync != NULL; }
+
+    protected:
+        virtual ~Fence();
+
+        void* mSync;
+        unsigned int mContextID;
+};
+
+//! Ring of pixel buffer objects of a context with a fence behind the last transfer through every buffer
+/**
+ * The ring is used to transfer images between the host and the GPU without waiting for the GPU,
+ * i.e. by reading back into one buffer while the transfer into another one is still running.
+ * It keeps the index of the buffer used by the next transfer, what is done with the other
+ * buffers is up to the user of the ring.
+ *
+ * The buffers are created, when they are bound the first time. Reallocated buffers are
+ * orphaned, hence mapping them afterwards does not wait for their previous transfer.
+ * All methods except releaseDeferred() must be called while the context of the ring is current.
+ **/
+class OSGPPU_EXPORT PixelBufferRing : public osg::Referenced
+{
+    public:
+        /**
+        * @param target GL_PIXEL_PACK_BUFFER_ARB for read backs or GL_PIXEL_UNPACK_BUFFER_ARB for uploads
+        * @param usage Usage hint of the buffers, i.e. GL_STREAM_READ_ARB or GL_STREAM_DRAW_ARB
+        **/
+        PixelBufferRing(GLenum target, GLenum usage);
+
+        /**
+        * Set the number of buffers and the context they belong to. If either has changed, the old
+        * buffers are released and the ring starts again with its first buffer.
+        **/
+        void resize(unsigned int contextID, unsigned int num);
+
+        //! Get number of buffers in the ring
+        inline unsigned int size() const { return mBuffers.size(); }
+
+        //! Get the context of the buffers
+        inline unsigned int getContextID() const { return mContextID; }
+
+        //! Get index of the buffer used by the next transfer
+        inline unsigned int getNext() const { return mNext; }
+
+        //! Set index of the buffer used by the next transfer
+        inline void setNext(unsigned int index) { mNext = mBuffers.empty() ? 0 : index % mBuffers.size(); }
+
+        //! Get index of the buffer used by the next transfer and move on to the following buffer
+        unsigned int advance();
+
+        /**
+        * Bind the buffer to the target of the ring. The buffer is created if required and
+        * reallocated to the given size, if its size has changed or if it shall be orphaned.
+        **/
+        void bind(unsigned int index, unsigned int size, bool orphan = false);
+
+        //! Bind no buffer to the target of the ring
+        void unbind();
+
+        /**
+        * Allocate immutable storage for the buffer, which is mapped for reading and writing as long
+        * as the buffer exists. Returns NULL if GL_ARB_buffer_storage is not supported by the context.
+        **/
+        void* allocatePersistent(unsigned int index, unsigned int size);
+
+        //! Check whenever the given context supports persistently mapped buffers
+        static bool isPersistentMappingSupported(unsigned int contextID);
+
+        /**
+        * Map the allocated buffer, i.e. with GL_READ_ONLY_ARB or GL_WRITE_ONLY_ARB.
+        * @return Memory of the buffer or NULL if it could not be mapped
+        **/
+        void* map(unsigned int index, GLenum access);
+
+        //! Unmap the buffer, if it is mapped and not mapped persistently
+        void unmap(unsigned int index);
+
+        //! Get the memory of the mapped buffer or NULL if it is not mapped
+        inline void* getMappedData(unsigned int index) const { return mBuffers[index].data; }
+
+        //! Get the buffer object, 0 if it was not created yet
+        inline GLuint getBufferID(unsigned int index) const { return mBuffers[index].id; }
+
+        //! Get the size of the buffer in bytes
+        inline unsigned int getBufferSize(unsigned int index) const { return mBuffers[index].size; }
+
+        //! Get the fence behind the last transfer through the buffer
+        inline Fence* getFence(unsigned int index) const { return mBuffers[index].fence.get(); }
+
+        //! Insert the fence of the buffer behind the commands issued so far
+        void insertFence(unsigned int index);
+
+        //! Unmap and delete the buffers and their fences
+        void release();
+
+        /**
+        * Hand the buffers and their fences over to be deleted, when the context is current
+        * the next time. This is done by the destructor on its own.
+        **/
+        void releaseDeferred();
+
+    protected:
+        virtual ~PixelBufferRing();
+
+        struct Buffer
+        {
+            Buffer() : id(0), size(0), data(NULL), persistent(false) {}
+
+            GLuint id;
+            unsigned int size;
+            void* data;
+            bool persistent;
+            osg::ref_ptr<Fence> fence;
+        };
+
+        GLenum mTarget;
+        GLenum mUsage;
+        unsigned int mContextID;
+        unsigned int mNext;
+        std::vector<Buffer> mBuffers;
+};
+
+};
+
+#endif
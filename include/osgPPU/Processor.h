@@ -22,17 +22,27 @@
 // Includes
 //-------------------------------------------------------------------------
 #include <osgPPU/Unit.h>
+#include <osgPPU/Profiler.h>
 #include <osg/Camera>
 #include <osg/State>
 #include <osg/Geode>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Atomic>
 
 #include <osgPPU/Export.h>
 
+#include <vector>
+#include <list>
+#include <string>
+#include <ostream>
+
 
 namespace osgPPU
 {
 
 class Visitor;
+class UnitInOut;
+class UnitInOutRepeat;
 
 //! Main processor used to setup the unit pipeline
 /**
@@ -74,6 +84,11 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         virtual void traverse(osg::NodeVisitor& nv);
 
+        /**
+        * Release the OpenGL objects of the units and of the profiler. @see Profiler::releaseGLObjects()
+        **/
+        virtual void releaseGLObjects(osg::State* state = 0) const;
+
         /**
          * Add a camera which texture attachment can be used as input to the pipeline.
          * The camera object must be setted up to render into a texture.
@@ -97,6 +112,25 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         void dirtyUnitSubgraph();
 
+        /**
+        * Mark only the part of the unit graph, which depends on the given unit, as dirty.
+        * Call this after you have added the unit to the graph or changed its inputs.
+        * On the next traversal only the unit and all units below it are initialized again,
+        * all other units keep their setup (FBOs, textures and uniforms). Cycles are resolved
+        * in this part of the graph only.
+        *
+        * NOTE: If texture aliasing is enabled, the whole graph is initialized again,
+        *       since outputs are shared between all branches.
+        **/
+        void dirtyUnitSubgraph(Unit* unit);
+
+        /**
+        * Mark the execution plan as dirty, so that it is rebuilt on the next traversal.
+        * The units keep their setup. Other than the plan itself, the dirty state can be
+        * changed from any thread at any time, e.g. by other processors sharing units.
+        **/
+        void dirtyExecutionPlan();
+
         /**
         * Check whenever the subgraph is valid. A subgraph is valid if it can be
         * traversed by default osg traversal's, hence if it does not contain any cycles.
@@ -104,7 +138,7 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * CullTraverser first to resolve the cycles automatically. Afterwards the subgraph
         * became valid.
         **/
-        inline bool isDirtyUnitSubgraph() const {return mbDirtyUnitGraph;}
+        inline bool isDirtyUnitSubgraph() const {return (unsigned(mDirtyFlags) & DIRTY_UNIT_GRAPH) != 0;}
 
         /**
         * Force to mark the subgraph as non-dirty. It is not recommended to traverse
@@ -112,7 +146,7 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * cycles which will end up in seg faults. Use this method only if
         * you know what you are doing.
         **/
-        inline void markUnitSubgraphNonDirty() {mbDirtyUnitGraph = false;}
+        inline void markUnitSubgraphNonDirty() {mDirtyFlags.AND(~unsigned(DIRTY_UNIT_GRAPH));}
 
         /**
         * Search in the subgraph for a unit. To be able to find the unit
@@ -127,7 +161,8 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * use the visitor to remove the unit from the graph. The subgraph of the unit
         * will be marked as dirty, so that it gets reorganized on the next traverse. All the
         * input units of the removed unit will be afterwards input units for the children
-        * of the removed unit.
+        * of the removed unit. Only the children of the removed unit and the units below
+        * them are initialized again.
         * @param unit Pointer to the unit to remove
         * @return true on success otherwise false
         **/
@@ -142,6 +177,7 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * any input or any graph structure. 
         * NOTE: Enabling this feature the unit will not be executed on its right place, but only at the end.
         *       If there are several units which are executed at the end, the order of them is undefined.
+        *       Copies of the processor do not take over the placed units, they have to be placed again.
         **/
         void placeUnitAsLast(Unit* unit, bool enable = true);
 
@@ -162,7 +198,7 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * do not want osg::Clamp in the pipelines be sure to set to false
         * before init() is called.
         **/
-        void useColorClamp( bool useColorClamp = true ) {mUseColorClamp = useColorClamp; mbDirty = true;}
+        void useColorClamp( bool useColorClamp = true ) {mUseColorClamp = useColorClamp; mDirtyFlags.OR(DIRTY_INIT);}
 
         /**
         * Call this method whenever your main viewport of any of the used cameras
@@ -172,9 +208,350 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         * NOTE: You can also use dirtyUnitSubgraph(), however this will run the whole
         *       initialization process again, which costs time. A call that just viewport
         *       changed require usually less time to complete.
+        *
+        * Output textures, which have to change their size, are given back to the TexturePool
+        * and replaced by textures of the new size, if they are used by units only.
         **/
         virtual void onViewportChange();
 
+        /**
+        * Single step of the execution plan. The step refers to a unit and to the
+        * indices of its parent units in the plan, so that the units can be executed
+        * without walking the unit graph on every frame.
+        **/
+        struct ExecutionStep
+        {
+            ExecutionStep() : repeat(NULL), segmentEnd(0), dead(false), fused(false), duplicate(false) {}
+
+            //! Unit executed by this step
+            osg::ref_ptr<Unit> unit;
+
+            //! Indices of the steps of the parent units
+            std::vector<unsigned> parents;
+
+            //! Set if the unit is a repeat unit, which iterates over a segment of the plan
+            UnitInOutRepeat* repeat;
+
+            //! Index behind the last step of the repeatable segment starting with this step
+            unsigned segmentEnd;
+
+            //! Set if nobody reads the output of the unit, hence it is not executed
+            bool dead;
+
+            //! Set if the shader of the unit is executed by a preceding unit, hence it is not executed
+            bool fused;
+
+            //! Set if an equal unit is executed before, hence the unit is not executed and provides the outputs of the equal unit
+            bool duplicate;
+
+            //! Group of equal units sharing their outputs, possibly between several processors. NULL if the unit is not shared
+            osg::ref_ptr<osg::Referenced> sharedGroup;
+        };
+
+        //! Flat list of units sorted in the order of their execution
+        typedef std::vector<ExecutionStep> ExecutionPlan;
+
+        /**
+        * Execution plan as it is published to the traversals. A published plan is never
+        * changed. Rebuilding the plan publishes a new one, while traversals running
+        * at the same time finish with the plan they have taken before.
+        **/
+        class PlanSnapshot : public osg::Referenced
+        {
+            public:
+                PlanSnapshot() {}
+                PlanSnapshot(const ExecutionPlan& plan, const osg::NodeList& planChildren) : steps(plan), children(planChildren) {}
+
+                //! Steps of the plan
+                const ExecutionPlan steps;
+
+                //! Children of the processor, which are not units, traversed before the steps
+                const osg::NodeList children;
+
+            protected:
+                virtual ~PlanSnapshot() {}
+        };
+
+        /**
+        * Get the execution plan of the processor. The plan is built once as soon
+        * as the unit subgraph was marked as dirty and is then used on every update and cull
+        * traversal. Every unit is placed after all of its parents. Units placed as last
+        * by placeUnitAsLast() are at the end of the plan. The returned plan stays valid
+        * even if the processor rebuilds its plan in the meantime.
+        **/
+        osg::ref_ptr<const PlanSnapshot> getPlanSnapshot() const;
+
+        //! Get a copy of the steps of the current execution plan, @see getPlanSnapshot()
+        inline ExecutionPlan getExecutionPlan() const { return getPlanSnapshot()->steps; }
+
+        /**
+        * Enable direct execution of the units. In this mode the units are not passed to
+        * the cull visitor anymore. Instead the processor emits only one drawable, which draws
+        * all units in the order of the execution plan. This saves creation of render leaves
+        * and state graphs for every unit on every frame. Children of units, which are not units
+        * (i.e. cameras), are still culled as usual. Default is false.
+        **/
+        void setUseDirectExecution(bool enable);
+
+        /**
+        * Check whenever the units are executed directly. @see setUseDirectExecution()
+        **/
+        inline bool getUseDirectExecution() const { return mbDirectExecution; }
+
+        /**
+        * Enable sharing of output textures between units. After the execution plan is built,
+        * the lifetime of every output texture is computed, i.e. from the unit writing it up to
+        * the last unit reading it. Units whose outputs are never alive at the same time will then
+        * render into the same texture, if type, size and format of the textures match.
+        * Only outputs of UnitInOut and UnitInResampleOut units, which are read by other units
+        * only, are shared. Use Unit::setKeepAlive() for outputs read by your application.
+        * Default is false.
+        **/
+        void setUseTextureAliasing(bool enable);
+
+        /**
+        * Check whenever output textures are shared between units. @see setUseTextureAliasing()
+        **/
+        inline bool getUseTextureAliasing() const { return mbTextureAliasing; }
+
+        /**
+        * Enable elimination of dead units. When the execution plan is built, units whose
+        * outputs never reach a UnitOut (or UnitOutCapture), a unit kept alive by
+        * Unit::setKeepAlive(), an output texture specified by the application or an input
+        * mapped to a uniform, are marked as dead and are not executed anymore. MRT outputs
+        * of living units, which are not read by anyone, are not rendered either.
+        * Make sure to mark units, whose outputs are read directly by your application, as kept alive.
+        * Default is false.
+        **/
+        void setUseDeadUnitElimination(bool enable);
+
+        /**
+        * Check whenever dead units are eliminated. @see setUseDeadUnitElimination()
+        **/
+        inline bool getUseDeadUnitElimination() const { return mbDeadUnitElimination; }
+
+        /**
+        * Enable fusion of the shaders of simple unit chains. When the execution plan is built,
+        * chains of UnitInOut units, where every unit is the only consumer of its predecessor
+        * and all but the first unit use point-wise shaders (@see ShaderAttribute::setPointwise()),
+        * are executed in one pass. The first unit of the chain renders a generated shader directly
+        * into the output of the last unit, the other units of the chain are not executed.
+        * This saves a full write and read of the output texture for every fused unit.
+        * Furthermore sibling units reading exactly the same inputs are rendered by the first
+        * of them in one pass into multiple render targets, which are the outputs of the siblings.
+        * All fused outputs must have the same size and format. Units whose statesets hold other state
+        * than their shader, their inputs and osgPPU's own uniforms (e.g. blending, modes or user uniforms)
+        * are never fused, since that state would be lost. Default is false.
+        **/
+        void setUseShaderFusion(bool enable);
+
+        /**
+        * Check whenever shaders of unit chains are fused. @see setUseShaderFusion()
+        **/
+        inline bool getUseShaderFusion() const { return mbShaderFusion; }
+
+        /**
+        * Enable elimination of duplicate units. Units of the same type, with the same shader
+        * program, uniform values, inputs, viewport and output format compute the same outputs,
+        * hence only the first of them is executed and all its duplicates provide its outputs
+        * to their consumers. Units fed by the same camera attachments are recognized as equal
+        * also between processors sharing the camera. Such units are executed once per frame
+        * by the processor culled first. If the processors use direct execution, the unit is drawn
+        * once per frame and context by the processor drawn first. Units of processors using
+        * direct execution are shared only with processors using direct execution too.
+        * Default is false.
+        **/
+        void setUseDuplicateUnitElimination(bool enable);
+
+        /**
+        * Check whenever duplicate units are eliminated. @see setUseDuplicateUnitElimination()
+        **/
+        inline bool getUseDuplicateUnitElimination() const { return mbDuplicateUnitElimination; }
+
+        /**
+        * Enable profiling of the units. If enabled, the time spent by every unit in the cull
+        * traversal and in its draw callback as well as the time required by the GPU to render
+        * the unit is measured. Use getProfiler() to get the averaged timings. Default is false.
+        **/
+        void setUseProfiler(bool enable);
+
+        /**
+        * Get the profiler measuring the units of the processor. Returns NULL if profiling
+        * is disabled. @see setUseProfiler()
+        **/
+        inline Profiler* getProfiler() { return mProfiler.get(); }
+        inline const Profiler* getProfiler() const { return mProfiler.get(); }
+
+        /**
+        * Get the peak amount of memory in bytes of the output textures being alive at the same step of the
+        * execution plan without sharing them. An output is alive from the step writing it until the last
+        * step reading it, outputs read by the application are alive until the end of the plan.
+        * The value is computed only if texture aliasing is enabled.
+        **/
+        inline unsigned int getOutputMemoryWithoutAliasing() const { return mOutputMemory; }
+
+        /**
+        * Get the peak amount of memory in bytes of the output textures being alive at the same step of the
+        * execution plan after they were shared, a shared texture is alive as long as any of its users.
+        * The value is computed only if texture aliasing is enabled.
+        **/
+        inline unsigned int getOutputMemoryWithAliasing() const { return mAliasedOutputMemory; }
+
+        /**
+        * Memory in bytes allocated by a single unit.
+        **/
+        struct OSGPPU_EXPORT UnitMemory
+        {
+            UnitMemory() : executed(true), numTextures(0), textureBytes(0), mipmapBytes(0), sharedBytes(0), pboBytes(0) {}
+
+            //! Name of the unit
+            std::string name;
+
+            //! Class name of the unit
+            std::string className;
+
+            //! False if the unit is eliminated from the execution plan, hence its outputs are never rendered
+            bool executed;
+
+            //! Number of output textures incl. MRT outputs
+            unsigned int numTextures;
+
+            //! Memory of the base level of all output textures incl. all slices, layers and faces
+            unsigned int textureBytes;
+
+            //! Additional memory of the mipmap levels of the output textures
+            unsigned int mipmapBytes;
+
+            //! Part of textureBytes and mipmapBytes of textures which are also the output of other units (bypassed, aliased or shared textures)
+            unsigned int sharedBytes;
+
+            //! Memory of the input and output PBOs
+            unsigned int pboBytes;
+        };
+
+        /**
+        * Memory in bytes allocated by the units of a processor. @see getMemoryStatistics()
+        **/
+        struct OSGPPU_EXPORT MemoryStatistics
+        {
+            MemoryStatistics() : numTextures(0), textureBytes(0), mipmapBytes(0), unsharedBytes(0), pboBytes(0), poolBytes(0) {}
+
+            //! Memory of every unit in the order of the execution plan
+            std::vector<UnitMemory> units;
+
+            //! Number of different output textures
+            unsigned int numTextures;
+
+            //! Memory of the base level of all output textures, every texture is counted once
+            unsigned int textureBytes;
+
+            //! Additional memory of the mipmap levels, every texture is counted once
+            unsigned int mipmapBytes;
+
+            //! Memory the output textures would require if no texture were shared between units
+            unsigned int unsharedBytes;
+
+            //! Memory of all PBOs
+            unsigned int pboBytes;
+
+            //! Memory of the unused textures held by the TexturePool
+            unsigned int poolBytes;
+
+            //! Total memory allocated by the processor, without the textures held by the pool
+            inline unsigned int getTotalBytes() const { return textureBytes + mipmapBytes + pboBytes; }
+
+            /**
+            * Write the statistics as JSON object.
+            **/
+            void writeJSON(std::ostream& out) const;
+        };
+
+        /**
+        * Compute the memory allocated by the output textures and PBOs of the units.
+        * The statistics reflect the current size of the textures, hence call it again
+        * after the viewport was resized. Units which are not executed, because they were
+        * eliminated or fused, do not allocate their outputs and are listed with zero memory.
+        **/
+        MemoryStatistics getMemoryStatistics() const;
+
+        /**
+        * Output texture of a unit as set up by the dry run. @see dryRun()
+        **/
+        struct OSGPPU_EXPORT OutputDescription
+        {
+            OutputDescription() : mrt(0), width(0), height(0), depth(0), internalFormat(0), target(0), numLevels(1) {}
+
+            //! MRT index of the output
+            int mrt;
+
+            //! Size of the texture, depth is the number of slices or layers
+            int width, height, depth;
+
+            //! Internal format of the texture
+            GLenum internalFormat;
+
+            //! Texture target, i.e. GL_TEXTURE_2D
+            GLenum target;
+
+            //! Number of mipmap levels
+            unsigned int numLevels;
+        };
+
+        /**
+        * Unit as set up by the dry run. @see dryRun()
+        **/
+        struct OSGPPU_EXPORT UnitDescription
+        {
+            UnitDescription() : executed(true), viewportWidth(0), viewportHeight(0) {}
+
+            //! Name of the unit
+            std::string name;
+
+            //! Class name of the unit
+            std::string className;
+
+            //! False if the unit is eliminated from the execution plan
+            bool executed;
+
+            //! Size of the viewport the unit is rendered with
+            int viewportWidth, viewportHeight;
+
+            //! Names of the parent units
+            std::vector<std::string> inputs;
+
+            //! Output textures of the unit
+            std::vector<OutputDescription> outputs;
+        };
+
+        /**
+        * Result of a dry run. @see dryRun()
+        **/
+        struct OSGPPU_EXPORT DryRunResult
+        {
+            //! Units in the order of their execution
+            std::vector<UnitDescription> units;
+
+            //! Memory of the set up pipeline
+            MemoryStatistics memory;
+
+            /**
+            * Write the result as JSON object.
+            **/
+            void writeJSON(std::ostream& out) const;
+        };
+
+        /**
+        * Set up the unit graph without rendering it. Cycles are resolved, the units are
+        * ordered and initialized and their output textures are created exactly as on the
+        * first update traversal, however no OpenGL context is required. The textures are
+        * not allocated on the GPU. The attached camera must provide a viewport and the
+        * attachments read by the pipeline, but need no graphics context.
+        * Use this to check or to cost-estimate pipelines on machines without a GPU.
+        * The processor can be rendered afterwards as usual.
+        * @return false if no camera is attached
+        **/
+        bool dryRun(DryRunResult& result);
+
     protected:
 
         /**
@@ -182,6 +559,19 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         virtual void init();
 
+        /**
+        * Set up the dirty parts of the unit graph and rebuild the execution plan if required.
+        * This is called by the first update or cull traversal after the graph was changed.
+        * No OpenGL calls are done here. The caller must hold the unit graph mutex.
+        **/
+        void setupUnitGraph();
+
+        /**
+        * Publish the plan to the traversals, which take it by getPlanSnapshot() without locking.
+        * The caller must hold the unit graph mutex.
+        **/
+        void publishPlanSnapshot(const PlanSnapshot* plan);
+
         /**
         * Callback method which will be called as soon as a unit is get initialized.
         * Use this method to catch up the initialization process of a unit.
@@ -196,24 +586,152 @@ class OSGPPU_EXPORT Processor : public osg::Group {
         **/
         virtual void onUnitUpdate(Unit*) {}
 
+        /**
+        * Build the execution plan out of the current unit subgraph. This is called
+        * automatically whenever the subgraph was marked as dirty.
+        **/
+        virtual void buildExecutionPlan();
+
+        /**
+        * Release the current execution plan, so that the units get traversed
+        * in the default way again.
+        **/
+        void clearExecutionPlan();
+
+        /**
+        * Flags of the steps skipped during one traversal of the plan. The flags are
+        * kept by the traversing thread, so that several threads can traverse the plan at once.
+        **/
+        typedef std::vector<unsigned char> SkippedSteps;
+
+        /**
+        * Execute the steps [begin, end) of the plan on the given visitor. Repeatable
+        * segments are executed as often as their repeat unit requests on cull traversal.
+        **/
+        void executePlan(osg::NodeVisitor& nv, const ExecutionPlan& plan, unsigned begin, unsigned end, SkippedSteps& skipped);
+
+        //! Execute one step of the plan, if none of its parents was skipped
+        void executeStep(osg::NodeVisitor& nv, const ExecutionPlan& plan, unsigned index, SkippedSteps& skipped);
+
+        /**
+        * Draw the steps [begin, end) of the plan directly. This is used in direct
+        * execution mode by the processor's drawable.
+        **/
+        void drawExecutionPlan(osg::RenderInfo& renderInfo, const ExecutionPlan& plan, unsigned begin, unsigned end, SkippedSteps& skipped) const;
+
+        //! Draw one step of the plan directly, if none of its parents was skipped
+        void drawStep(osg::RenderInfo& renderInfo, const ExecutionPlan& plan, unsigned index, SkippedSteps& skipped) const;
+
+        /**
+        * Share output textures between units, whose outputs are not alive at the
+        * same time. This is called every time the execution plan was built, if texture aliasing is enabled.
+        **/
+        virtual void aliasOutputTextures();
+
+        /**
+        * Mark steps of the execution plan as dead, whose units outputs are not read by anyone.
+        * Unread MRT outputs of living units are detached. This is called after the execution
+        * plan was built. If dead unit elimination is disabled, every unit is marked as living.
+        **/
+        virtual void eliminateDeadUnits();
+
+        /**
+        * Find units computing the same outputs and mark all but the first one as duplicates.
+        * This is called after the execution plan was built, if duplicate unit elimination
+        * is enabled. @see setUseDuplicateUnitElimination()
+        **/
+        virtual void eliminateDuplicateUnits();
+
+        /**
+        * Give every duplicate unit its own outputs back and leave the groups of shared units.
+        **/
+        void restoreSharedUnits();
+
+        /**
+        * Let the unit provide the given outputs instead of its own ones. @see restoreSharedUnits()
+        **/
+        void shareUnitOutputs(UnitInOut* unit, const Unit::TextureMap& outputs);
+
+        /**
+        * Fuse the shaders of point-wise unit chains and of sibling units. This is called after the execution plan
+        * was built, if shader fusion is enabled. @see setUseShaderFusion()
+        **/
+        virtual void fuseUnits();
+
+        /**
+        * Give the first unit of every fused chain or sibling group its own shader and outputs back.
+        **/
+        void restoreFusedUnits();
+
+        /**
+        * Give every unit, which output was shared by aliasOutputTextures(), its own output back.
+        **/
+        void restoreOutputTextures();
+
     private:
 
-        bool      mbDirty;
-        bool      mbDirtyUnitGraph;
+        //! Parts of the processor, which have to be set up again on the next traversal
+        enum DirtyFlag
+        {
+            DIRTY_INIT = 1,
+            DIRTY_UNIT_GRAPH = 2,
+            DIRTY_EXECUTION_PLAN = 4
+        };
+
+        //! Dirty flags, changed atomically since other processors and threads can set them at any time
+        OpenThreads::Atomic mDirtyFlags;
         bool      mUseColorClamp;
+        bool      mbDirectExecution;
+        bool      mbTextureAliasing;
+        bool      mbDeadUnitElimination;
+        bool      mbShaderFusion;
+        bool      mbDuplicateUnitElimination;
+        unsigned int mOutputMemory;
+        unsigned int mAliasedOutputMemory;
         osg::observer_ptr<osg::Camera> mCamera;
-        std::list<Unit*> mLastUnits;
-        osg::ref_ptr<osg::NodeCallback> mCollectLastUnitsCallback;
+        std::list<osg::observer_ptr<Unit> > mLastUnits;
+        std::vector<osg::observer_ptr<Unit> > mDirtyUnits;
 
-        friend class SetupUnitRenderingVisitor;
-        friend class CollectLastUnitsCallback;
+        //! Plan being built, only accessed while the unit graph is locked
+        ExecutionPlan mExecutionPlan;
+        osg::NodeList mPlanChildren;
 
-        /**
-        * Add a unit to the list of last units. This will place a unit at the end of the execution pipeline.
-        * Use placeUnitAsLast() to force unit to be executed at the end. Putting unit into the list of last
-        * units, does not enforce it not to be executed on its right place!
-        **/
-        inline void addLastUnit(Unit* unit) { if (unit) mLastUnits.push_back(unit); }
+        //! Plan published to the traversals, exchanged while the unit graph is locked
+        osg::ref_ptr<const PlanSnapshot> mPlanSnapshot;
+
+        //! Published plan and number of threads just taking it, so that traversals take it without locking
+        OpenThreads::AtomicPtr mPublishedPlan;
+        mutable OpenThreads::Atomic mPlanReaders;
+        mutable OpenThreads::Mutex mUnitGraphMutex;
+        osg::ref_ptr<osg::Geode> mDirectGeode;
+        osg::ref_ptr<Profiler> mProfiler;
+
+        //! Output of a unit sharing the texture of another unit, the own texture is kept to give it back
+        struct AliasedOutput
+        {
+            osg::observer_ptr<UnitInOut> unit;
+            int mrt;
+            osg::ref_ptr<osg::Texture> texture;
+        };
+        std::vector<AliasedOutput> mAliasedOutputs;
+
+        struct FusedChain
+        {
+            osg::observer_ptr<UnitInOut> unit;
+            osg::ref_ptr<osg::Texture> output;
+            osg::ref_ptr<osg::StateAttribute> shader;
+            osg::StateAttribute::OverrideValue value;
+            osg::ref_ptr<osg::StateAttribute> fused;
+        };
+        std::vector<FusedChain> mFusedChains;
+
+        typedef std::pair<osg::observer_ptr<UnitInOut>, Unit::TextureMap> SharedOutput;
+        std::vector<SharedOutput> mSharedOutputs;
+        std::vector<osg::ref_ptr<osg::Referenced> > mSharedGroups;
+
+        friend class SetupUnitRenderingVisitor;
+        friend class BuildExecutionPlanVisitor;
+        friend class DirectExecutionDrawable;
 
 };
 
@@ -0,0 +1,226 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_PROFILER_H_
+#define _C_PROFILER_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/RenderInfo>
+#include <osg/GL>
+#include <osg/Drawable>
+#include <osg/buffered_value>
+#include <OpenThreads/Mutex>
+
+#include <osgPPU/Export.h>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <ostream>
+
+namespace osgPPU
+{
+
+class Unit;
+
+//! Measure the time required by every unit of a processor
+/**
+ * The profiler records the CPU time spent in the cull traversal and in the draw
+ * callback of every unit. If the OpenGL context supports timer queries, also the time
+ * required by the GPU to render the unit is measured. The timer queries are kept in a ring
+ * per unit, hence their results are read several frames later, when they are available.
+ * The profiler does never wait for the GPU. If no timer queries are supported, i.e. on
+ * software renderers, only the CPU times are recorded.
+ *
+ * The timings are averaged over the last samples, @see setNumSamples().
+ * Since timer queries can not be nested, the profiler can not be used together
+ * with other GPU timers, i.e. the GPU statistics of osgViewer.
+ *
+ * Use Processor::setUseProfiler() to profile the units of a processor.
+ **/
+class OSGPPU_EXPORT Profiler : public osg::Referenced
+{
+    public:
+
+        /**
+        * Averaged timings of a unit in milliseconds. Times which were not measured
+        * are negative.
+        **/
+        struct OSGPPU_EXPORT Timing
+        {
+            Timing() : cullTime(-1.0), drawTime(-1.0), gpuTime(-1.0), numDraws(0) {}
+
+            //! Name of the unit
+            std::string name;
+
+            //! CPU time spent in the cull traversal of the unit
+            double cullTime;
+
+            //! CPU time spent in the draw callback of the unit
+            double drawTime;
+
+            //! Time required by the GPU to render the unit
+            double gpuTime;
+
+            //! Number of times the unit was drawn since the last reset
+            unsigned int numDraws;
+        };
+
+        typedef std::vector<Timing> TimingList;
+
+        Profiler();
+
+        /**
+        * Set the number of samples over which the timings are averaged. Default is 30.
+        **/
+        void setNumSamples(unsigned int num);
+
+        /**
+        * Get the number of samples over which the timings are averaged.
+        **/
+        inline unsigned int getNumSamples() const { return mNumSamples; }
+
+        /**
+        * Set the number of timer queries used per unit and context. The result of
+        * a query is read when the query is used again, hence the results are available
+        * this number of executions later. If a result is still not available the sample is dropped.
+        * Default is 4.
+        **/
+        void setNumQueries(unsigned int num);
+
+        /**
+        * Get number of timer queries used per unit.
+        **/
+        inline unsigned int getNumQueries() const { return mNumQueries; }
+
+        /**
+        * Get the averaged timings of a unit.
+        * @return false if the unit was not profiled yet
+        **/
+        bool getTiming(const Unit* unit, Timing& timing) const;
+
+        /**
+        * Get the averaged timings of all profiled units in the order they were executed first.
+        **/
+        TimingList getTimings() const;
+
+        /**
+        * Write the averaged timings as comma separated values with a header line.
+        **/
+        void writeCSV(std::ostream& out) const;
+
+        /**
+        * Remove all samples. The timer queries are deleted on the next draw on their context.
+        **/
+        void reset();
+
+        /**
+        * Delete the timer queries of the given context. Without a state the queries of all contexts
+        * are deleted as soon as the profiler draws on their context the next time, since the
+        * contexts might not be current. This is done by the destructor on its own.
+        **/
+        void releaseGLObjects(osg::State* state = 0) const;
+
+        /**
+        * Add a CPU time sample of a unit's cull traversal in seconds.
+        **/
+        void addCullTime(const Unit* unit, double time);
+
+        /**
+        * Start to measure the draw of the unit. Must be called from the draw thread.
+        **/
+        void beginDraw(const Unit* unit, osg::RenderInfo& info);
+
+        /**
+        * Finish to measure the draw of the unit started with beginDraw().
+        **/
+        void endDraw(const Unit* unit, osg::RenderInfo& info);
+
+    protected:
+        virtual ~Profiler();
+
+        //! Samples of a single value
+        struct Samples
+        {
+            Samples() : next(0), sum(0.0) {}
+            void add(double value, unsigned int num);
+            double average() const { return values.empty() ? -1.0 : sum / double(values.size()); }
+
+            std::vector<double> values;
+            unsigned int next;
+            double sum;
+        };
+
+        //! Samples of a unit
+        struct Record
+        {
+            Record() : order(0), numDraws(0) {}
+
+            std::string name;
+            unsigned int order;
+            unsigned int numDraws;
+            Samples cull, draw, gpu;
+        };
+
+        //! Timer queries of a unit on a context
+        struct Queries
+        {
+            Queries() : next(0), active(false), drawStart(0.0) {}
+
+            std::vector<GLuint> ids;
+            std::vector<bool> pending;
+            unsigned int next;
+            bool active;
+            double drawStart;
+        };
+
+        //! Timer queries of all units on a context, only accessed by the draw thread of the context
+        struct ContextQueries
+        {
+            ContextQueries() : generation(0) {}
+
+            std::map<const Unit*, Queries> units;
+
+            //! Value of the reset counter, when the queries were created
+            unsigned int generation;
+        };
+
+        Record& getRecord(const Unit* unit);
+        static Timing getTiming(const Record& record);
+
+        typedef std::map<const Unit*, Record> RecordMap;
+
+        //! Samples shared by all threads, guarded by the mutex
+        RecordMap mRecords;
+        unsigned int mNumSamples;
+        unsigned int mNumQueries;
+        unsigned int mGeneration;
+        mutable OpenThreads::Mutex mMutex;
+
+        //! Queries per context, the GL calls are done without holding the mutex
+        mutable osg::buffered_object<ContextQueries> mContextQueries;
+
+        //! Delete the timer queries of the context handed over by releaseGLObjects() without a state
+        static void flushDeletedQueries(unsigned int contextID, osg::Drawable::Extensions* ext);
+};
+
+};
+
+#endif
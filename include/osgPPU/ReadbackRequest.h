@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_READBACK_REQUEST_H_
+#define _C_READBACK_REQUEST_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/Image>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+#include <osgPPU/Export.h>
+#include <osgPPU/Fence.h>
+
+namespace osgPPU
+{
+
+//! Handle of an output of a unit read back to the CPU, @see Unit::requestReadback()
+/**
+ * The request is a future of the read back image. It is serviced on the draw after the unit
+ * computed its output: the output is read into a pooled pixel buffer object and a fence is inserted
+ * behind the transfer. On the next draws the fence is checked without waiting, as soon as it is
+ * signaled the image is copied out of the buffer. If the transfer is not done after the maximal
+ * latency of the unit, then the draw waits for it. The request is completed on the next update
+ * of the unit, i.e. the callback is called on the update thread.
+ **/
+class OSGPPU_EXPORT ReadbackRequest : public osg::Referenced
+{
+    public:
+        //! State of the request
+        enum Status
+        {
+            //! Waiting for the next draw of the unit
+            PENDING,
+
+            //! Transfer is issued, the image is not handed out yet
+            IN_FLIGHT,
+
+            //! Image is available
+            COMPLETE,
+
+            //! Output could not be read back, i.e. since the unit has no such output
+            FAILED
+        };
+
+        /**
+        * Callback called on the update thread, when the request is completed or failed.
+        **/
+        struct Callback : public osg::Referenced
+        {
+            virtual void operator()(ReadbackRequest* request) = 0;
+        };
+
+        /**
+        * Create a request. A width or height of 0 reads the whole mipmap level.
+        **/
+        ReadbackRequest(int mrt, int level, int x, int y, int width, int height, GLenum format, GLenum type);
+
+        //! Get state of the request
+        Status getStatus() const;
+
+        //! Check whenever the request is completed or failed
+        bool isDone() const;
+
+        /**
+        * Get the image read back. The rows are bottom up.
+        * @return NULL if the request is not completed
+        **/
+        osg::Image* getImage();
+        const osg::Image* getImage() const;
+
+        /**
+        * Wait until the request is completed or failed. Since requests are completed by the
+        * update of the unit, never call it on the update or the draw thread.
+        * @return true if the request is completed
+        **/
+        bool wait() const;
+
+        //! Set callback called when the request is done, it must be set before the request is done
+        inline void setCallback(Callback* cb) { mCallback = cb; }
+
+        //! Get callback called when the request is done
+        inline Callback* getCallback() { return mCallback.get(); }
+
+        //! Get index of the output which is read back
+        inline int getMRT() const { return mMRT; }
+
+        //! Get mipmap level which is read back
+        inline int getLevel() const { return mLevel; }
+
+        //! Get rectangle of the level which is read back, clamped to the level when the transfer is issued
+        inline void getRegion(int& x, int& y, int& width, int& height) const
+        {
+            x = mRegion[0]; y = mRegion[1]; width = mRegion[2]; height = mRegion[3];
+        }
+
+        //! Get format and type of the image
+        inline GLenum getFormat() const { return mFormat; }
+        inline GLenum getType() const { return mType; }
+
+        //! Get number of draws of the unit between issuing the transfer and copying the image
+        inline unsigned int getLatency() const { return mAge; }
+
+    protected:
+        friend class Unit;
+
+        virtual ~ReadbackRequest() {}
+
+        //! Set the final state, wake up the waiting threads and call the callback
+        void complete();
+
+        int mMRT;
+        int mLevel;
+        int mRegion[4];
+        GLenum mFormat;
+        GLenum mType;
+
+        Status mStatus;
+
+        //! State the request is completed with, set on draw
+        Status mResult;
+
+        osg::ref_ptr<osg::Image> mImage;
+        osg::ref_ptr<Callback> mCallback;
+
+        //! Pixel buffer object of the transfer with the fence behind it, of the context the transfer is issued in
+        unsigned int mContextID;
+        osg::ref_ptr<PixelBufferRing> mBuffer;
+        unsigned int mAge;
+
+        mutable OpenThreads::Mutex mMutex;
+        mutable OpenThreads::Condition mCondition;
+};
+
+};
+
+#endif
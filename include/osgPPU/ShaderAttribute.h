@@ -28,6 +28,9 @@
 
 #include <osgPPU/Export.h>
 
+#include <vector>
+#include <string>
+
 namespace osgPPU
 {
 
@@ -160,6 +163,42 @@ class OSGPPU_EXPORT ShaderAttribute : public osg::Program
         **/
         bool bindFragData(const std::string& name, unsigned int index);
 
+        /**
+        * Declare the fragment shader as point-wise. A point-wise shader reads its input only at
+        * the position of the current fragment, i.e. texture2D(input, gl_TexCoord[0].st), through
+        * a sampler uniform of this attribute set to the texture unit 0, and writes its result to
+        * gl_FragColor only. Units using such shaders can be fused with the preceding unit into
+        * one pass (@see Processor::setUseShaderFusion()). Default is false.
+        **/
+        inline void setPointwise(bool b) { mbPointwise = b; }
+
+        /**
+        * Check whenever the fragment shader is declared as point-wise.
+        **/
+        inline bool getPointwise() const { return mbPointwise; }
+
+        /**
+        * Create a shader attribute which executes the fragment shaders of the given attributes
+        * one after another in one pass. Every stage after the first one must be point-wise, its input
+        * is replaced by the result of the previous stage. Vertex shaders and texture bindings
+        * are taken from the first stage. The uniforms of all stages are shared with the new attribute,
+        * hence changing them changes the fused shader too. Uniform names must be unique between the stages.
+        * @return New attribute or NULL if the shaders cannot be fused.
+        **/
+        static ShaderAttribute* createFusedShader(const std::vector<ShaderAttribute*>& stages);
+
+        /**
+        * Create a shader attribute which executes the fragment shaders of the given attributes
+        * in one pass, where the result of the i-th shader is written to gl_FragData[i]. All shaders
+        * must read the same inputs, i.e. samplers set to the same texture unit read the same texture.
+        * Such samplers are replaced by the samplers of the first shader. The input of the point-wise
+        * shaders (@see setPointwise()) is fetched once for all of them and passed to them, other fetches
+        * are left to the compiler. Vertex shaders are taken from the first shader.
+        * The uniforms of all shaders are shared with the new attribute. Uniform names must be unique.
+        * @return New attribute or NULL if the shaders cannot be merged.
+        **/
+        static ShaderAttribute* createMergedShader(const std::vector<ShaderAttribute*>& shaders);
+
         /**
          * Apply the shader attribute to the given state. This will bind the shader program
          * and set the uniforms. NOTE: The uniforms would be bound in this method,
@@ -240,6 +279,9 @@ class OSGPPU_EXPORT ShaderAttribute : public osg::Program
         //! maximal possible number of supported texture units
         int mMaxTextureUnits;
 
+        //! fragment shader is point-wise
+        bool mbPointwise;
+
         /**
          * Set parameters as uniform values.
          **/
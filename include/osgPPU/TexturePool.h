@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_TEXTURE_POOL_H_
+#define _C_TEXTURE_POOL_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osg/Referenced>
+#include <osg/Texture>
+#include <OpenThreads/Mutex>
+
+#include <osgPPU/Export.h>
+
+#include <map>
+
+namespace osgPPU
+{
+
+//! Process-wide pool of textures which can be shared between units and processors
+/**
+ * Units release their output textures into the pool, whenever they do not need
+ * them anymore (i.e. when the viewport size has changed or the unit is deleted). Another unit, which requires
+ * a texture of the same type, size and format, can acquire it from the pool instead of
+ * allocating a new one. This is especially useful if several processors are used, i.e.
+ * one per view, since they usually create identical intermediate textures.
+ *
+ * The pool holds at most getMaxBytesHeld() bytes, mipmap levels included. If more is released into the pool,
+ * the textures released first are dropped.
+ *
+ * The pool is thread safe, hence processors traversed in different threads can use it.
+ **/
+class OSGPPU_EXPORT TexturePool : public osg::Referenced
+{
+    public:
+
+        /**
+        * Key used to find matching textures in the pool.
+        **/
+        struct OSGPPU_EXPORT Key
+        {
+            Key(GLenum target = 0, int width = 0, int height = 0, int depth = 1, GLenum internalFormat = 0, unsigned numMipmaps = 0) :
+                _target(target), _width(width), _height(height), _depth(depth), _internalFormat(internalFormat), _numMipmaps(numMipmaps) {}
+
+            bool operator< (const Key& key) const;
+
+            GLenum   _target;
+            int      _width;
+            int      _height;
+            int      _depth;
+            GLenum   _internalFormat;
+            unsigned _numMipmaps;
+        };
+
+        /**
+        * Get the process-wide instance of the pool.
+        **/
+        static TexturePool* instance();
+
+        /**
+        * Acquire a texture from the pool. The texture is removed from the pool.
+        * @param key Description of the required texture
+        * @return Texture matching the key or NULL if no such texture is in the pool
+        **/
+        osg::ref_ptr<osg::Texture> acquire(const Key& key);
+
+        /**
+        * Return a texture to the pool. The texture must not be used anymore by
+        * the caller, since it can be acquired by anybody else afterwards.
+        **/
+        void release(osg::Texture* texture);
+
+        /**
+        * Remove all textures from the pool. This will free the memory of the textures
+        * as soon as nobody else does reference them.
+        **/
+        void clear();
+
+        /**
+        * Compute the key which describes the given texture.
+        **/
+        static Key computeKey(osg::Texture* texture);
+
+        /**
+        * Compute the key of a texture, which is not created yet. Mipmap levels are
+        * counted only if the minification filter does require them, as computeKey() does.
+        **/
+        static Key computeKey(GLenum target, int width, int height, int depth, GLenum internalFormat, osg::Texture::FilterMode minFilter);
+
+        /**
+        * Set the amount of memory in bytes, which the pool may hold at most (default 128 MB).
+        * The textures released first are dropped, as soon as the pool holds more.
+        **/
+        void setMaxBytesHeld(unsigned int bytes);
+
+        //! Get the amount of memory in bytes, which the pool may hold at most
+        unsigned int getMaxBytesHeld() const;
+
+        /**
+        * Get amount of acquire requests which were served from the pool.
+        **/
+        unsigned int getNumHits() const;
+
+        /**
+        * Get amount of acquire requests which could not be served from the pool.
+        **/
+        unsigned int getNumMisses() const;
+
+        /**
+        * Get amount of memory in bytes held by the textures in the pool, including their mipmap levels.
+        **/
+        unsigned int getBytesHeld() const;
+
+        /**
+        * Get number of textures currently held by the pool.
+        **/
+        unsigned int getNumTexturesHeld() const;
+
+    protected:
+
+        TexturePool();
+        virtual ~TexturePool();
+
+    private:
+        //! Texture held by the pool and the order in which it was released
+        struct Entry
+        {
+            osg::ref_ptr<osg::Texture> texture;
+            unsigned int stamp;
+        };
+        typedef std::multimap<Key, Entry> TextureMap;
+
+        //! Drop the textures released first until the pool fits into the budget, the lock must be held
+        void trim();
+
+        TextureMap mTextures;
+        unsigned int mNumHits;
+        unsigned int mNumMisses;
+        unsigned int mBytesHeld;
+        unsigned int mMaxBytesHeld;
+        unsigned int mStamp;
+        mutable OpenThreads::Mutex mMutex;
+};
+
+};
+
+#endif
@@ -29,6 +29,11 @@
 
 #include <osgPPU/Export.h>
 #include <osgPPU/ColorAttribute.h>
+#include <osgPPU/Fence.h>
+#include <osgPPU/ReadbackRequest.h>
+
+#include <OpenThreads/Mutex>
+#include <list>
 
 #define OSGPPU_VIEWPORT_WIDTH_UNIFORM "osgppu_ViewportWidth"
 #define OSGPPU_VIEWPORT_HEIGHT_UNIFORM "osgppu_ViewportHeight"
@@ -38,6 +43,8 @@
 namespace osgPPU
 {
 
+class Processor;
+
 //! Abstract base class of any unit
 /**
  * Units represents renderable units of the osgPPU library.
@@ -203,6 +210,21 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         **/
         inline bool getActive() const { return mbActive; }
 
+        /**
+        * Mark the output of this unit as used by the application. Outputs of such units
+        * are never shared with other units (@see Processor::setUseTextureAliasing()), hence
+        * their content stays valid until the unit is executed again. Such units are also never
+        * eliminated as dead (@see Processor::setUseDeadUnitElimination()). Specify this for every
+        * unit whose output texture is read directly by your application, before the processor
+        * builds its execution plan. Default is false.
+        **/
+        inline void setKeepAlive(bool b) { mbKeepAlive = b; }
+
+        /**
+        * Check whenever the unit's output is kept alive.
+        **/
+        inline bool getKeepAlive() const { return mbKeepAlive; }
+
         /**
          * Change drawing position and size of this ppu by using the
          * new frustum planes in the orthogonal projection matrix.
@@ -290,6 +312,58 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         void setUsePBOForOutputTexture(int mrt, bool use);
         inline bool getUsePBOForOutputTexture(int mrt) { return mOutputPBO[mrt].valid(); }
 
+        /**
+        * Set number of buffers behind every input and output pbo (default 1). The input textures are
+        * read into the buffers one after the other. With one buffer the input pbo holds the input of
+        * the current frame, hence a module using it has to wait until the transfer is done. With more
+        * buffers getInputPBO() returns the newest buffer whose transfer is done, usually the one filled
+        * in the previous frame, so that a module works on frame N while the GPU fills the buffer of
+        * frame N+1. If no newer transfer is done yet, the previous buffer is returned again. The output
+        * pbo is a buffer whose upload into the output texture has finished, if there is any.
+        * The fences of the buffers are only polled, the draw thread never waits for the GPU.
+        * The buffers are used by one graphics context only.
+        **/
+        void setNumPBOBuffers(unsigned int num);
+        inline unsigned int getNumPBOBuffers() const { return mNumPBOBuffers; }
+
+        /**
+        * Restrict the transfers between the textures and the pbos to a rectangle of the textures.
+        * The rows of the rectangle are tightly packed at the beginning of the buffers. A width or
+        * height of 0 transfers the whole textures (default).
+        **/
+        void setPBORegion(int x, int y, int width, int height);
+        inline void getPBORegion(int& x, int& y, int& width, int& height) const
+        {
+            x = mPBORegion[0]; y = mPBORegion[1]; width = mPBORegion[2]; height = mPBORegion[3];
+        }
+
+        /**
+        * Request to read an output of the unit back to the CPU, without stalling the rendering.
+        * The output is read on the next draw of the unit, hence it contains the result computed
+        * in that frame. The image is available a few frames later, @see ReadbackRequest.
+        * Only outputs of type Texture2D and TextureRectangle can be read back.
+        * Can be called from any thread.
+        * @param mrt Index of the output
+        * @param level Mipmap level, i.e. the 1x1 level of a UnitInMipmapOut
+        * @param x,y,width,height Rectangle of the level, a width or height of 0 reads the whole level
+        * @param format,type Format and type of the image
+        **/
+        ReadbackRequest* requestReadback(int mrt = 0, int level = 0, int x = 0, int y = 0, int width = 0, int height = 0,
+            GLenum format = GL_RGBA, GLenum type = GL_FLOAT);
+
+        /**
+        * Set the maximal number of draws of the unit, a readback may be in flight (default 2).
+        * If the transfer is not done by then, the draw waits for it. 0 waits on the draw the
+        * transfer was issued on.
+        **/
+        inline void setMaxReadbackLatency(unsigned int frames) { mMaxReadbackLatency = frames; }
+
+        //! Get the maximal number of draws a readback may be in flight
+        inline unsigned int getMaxReadbackLatency() const { return mMaxReadbackLatency; }
+
+        //! Get number of readbacks which are not completed yet
+        unsigned int getNumPendingReadbacks() const;
+
         /** 
         * Push current FBO, so that it can safely be overwritten.
         * Derived classes and its subclasses get use of this method.
@@ -313,9 +387,10 @@ class OSGPPU_EXPORT Unit : public osg::Group {
 
         /**
         * Unit traverse function used by node visitors when updating or rendering the unit.
-        * Units are traversed in the DFS manner. However, a unit is get only first applied
-        * on the visitor, if all its parents has been already traversed. This force every
-        * parent to compute its output before a child can start its computation.
+        * On update and cull traversals the units are executed by the processor in the order
+        * of its execution plan, which force every parent to compute its output before a child
+        * can start its computation. Hence here only the children which are not units are traversed.
+        * Other visitors traverse the unit as a usual group.
         **/
         virtual void traverse(osg::NodeVisitor& nv);
 
@@ -467,14 +542,85 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         //! Pushed FBOs
         mutable osg::buffered_value<GLuint> mPushedFBO;
 
+        //! Ring of buffers behind an input or output pbo
+        struct PBORing
+        {
+            PBORing() : size(0), current(0), count(0) {}
+
+            //! Buffers given out by getInputPBO() and getOutputPBO()
+            std::vector<osg::ref_ptr<osg::PixelDataBufferObject> > buffers;
+
+            //! Fences behind the transfers and index of the buffer used by the next transfer.
+            //! The buffers are osg's own pbos, hence the pixel buffers of the ring itself stay unused.
+            osg::ref_ptr<PixelBufferRing> transfers;
+
+            //! Size of the buffers as they were compiled
+            unsigned int size;
+
+            //! Buffer given out last and number of transfers so far
+            unsigned int current;
+            unsigned int count;
+
+            //! FBO the input texture is read from
+            osg::ref_ptr<osg::FrameBufferObject> fbo;
+        };
+        typedef std::map<int, PBORing> PBORingMap;
+
+        //! Read the input textures into the input pbos and select the output pbos, called on draw
+        void beginPBOTransfer(osg::RenderInfo& ri);
+
+        //! Upload the output pbos into the output textures, called on draw
+        void endPBOTransfer(osg::RenderInfo& ri);
+
+        //! Recreate the ring, if the pbo or its size changed, returns false if there is no pbo
+        bool updatePBORing(PBORing& ring, osg::PixelDataBufferObject* pbo, osg::State& state);
+
+        //! Release the fences and drop the buffers of the ring, the fbo is kept
+        void clearPBORing(PBORing& ring);
+
+        //! Get the rectangle of the texture transferred from or into the pbos
+        void computePBORegion(osg::Texture* texture, int& x, int& y, int& width, int& height) const;
+
+        PBORingMap mInputPBORing;
+        PBORingMap mOutputPBORing;
+        unsigned int mNumPBOBuffers;
+        int mPBORegion[4];
+
+        //! Issue the pending readbacks and copy the finished ones, called on draw
+        void serviceReadbacks(osg::RenderInfo& ri);
+
+        //! Read the output of a request into a pixel buffer object, returns false if it can not be read
+        bool issueReadback(osg::RenderInfo& ri, ReadbackRequest& request);
+
+        //! Copy the image out of the pixel buffer object of a request
+        void finishReadback(osg::RenderInfo& ri, ReadbackRequest& request);
+
+        //! Complete the requests serviced by the draw, called on update
+        void completeReadbacks();
+
+        //! Requests not serviced yet or in flight
+        std::list<osg::ref_ptr<ReadbackRequest> > mReadbacks;
+
+        //! Requests serviced by the draw, which are completed on the next update
+        std::list<osg::ref_ptr<ReadbackRequest> > mFinishedReadbacks;
+
+        //! Free pixel buffer objects for the readbacks of every context, each is a ring of a single buffer
+        osg::buffered_object<std::vector<osg::ref_ptr<PixelBufferRing> > > mReadbackBuffers;
+
+        //! FBOs the outputs are read from, by output index and mipmap level
+        std::map<std::pair<int, int>, osg::ref_ptr<osg::FrameBufferObject> > mReadbackFBO;
+
+        unsigned int mMaxReadbackLatency;
+        mutable OpenThreads::Mutex mReadbackMutex;
+
         void printDebugInfo(const osg::Drawable* dr);
 
     private:
         bool mbActive;
+        bool mbKeepAlive;
 
-        // Separate both folowing variables to allow update and cull traversal in different threads
-        bool mbUpdateTraversed; // requires to check whenever unit was already traversed by update visitor
-        bool mbCullTraversed; // requires to check whenever unit was already traversed by cull visitor
+        Processor* mPlanProcessor; // processor executing the unit, NULL if the unit is not planned
+        osg::NodeList mPlanChildren; // children which are not executed by the processor
 
         osg::ref_ptr<NotifyCallback> _notifyBeginDrawCallback;
         osg::ref_ptr<NotifyCallback> _notifyEndDrawCallback;
@@ -482,8 +628,7 @@ class OSGPPU_EXPORT Unit : public osg::Group {
         // it is good to have friends
         friend class Processor;
         friend class Pipeline;
-        friend class CleanUpdateTraversedVisitor;
-        friend class CleanCullTraversedVisitor;
+        friend class BuildExecutionPlanVisitor;
         friend class SetMaximumInputsVisitor;
 };
 
@@ -25,6 +25,8 @@
 #include <osgPPU/Unit.h>
 #include <osgPPU/Camera.h>
 
+#include <set>
+
 #define OSGPPU_MIPMAP_LEVEL_UNIFORM "osgppu_MipmapLevel"
 #define OSGPPU_MIPMAP_LEVEL_NUM_UNIFORM "osgppu_MipmapLevelNum"
 #define OSGPPU_CUBEMAP_FACE_UNIFORM "osgppu_CubeMapFace"
@@ -193,7 +195,7 @@ namespace osgPPU
             /**
             * Set a MRT to texture map for output textures
             **/
-            inline void setOutputTextureMap(const TextureMap& map) { mOutputTex = map; dirty();}
+            void setOutputTextureMap(const TextureMap& map);
     
         protected:
 
@@ -218,6 +220,28 @@ namespace osgPPU
 
             virtual void assignOutputPBO();
 
+            /**
+            * Create a new output texture of the given size. The texture is taken from the
+            * TexturePool if a matching one is available. Specify 0 as size, if the size is not known yet.
+            **/
+            osg::ref_ptr<osg::Texture> createOutputTexture(int width, int height);
+
+            //! Get OpenGL texture target according to the output texture type
+            GLenum getOutputTextureTarget() const;
+
+            /**
+            * Check whenever the output texture is owned by this unit only, hence
+            * it can be given back to the pool if it is not required anymore.
+            **/
+            bool isOutputTextureReleasable(int mrt) const;
+
+            /**
+            * Specify MRT outputs which are not read by anyone. Such outputs are not attached
+            * to the FBO, hence they are not rendered. Since the draw buffers are assigned in the
+            * order of the attachments, only outputs behind the last read output are detached.
+            **/
+            void setDeadOutputs(const std::set<int>& mrts);
+
             //! Framebuffer object where results are written
             osg::ref_ptr<FrameBufferObject>    mFBO;    
 
@@ -238,6 +262,14 @@ namespace osgPPU
 
             //! Internal format of the output texture
             GLenum mOutputInternalFormat;
+
+            //! MRT indices of the output textures not owned by the unit (specified by the user or shared)
+            std::set<int> mUserOutputTex;
+
+            //! MRT indices of the outputs which are not attached, because nobody reads them
+            std::set<int> mDeadOutputs;
+
+            friend class Processor;
     };
 
 };
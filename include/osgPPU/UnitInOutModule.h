@@ -23,7 +23,9 @@
 //-------------------------------------------------------------------------
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitInOut.h>
+#include <osgPPU/Fence.h>
 #include <osgDB/DynamicLibrary>
+#include <OpenThreads/Mutex>
 
 //! Name of the function which is the entry point of the module 
 #define OSGPPU_MODULE_ENTRY osgppuInitModule
@@ -36,6 +38,10 @@ namespace osgPPU
     * UnitInOutModule does load a module from a dynamic library which is capable
     * of doing processing operations on the input data. Such a module could be for 
     * example a cuda processing module which process the input by cuda.
+    *
+    * A Module is executed synchronously in the draw and works on the pixel buffer objects
+    * of the unit. An AsyncModule gets mapped memory instead and processes the frames
+    * asynchronously with one frame of latency.
     **/
     class OSGPPU_EXPORT UnitInOutModule : public UnitInOut
     {
@@ -77,17 +83,92 @@ namespace osgPPU
 
             };
 
+            /**
+            * Memory of an input or output of a frame handed to an AsyncModule.
+            **/
+            struct Buffer
+            {
+                Buffer() : data(NULL), size(0), width(0), height(0), format(0), type(0) {}
+
+                //! Mapped memory of the buffer
+                void* data;
+
+                //! Size in bytes, the rows are tightly packed and bottom up
+                unsigned int size;
+
+                //! Size and format of the texture
+                int width, height;
+                GLenum format, type;
+            };
+
+            /**
+            * Frame handed to an AsyncModule.
+            **/
+            struct Frame
+            {
+                Frame() : slot(0), number(0) {}
+
+                //! Index of the slot holding the frame, @see releaseFrame()
+                unsigned int slot;
+
+                //! Number of the frame, counted since the slots were created
+                unsigned int number;
+
+                //! Input textures read back, by index of the input. The module must only read them.
+                std::map<int, Buffer> inputs;
+
+                //! Buffers uploaded into the output textures, by index of the output
+                std::map<int, Buffer> outputs;
+            };
+
+            /**
+            * Module processing the frames asynchronously. The unit owns a number of slots, each with
+            * a buffer per input and output texture. The input textures are read into the buffers of a
+            * free slot. As soon as a fence tells that the transfer is done, the frame is handed to
+            * process(). From then on the module owns the slot and may process it on any thread. When the
+            * outputs are written, the module hands the slot back by UnitInOutModule::releaseFrame(). On the
+            * next draw the outputs are uploaded into the output textures and the slot becomes free when the
+            * upload is done. If no slot is free, the inputs of the frame are not read back.
+            *
+            * Hence the outputs are one frame or more behind the inputs, but the draw thread never waits
+            * for the module or for a transfer. The buffers are mapped once and stay mapped, if the context
+            * supports GL_ARB_buffer_storage. Otherwise they are mapped while the module owns the slot.
+            * The input and output textures must be Texture2D or TextureRectangle.
+            **/
+            class AsyncModule : public Module
+            {
+                public:
+                    AsyncModule(UnitInOutModule* parent) : Module(parent) {}
+
+                    /**
+                    * Process the frame or pass it to a thread processing it. Called on the draw thread,
+                    * which hence should not be blocked. The memory stays valid until the slot is released.
+                    **/
+                    virtual void process(const Frame& frame) = 0;
+            };
+
             typedef bool (*OSGPPU_MODULE_ENTRY)(UnitInOutModule*);
 
+            //! Entry point of a module built into the application, gets the words following the module name
+            typedef bool (*BuiltinModuleEntry)(UnitInOutModule*, const std::string& arguments);
+
             /**
             * Specify the file name of a dynamic libray containg the module.
             * A method "osgppuInitModule" has to be present in the library.
             * To the method pointer of this unit will be passed to let it
             * setup himself properly.
+            * If the first word of the given string is the name of a built-in module,
+            * then no library is loaded, but the built-in module is set up with the remaining words.
             * @return true if loading was successful
             **/
             virtual bool loadModule(const std::string& moduleFile);
 
+            /**
+            * Register a built-in module, which can be loaded by its name in loadModule().
+            * The module "cpu" is registered by default, @see CPUModule. Specify NULL to remove a module.
+            **/
+            static void registerBuiltinModule(const std::string& name, BuiltinModuleEntry entry);
+
             /**
             * Set module which will be used to process the input data.
             **/
@@ -103,6 +184,26 @@ namespace osgPPU
             Module* getModule() { return _module.get(); }
             const Module* getModule() const { return _module.get(); }
 
+            /**
+            * Set number of frame slots used by an AsyncModule (default 2). With two slots
+            * the module processes one frame, while the next frame is transferred.
+            **/
+            void setNumSlots(unsigned int num);
+
+            //! Get number of frame slots used by an AsyncModule
+            inline unsigned int getNumSlots() const { return _numSlots; }
+
+            /**
+            * Hand the slot of a processed frame back to the unit. Can be called from any thread.
+            **/
+            void releaseFrame(unsigned int slot);
+
+            //! Get number of frames handed to the AsyncModule
+            unsigned int getNumProcessedFrames() const;
+
+            //! Get number of frames not read back, since all slots were in use
+            unsigned int getNumSkippedFrames() const;
+
         protected:
 
             //! Start cuda kernel running over the input textures
@@ -111,10 +212,56 @@ namespace osgPPU
             //! Stop cuda kernel execution and write results to the output textures
             virtual void noticeFinishRendering(osg::RenderInfo &, const osg::Drawable* );
 
+            //! State of a frame slot
+            enum SlotState
+            {
+                SLOT_FREE,
+                SLOT_READBACK,
+                SLOT_PROCESSING,
+                SLOT_RELEASED,
+                SLOT_UPLOADING
+            };
+
+            //! Frame slot of an AsyncModule
+            struct Slot
+            {
+                Slot() : state(SLOT_FREE) {}
+
+                SlotState state;
+                Frame frame;
+
+                //! Fence behind the last transfer of the slot
+                osg::ref_ptr<Fence> fence;
+            };
+
+            //! Run the transfers of the slots and hand the read frames to the AsyncModule
+            void processSlots(osg::RenderInfo& ri);
+
+            //! Recreate the slots, if the textures changed. Returns false if the module owns a slot.
+            bool updateSlots(osg::State& state);
+
+            //! Map and unmap the buffers of a slot, if they are not mapped persistently
+            void mapSlot(Slot& slot);
+            void unmapSlot(Slot& slot);
+
+            //! Pixel buffers of the inputs and outputs, slot i uses the buffer i of every ring
+            typedef std::map<int, osg::ref_ptr<PixelBufferRing> > BufferRingMap;
+            BufferRingMap _inputRings;
+            BufferRingMap _outputRings;
+
             bool  _moduleDirty;
             osg::ref_ptr<Module> _module;
             osg::ref_ptr<osgDB::DynamicLibrary> _moduleLib;
             std::string _moduleFile;
+
+            unsigned int _numSlots;
+            std::vector<Slot> _slots;
+            bool _persistent;
+            std::map<int, osg::ref_ptr<osg::FrameBufferObject> > _readFBO;
+            unsigned int _frameNumber;
+            unsigned int _numProcessed;
+            unsigned int _numSkipped;
+            mutable OpenThreads::Mutex _slotMutex;
     };
 
 };
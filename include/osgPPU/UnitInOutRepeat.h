@@ -83,9 +83,6 @@ namespace osgPPU
             //! Overriden method from the base class
             virtual void init();
 
-            //! Special treatment for traversing repeatable subgraph
-            virtual void traverse(osg::NodeVisitor& nv);
-
             int _numIterations;
             unsigned _lastNodeOutputIndex;
             osg::ref_ptr<Unit>    _lastNode;
@@ -0,0 +1,209 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#ifndef _C_UNIT_INREDUCTIONOUT_H_
+#define _C_UNIT_INREDUCTIONOUT_H_
+
+
+//-------------------------------------------------------------------------
+// Includes
+//-------------------------------------------------------------------------
+#include <osgPPU/Export.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/ReadbackRequest.h>
+
+#include <osg/Vec3>
+#include <osg/Texture2D>
+#include <osg/buffered_value>
+
+#include <map>
+
+#define OSGPPU_REDUCTION_MAX_BINS 256
+
+namespace osgPPU
+{
+    //! Compute luminance statistics and a histogram of the input texture
+    /**
+    * UnitInReductionOut reduces the luminance of the input 0 to its minimum, maximum,
+    * sum and average and counts it into a histogram of log2 luminance. Other than a mipmap
+    * chain, i.e. UnitInMipmapOut with luminance_mipmap_fp.glsl, the unit needs only a
+    * few passes and gives more than the average, which makes auto exposure cheaper
+    * and more robust.
+    *
+    * The output is a small RGBA32F texture of the size max(2, bins) x 2:
+    *   - texel (0,0) = (minimum, maximum, sum, average)
+    *   - texel (1,0) = (geometric mean, number of pixels, 0, 0)
+    *   - texel (b,1) = (fraction of bin b, cumulative fraction up to bin b, lower log2 bound, upper log2 bound)
+    * Shaders of the children read it with texelFetch or at the texel centers.
+    * The output can be read back to the CPU with requestReadback(), @see requestStatistics().
+    *
+    * If the context supports compute shaders (GL 4.3 or GL_ARB_compute_shader), the reduction
+    * is done by two dispatches: the first one reduces tiles of 32x32 pixels and counts the
+    * histogram in shared memory, the second one combines the tiles into the output. Otherwise
+    * the reduction is done by fragment passes each reducing blocks of 8x8 texels, i.e. 4 passes
+    * for 1920x1080. The statistics are exact on both paths.
+    *
+    * The histogram of the fragment path is only an approximation: it is counted over a grid of at
+    * most 256x256 samples spread evenly over the input, while the compute path counts every texel.
+    * Hence for larger inputs the fractions are those of the samples and small bright areas between
+    * the samples might be missed.
+    **/
+    class OSGPPU_EXPORT UnitInReductionOut : public UnitInOut {
+        public:
+            META_Node(osgPPU,UnitInReductionOut);
+
+            //! Create default ppfx
+            UnitInReductionOut();
+            UnitInReductionOut(const UnitInReductionOut&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
+
+            //! Release it and used memory
+            virtual ~UnitInReductionOut();
+
+            /**
+             * Initialize the UnitInReductionOut.
+             * This will setup the passes and the output texture of the given number of bins.
+             **/
+            virtual void init();
+
+            /**
+            * Set number of bins of the histogram, at most OSGPPU_REDUCTION_MAX_BINS (default 64).
+            * Without compute shaders the bins count a grid of at most 256x256 samples of
+            * the input instead of every texel, i.e. the histogram is approximated.
+            **/
+            void setNumBins(unsigned int bins);
+
+            //! Get number of bins of the histogram
+            inline unsigned int getNumBins() const { return mNumBins; }
+
+            /**
+            * Set range of the histogram in log2 luminance (default -10 to 10). Luminance
+            * outside of the range is counted into the first or the last bin.
+            **/
+            void setHistogramRange(float minLog2, float maxLog2);
+
+            //! Get lower bound of the histogram in log2 luminance
+            inline float getHistogramMin() const { return mHistogramMin; }
+
+            //! Get upper bound of the histogram in log2 luminance
+            inline float getHistogramMax() const { return mHistogramMax; }
+
+            /**
+            * Set weights of the color channels giving the luminance (default as luminance_fp.glsl).
+            **/
+            void setLuminanceWeights(const osg::Vec3& weights);
+
+            //! Get weights of the color channels
+            inline const osg::Vec3& getLuminanceWeights() const { return mLuminanceWeights; }
+
+            /**
+            * Enable or disable the compute shader path. If disabled or not supported
+            * by the context, the fragment passes are used (default enabled).
+            **/
+            inline void setUseComputeShader(bool use) { mUseComputeShader = use; }
+
+            //! Check whenever the compute shader path is used if supported
+            inline bool getUseComputeShader() const { return mUseComputeShader; }
+
+            /**
+            * Request to read the whole output back, without stalling the rendering.
+            * This is a shortcut of requestReadback(0), @see Unit::requestReadback().
+            **/
+            inline ReadbackRequest* requestStatistics() { return requestReadback(0); }
+
+            /**
+            * Return output texture for the specified MRT index. It is of the size
+            * max(2, bins) x 2 and not of the size of the input.
+            **/
+            virtual osg::Texture* getOrCreateOutputTexture(int mrt = 0);
+
+            /**
+            * Release the programs of the compute path. If no state is given,
+            * the programs of all contexts are queued for the deletion.
+            **/
+            virtual void releaseGLObjects(osg::State* state = 0) const;
+
+        protected:
+
+            bool noticeBeginRendering (osg::RenderInfo&, const osg::Drawable* );
+            void noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* );
+            void noticeChangeViewport(osg::Viewport* vp);
+
+            //! Get width of the output texture
+            inline int getOutputWidth() const { return mNumBins > 2 ? (int)mNumBins : 2; }
+
+            //! Setup textures and drawables of the fragment passes
+            void createFragmentPasses();
+
+            //! Perform the reduction by the fragment passes
+            void drawFragmentPasses(osg::RenderInfo& info);
+
+            //! Perform the reduction by the compute shaders, return false if not possible
+            bool dispatchComputePasses(osg::RenderInfo& info);
+
+            //! Fragment pass rendering into a texture
+            struct Pass
+            {
+                osg::ref_ptr<FrameBufferObject> fbo;
+                osg::ref_ptr<osg::Drawable> drawable;
+            };
+
+            //! Programs of the compute path of a context
+            struct ComputePrograms
+            {
+                ComputePrograms() : reduce(0), resolve(0), built(false) {}
+
+                GLuint reduce;
+                GLuint resolve;
+                bool built;
+
+                //! Uniform locations of the reduce and the resolve program
+                GLint reduceInputSize, reduceNumBins, reduceRange, reduceWeights;
+                GLint resolvePartialsSize, resolveNumBins, resolveRange, resolveNumPixels, resolveOutputWidth;
+            };
+
+            //! Delete the programs of the context, which is current if a state is given
+            void releaseComputePrograms(unsigned int contextID, osg::State* state) const;
+
+            std::vector<Pass> mPasses;
+
+            //! Compute programs per context, each only accessed by the draw thread of its context
+            mutable osg::buffered_object<ComputePrograms> mComputePrograms;
+
+            //! Tile results and histogram counts of the compute path
+            osg::ref_ptr<osg::Texture2D> mPartialsTex;
+            osg::ref_ptr<osg::Texture2D> mBinsTex;
+
+            //! Uniforms shared by the fragment passes
+            osg::ref_ptr<osg::Uniform> mRangeUniform;
+            osg::ref_ptr<osg::Uniform> mWeightsUniform;
+
+            osg::ref_ptr<osg::RefMatrix> mProjectionMatrix;
+            osg::ref_ptr<osg::RefMatrix> mModelviewMatrix;
+
+            unsigned int mNumBins;
+            float mHistogramMin;
+            float mHistogramMax;
+            osg::Vec3 mLuminanceWeights;
+            bool mUseComputeShader;
+
+            //! Size of the input 0
+            int mInputWidth;
+            int mInputHeight;
+    };
+
+};
+
+#endif
@@ -14,6 +14,7 @@
  *   The full license is in LICENSE file included with this distribution.  *
  ***************************************************************************/
 
+
 #ifndef _C_UNIT_CAPTURE__H_
 #define _C_UNIT_CAPTURE__H_
 
@@ -23,20 +24,64 @@
 //-------------------------------------------------------------------------
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitOut.h>
+#include <osgPPU/Fence.h>
+#include <osgPPU/CaptureSink.h>
+
+#include <OpenThreads/Mutex>
 
 namespace osgPPU
 {
-    //! Capture the content of the input texture to a file
+    //! Capture the content of the input texture to a file or another sink
     /**
     * Screen capturing ppu. The input texture is captured into a file.
     * This ppu allows to render out in higher resolution than your
     * monitor supports. This can be only achieved if your rendering
     * is going completely through ppu pipeline, so renderer in offscreen mode.
+    *
+    * The capturing does not stall the rendering. The input textures are read back
+    * into a ring of pixel buffer objects. A captured frame is taken from the ring a few
+    * frames later, as soon as its fence tells that the transfer is done. Then it is
+    * passed to the sink by a pool of worker threads. If the workers can not keep up,
+    * then the frames are either dropped or the rendering waits, @see setQueuePolicy().
+    * The sink reads the frame directly out of the mapped pixel buffer, so the frame is
+    * not copied on its way. The buffer is unmapped as soon as the sink is done with it.
     **/
     class OSGPPU_EXPORT UnitOutCapture : public UnitOut {
         public:
             META_Node(osgPPU,UnitOutCapture);
-        
+
+            /**
+            * Policy applied if a frame is captured while all buffers are in use.
+            **/
+            enum QueuePolicy
+            {
+                //! Drop the frame, the rendering never waits
+                DROP_FRAMES,
+
+                //! Wait until a buffer becomes free, no frame is lost
+                BLOCK
+            };
+
+            /**
+            * Counters of the captured frames.
+            **/
+            struct OSGPPU_EXPORT Statistics
+            {
+                Statistics() : numQueued(0), numDropped(0), numWritten(0), numFailed(0) {}
+
+                //! Number of frames passed to the workers
+                unsigned int numQueued;
+
+                //! Number of frames dropped, since all buffers were in use
+                unsigned int numDropped;
+
+                //! Number of frames written successfully
+                unsigned int numWritten;
+
+                //! Number of frames which could not be written
+                unsigned int numFailed;
+            };
+
             //! Create default ppfx 
             UnitOutCapture();
             UnitOutCapture(const UnitOutCapture&, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY);
@@ -55,6 +100,16 @@ namespace osgPPU
     
             //! get currently used extension 
             inline const std::string& getFileExtension() const { return mExtension; }
+
+            /**
+            * Set the sink receiving the captured frames. If no sink is set (default), then every
+            * frame is written into its own file at the path with the extension set by
+            * setPath() and setFileExtension(), @see ImageFileSink.
+            **/
+            inline void setSink(CaptureSink* sink) { mSink = sink; }
+
+            //! Get the sink receiving the captured frames, NULL if the frames are written into files
+            inline CaptureSink* getSink() { return mSink.get(); }
     
             /**
             * Set if the output should be generated only once.
@@ -67,14 +122,110 @@ namespace osgPPU
             //! Check if the unit will shot once on the next traversion
             inline bool getShotOnce() { return mShotOnce; }
 
+            /**
+            * Set number of pixel buffers per input, into which the frames are read back (default 3).
+            * This is the number of frames, which can be in flight on the GPU.
+            **/
+            void setNumBuffers(unsigned int num);
+
+            //! Get number of pixel buffers per input
+            inline unsigned int getNumBuffers() const { return mNumBuffers; }
+
+            /**
+            * Set number of worker threads encoding and writing the frames (default 2).
+            **/
+            void setNumWorkers(unsigned int num);
+
+            //! Get number of worker threads
+            inline unsigned int getNumWorkers() const { return mNumWorkers; }
+
+            /**
+            * Set maximal number of frames waiting for the workers (default 8).
+            **/
+            void setQueueDepth(unsigned int depth);
+
+            //! Get maximal number of frames waiting for the workers
+            inline unsigned int getQueueDepth() const { return mQueueDepth; }
+
+            /**
+            * Set what happens if the buffers or the queue of the workers are full (default DROP_FRAMES).
+            **/
+            inline void setQueuePolicy(QueuePolicy policy) { mQueuePolicy = policy; }
+
+            //! Get policy applied if the buffers or the queue are full
+            inline QueuePolicy getQueuePolicy() const { return mQueuePolicy; }
+
+            /**
+            * Set the data type the frames are read back as. By default (0) the type is derived
+            * from the internal format of the input, which reads back 16 bit float textures as
+            * GL_FLOAT. Set GL_HALF_FLOAT_ARB to read them back natively as half, i.e. for
+            * a HDRFileSink. This halves the transfer and the memory of the frames.
+            **/
+            inline void setDataType(GLenum type) { mDataType = type; }
+
+            //! Get data type the frames are read back as, 0 if derived from the input
+            inline GLenum getDataType() const { return mDataType; }
+
+            //! Get counters of the captured frames
+            Statistics getStatistics() const;
+
             //! Direct function, which can be used to take a screenshot.
             virtual void captureInput(osg::State* state);
 
+            /**
+            * Wait until all frames in flight are read back and written. The context
+            * of the state must be current. Call it after the capturing was deactivated,
+            * since frames in flight are passed to the workers only while the unit is active.
+            **/
+            void flush(osg::State* state);
+
             //! Initialze the default Processoring unit
             virtual void init();
 
         protected:
-        
+            //! Frame read back into a pixel buffer object of the ring
+            struct Readback
+            {
+                Readback() : pending(false), input(0), number(0), width(0), height(0), format(0), type(0) {}
+
+                //! Set while the buffer holds a frame, which was not passed to the workers
+                bool pending;
+
+                //! View on the mapped buffer, while the frame is passed to the sink
+                osg::ref_ptr<osg::Image> view;
+
+                //! Index of the input and number of the captured frame
+                int input, number;
+
+                //! Size and format of the captured frame
+                int width, height;
+                GLenum format, type;
+            };
+
+            //! Ring of pixel buffers of an input in a context and the frames read back into them
+            struct ReadbackRing
+            {
+                ReadbackRing() : retire(0) {}
+                osg::ref_ptr<PixelBufferRing> buffers;
+                std::vector<Readback> frames;
+                unsigned int retire;
+            };
+
+            //! Pass oldest frames of the ring to the workers, optionally wait for them
+            void retire(ReadbackRing& ring, bool wait, bool all);
+
+            //! Pass a captured image to the workers
+            void queue(osg::Image* image, int input, int number);
+
+            //! Unmap the buffer, if the sink is done with its frame. Returns false if the sink still uses it.
+            bool unmap(ReadbackRing& ring, unsigned int index, bool wait);
+
+            //! Get worker pool, create it if required
+            osg::Referenced* getWriter();
+
+            //! Wait for the worker pool and release it
+            void releaseWriter();
+
             //! path were to store the files
             std::string mPath;
     
@@ -85,6 +236,26 @@ namespace osgPPU
             std::string mExtension;
 
             bool mShotOnce;
+
+            unsigned int mNumBuffers;
+            unsigned int mNumWorkers;
+            unsigned int mQueueDepth;
+            QueuePolicy mQueuePolicy;
+            GLenum mDataType;
+
+            //! Rings of pixel buffers per context and input
+            std::map<std::pair<unsigned int, int>, ReadbackRing> mReadbacks;
+
+            //! Pool of workers writing the frames
+            osg::ref_ptr<osg::Referenced> mWriter;
+
+            //! Sink set by the user and the sink writing files, if none is set
+            osg::ref_ptr<CaptureSink> mSink;
+            osg::ref_ptr<ImageFileSink> mFileSink;
+
+            //! Counters of released worker pools and of frames dropped before they reached the workers
+            Statistics mStatistics;
+            mutable OpenThreads::Mutex mMutex;
     };
 
 };
@@ -23,6 +23,10 @@
 //-------------------------------------------------------------------------
 #include <osgPPU/Export.h>
 #include <osgPPU/UnitBypass.h>
+#include <osgPPU/Fence.h>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
 
 namespace osgPPU
 {
@@ -31,6 +35,10 @@ namespace osgPPU
     * If you like to have an external texture as input to any unit in the unit graph,
     * then you have to setup this behaviour with the help of this unit. The unit should be placed
     * directly under processor. Unit works as a simple bypass, by passing specified texture to the output.
+    *
+    * In the streaming mode the texture content is produced by the application, i.e. by a video
+    * decoding thread. The frames are written directly into a ring of pixel buffers and uploaded
+    * asynchronously from there, @see setStreaming().
     **/
     class OSGPPU_EXPORT UnitTexture : public UnitBypass {
         public:
@@ -53,6 +61,115 @@ namespace osgPPU
             **/
             inline osg::Texture* getTexture() { return _externTexture; }
 
+            /**
+            * Enable the streaming upload of frames into the texture. A producer writes the frames
+            * into a ring of pixel buffers, @see acquireFrame(). When the unit is drawn, the newest
+            * published frame is uploaded out of its buffer into the texture. The transfer runs
+            * asynchronously, so that it overlaps with the processing of the previous frame. A buffer
+            * is mapped again for the producer, when the fence behind its upload is signaled. The buffers
+            * are orphaned before they are mapped, hence mapping never waits for the GPU.
+            *
+            * The texture must be a Texture2D or a TextureRectangle with its size set. The streaming
+            * supports one graphics context only. Without pixel buffer support the frames are uploaded
+            * synchronously out of client memory.
+            * @param numBuffers Number of buffers in the ring, 0 disables the streaming (default)
+            * @param format Pixel format of the frames
+            * @param type Data type of the frames
+            **/
+            void setStreaming(unsigned int numBuffers, GLenum format = GL_RGBA, GLenum type = GL_UNSIGNED_BYTE);
+
+            //! Get number of buffers in the streaming ring, 0 if streaming is disabled
+            inline unsigned int getNumStreamBuffers() const { return mNumStreamBuffers; }
+
+            //! Get size of a frame in bytes, the rows are tightly packed and bottom up
+            unsigned int getStreamFrameSize() const;
+
+            /**
+            * Get memory to write the next frame into. This method can be called from any thread.
+            * The buffers are mapped by the rendering, hence there is no memory before the unit was
+            * drawn the first time.
+            * @param wait If true, then wait until a buffer is available, otherwise return NULL if all buffers are in use
+            * @return Memory of getStreamFrameSize() bytes or NULL
+            **/
+            void* acquireFrame(bool wait = false);
+
+            /**
+            * Publish the frame written into the memory got by acquireFrame(). It is uploaded
+            * on the next draw. A published frame is replaced by newer frames, if it was not
+            * uploaded in between.
+            **/
+            void publishFrame(void* data);
+
+            //! Give the memory got by acquireFrame() back without publishing it
+            void cancelFrame(void* data);
+
+            //! Get number of frames uploaded into the texture
+            unsigned int getNumUploadedFrames() const;
+
+            //! Get number of published frames replaced by newer frames before their upload
+            unsigned int getNumReplacedFrames() const;
+
+        protected:
+            //! State of a buffer of the streaming ring
+            enum StreamState
+            {
+                //! Not mapped, i.e. while its upload is in flight
+                STREAM_FREE,
+
+                //! Mapped and available for the producer
+                STREAM_MAPPED,
+
+                //! Given to the producer
+                STREAM_WRITING,
+
+                //! Holds a published frame
+                STREAM_READY,
+
+                //! Upload out of the buffer was issued
+                STREAM_UPLOADING
+            };
+
+            //! Frame slot of the streaming ring, it uses the pixel buffer of the same index
+            struct StreamBuffer
+            {
+                StreamBuffer() : data(NULL), state(STREAM_FREE), sequence(0) {}
+
+                //! Mapped memory or client memory without pixel buffers
+                void* data;
+                std::vector<unsigned char> memory;
+
+                StreamState state;
+
+                //! Number of the published frame
+                unsigned int sequence;
+            };
+
+            //! Draw callback uploading the published frame
+            struct StreamDrawCallback : public EmptyDrawCallback
+            {
+                StreamDrawCallback(UnitTexture* parent) : EmptyDrawCallback(parent) {}
+                void drawImplementation (osg::RenderInfo& ri, const osg::Drawable* dr) const;
+            };
+
+            //! Upload the newest published frame and map the free buffers, called on draw
+            void uploadStreamFrame(osg::RenderInfo& ri);
+
+            //! Find the buffer of the given memory
+            StreamBuffer* findStreamBuffer(void* data);
+
+            unsigned int mNumStreamBuffers;
+            GLenum mStreamFormat;
+            GLenum mStreamType;
+
+            std::vector<StreamBuffer> mStreamBuffers;
+            osg::ref_ptr<PixelBufferRing> mStreamRing;
+            unsigned int mStreamFrameSize;
+            unsigned int mStreamSequence;
+            unsigned int mNumUploadedFrames;
+            unsigned int mNumReplacedFrames;
+            mutable OpenThreads::Mutex mStreamMutex;
+            OpenThreads::Condition mStreamMapped;
+
         private:
             virtual void setupInputsFromParents();
             osg::ref_ptr<osg::Texture> _externTexture;
@@ -21,6 +21,8 @@
 #include <osg/Uniform>
 #include <osg/Texture>
 
+#include <string>
+
 #include <osgPPU/Export.h>
 
 /**
@@ -41,9 +43,17 @@ namespace osgPPU
     OSGPPU_EXPORT osg::Uniform::Type convertTextureToUniformType(osg::Texture* tex);
 
     /**
-    * Compute memory size in bytes, which is allocated by the texture.
+    * Compute memory size in bytes, which is allocated by the texture. All faces of
+    * a cubemap are included.
+    * @param withMipmaps If true, the memory of the whole mipmap chain is included if
+    *                    the texture is filtered with mipmaps.
+    **/
+    OSGPPU_EXPORT unsigned int computeTextureSizeInBytes(osg::Texture* tex, bool withMipmaps = false);
+
+    /**
+    * Quote and escape a string for json output. Control characters are dropped.
     **/
-    OSGPPU_EXPORT unsigned int computeTextureSizeInBytes(osg::Texture* tex);
+    OSGPPU_EXPORT std::string toJSONString(const std::string& str);
 
 };
 
@@ -27,6 +27,8 @@
 #include <osgUtil/CullVisitor>
 #include <queue>
 #include <list>
+#include <map>
+#include <set>
 
 namespace osgPPU
 {
@@ -41,62 +43,8 @@ class OSGPPU_EXPORT UnitVisitor : public osg::NodeVisitor
 
         virtual void run(osg::Group* root) { root->traverse(*this); }
         inline  void run(osg::Group& root) { run(&root); }
-
-        static OpenThreads::Mutex s_mutex_changeUnitSubgraph;
-};
-
-//------------------------------------------------------------------------------
-// Visitor to set update traversed flag to false
-//------------------------------------------------------------------------------
-class OSGPPU_EXPORT CleanUpdateTraversedVisitor : public UnitVisitor
-{
-public:
-
-    CleanUpdateTraversedVisitor() : UnitVisitor()
-    {
-    }
-
-    void apply (osg::Group &node)
-    {
-        Unit* unit = dynamic_cast<Unit*>(&node);
-        if (unit) unit->mbUpdateTraversed = false;
-        node.traverse(*this);
-    }
-
-    void run (osg::Group* root);
-
-    const char* className() { return "CleanUpdateTraversedVisitor"; }
-
-    static osg::ref_ptr<CleanUpdateTraversedVisitor> sVisitor;
-
-private:
-    OpenThreads::Mutex _mutex;
-};
-
-//------------------------------------------------------------------------------
-// Visitor to set update traversed flag to false
-//------------------------------------------------------------------------------
-class OSGPPU_EXPORT CleanCullTraversedVisitor : public UnitVisitor
-{
-public:
-
-    CleanCullTraversedVisitor() : UnitVisitor()
-    {
-    }
-
-    void apply (osg::Group &node);
-
-    void run (osg::Group* root);
-
-    const char* className() { return "CleanCullTraversedVisitor"; }
-
-    static osg::ref_ptr<CleanCullTraversedVisitor> sVisitor;
-
-private:
-    OpenThreads::Mutex _mutex;
 };
 
-
 //------------------------------------------------------------------------------
 // Helper visitor to setup maximum number of input attachments
 //------------------------------------------------------------------------------
@@ -225,6 +173,7 @@ public:
         _startIndex = proc ? proc->getOrCreateStateSet()->getBinNumber() : 0;
         _binName = proc ? proc->getOrCreateStateSet()->getBinName() : "DefaultPPUBin";
         _initUnits = true;
+        _initDirtyUnitsOnly = false;
     }
 
     void apply (osg::Group &node);
@@ -232,6 +181,7 @@ public:
 
     void setStartIndex(unsigned ind) { _startIndex = ind; }
     void setInitUnitsWhenFound(bool b) { _initUnits = b; }
+    void setInitDirtyUnitsOnly(bool b) { _initDirtyUnitsOnly = b; }
     void setBinName(const std::string& name) { _binName = name; }
 
     const char* className() { return "SetupUnitRenderingVisitor"; }
@@ -240,11 +190,38 @@ private:
     Processor* _proc;
     UnitSet mUnitSet;
     bool _initUnits;
+    bool _initDirtyUnitsOnly;
     unsigned _startIndex;
     std::string _binName;
 };
 
 
+//------------------------------------------------------------------------------
+// Visitor used to build the execution plan of a processor. Units are collected
+// in DFS order, however a unit is only placed after all of its parent units.
+// Subgraphs of repeat units are placed as contiguous segments.
+//------------------------------------------------------------------------------
+class OSGPPU_EXPORT BuildExecutionPlanVisitor : public UnitVisitor
+{
+public:
+
+    BuildExecutionPlanVisitor(Processor* proc) : UnitVisitor(), _proc(proc), _deferLastUnits(true)
+    {
+    }
+
+    void apply (osg::Group &node);
+    void run (osg::Group* root);
+
+    const char* className() { return "BuildExecutionPlanVisitor"; }
+private:
+    bool isLastUnit(Unit* unit) const;
+
+    Processor* _proc;
+    std::map<Unit*, unsigned> _planIndex;
+    std::set<Unit*> _blockedUnits;
+    bool _deferLastUnits;
+};
+
 //--------------------------------------------------------------------------
 // Helper class to find the processor
 //--------------------------------------------------------------------------
@@ -267,6 +244,34 @@ public:
     const char* className() { return "FindProcessorVisitor"; }
 };
 
+//--------------------------------------------------------------------------
+// Helper class to find the sources of the inputs of a unit. For every input
+// index the parent unit and the MRT index of its output is stored, in the same
+// order as the unit collects its inputs from the parents. Inputs coming from
+// the processor's camera are stored with a NULL unit.
+//--------------------------------------------------------------------------
+class OSGPPU_EXPORT CollectInputSourcesVisitor: public UnitVisitor
+{
+public:
+    typedef std::pair<Unit*, int> Source;
+
+    CollectInputSourcesVisitor(Unit* caller) : UnitVisitor(), _caller(caller)
+    {
+        setTraversalMode(osg::NodeVisitor::TRAVERSE_PARENTS);
+    }
+
+    void apply(osg::Group& node);
+    void run(osg::Group* root) { root->accept(*this); }
+
+    const std::vector<Source>& getSources() const { return _sources; }
+
+    const char* className() { return "CollectInputSourcesVisitor"; }
+
+private:
+    Unit* _caller;
+    std::vector<Source> _sources;
+};
+
 //------------------------------------------------------------------------------
 // Mark every unit in the graph as dirty
 //------------------------------------------------------------------------------
@@ -0,0 +1,250 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osg/ArgumentParser>
+#include <osg/Camera>
+#include <osg/FrameStamp>
+#include <osg/Texture2D>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Barrier>
+#include <OpenThreads/Atomic>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitCameraAttachmentBypass.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitInResampleOut.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/ShaderAttribute.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+
+//------------------------------------------------------------------------------
+// Cull visitor counting how often every unit was executed by its processor.
+// Nothing is culled into render bins, hence no graphics context is required.
+//------------------------------------------------------------------------------
+class CountingCullVisitor : public osg::NodeVisitor
+{
+    public:
+        CountingCullVisitor() : osg::NodeVisitor(osg::NodeVisitor::CULL_VISITOR, osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN) {}
+
+        void apply(osg::Group& node)
+        {
+            // the unit is executed, if it is accepted by the processor directly
+            const osg::NodePath& path = getNodePath();
+            osgPPU::Unit* unit = dynamic_cast<osgPPU::Unit*>(&node);
+            if (unit && path.size() >= 2 && dynamic_cast<osgPPU::Processor*>(path[path.size() - 2]))
+                executed[unit]++;
+
+            traverse(node);
+        }
+
+        std::map<const osgPPU::Unit*, unsigned> executed;
+};
+
+typedef std::vector<const osgPPU::Unit*> UnitList;
+
+//------------------------------------------------------------------------------
+// Thread culling the processor once per frame, all threads cull the same frame at once
+//------------------------------------------------------------------------------
+class CullThread : public OpenThreads::Thread
+{
+    public:
+        CullThread(osgPPU::Processor* processor, const UnitList& units, OpenThreads::Barrier* barrier, unsigned numFrames) :
+            _processor(processor), _units(units), _barrier(barrier), _numFrames(numFrames) {}
+
+        void run()
+        {
+            osg::ref_ptr<osg::FrameStamp> frameStamp = new osg::FrameStamp();
+            for (unsigned frame=0; frame < _numFrames; frame++)
+            {
+                _barrier->block();
+
+                frameStamp->setFrameNumber(frame);
+                CountingCullVisitor cv;
+                cv.setFrameStamp(frameStamp.get());
+                _processor->accept(cv);
+
+                // every unit has to be executed exactly once by every cull traversal
+                for (UnitList::const_iterator it = _units.begin(); it != _units.end(); it++)
+                {
+                    unsigned count = cv.executed[*it];
+                    if (count == 1) continue;
+
+                    std::ostringstream error;
+                    error << "unit " << (*it)->getName() << " was executed " << count << " times in frame " << frame;
+                    errors.push_back(error.str());
+                }
+                if (cv.executed.size() != _units.size())
+                {
+                    std::ostringstream error;
+                    error << cv.executed.size() << " units were executed in frame " << frame << " instead of " << _units.size();
+                    errors.push_back(error.str());
+                }
+            }
+        }
+
+        std::vector<std::string> errors;
+
+    private:
+        osgPPU::Processor* _processor;
+        UnitList _units;
+        OpenThreads::Barrier* _barrier;
+        unsigned _numFrames;
+};
+
+//------------------------------------------------------------------------------
+// Thread rebuilding the execution plan of the processor while it is culled
+//------------------------------------------------------------------------------
+class RebuildThread : public OpenThreads::Thread
+{
+    public:
+        RebuildThread(osgPPU::Processor* processor) : _processor(processor) {}
+
+        void run()
+        {
+            while (!unsigned(done))
+            {
+                _processor->dirtyExecutionPlan();
+                OpenThreads::Thread::microSleep(100);
+            }
+        }
+
+        OpenThreads::Atomic done;
+
+    private:
+        osgPPU::Processor* _processor;
+};
+
+//------------------------------------------------------------------------------
+// Create a pipeline with a branch, so that the order of the units matters
+//------------------------------------------------------------------------------
+osgPPU::Processor* createProcessor(osg::Camera* camera)
+{
+    osgPPU::Processor* processor = new osgPPU::Processor();
+    processor->setName("Processor");
+    processor->setCamera(camera);
+
+    osgPPU::ShaderAttribute* shader = new osgPPU::ShaderAttribute();
+    {
+        osg::Shader* fpShader = new osg::Shader(osg::Shader::FRAGMENT);
+        fpShader->setShaderSource(
+            "uniform sampler2D texUnit0;\n"
+            "void main()\n"
+            "{\n"
+            "   gl_FragColor = texture2D(texUnit0, gl_TexCoord[0].st) * 0.8;\n"
+            "}\n");
+        shader->addShader(fpShader);
+        shader->setName("DarkenShader");
+        shader->add("texUnit0", osg::Uniform::SAMPLER_2D);
+        shader->set("texUnit0", 0);
+    }
+
+    osgPPU::UnitCameraAttachmentBypass* unitCam = new osgPPU::UnitCameraAttachmentBypass();
+    unitCam->setBufferComponent(osg::Camera::COLOR_BUFFER);
+    unitCam->setName("ColorBypass");
+    processor->addChild(unitCam);
+
+    osgPPU::UnitInResampleOut* resample = new osgPPU::UnitInResampleOut();
+    resample->setName("Resample");
+    resample->setFactorX(0.5);
+    resample->setFactorY(0.5);
+    unitCam->addChild(resample);
+
+    osgPPU::UnitInOut* darken = new osgPPU::UnitInOut();
+    darken->setName("Darken");
+    darken->getOrCreateStateSet()->setAttributeAndModes(shader);
+    resample->addChild(darken);
+
+    osgPPU::UnitInOut* combine = new osgPPU::UnitInOut();
+    combine->setName("Combine");
+    combine->getOrCreateStateSet()->setAttributeAndModes(shader);
+    unitCam->addChild(combine);
+    combine->setInputToUniform(darken, "darkenInput", true);
+
+    osgPPU::UnitOut* unitOut = new osgPPU::UnitOut();
+    unitOut->setName("Output");
+    unitOut->setInputTextureIndexForViewportReference(-1);
+    combine->addChild(unitOut);
+
+    return processor;
+}
+
+//------------------------------------------------------------------------------
+// Main code
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    unsigned numThreads = 8;
+    unsigned numFrames = 500;
+    while (arguments.read("--threads", numThreads)) {}
+    while (arguments.read("--frames", numFrames)) {}
+    if (numThreads == 0) numThreads = 1;
+
+    // the camera is never rendered, it only provides the viewport and the attachment
+    osg::ref_ptr<osg::Camera> camera = new osg::Camera();
+    camera->setViewport(0, 0, 256, 256);
+    osg::Texture2D* texture = new osg::Texture2D();
+    texture->setTextureSize(256, 256);
+    texture->setInternalFormat(GL_RGBA);
+    camera->attach(osg::Camera::COLOR_BUFFER, texture);
+
+    osg::ref_ptr<osgPPU::Processor> processor = createProcessor(camera.get());
+
+    // set up the pipeline first, so that the expected units are known
+    osgPPU::Processor::DryRunResult result;
+    if (!processor->dryRun(result))
+    {
+        std::cout << "ERROR: dry run of the pipeline failed" << std::endl;
+        return 1;
+    }
+
+    UnitList units;
+    osg::ref_ptr<const osgPPU::Processor::PlanSnapshot> plan = processor->getPlanSnapshot();
+    for (osgPPU::Processor::ExecutionPlan::const_iterator it = plan->steps.begin(); it != plan->steps.end(); it++)
+        units.push_back(it->unit.get());
+
+    // cull the same processor by several threads at once, while its plan is rebuilt
+    OpenThreads::Barrier barrier(numThreads);
+    std::vector<CullThread*> threads;
+    for (unsigned i=0; i < numThreads; i++)
+        threads.push_back(new CullThread(processor.get(), units, &barrier, numFrames));
+
+    RebuildThread rebuild(processor.get());
+    rebuild.start();
+    for (unsigned i=0; i < numThreads; i++)
+        threads[i]->start();
+    for (unsigned i=0; i < numThreads; i++)
+        threads[i]->join();
+    ++rebuild.done;
+    rebuild.join();
+
+    unsigned numErrors = 0;
+    for (unsigned i=0; i < numThreads; i++)
+    {
+        for (unsigned j=0; j < threads[i]->errors.size(); j++)
+            std::cout << "ERROR: thread " << i << ": " << threads[i]->errors[j] << std::endl;
+        numErrors += threads[i]->errors.size();
+        delete threads[i];
+    }
+
+    std::cout << numThreads << " threads culled " << units.size() << " units in " << numFrames << " frames, " << numErrors << " errors" << std::endl;
+    return numErrors ? 1 : 0;
+}
@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osg/ArgumentParser>
+#include <osg/Camera>
+#include <osg/Texture2D>
+#include <osgDB/FileUtils>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitInResampleOut.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/ShaderAttribute.h>
+
+#include "../../example/hdr/hdrppu.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+
+//------------------------------------------------------------------------------
+// Errors found by the check
+//------------------------------------------------------------------------------
+static std::vector<std::string> errors;
+
+static void expect(bool condition, const std::string& error)
+{
+    if (!condition) errors.push_back(error);
+}
+
+//------------------------------------------------------------------------------
+// Add units around the shipped HDR pipeline, so that every optimization of the plan is hit:
+//  - Grade and Gamma behind the pipeline form a chain, which is fused into one pass
+//  - ResampleTwin computes the same as Resample of the pipeline, hence it is a duplicate
+//  - Debug is read by nobody, hence it is dead
+//------------------------------------------------------------------------------
+static void extendPipeline(osgPPU::Unit* firstUnit, osgPPU::Unit* lastUnit)
+{
+    osgPPU::ShaderAttribute* gradeShader = new osgPPU::ShaderAttribute();
+    {
+        osg::Shader* fpShader = new osg::Shader(osg::Shader::FRAGMENT);
+        fpShader->setShaderSource(
+            "uniform sampler2D texUnit0;\n"
+            "uniform float exposure;\n"
+            "void main()\n"
+            "{\n"
+            "   gl_FragColor = texture2D(texUnit0, gl_TexCoord[0].st) * exposure;\n"
+            "}\n");
+        gradeShader->addShader(fpShader);
+        gradeShader->setName("GradeShader");
+        gradeShader->add("texUnit0", osg::Uniform::SAMPLER_2D);
+        gradeShader->set("texUnit0", 0);
+        gradeShader->add("exposure", osg::Uniform::FLOAT);
+        gradeShader->set("exposure", 1.2f);
+    }
+
+    osgPPU::ShaderAttribute* gammaShader = new osgPPU::ShaderAttribute();
+    {
+        osg::Shader* fpShader = new osg::Shader(osg::Shader::FRAGMENT);
+        fpShader->setShaderSource(
+            "uniform sampler2D gammaInput;\n"
+            "void main()\n"
+            "{\n"
+            "   vec4 color = texture2D(gammaInput, gl_TexCoord[0].st);\n"
+            "   gl_FragColor = vec4(pow(color.rgb, vec3(1.0 / 2.2)), color.a);\n"
+            "}\n");
+        gammaShader->addShader(fpShader);
+        gammaShader->setName("GammaShader");
+        gammaShader->setPointwise(true);
+        gammaShader->add("gammaInput", osg::Uniform::SAMPLER_2D);
+        gammaShader->set("gammaInput", 0);
+    }
+
+    osgPPU::UnitInOut* grade = new osgPPU::UnitInOut();
+    grade->setName("Grade");
+    grade->getOrCreateStateSet()->setAttributeAndModes(gradeShader);
+    lastUnit->addChild(grade);
+
+    osgPPU::UnitInOut* gamma = new osgPPU::UnitInOut();
+    gamma->setName("Gamma");
+    gamma->getOrCreateStateSet()->setAttributeAndModes(gammaShader);
+    grade->addChild(gamma);
+
+    osgPPU::UnitOut* unitOut = new osgPPU::UnitOut();
+    unitOut->setName("Output");
+    gamma->addChild(unitOut);
+
+    // small preview of the downsampled scene, it reads the same as the resample unit of the pipeline
+    osgPPU::UnitInResampleOut* twin = new osgPPU::UnitInResampleOut();
+    twin->setName("ResampleTwin");
+    twin->setFactorX(0.25);
+    twin->setFactorY(0.25);
+    firstUnit->addChild(twin);
+
+    osgPPU::UnitOut* preview = new osgPPU::UnitOut();
+    preview->setName("Preview");
+    twin->addChild(preview);
+
+    osgPPU::UnitInOut* debug = new osgPPU::UnitInOut();
+    debug->setName("Debug");
+    firstUnit->addChild(debug);
+}
+
+//------------------------------------------------------------------------------
+// Main code
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    // the shaders of the pipeline are read from Data/glsl below the given directory
+    std::string dataDir;
+    while (arguments.read("--data", dataDir))
+        osgDB::getDataFilePathList().push_back(dataDir);
+    if (osgDB::findDataFile("Data/glsl/tonemap_hdr_fp.glsl").empty())
+    {
+        std::cout << "ERROR: shaders of the HDR pipeline not found, use --data <source directory>" << std::endl;
+        return 1;
+    }
+
+    // the camera is never rendered, it only provides the viewport and the hdr attachment
+    osg::ref_ptr<osg::Camera> camera = new osg::Camera();
+    camera->setViewport(0, 0, 512, 512);
+    osg::Texture2D* texture = new osg::Texture2D();
+    texture->setTextureSize(512, 512);
+    texture->setInternalFormat(GL_RGBA16F_ARB);
+    texture->setSourceFormat(GL_RGBA);
+    texture->setSourceType(GL_FLOAT);
+    camera->attach(osg::Camera::COLOR_BUFFER, texture);
+
+    osg::ref_ptr<osgPPU::Processor> processor = new osgPPU::Processor();
+    processor->setName("Processor");
+    processor->setCamera(camera.get());
+    processor->setUseDeadUnitElimination(true);
+    processor->setUseShaderFusion(true);
+    processor->setUseDuplicateUnitElimination(true);
+
+    HDRRendering hdr;
+    osgPPU::Unit* firstUnit = NULL;
+    osgPPU::Unit* lastUnit = NULL;
+    hdr.createHDRPipeline(processor.get(), firstUnit, lastUnit);
+    processor->addChild(firstUnit);
+    extendPipeline(firstUnit, lastUnit);
+
+    osgPPU::Processor::DryRunResult result;
+    if (!processor->dryRun(result))
+    {
+        std::cout << "ERROR: dry run of the pipeline failed" << std::endl;
+        return 1;
+    }
+
+    osg::ref_ptr<const osgPPU::Processor::PlanSnapshot> plan = processor->getPlanSnapshot();
+    const osgPPU::Processor::ExecutionPlan& steps = plan->steps;
+
+    // every unit is placed once and after all its parents
+    std::map<std::string, unsigned> index;
+    for (unsigned i=0; i < steps.size(); i++)
+    {
+        const std::string& name = steps[i].unit->getName();
+        expect(index.find(name) == index.end(), "unit " + name + " is placed more than once");
+        index[name] = i;
+
+        for (unsigned j=0; j < steps[i].parents.size(); j++)
+            expect(steps[i].parents[j] < i, "unit " + name + " is placed before its parent " + steps[steps[i].parents[j]].unit->getName());
+    }
+
+    const char* units[] = {"HDRBypass", "Resample", "ComputePixelLuminance", "ComputeSceneLuminance", "Brightpass",
+        "BlurHorizontal", "BlurVertical", "HDR-Result", "AdaptedLuminance", "AdaptedLuminanceCopy",
+        "Grade", "Gamma", "Output", "ResampleTwin", "Preview", "Debug"};
+    const unsigned numUnits = sizeof(units) / sizeof(units[0]);
+    for (unsigned i=0; i < numUnits; i++)
+        expect(index.find(units[i]) != index.end(), std::string("unit ") + units[i] + " is not placed");
+    expect(steps.size() == numUnits, "plan has an unexpected number of steps");
+    if (!errors.empty() || steps.size() != numUnits)
+    {
+        for (unsigned i=0; i < errors.size(); i++) std::cout << "ERROR: " << errors[i] << std::endl;
+        return 1;
+    }
+
+    // the chain of the pipeline is executed in order, the adapted luminance is fed back through its copy
+    const char* order[] = {"HDRBypass", "Resample", "ComputePixelLuminance", "ComputeSceneLuminance", "AdaptedLuminance",
+        "Brightpass", "BlurHorizontal", "BlurVertical", "HDR-Result", "Grade", "Gamma", "Output"};
+    for (unsigned i=1; i < sizeof(order) / sizeof(order[0]); i++)
+        expect(index[order[i-1]] < index[order[i]], std::string("unit ") + order[i] + " is placed before " + order[i-1]);
+    expect(index["AdaptedLuminance"] < index["AdaptedLuminanceCopy"], "unit AdaptedLuminanceCopy is placed before AdaptedLuminance");
+
+    // only the unit nobody reads is dead
+    for (unsigned i=0; i < steps.size(); i++)
+    {
+        const std::string& name = steps[i].unit->getName();
+        expect(steps[i].dead == (name == "Debug"), "unit " + name + (steps[i].dead ? " is dead" : " is not dead"));
+    }
+
+    // the point-wise gamma is fused into the grading, which renders into the output of the gamma
+    for (unsigned i=0; i < steps.size(); i++)
+    {
+        const std::string& name = steps[i].unit->getName();
+        expect(steps[i].fused == (name == "Gamma"), "unit " + name + (steps[i].fused ? " is fused" : " is not fused"));
+    }
+    osgPPU::Unit* grade = steps[index["Grade"]].unit.get();
+    osgPPU::Unit* gamma = steps[index["Gamma"]].unit.get();
+    expect(grade->getOutputTexture(0) == gamma->getOutputTexture(0), "Grade does not render into the output of Gamma");
+
+    // the twin of the resample unit is not executed and provides the output of the resample unit
+    for (unsigned i=0; i < steps.size(); i++)
+    {
+        const std::string& name = steps[i].unit->getName();
+        expect(steps[i].duplicate == (name == "ResampleTwin"), "unit " + name + (steps[i].duplicate ? " is a duplicate" : " is not a duplicate"));
+    }
+    osgPPU::Unit* resample = steps[index["Resample"]].unit.get();
+    osgPPU::Unit* twin = steps[index["ResampleTwin"]].unit.get();
+    expect(resample->getOutputTexture(0) == twin->getOutputTexture(0), "ResampleTwin does not provide the output of Resample");
+
+    // the dry run reports the same
+    expect(result.units.size() == steps.size(), "dry run reports an unexpected number of units");
+    for (unsigned i=0; i < result.units.size() && i < steps.size(); i++)
+    {
+        const osgPPU::Processor::UnitDescription& desc = result.units[i];
+        expect(desc.name == steps[i].unit->getName(), "dry run reports " + desc.name + " out of order");
+        expect(desc.executed == (!steps[i].dead && !steps[i].fused), "dry run reports " + desc.name + " with a wrong execution state");
+    }
+
+    for (unsigned i=0; i < errors.size(); i++)
+        std::cout << "ERROR: " << errors[i] << std::endl;
+
+    std::cout << "HDR pipeline planned " << steps.size() << " units, " << errors.size() << " errors" << std::endl;
+    return errors.empty() ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osg/ArgumentParser>
+#include <osgDB/ReadFile>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitTexture.h>
+#include <osgPPU/BatchProcessor.h>
+
+#include <iostream>
+
+//------------------------------------------------------------------------------
+// Main code
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " processes all images of a directory by a .ppu pipeline without any window.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options] ppufile");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--input <dir>", "Directory containing the images to process [default .]");
+    arguments.getApplicationUsage()->addCommandLineOption("--input-extension <ext>", "Extension of the images to process [default png]");
+    arguments.getApplicationUsage()->addCommandLineOption("--output <dir>", "Directory to write the processed images to [default .]");
+    arguments.getApplicationUsage()->addCommandLineOption("--output-extension <ext>", "Extension of the processed images [default png]");
+    arguments.getApplicationUsage()->addCommandLineOption("--input-unit <name>", "Name of the UnitTexture the images are fed into [default Input]");
+    arguments.getApplicationUsage()->addCommandLineOption("--output-unit <name>", "Name of the unit whose output is written [default Output]");
+    arguments.getApplicationUsage()->addCommandLineOption("--buffers <n>", "Number of upload buffers, 2 for double and 3 for triple buffering [default 2]");
+    arguments.getApplicationUsage()->addCommandLineOption("--in-flight <n>", "Number of frames rendered ahead of the read back [default 3]");
+    arguments.getApplicationUsage()->addCommandLineOption("--float", "Read back the output as float, i.e. to write HDR images");
+
+    if (arguments.read("-h") || arguments.read("--help") || arguments.argc() <= 1)
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    std::string inputDir = ".", inputExtension = "png";
+    std::string outputDir = ".", outputExtension = "png";
+    std::string inputUnit = "Input", outputUnit = "Output";
+    unsigned numBuffers = 2, numFramesInFlight = 3;
+    while (arguments.read("--input", inputDir)) {}
+    while (arguments.read("--input-extension", inputExtension)) {}
+    while (arguments.read("--output", outputDir)) {}
+    while (arguments.read("--output-extension", outputExtension)) {}
+    while (arguments.read("--input-unit", inputUnit)) {}
+    while (arguments.read("--output-unit", outputUnit)) {}
+    while (arguments.read("--buffers", numBuffers)) {}
+    while (arguments.read("--in-flight", numFramesInFlight)) {}
+    bool readFloat = arguments.read("--float");
+
+    if (arguments.argc() <= 1)
+    {
+        osg::notify(osg::FATAL) << "No .ppu file specified" << std::endl;
+        return 1;
+    }
+
+    osg::ref_ptr<osgPPU::Processor> processor = dynamic_cast<osgPPU::Processor*>(osgDB::readObjectFile(arguments[1]));
+    if (!processor.valid())
+    {
+        osg::notify(osg::FATAL) << "File does not contain a valid pipeline " << arguments[1] << std::endl;
+        return 1;
+    }
+
+    osgPPU::UnitTexture* input = dynamic_cast<osgPPU::UnitTexture*>(processor->findUnit(inputUnit));
+    osgPPU::Unit* output = processor->findUnit(outputUnit);
+    if (!input || !output)
+    {
+        osg::notify(osg::FATAL) << "Pipeline has no UnitTexture " << inputUnit << " or no unit " << outputUnit << std::endl;
+        return 1;
+    }
+
+    osg::ref_ptr<osgPPU::BatchProcessor::ImageFileSource> source = osgPPU::BatchProcessor::ImageFileSource::createFromDirectory(inputDir, inputExtension);
+    if (source->getFiles().empty())
+    {
+        osg::notify(osg::FATAL) << "No ." << inputExtension << " images found in " << inputDir << std::endl;
+        return 1;
+    }
+
+    osg::ref_ptr<osgPPU::BatchProcessor> batch = new osgPPU::BatchProcessor(processor.get(), input, output);
+    batch->setNumUploadBuffers(numBuffers);
+    batch->setNumFramesInFlight(numFramesInFlight);
+    if (readFloat) batch->setOutputFormat(GL_RGBA, GL_FLOAT);
+
+    bool success = batch->run(source.get(), new osgPPU::BatchProcessor::ImageFileSink(outputDir, outputExtension));
+
+    const osgPPU::BatchProcessor::Statistics& stats = batch->getStatistics();
+    std::cout << stats.numFrames << " frames, " << stats.getFramesPerSecond() << " fps, "
+              << stats.numSkipped << " skipped, " << stats.numFailed << " failed, " << stats.numStalls << " stalls" << std::endl;
+
+    return success ? 0 : 1;
+}
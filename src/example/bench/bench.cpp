@@ -0,0 +1,420 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgViewer/Viewer>
+#include <osgDB/ReadFile>
+#include <osg/Texture2D>
+#include <osg/ShapeDrawable>
+#include <osg/Geode>
+#include <osg/ClampColor>
+#include <osg/Timer>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/TexturePool.h>
+#include <osgPPU/Utility.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+
+//------------------------------------------------------------------------------
+// Options of the processor to benchmark
+//------------------------------------------------------------------------------
+struct ProcessorOptions
+{
+    ProcessorOptions() : directExecution(false), textureAliasing(false), deadUnits(false), shaderFusion(false), duplicateUnits(false) {}
+
+    bool directExecution;
+    bool textureAliasing;
+    bool deadUnits;
+    bool shaderFusion;
+    bool duplicateUnits;
+};
+
+//------------------------------------------------------------------------------
+// Result of one benchmark run
+//------------------------------------------------------------------------------
+struct Result
+{
+    Result() : width(0), height(0), frameTime(0.0), gpuTime(-1.0), peakTextureMemory(0), passes(0.0), estimatedFBOSwitches(0.0) {}
+
+    int width, height;
+    //! Wall clock time of a whole frame, the viewer might render in other threads
+    double frameTime;
+    double gpuTime;
+    unsigned int peakTextureMemory;
+    double passes;
+
+    //! Estimated from the draws of the units, the real binds of the framebuffers are not counted
+    double estimatedFBOSwitches;
+    std::vector<osgPPU::Profiler::Timing> units;
+};
+
+//------------------------------------------------------------------------------
+// Create camera resulting texture
+//------------------------------------------------------------------------------
+osg::Texture* createRenderTexture(int tex_width, int tex_height, bool depth)
+{
+    osg::Texture2D* texture2D = new osg::Texture2D;
+    texture2D->setTextureSize(tex_width, tex_height);
+    texture2D->setResizeNonPowerOfTwoHint(false);
+    texture2D->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setWrap(osg::Texture2D::WRAP_S,osg::Texture2D::CLAMP_TO_EDGE);
+    texture2D->setWrap(osg::Texture2D::WRAP_T,osg::Texture2D::CLAMP_TO_EDGE);
+
+    if (!depth)
+    {
+        texture2D->setInternalFormat(GL_RGBA16F_ARB);
+        texture2D->setSourceFormat(GL_RGBA);
+        texture2D->setSourceType(GL_FLOAT);
+    }else{
+        texture2D->setInternalFormat(GL_DEPTH_COMPONENT);
+    }
+
+    return texture2D;
+}
+
+//------------------------------------------------------------------------------
+// Synthetic input scene, which looks the same on every run
+//------------------------------------------------------------------------------
+osg::Node* createSyntheticScene()
+{
+    osg::Geode* geode = new osg::Geode();
+    for (int x=-2; x <= 2; x++)
+        for (int y=-2; y <= 2; y++)
+        {
+            osg::ShapeDrawable* shape = new osg::ShapeDrawable(new osg::Sphere(osg::Vec3(x, y, 0.0f), 0.4f));
+
+            // bright spots make the hdr and glow pipelines do some work
+            float intensity = ((x + y) % 3 == 0) ? 4.0f : 0.8f;
+            shape->setColor(osg::Vec4(intensity * (x + 3) / 5.0f, intensity * (y + 3) / 5.0f, intensity * 0.5f, 1.0f));
+            geode->addDrawable(shape);
+        }
+    return geode;
+}
+
+//------------------------------------------------------------------------------
+// Create an offscreen context of the given size, NULL if not possible
+//------------------------------------------------------------------------------
+osg::GraphicsContext* createOffscreenContext(int width, int height)
+{
+    osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+    traits->x = 0;
+    traits->y = 0;
+    traits->width = width;
+    traits->height = height;
+    traits->windowDecoration = false;
+    traits->doubleBuffer = false;
+    traits->pbuffer = true;
+    traits->alpha = 8;
+    traits->depth = 24;
+
+    return osg::GraphicsContext::createGraphicsContext(traits.get());
+}
+
+//------------------------------------------------------------------------------
+// Load the pipeline and setup it for the given camera
+//------------------------------------------------------------------------------
+osgPPU::Processor* loadProcessor(const std::string& ppuFile, osg::Camera* camera, const ProcessorOptions& options)
+{
+    osg::ref_ptr<osgPPU::Processor> processor = dynamic_cast<osgPPU::Processor*>(osgDB::readObjectFile(ppuFile));
+    if (!processor.valid())
+    {
+        osg::notify(osg::FATAL) << "File " << ppuFile << " does not contain a valid pipeline" << std::endl;
+        return NULL;
+    }
+    processor->setCamera(camera);
+    processor->setUseDirectExecution(options.directExecution);
+    processor->setUseTextureAliasing(options.textureAliasing);
+    processor->setUseDeadUnitElimination(options.deadUnits);
+    processor->setUseShaderFusion(options.shaderFusion);
+    processor->setUseDuplicateUnitElimination(options.duplicateUnits);
+    return processor.release();
+}
+
+//------------------------------------------------------------------------------
+// Setup the pipeline at the given resolution without any graphics context
+//------------------------------------------------------------------------------
+bool runDryRun(const std::string& ppuFile, int width, int height, const ProcessorOptions& options, osgPPU::Processor::DryRunResult& result)
+{
+    osg::ref_ptr<osg::Camera> camera = new osg::Camera();
+    camera->setViewport(new osg::Viewport(0, 0, width, height));
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    camera->attach(osg::Camera::COLOR_BUFFER, createRenderTexture(width, height, false));
+    camera->attach(osg::Camera::DEPTH_BUFFER, createRenderTexture(width, height, true));
+
+    osg::ref_ptr<osgPPU::Processor> processor = loadProcessor(ppuFile, camera.get(), options);
+    if (!processor.valid()) return false;
+
+    return processor->dryRun(result);
+}
+
+//------------------------------------------------------------------------------
+// Render the pipeline at the given resolution and measure it
+//------------------------------------------------------------------------------
+bool runBenchmark(const std::string& ppuFile, osg::Node* model, int width, int height, unsigned numFrames, unsigned numWarmup, const ProcessorOptions& options, Result& result)
+{
+    osg::ref_ptr<osg::GraphicsContext> gc = createOffscreenContext(width, height);
+    if (!gc.valid())
+    {
+        osg::notify(osg::FATAL) << "Cannot create an offscreen context of size " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    osg::ref_ptr<osgViewer::Viewer> viewer = new osgViewer::Viewer();
+    viewer->setThreadingModel(osgViewer::Viewer::SingleThreaded);
+
+    // camera renders the scene into textures, which are the input of the pipeline
+    osg::Camera* camera = viewer->getCamera();
+    camera->setGraphicsContext(gc.get());
+    camera->setViewport(new osg::Viewport(0, 0, width, height));
+    camera->setDrawBuffer(GL_FRONT);
+    camera->setReadBuffer(GL_FRONT);
+    camera->setClearColor(osg::Vec4(0.0f,0.0f,0.0f,0.0f));
+    camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    camera->attach(osg::Camera::COLOR_BUFFER, createRenderTexture(width, height, false));
+    camera->attach(osg::Camera::DEPTH_BUFFER, createRenderTexture(width, height, true));
+
+    // fixed view on the scene, hence every frame renders the same
+    const osg::BoundingSphere& bs = model->getBound();
+    camera->setProjectionMatrixAsPerspective(35.0, double(width) / double(height), 0.1, bs.radius() * 10.0);
+    camera->setViewMatrixAsLookAt(bs.center() + osg::Vec3(0.0f, -bs.radius() * 3.0f, bs.radius()), bs.center(), osg::Vec3(0.0f, 0.0f, 1.0f));
+
+    osg::ref_ptr<osgPPU::Processor> processor = loadProcessor(ppuFile, camera, options);
+    if (!processor.valid()) return false;
+    processor->setUseProfiler(true);
+    processor->getProfiler()->setNumSamples(numFrames);
+
+    // hdr pipelines work on unclamped values
+    osg::ClampColor* clamp = new osg::ClampColor();
+    clamp->setClampVertexColor(GL_FALSE);
+    clamp->setClampFragmentColor(GL_FALSE);
+    clamp->setClampReadColor(GL_FALSE);
+
+    osg::ref_ptr<osg::Group> root = new osg::Group();
+    root->getOrCreateStateSet()->setAttribute(clamp, osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE | osg::StateAttribute::PROTECTED);
+    root->addChild(model);
+    root->addChild(processor.get());
+    viewer->setSceneData(root.get());
+    viewer->realize();
+
+    // the pipeline is set up during the first frames, which are not measured
+    double simulationTime = 0.0;
+    for (unsigned i=0; i < numWarmup; i++)
+    {
+        viewer->frame(simulationTime);
+        simulationTime += 1.0 / 60.0;
+    }
+    processor->getProfiler()->reset();
+
+    result.width = width;
+    result.height = height;
+    result.peakTextureMemory = 0;
+
+    // only the frames are timed, the memory statistics are gathered in between
+    double frameTime = 0.0;
+    for (unsigned i=0; i < numFrames; i++)
+    {
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        viewer->frame(simulationTime);
+        frameTime += osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+        simulationTime += 1.0 / 60.0;
+
+        osgPPU::Processor::MemoryStatistics memory = processor->getMemoryStatistics();
+        result.peakTextureMemory = osg::maximum(result.peakTextureMemory, memory.getTotalBytes() + memory.poolBytes);
+    }
+    result.frameTime = frameTime / double(numFrames);
+
+    // sum up the timings of all units
+    osgPPU::Processor::ExecutionPlan plan = processor->getExecutionPlan();
+    for (unsigned i=0; i < plan.size(); i++)
+    {
+        osgPPU::Profiler::Timing timing;
+        if (!processor->getProfiler()->getTiming(plan[i].unit.get(), timing)) continue;
+        result.units.push_back(timing);
+
+        double draws = double(timing.numDraws) / double(numFrames);
+        result.passes += draws;
+        if (timing.gpuTime >= 0.0)
+            result.gpuTime = osg::maximum(result.gpuTime, 0.0) + timing.gpuTime * draws;
+
+        // estimate: every unit rendering into own outputs binds its fbo, output units bind the camera's framebuffer again
+        if (dynamic_cast<osgPPU::UnitInOut*>(plan[i].unit.get()) || dynamic_cast<osgPPU::UnitOut*>(plan[i].unit.get()))
+            result.estimatedFBOSwitches += draws;
+    }
+
+    // release everything of the context before it goes away
+    viewer->setDone(true);
+    viewer = NULL;
+    osgPPU::TexturePool::instance()->clear();
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Write the results as json
+//------------------------------------------------------------------------------
+void writeResults(std::ostream& out, const std::string& ppuFile, unsigned numFrames, const ProcessorOptions& options, const std::vector<Result>& results)
+{
+    out << "{" << std::endl;
+    out << "  \"pipeline\": " << osgPPU::toJSONString(ppuFile) << "," << std::endl;
+    out << "  \"frames\": " << numFrames << "," << std::endl;
+    out << "  \"options\": {"
+        << "\"direct_execution\": " << (options.directExecution ? "true" : "false")
+        << ", \"texture_aliasing\": " << (options.textureAliasing ? "true" : "false")
+        << ", \"dead_unit_elimination\": " << (options.deadUnits ? "true" : "false")
+        << ", \"shader_fusion\": " << (options.shaderFusion ? "true" : "false")
+        << ", \"duplicate_unit_elimination\": " << (options.duplicateUnits ? "true" : "false") << "}," << std::endl;
+    out << "  \"results\": [" << std::endl;
+
+    for (unsigned i=0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        out << "    {" << std::endl;
+        out << "      \"width\": " << r.width << ", \"height\": " << r.height << "," << std::endl;
+        out << "      \"frame_ms\": " << r.frameTime << "," << std::endl;
+        out << "      \"gpu_ms_per_frame\": " << r.gpuTime << "," << std::endl;
+        out << "      \"peak_texture_bytes\": " << r.peakTextureMemory << "," << std::endl;
+        out << "      \"passes_per_frame\": " << r.passes << "," << std::endl;
+        out << "      \"estimated_fbo_switches_per_frame\": " << r.estimatedFBOSwitches << "," << std::endl;
+        out << "      \"units\": [" << std::endl;
+        for (unsigned j=0; j < r.units.size(); j++)
+        {
+            const osgPPU::Profiler::Timing& t = r.units[j];
+            out << "        {\"name\": " << osgPPU::toJSONString(t.name) << ", \"cull_ms\": " << t.cullTime << ", \"draw_ms\": " << t.drawTime
+                << ", \"gpu_ms\": " << t.gpuTime << ", \"draws_per_frame\": " << double(t.numDraws) / double(numFrames) << "}"
+                << (j + 1 < r.units.size() ? "," : "") << std::endl;
+        }
+        out << "      ]" << std::endl;
+        out << "    }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// Main code
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " renders a .ppu pipeline offscreen for a number of frames and reports the timings as json. Without a GPU run it on Mesa, i.e. under Xvfb with LIBGL_ALWAYS_SOFTWARE=1.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options] ppufile");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--frames <n>", "Number of measured frames [default 100]");
+    arguments.getApplicationUsage()->addCommandLineOption("--warmup <n>", "Number of frames rendered before measuring [default 10]");
+    arguments.getApplicationUsage()->addCommandLineOption("--resolutions <list>", "Comma separated list of resolutions, i.e. 640x480,1280x720 [default 640x480]");
+    arguments.getApplicationUsage()->addCommandLineOption("--model <file>", "Render the given model instead of the synthetic scene");
+    arguments.getApplicationUsage()->addCommandLineOption("--output <file>", "Write the json to the given file instead of stdout");
+    arguments.getApplicationUsage()->addCommandLineOption("--direct", "Use direct execution of the processor");
+    arguments.getApplicationUsage()->addCommandLineOption("--aliasing", "Use texture aliasing");
+    arguments.getApplicationUsage()->addCommandLineOption("--dead-units", "Use dead unit elimination");
+    arguments.getApplicationUsage()->addCommandLineOption("--fusion", "Use shader fusion");
+    arguments.getApplicationUsage()->addCommandLineOption("--duplicates", "Use duplicate unit elimination");
+    arguments.getApplicationUsage()->addCommandLineOption("--dry-run", "Do not render, but report the execution order, the outputs and the memory of the pipeline. Requires no graphics context.");
+
+    if (arguments.read("-h") || arguments.read("--help") || arguments.argc() <= 1)
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    unsigned numFrames = 100;
+    unsigned numWarmup = 10;
+    std::string resolutions = "640x480";
+    std::string modelFile, outputFile;
+    ProcessorOptions options;
+    while (arguments.read("--frames", numFrames)) {}
+    while (arguments.read("--warmup", numWarmup)) {}
+    while (arguments.read("--resolutions", resolutions)) {}
+    while (arguments.read("--model", modelFile)) {}
+    while (arguments.read("--output", outputFile)) {}
+    while (arguments.read("--direct")) options.directExecution = true;
+    while (arguments.read("--aliasing")) options.textureAliasing = true;
+    while (arguments.read("--dead-units")) options.deadUnits = true;
+    while (arguments.read("--fusion")) options.shaderFusion = true;
+    while (arguments.read("--duplicates")) options.duplicateUnits = true;
+    bool dryRun = arguments.read("--dry-run");
+    if (numFrames == 0) numFrames = 1;
+
+    if (arguments.argc() <= 1)
+    {
+        osg::notify(osg::FATAL) << "No .ppu file specified" << std::endl;
+        return 1;
+    }
+    std::string ppuFile = arguments[1];
+
+    // recorded input or the synthetic scene
+    osg::ref_ptr<osg::Node> model = modelFile.empty() ? createSyntheticScene() : osgDB::readNodeFile(modelFile);
+    if (!model.valid())
+    {
+        osg::notify(osg::FATAL) << "File not found " << modelFile << std::endl;
+        return 1;
+    }
+
+    // run the benchmark for every resolution
+    std::vector<Result> results;
+    std::stringstream dryRunResults;
+    dryRunResults << "[";
+    std::stringstream list(resolutions);
+    std::string resolution;
+    while (std::getline(list, resolution, ','))
+    {
+        int width = 0, height = 0;
+        if (sscanf(resolution.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+        {
+            osg::notify(osg::FATAL) << "Invalid resolution " << resolution << std::endl;
+            return 1;
+        }
+
+        if (dryRun)
+        {
+            osgPPU::Processor::DryRunResult result;
+            if (!runDryRun(ppuFile, width, height, options, result)) return 1;
+
+            dryRunResults << (dryRunResults.str().size() > 1 ? "," : "") << std::endl;
+            dryRunResults << "{\"width\": " << width << ", \"height\": " << height << ", \"plan\": ";
+            result.writeJSON(dryRunResults);
+            dryRunResults << "}";
+            continue;
+        }
+
+        Result result;
+        if (!runBenchmark(ppuFile, model.get(), width, height, numFrames, numWarmup, options, result)) return 1;
+        results.push_back(result);
+    }
+    if (dryRun) dryRunResults << std::endl << "]" << std::endl;
+
+    std::ofstream file;
+    if (!outputFile.empty()) file.open(outputFile.c_str());
+    std::ostream& out = outputFile.empty() ? std::cout : file;
+
+    if (dryRun)
+        out << dryRunResults.str();
+    else
+        writeResults(out, ppuFile, numFrames, options, results);
+
+    return 0;
+}
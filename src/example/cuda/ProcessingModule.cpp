@@ -35,6 +35,9 @@ class OSGPPU_CUDAK_EXPORT ProcessingModule : public UnitInOutModule::Module
             parent->setUsePBOForInputTexture(0, true);
             parent->setUsePBOForOutputTexture(0, true);
 
+            // process the previous frame, while the current one is transferred
+            parent->setNumPBOBuffers(2);
+
             osg::notify(osg::INFO) << "osgPPU - Module - cudaKernel initialize" << std::endl;
         }
 
@@ -0,0 +1,231 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgViewer/CompositeViewer>
+#include <osgGA/TrackballManipulator>
+#include <osgDB/ReadFile>
+#include <osg/Texture2D>
+#include <osg/ShapeDrawable>
+#include <osg/Geode>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+
+#include <osgPPU/Processor.h>
+#include <osgPPU/UnitCameraAttachmentBypass.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/ShaderAttribute.h>
+
+#include <iostream>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Shader which is used by every view, it just darkens the input a little bit
+//------------------------------------------------------------------------------
+const char* darkenShaderSrc =
+    "uniform sampler2D texUnit0;\n"
+    "void main()\n"
+    "{\n"
+    "   gl_FragColor = texture2D(texUnit0, gl_TexCoord[0].st) * 0.8;\n"
+    "}\n";
+
+//------------------------------------------------------------------------------
+// Count how often a unit was drawn. Every unit has to be drawn exactly once per
+// frame, regardless of how many cull threads traverse its processor.
+//------------------------------------------------------------------------------
+struct CountDrawsCallback : public osgPPU::Unit::NotifyCallback
+{
+    CountDrawsCallback() : count(0) {}
+
+    void operator()(osg::RenderInfo&, const osgPPU::Unit*) const { ++count; }
+
+    mutable OpenThreads::Atomic count;
+};
+
+typedef std::vector<std::pair<const osgPPU::Unit*, osg::ref_ptr<CountDrawsCallback> > > DrawCounters;
+
+//------------------------------------------------------------------------------
+// Create camera resulting texture
+//------------------------------------------------------------------------------
+osg::Texture* createRenderTexture(int tex_width, int tex_height, bool depth)
+{
+    osg::Texture2D* texture2D = new osg::Texture2D;
+    texture2D->setTextureSize(tex_width, tex_height);
+    texture2D->setResizeNonPowerOfTwoHint(false);
+    texture2D->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::LINEAR);
+    texture2D->setWrap(osg::Texture2D::WRAP_S,osg::Texture2D::CLAMP_TO_EDGE);
+    texture2D->setWrap(osg::Texture2D::WRAP_T,osg::Texture2D::CLAMP_TO_EDGE);
+
+    if (!depth)
+    {
+        texture2D->setInternalFormat(GL_RGBA);
+    }else{
+        texture2D->setInternalFormat(GL_DEPTH_COMPONENT);
+    }
+
+    return texture2D;
+}
+
+//------------------------------------------------------------------------------
+// Setup the camera of a view to render into textures and create a pipeline for it.
+// Every view gets its own processor, however all processors are placed in the same
+// scene graph, hence every cull thread traverses all of them.
+//------------------------------------------------------------------------------
+osgPPU::Processor* setupView(osg::Camera* camera, osgPPU::ShaderAttribute* shader, DrawCounters& counters)
+{
+    osg::Viewport* vp = camera->getViewport();
+
+    camera->setClearColor(osg::Vec4(0.0f,0.0f,0.0f,0.0f));
+    camera->setClearMask(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+    camera->setProjectionMatrixAsPerspective(35.0, vp->width()/vp->height(), 0.01, 100.0);
+    camera->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+    camera->attach(osg::Camera::COLOR_BUFFER, createRenderTexture((int)vp->width(), (int)vp->height(), false));
+    camera->attach(osg::Camera::DEPTH_BUFFER, createRenderTexture((int)vp->width(), (int)vp->height(), true));
+
+    osgPPU::Processor* processor = new osgPPU::Processor();
+    processor->setCamera(camera);
+
+    osgPPU::UnitCameraAttachmentBypass* unitCam = new osgPPU::UnitCameraAttachmentBypass();
+    unitCam->setBufferComponent(osg::Camera::COLOR_BUFFER);
+    unitCam->setName("ColorBypass");
+    processor->addChild(unitCam);
+
+    osgPPU::UnitInOut* darken = new osgPPU::UnitInOut();
+    darken->setName("Darken");
+    darken->getOrCreateStateSet()->setAttributeAndModes(shader);
+    unitCam->addChild(darken);
+
+    osgPPU::UnitOut* unitOut = new osgPPU::UnitOut();
+    unitOut->setName("Output");
+    unitOut->setInputTextureIndexForViewportReference(-1);
+    darken->addChild(unitOut);
+
+    // count the draws of the units rendering something
+    osgPPU::Unit* drawn[] = {darken, unitOut};
+    for (unsigned i=0; i < 2; i++)
+    {
+        CountDrawsCallback* counter = new CountDrawsCallback();
+        drawn[i]->setEndDrawCallback(counter);
+        counters.push_back(DrawCounters::value_type(drawn[i], counter));
+    }
+
+    return processor;
+}
+
+//------------------------------------------------------------------------------
+// Main code
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName() + " renders the same scene in several views, each with its own osgPPU pipeline. The views are culled in parallel.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName() + " [options] [osgfile]");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--views <n>", "Number of views to create [default 4]");
+    arguments.getApplicationUsage()->addCommandLineOption("--frames <n>", "Quit after the given number of frames, 0 runs until the viewer is closed [default 0]");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout);
+        return 1;
+    }
+
+    unsigned numViews = 4;
+    unsigned numFrames = 0;
+    while (arguments.read("--views", numViews)) {}
+    while (arguments.read("--frames", numFrames)) {}
+    if (numViews == 0) numViews = 1;
+
+    // setup scene shared by all views
+    osg::ref_ptr<osg::Node> model = arguments.argc() > 1 ? osgDB::readNodeFile(arguments[1]) : NULL;
+    if (!model.valid())
+    {
+        osg::Geode* geode = new osg::Geode();
+        geode->addDrawable(new osg::ShapeDrawable(new osg::Box(osg::Vec3(0,0,0), 1.0f)));
+        model = geode;
+    }
+
+    osg::ref_ptr<osg::Group> root = new osg::Group();
+    root->addChild(model.get());
+
+    // the shader is shared between all pipelines
+    osgPPU::ShaderAttribute* shader = new osgPPU::ShaderAttribute();
+    {
+        osg::Shader* fpShader = new osg::Shader(osg::Shader::FRAGMENT);
+        fpShader->setShaderSource(darkenShaderSrc);
+        shader->addShader(fpShader);
+        shader->setName("DarkenShader");
+        shader->add("texUnit0", osg::Uniform::SAMPLER_2D);
+        shader->set("texUnit0", 0);
+    }
+
+    // every view gets its own window and its own camera, hence its own cull thread
+    osgViewer::CompositeViewer viewer(arguments);
+    viewer.setThreadingModel(osgViewer::CompositeViewer::CullThreadPerCameraDrawThreadPerContext);
+
+    unsigned windowWidth = 320;
+    unsigned windowHeight = 240;
+    unsigned columns = 1;
+    while (columns * columns < numViews) columns++;
+
+    DrawCounters counters;
+
+    for (unsigned i=0; i < numViews; i++)
+    {
+        osgViewer::View* view = new osgViewer::View();
+        view->setUpViewInWindow(50 + (i % columns) * (windowWidth + 10), 50 + (i / columns) * (windowHeight + 30), windowWidth, windowHeight);
+        view->setCameraManipulator(new osgGA::TrackballManipulator());
+
+        root->addChild(setupView(view->getCamera(), shader, counters));
+        view->setSceneData(root.get());
+
+        viewer.addView(view);
+    }
+
+    viewer.realize();
+
+    // run the viewer and report the mean frame time
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    unsigned frame = 0;
+    while (!viewer.done() && (numFrames == 0 || frame < numFrames))
+    {
+        viewer.frame();
+        frame++;
+    }
+    double elapsed = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+    // wait until the draw threads have finished the last frame
+    viewer.stopThreading();
+
+    if (frame)
+        std::cout << numViews << " views, " << frame << " frames, " << (elapsed * 1000.0 / frame) << " ms per frame" << std::endl;
+
+    // every unit must have been executed once per frame, neither skipped nor executed by several threads
+    bool valid = true;
+    for (DrawCounters::const_iterator it = counters.begin(); it != counters.end(); it++)
+    {
+        unsigned count = it->second->count;
+        if (count == frame) continue;
+
+        std::cout << "ERROR: unit " << it->first->getName() << " was executed " << count << " times in " << frame << " frames" << std::endl;
+        valid = false;
+    }
+
+    return valid ? 0 : 1;
+}
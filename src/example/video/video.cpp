@@ -18,7 +18,10 @@
 #include <osgPPU/UnitTexture.h>
 #include <osgPPU/ShaderAttribute.h>
 
+#include <OpenThreads/Thread>
+
 #include <iostream>
+#include <string.h>
 
 
 //
@@ -82,6 +85,47 @@ osg::Drawable* createSquare(float textureCoordMax=1.0f)
 }
 
 
+//--------------------------------------------------------------------------
+// Thread feeding the frames of the video into the streaming unit. A decoder
+// would decode directly into the acquired memory, here the frames are copied.
+//--------------------------------------------------------------------------
+class StreamProducer : public OpenThreads::Thread
+{
+public:
+    StreamProducer(osg::Image* video, osgPPU::UnitTexture* unit) : _video(video), _unit(unit), _done(false) {}
+
+    void stop()
+    {
+        _done = true;
+        join();
+    }
+
+    virtual void run()
+    {
+        unsigned int modified = 0;
+        while (!_done)
+        {
+            if (_video->getModifiedCount() == modified)
+            {
+                OpenThreads::Thread::microSleep(1000);
+                continue;
+            }
+            modified = _video->getModifiedCount();
+
+            // the frame is skipped, if all buffers are in use
+            void* frame = _unit->acquireFrame();
+            if (!frame) continue;
+            memcpy(frame, _video->data(), osg::minimum(_video->getTotalSizeInBytes(), _unit->getStreamFrameSize()));
+            _unit->publishFrame(frame);
+        }
+    }
+
+private:
+    osg::ref_ptr<osg::Image> _video;
+    osg::ref_ptr<osgPPU::UnitTexture> _unit;
+    volatile bool _done;
+};
+
 //--------------------------------------------------------------------------
 // Event handler to react on user input
 //--------------------------------------------------------------------------
@@ -117,8 +161,11 @@ public:
 
 
 //--------------------------------------------------------------------------
-int main(int , char **)
+int main(int argc, char **argv)
 {
+    // with --stream the frames are uploaded by the streaming mode of the UnitTexture
+    bool streaming = argc > 1 && std::string(argv[1]) == "--stream";
+
     // construct the viewer.
     osg::ref_ptr<osgViewer::Viewer> viewer = new osgViewer::Viewer();
 
@@ -166,7 +213,22 @@ int main(int , char **)
 
     // create osgPPU's units and processor
     osgPPU::Processor* processor = new osgPPU::Processor();
-    osgPPU::UnitTexture* unitTexture = new osgPPU::UnitTexture(gVideoTexture);
+    osgPPU::UnitTexture* unitTexture = NULL;
+    StreamProducer* producer = NULL;
+    if (streaming)
+    {
+        osg::Texture2D* streamTexture = new osg::Texture2D();
+        streamTexture->setTextureSize(image->s(), image->t());
+        streamTexture->setInternalFormat(GL_RGBA);
+        streamTexture->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::LINEAR);
+        streamTexture->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::LINEAR);
+
+        unitTexture = new osgPPU::UnitTexture(streamTexture);
+        unitTexture->setStreaming(3, image->getPixelFormat(), image->getDataType());
+        producer = new StreamProducer(image.get(), unitTexture);
+        producer->start();
+    }else
+        unitTexture = new osgPPU::UnitTexture(gVideoTexture);
     osgPPU::UnitInOut* unitInOut = new osgPPU::UnitInOut();
 
     // create a processing shader, this will process the given image and output to the output texture
@@ -197,6 +259,7 @@ int main(int , char **)
 
     // give some info to the console
     printf("video (Play the video found under Data/Images/video.avi)\n");
+    printf("Run with --stream to upload the frames by a producer thread\n");
     printf("Keys:\n");
     printf("\tF1 - Show original input\n");
     printf("\tF2 - Show postprocessed video\n");
@@ -205,5 +268,11 @@ int main(int , char **)
     viewer->addEventHandler(new KeyboardEventHandler());
 
     // run viewer
-    return viewer->run();
+    int result = viewer->run();
+    if (producer)
+    {
+        producer->stop();
+        delete producer;
+    }
+    return result;
 }
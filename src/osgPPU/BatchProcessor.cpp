@@ -0,0 +1,539 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/BatchProcessor.h>
+#include <osgPPU/Fence.h>
+
+#include <osg/Texture2D>
+#include <osg/BufferObject>
+#include <osg/Timer>
+#include <osg/Notify>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osgViewer/Viewer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <deque>
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// Queue between two threads, which blocks if it is full or empty
+//------------------------------------------------------------------------------
+template<class T> class BoundedQueue
+{
+    public:
+        BoundedQueue(unsigned int capacity) : mCapacity(capacity), mClosed(false) {}
+
+        //! Add an item, wait while the queue is full. Returns false if the queue was closed.
+        bool push(const T& item)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            while (!mClosed && mItems.size() >= mCapacity) mNotFull.wait(&mMutex);
+            if (mClosed) return false;
+
+            mItems.push_back(item);
+            mNotEmpty.signal();
+            return true;
+        }
+
+        //! Remove the first item, wait while the queue is empty. Returns false if the queue is closed and empty.
+        bool pop(T& item)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            while (!mClosed && mItems.empty()) mNotEmpty.wait(&mMutex);
+            if (mItems.empty()) return false;
+
+            item = mItems.front();
+            mItems.pop_front();
+            mNotFull.signal();
+            return true;
+        }
+
+        //! No more items are added, waiting threads are woken up
+        void close()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            mClosed = true;
+            mNotEmpty.broadcast();
+            mNotFull.broadcast();
+        }
+
+    private:
+        OpenThreads::Mutex mMutex;
+        OpenThreads::Condition mNotEmpty;
+        OpenThreads::Condition mNotFull;
+        std::deque<T> mItems;
+        unsigned int mCapacity;
+        bool mClosed;
+};
+
+typedef BoundedQueue<osg::ref_ptr<osg::Image> > ImageQueue;
+typedef BoundedQueue<std::pair<unsigned int, osg::ref_ptr<osg::Image> > > FrameQueue;
+
+//------------------------------------------------------------------------------
+// Thread reading the images of the source
+//------------------------------------------------------------------------------
+class DecodeThread : public OpenThreads::Thread
+{
+    public:
+        DecodeThread(BatchProcessor::Source* source, ImageQueue& queue) : _source(source), _queue(queue) {}
+
+        void run()
+        {
+            while (true)
+            {
+                osg::ref_ptr<osg::Image> image = _source->read();
+                if (!image.valid() || !_queue.push(image)) break;
+            }
+            _queue.close();
+        }
+
+    private:
+        osg::ref_ptr<BatchProcessor::Source> _source;
+        ImageQueue& _queue;
+};
+
+//------------------------------------------------------------------------------
+// Thread passing the read back images to the sink
+//------------------------------------------------------------------------------
+class EncodeThread : public OpenThreads::Thread
+{
+    public:
+        EncodeThread(BatchProcessor::Sink* sink, FrameQueue& queue) : _sink(sink), _queue(queue), _numFrames(0), _numFailed(0) {}
+
+        void run()
+        {
+            std::pair<unsigned int, osg::ref_ptr<osg::Image> > frame;
+            while (_queue.pop(frame))
+            {
+                bool success = _sink->write(frame.first, frame.second.get());
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                _numFrames++;
+                if (!success) _numFailed++;
+            }
+        }
+
+        void getCounters(unsigned int& numFrames, unsigned int& numFailed)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            numFrames = _numFrames;
+            numFailed = _numFailed;
+        }
+
+    private:
+        osg::ref_ptr<BatchProcessor::Sink> _sink;
+        FrameQueue& _queue;
+        OpenThreads::Mutex _mutex;
+        unsigned int _numFrames;
+        unsigned int _numFailed;
+};
+
+//------------------------------------------------------------------------------
+// Transfers of the images between host and GPU, executed in the draw traversal
+//------------------------------------------------------------------------------
+class BatchTransfer : public osg::Referenced
+{
+    public:
+        BatchTransfer(osg::Texture* input, Unit* output, int mrt, GLenum format, GLenum type, unsigned int numUploads, unsigned int numReadbacks, FrameQueue& queue) :
+            mInput(input), mOutput(output), mOutputIndex(mrt), mFormat(format), mType(type),
+            mUploads(new PixelBufferRing(GL_PIXEL_UNPACK_BUFFER_ARB, GL_STREAM_DRAW_ARB)), mNumUploads(numUploads),
+            mReadbacks(new PixelBufferRing(GL_PIXEL_PACK_BUFFER_ARB, GL_STREAM_READ_ARB)), mFrames(numReadbacks), mNextRetire(0),
+            mQueue(queue), mFrame(0), mNumStalls(0), mUploaded(false)
+        {
+        }
+
+        //! Set image uploaded in the next frame
+        inline void setImage(osg::Image* image) { mImage = image; }
+
+        //! Get number of times a buffer was reused before the GPU was done with it
+        inline unsigned int getNumStalls() const { return mNumStalls; }
+
+        //! Copy the image into the input texture
+        void upload(osg::RenderInfo& renderInfo)
+        {
+            mUploaded = false;
+            if (!mImage.valid()) return;
+
+            osg::State& state = *renderInfo.getState();
+            unsigned int contextID = state.getContextID();
+
+            // the texture is allocated by its first apply
+            state.applyTextureAttribute(0, mInput.get());
+            if (!mInput->getTextureObject(contextID)) return;
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, mImage->getPacking());
+
+            osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+            if (ext && ext->isPBOSupported())
+            {
+                // the buffer is written, after the GPU has copied the image uploaded through it before
+                mUploads->resize(contextID, mNumUploads);
+                unsigned int index = mUploads->advance();
+                if (mUploads->getFence(index)->wait()) mNumStalls++;
+
+                unsigned int size = mImage->getTotalSizeInBytes();
+                mUploads->bind(index, size);
+                void* data = mUploads->map(index, GL_WRITE_ONLY_ARB);
+                if (data)
+                {
+                    memcpy(data, mImage->data(), size);
+                    mUploads->unmap(index);
+                    mUploads->bind(index, size);
+                    glTexSubImage2D(mInput->getTextureTarget(), 0, 0, 0, mImage->s(), mImage->t(), mImage->getPixelFormat(), mImage->getDataType(), NULL);
+                }
+                mUploads->unbind();
+                mUploads->insertFence(index);
+            }else
+            {
+                glTexSubImage2D(mInput->getTextureTarget(), 0, 0, 0, mImage->s(), mImage->t(), mImage->getPixelFormat(), mImage->getDataType(), mImage->data());
+            }
+
+            mImage = NULL;
+            mUploaded = true;
+        }
+
+        //! Start to read back the output texture
+        void readback(osg::RenderInfo& renderInfo)
+        {
+            if (!mUploaded) return;
+            mUploaded = false;
+
+            osg::Texture* texture = mOutput->getOutputTexture(mOutputIndex);
+            if (!texture) return;
+
+            osg::State& state = *renderInfo.getState();
+            unsigned int contextID = state.getContextID();
+            state.applyTextureAttribute(0, texture);
+
+            int width = texture->getTextureWidth();
+            int height = texture->getTextureHeight();
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+            osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+            if (ext && ext->isPBOSupported())
+            {
+                // if all buffers are in flight, then the oldest frame has to be finished first
+                mReadbacks->resize(contextID, mFrames.size());
+                unsigned int index = mReadbacks->advance();
+                Frame& frame = mFrames[index];
+                if (frame.pending) retire(true);
+
+                unsigned int size = osg::Image::computeRowWidthInBytes(width, mFormat, mType, 1) * height;
+                mReadbacks->bind(index, size);
+                glGetTexImage(texture->getTextureTarget(), 0, mFormat, mType, NULL);
+                mReadbacks->unbind();
+                mReadbacks->insertFence(index);
+
+                frame.pending = true;
+                frame.number = mFrame++;
+                frame.width = width;
+                frame.height = height;
+
+                // pass all finished frames without waiting
+                while (mFrames[mNextRetire].pending && mReadbacks->getFence(mNextRetire)->isSignaled())
+                    retire(false);
+            }else
+            {
+                osg::ref_ptr<osg::Image> image = new osg::Image();
+                image->allocateImage(width, height, 1, mFormat, mType, 1);
+                glGetTexImage(texture->getTextureTarget(), 0, mFormat, mType, image->data());
+                mQueue.push(std::pair<unsigned int, osg::ref_ptr<osg::Image> >(mFrame++, image));
+            }
+        }
+
+        //! Pass all frames in flight and release the GL objects, the context must be current
+        void finish(osg::State& state)
+        {
+            while (mFrames[mNextRetire].pending) retire(true);
+
+            mUploads->release();
+            mReadbacks->release();
+            mNextRetire = 0;
+        }
+
+    protected:
+        //! Frame read back into a buffer of the ring
+        struct Frame
+        {
+            Frame() : pending(false), number(0), width(0), height(0) {}
+
+            //! Set while a read back image was not passed to the sink
+            bool pending;
+
+            //! Number of the frame
+            unsigned int number;
+
+            //! Size of the image read back into the buffer
+            int width, height;
+        };
+
+        //! Pass the oldest frame in flight to the encoding thread
+        void retire(bool wait)
+        {
+            unsigned int index = mNextRetire;
+            Frame& frame = mFrames[index];
+            mNextRetire = (mNextRetire + 1) % mFrames.size();
+            if (wait && mReadbacks->getFence(index)->wait()) mNumStalls++;
+
+            osg::ref_ptr<osg::Image> image = new osg::Image();
+            image->allocateImage(frame.width, frame.height, 1, mFormat, mType, 1);
+
+            void* data = mReadbacks->map(index, GL_READ_ONLY_ARB);
+            if (data)
+            {
+                memcpy(image->data(), data, image->getTotalSizeInBytes());
+                mReadbacks->unmap(index);
+            }
+            frame.pending = false;
+
+            if (data) mQueue.push(std::pair<unsigned int, osg::ref_ptr<osg::Image> >(frame.number, image));
+        }
+
+        osg::ref_ptr<osg::Texture> mInput;
+        osg::ref_ptr<Unit> mOutput;
+        int mOutputIndex;
+        GLenum mFormat;
+        GLenum mType;
+        osg::ref_ptr<osg::Image> mImage;
+        osg::ref_ptr<PixelBufferRing> mUploads;
+        unsigned int mNumUploads;
+        osg::ref_ptr<PixelBufferRing> mReadbacks;
+        std::vector<Frame> mFrames;
+        unsigned int mNextRetire;
+        FrameQueue& mQueue;
+        unsigned int mFrame;
+        unsigned int mNumStalls;
+        bool mUploaded;
+};
+
+//------------------------------------------------------------------------------
+struct UploadCallback : public osg::Camera::DrawCallback
+{
+    UploadCallback(BatchTransfer* transfer) : _transfer(transfer) {}
+    void operator () (osg::RenderInfo& renderInfo) const { _transfer->upload(renderInfo); }
+    osg::ref_ptr<BatchTransfer> _transfer;
+};
+
+//------------------------------------------------------------------------------
+struct ReadbackCallback : public osg::Camera::DrawCallback
+{
+    ReadbackCallback(BatchTransfer* transfer) : _transfer(transfer) {}
+    void operator () (osg::RenderInfo& renderInfo) const { _transfer->readback(renderInfo); }
+    osg::ref_ptr<BatchTransfer> _transfer;
+};
+
+//------------------------------------------------------------------------------
+BatchProcessor::ImageFileSource* BatchProcessor::ImageFileSource::createFromDirectory(const std::string& directory, const std::string& extension)
+{
+    std::vector<std::string> files;
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(directory);
+    for (osgDB::DirectoryContents::const_iterator it = contents.begin(); it != contents.end(); it++)
+    {
+        if (osgDB::getLowerCaseFileExtension(*it) == extension)
+            files.push_back(osgDB::concatPaths(directory, *it));
+    }
+    std::sort(files.begin(), files.end());
+
+    return new ImageFileSource(files);
+}
+
+//------------------------------------------------------------------------------
+osg::Image* BatchProcessor::ImageFileSource::read()
+{
+    while (mNext < mFiles.size())
+    {
+        const std::string& file = mFiles[mNext++];
+        osg::Image* image = osgDB::readImageFile(file);
+        if (image) return image;
+
+        osg::notify(osg::WARN) << "osgPPU::BatchProcessor::ImageFileSource - cannot read " << file << std::endl;
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+bool BatchProcessor::ImageFileSink::write(unsigned int frame, osg::Image* image)
+{
+    std::ostringstream filename;
+    filename << mPath << "/" << mPrefix << std::setw(4) << std::setfill('0') << frame << "." << mExtension;
+
+    if (osgDB::writeImageFile(*image, filename.str())) return true;
+
+    osg::notify(osg::WARN) << "osgPPU::BatchProcessor::ImageFileSink - cannot write " << filename.str() << std::endl;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+BatchProcessor::BatchProcessor(Processor* processor, UnitTexture* input, Unit* output, int mrt) : osg::Referenced(),
+    mProcessor(processor),
+    mInput(input),
+    mOutput(output),
+    mOutputIndex(mrt),
+    mNumUploadBuffers(2),
+    mNumFramesInFlight(3),
+    mOutputFormat(GL_RGBA),
+    mOutputType(GL_UNSIGNED_BYTE),
+    mReportInterval(5.0)
+{
+}
+
+//------------------------------------------------------------------------------
+BatchProcessor::~BatchProcessor()
+{
+}
+
+//------------------------------------------------------------------------------
+bool BatchProcessor::run(Source* source, Sink* sink)
+{
+    mStatistics = Statistics();
+    if (!source || !sink || !mProcessor.valid() || !mInput.valid() || !mOutput.valid())
+    {
+        osg::notify(osg::WARN) << "osgPPU::BatchProcessor::run() - no source, sink, processor, input or output unit specified" << std::endl;
+        return false;
+    }
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // images are decoded while the previous ones are processed
+    ImageQueue images(mNumUploadBuffers);
+    DecodeThread decoder(source, images);
+    decoder.start();
+
+    osg::ref_ptr<osg::Image> image;
+    if (!images.pop(image))
+    {
+        decoder.join();
+        osg::notify(osg::WARN) << "osgPPU::BatchProcessor::run() - source does not provide any image" << std::endl;
+        return false;
+    }
+    int width = image->s();
+    int height = image->t();
+
+    // the images are copied into this texture, hence it has the format of the images
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D();
+    texture->setTextureSize(width, height);
+    texture->setInternalFormat(image->getInternalTextureFormat());
+    texture->setSourceFormat(image->getPixelFormat());
+    texture->setSourceType(image->getDataType());
+    texture->setResizeNonPowerOfTwoHint(false);
+    texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    mInput->setTexture(texture.get());
+
+    // render offscreen, if no context is given
+    if (!mGraphicsContext.valid())
+    {
+        osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits;
+        traits->width = width;
+        traits->height = height;
+        traits->windowDecoration = false;
+        traits->doubleBuffer = false;
+        traits->pbuffer = true;
+        traits->alpha = 8;
+        mGraphicsContext = osg::GraphicsContext::createGraphicsContext(traits.get());
+    }
+    if (!mGraphicsContext.valid())
+    {
+        images.close();
+        decoder.join();
+        osg::notify(osg::FATAL) << "osgPPU::BatchProcessor::run() - cannot create an offscreen context" << std::endl;
+        return false;
+    }
+
+    FrameQueue frames(mNumFramesInFlight);
+    osg::ref_ptr<BatchTransfer> transfer = new BatchTransfer(texture.get(), mOutput.get(), mOutputIndex, mOutputFormat, mOutputType, mNumUploadBuffers, mNumFramesInFlight, frames);
+
+    // the viewer does only render the processor, everything runs in this thread
+    osg::ref_ptr<osgViewer::Viewer> viewer = new osgViewer::Viewer();
+    viewer->setThreadingModel(osgViewer::Viewer::SingleThreaded);
+
+    osg::Camera* camera = viewer->getCamera();
+    camera->setGraphicsContext(mGraphicsContext.get());
+    camera->setViewport(new osg::Viewport(0, 0, width, height));
+    camera->setDrawBuffer(GL_FRONT);
+    camera->setReadBuffer(GL_FRONT);
+    camera->setClearMask(0);
+    camera->setPreDrawCallback(new UploadCallback(transfer.get()));
+    camera->setFinalDrawCallback(new ReadbackCallback(transfer.get()));
+    if (!mProcessor->getCamera()) mProcessor->setCamera(camera);
+
+    viewer->setSceneData(mProcessor.get());
+    viewer->realize();
+
+    EncodeThread encoder(sink, frames);
+    encoder.start();
+
+    osg::Timer_t lastReport = osg::Timer::instance()->tick();
+    while (image.valid())
+    {
+        if (image->s() != width || image->t() != height)
+        {
+            osg::notify(osg::WARN) << "osgPPU::BatchProcessor::run() - image " << image->getFileName() << " is skipped, since its size differs from the first image" << std::endl;
+            mStatistics.numSkipped++;
+        }else
+        {
+            transfer->setImage(image.get());
+            viewer->frame();
+        }
+
+        if (mReportInterval > 0.0 && osg::Timer::instance()->delta_s(lastReport, osg::Timer::instance()->tick()) >= mReportInterval)
+        {
+            lastReport = osg::Timer::instance()->tick();
+            encoder.getCounters(mStatistics.numFrames, mStatistics.numFailed);
+            mStatistics.seconds = osg::Timer::instance()->delta_s(start, lastReport);
+            osg::notify(osg::NOTICE) << "osgPPU::BatchProcessor - " << mStatistics.numFrames << " frames, " << mStatistics.getFramesPerSecond() << " fps" << std::endl;
+        }
+
+        image = NULL;
+        images.pop(image);
+    }
+    decoder.join();
+
+    // wait for the frames in flight
+    if (mGraphicsContext->makeCurrent())
+    {
+        transfer->finish(*mGraphicsContext->getState());
+        mGraphicsContext->releaseContext();
+    }
+    frames.close();
+    encoder.join();
+
+    camera->setPreDrawCallback(NULL);
+    camera->setFinalDrawCallback(NULL);
+
+    encoder.getCounters(mStatistics.numFrames, mStatistics.numFailed);
+    mStatistics.numStalls = transfer->getNumStalls();
+    mStatistics.seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+    if (mReportInterval > 0.0)
+        osg::notify(osg::NOTICE) << "osgPPU::BatchProcessor - processed " << mStatistics.numFrames << " frames in " << mStatistics.seconds << " s, " << mStatistics.getFramesPerSecond() << " fps" << std::endl;
+
+    return mStatistics.numFrames > 0 && mStatistics.numFailed == 0;
+}
+
+}; //end namespace
@@ -0,0 +1,1121 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/CPUExecutor.h>
+#include <osgPPU/ShaderAttribute.h>
+#include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitInMipmapOut.h>
+#include <osgPPU/UnitInOutRepeat.h>
+
+#include <osg/Notify>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <math.h>
+#include <string.h>
+
+// SSE is used for the pixel arithmetic whenever the compiler provides it
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define OSGPPU_CPU_SSE
+    #include <xmmintrin.h>
+#endif
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// RGBA float value, which is processed as a whole
+//------------------------------------------------------------------------------
+struct Pixel
+{
+#ifdef OSGPPU_CPU_SSE
+    __m128 v;
+
+    inline Pixel() : v(_mm_setzero_ps()) {}
+    inline Pixel(__m128 x) : v(x) {}
+    inline Pixel(float r, float g, float b, float a) : v(_mm_setr_ps(r, g, b, a)) {}
+
+    static inline Pixel load(const float* p) { return Pixel(_mm_loadu_ps(p)); }
+    inline void store(float* p) const { _mm_storeu_ps(p, v); }
+
+    inline Pixel operator+(const Pixel& p) const { return Pixel(_mm_add_ps(v, p.v)); }
+    inline Pixel operator-(const Pixel& p) const { return Pixel(_mm_sub_ps(v, p.v)); }
+    inline Pixel operator*(const Pixel& p) const { return Pixel(_mm_mul_ps(v, p.v)); }
+    inline Pixel operator/(const Pixel& p) const { return Pixel(_mm_div_ps(v, p.v)); }
+    inline Pixel operator*(float s) const { return Pixel(_mm_mul_ps(v, _mm_set1_ps(s))); }
+    inline Pixel max(const Pixel& p) const { return Pixel(_mm_max_ps(v, p.v)); }
+#else
+    float v[4];
+
+    inline Pixel() { v[0] = v[1] = v[2] = v[3] = 0.0f; }
+    inline Pixel(float r, float g, float b, float a) { v[0] = r; v[1] = g; v[2] = b; v[3] = a; }
+
+    static inline Pixel load(const float* p) { return Pixel(p[0], p[1], p[2], p[3]); }
+    inline void store(float* p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+
+    inline Pixel operator+(const Pixel& p) const { return Pixel(v[0] + p.v[0], v[1] + p.v[1], v[2] + p.v[2], v[3] + p.v[3]); }
+    inline Pixel operator-(const Pixel& p) const { return Pixel(v[0] - p.v[0], v[1] - p.v[1], v[2] - p.v[2], v[3] - p.v[3]); }
+    inline Pixel operator*(const Pixel& p) const { return Pixel(v[0] * p.v[0], v[1] * p.v[1], v[2] * p.v[2], v[3] * p.v[3]); }
+    inline Pixel operator/(const Pixel& p) const { return Pixel(v[0] / p.v[0], v[1] / p.v[1], v[2] / p.v[2], v[3] / p.v[3]); }
+    inline Pixel operator*(float s) const { return Pixel(v[0] * s, v[1] * s, v[2] * s, v[3] * s); }
+    inline Pixel max(const Pixel& p) const { return Pixel(osg::maximum(v[0], p.v[0]), osg::maximum(v[1], p.v[1]), osg::maximum(v[2], p.v[2]), osg::maximum(v[3], p.v[3])); }
+#endif
+
+    inline osg::Vec4 toVec4() const { float f[4]; store(f); return osg::Vec4(f[0], f[1], f[2], f[3]); }
+};
+
+//------------------------------------------------------------------------------
+static inline const float* getTexel(const osg::Image* image, int x, int y)
+{
+    x = osg::clampBetween(x, 0, image->s() - 1);
+    y = osg::clampBetween(y, 0, image->t() - 1);
+    return reinterpret_cast<const float*>(image->data()) + (y * image->s() + x) * 4;
+}
+
+//------------------------------------------------------------------------------
+static inline float* getRow(osg::Image* image, int y)
+{
+    return reinterpret_cast<float*>(image->data()) + y * image->s() * 4;
+}
+
+//------------------------------------------------------------------------------
+static inline Pixel samplePixel(const osg::Image* image, float s, float t, bool nearest)
+{
+    if (nearest)
+        return Pixel::load(getTexel(image, (int)floorf(s * image->s()), (int)floorf(t * image->t())));
+
+    // texel centers are at half integer coordinates
+    float u = s * image->s() - 0.5f;
+    float v = t * image->t() - 0.5f;
+    float x0 = floorf(u);
+    float y0 = floorf(v);
+    float fx = u - x0;
+    float fy = v - y0;
+
+    Pixel a = Pixel::load(getTexel(image, (int)x0, (int)y0));
+    Pixel b = Pixel::load(getTexel(image, (int)x0 + 1, (int)y0));
+    Pixel c = Pixel::load(getTexel(image, (int)x0, (int)y0 + 1));
+    Pixel d = Pixel::load(getTexel(image, (int)x0 + 1, (int)y0 + 1));
+
+    Pixel bottom = a + (b - a) * fx;
+    Pixel top = c + (d - c) * fx;
+    return bottom + (top - bottom) * fy;
+}
+
+//------------------------------------------------------------------------------
+static osg::Image* createImage(int width, int height)
+{
+    osg::Image* image = new osg::Image();
+    image->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+    memset(image->data(), 0, image->getTotalSizeInBytes());
+    return image;
+}
+
+//------------------------------------------------------------------------------
+static int computeNumLevels(int width, int height)
+{
+    int size = osg::maximum(width, height);
+    int levels = 1;
+    while (size > 1)
+    {
+        size /= 2;
+        levels++;
+    }
+    return levels;
+}
+
+//------------------------------------------------------------------------------
+// Reads the pixels of an input for the pixels of the output. If the input is of the
+// output size the texels are read directly, otherwise the input is sampled.
+//------------------------------------------------------------------------------
+class InputReader
+{
+    public:
+        InputReader(const CPUExecutor::Context& context, int index, int width, int height, int level = 0) :
+            mContext(context), mIndex(index), mLevel(level),
+            mImage(context.getInput(index, level)),
+            mInvWidth(1.0f / width), mInvHeight(1.0f / height)
+        {
+            mDirect = mImage && mImage->s() == width && mImage->t() == height;
+        }
+
+        inline bool valid() const { return mImage != NULL; }
+
+        inline Pixel operator()(int x, int y) const
+        {
+            if (mDirect) return Pixel::load(getTexel(mImage, x, y));
+            if (!mImage) return Pixel();
+
+            osg::Vec4 c = mContext.sample(mIndex, (x + 0.5f) * mInvWidth, (y + 0.5f) * mInvHeight, mLevel);
+            return Pixel(c.x(), c.y(), c.z(), c.w());
+        }
+
+    private:
+        const CPUExecutor::Context& mContext;
+        int mIndex, mLevel;
+        const osg::Image* mImage;
+        float mInvWidth, mInvHeight;
+        bool mDirect;
+};
+
+//------------------------------------------------------------------------------
+// Pool of threads processing the tiles of an output
+//------------------------------------------------------------------------------
+class CPUThreadPool : public osg::Referenced
+{
+    public:
+        struct Task
+        {
+            virtual ~Task() {}
+            virtual void operator()(int x0, int y0, int x1, int y1) const = 0;
+        };
+
+        CPUThreadPool(unsigned int numThreads) :
+            mTask(NULL), mNext(0), mPending(0), mGeneration(0), mQuit(false)
+        {
+            // the calling thread does work too
+            for (unsigned int i=1; i < numThreads; i++)
+            {
+                Worker* worker = new Worker(this);
+                mWorkers.push_back(worker);
+                worker->start();
+            }
+        }
+
+        void run(const Task& task, int width, int height, int tileSize)
+        {
+            std::vector<Tile> tiles;
+            for (int y=0; y < height; y += tileSize)
+                for (int x=0; x < width; x += tileSize)
+                    tiles.push_back(Tile(x, y, osg::minimum(x + tileSize, width), osg::minimum(y + tileSize, height)));
+
+            // small outputs are not worth to wake up the workers
+            if (mWorkers.empty() || tiles.size() == 1)
+            {
+                for (std::vector<Tile>::iterator it = tiles.begin(); it != tiles.end(); it++)
+                    task(it->x0, it->y0, it->x1, it->y1);
+                return;
+            }
+
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                mTask = &task;
+                mTiles.swap(tiles);
+                mNext = 0;
+                mPending = mTiles.size();
+                mGeneration++;
+                mWork.broadcast();
+            }
+
+            work();
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            while (mPending > 0) mDone.wait(&mMutex);
+            mTask = NULL;
+        }
+
+    protected:
+        ~CPUThreadPool()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                mQuit = true;
+                mWork.broadcast();
+            }
+            for (std::vector<Worker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); it++)
+            {
+                (*it)->join();
+                delete *it;
+            }
+        }
+
+        struct Tile
+        {
+            Tile(int ax0 = 0, int ay0 = 0, int ax1 = 0, int ay1 = 0) : x0(ax0), y0(ay0), x1(ax1), y1(ay1) {}
+            int x0, y0, x1, y1;
+        };
+
+        class Worker;
+        friend class Worker;
+
+        class Worker : public OpenThreads::Thread
+        {
+            public:
+                Worker(CPUThreadPool* pool) : _pool(pool) {}
+                virtual void run() { _pool->loop(); }
+            private:
+                CPUThreadPool* _pool;
+        };
+
+        //! Process tiles until all tiles of the current task are taken
+        void work()
+        {
+            while (true)
+            {
+                Tile tile;
+                const Task* task = NULL;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    if (mNext >= mTiles.size()) return;
+                    tile = mTiles[mNext++];
+                    task = mTask;
+                }
+
+                (*task)(tile.x0, tile.y0, tile.x1, tile.y1);
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                if (--mPending == 0) mDone.broadcast();
+            }
+        }
+
+        //! Wait for new tasks
+        void loop()
+        {
+            unsigned int generation = 0;
+            while (true)
+            {
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    while (!mQuit && mGeneration == generation) mWork.wait(&mMutex);
+                    if (mQuit) return;
+                    generation = mGeneration;
+                }
+                work();
+            }
+        }
+
+        std::vector<Worker*> mWorkers;
+        OpenThreads::Mutex mMutex;
+        OpenThreads::Condition mWork;
+        OpenThreads::Condition mDone;
+        const Task* mTask;
+        std::vector<Tile> mTiles;
+        unsigned int mNext;
+        unsigned int mPending;
+        unsigned int mGeneration;
+        bool mQuit;
+};
+
+//------------------------------------------------------------------------------
+struct KernelTask : public CPUThreadPool::Task
+{
+    KernelTask(const CPUExecutor::Kernel& kernel, const CPUExecutor::Context& context) : _kernel(kernel), _context(context) {}
+
+    void operator()(int x0, int y0, int x1, int y1) const
+    {
+        _kernel.compute(_context, x0, y0, x1, y1);
+    }
+
+    const CPUExecutor::Kernel& _kernel;
+    const CPUExecutor::Context& _context;
+};
+
+//------------------------------------------------------------------------------
+// Units without shader render the input 0 to the output
+//------------------------------------------------------------------------------
+class ResampleKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            if (!output) return;
+
+            InputReader input(context, 0, output->s(), output->t());
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                    input(x, y).store(row + x * 4);
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Compute a mipmap level as average of 2x2 texels of the previous level
+//------------------------------------------------------------------------------
+class BoxFilterKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            const osg::Image* input = context.getInput(0, context.getLevel() - 1);
+            if (!output || !input) return;
+
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    Pixel sum = Pixel::load(getTexel(input, 2*x, 2*y)) + Pixel::load(getTexel(input, 2*x + 1, 2*y))
+                              + Pixel::load(getTexel(input, 2*x, 2*y + 1)) + Pixel::load(getTexel(input, 2*x + 1, 2*y + 1));
+                    (sum * 0.25f).store(row + x * 4);
+                }
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Data/glsl/luminance_fp.glsl
+//------------------------------------------------------------------------------
+class LuminanceKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            if (!output) return;
+
+            InputReader input(context, osg::maximum(0, context.getSamplerIndex("texUnit0")), output->s(), output->t());
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    float c[4];
+                    input(x, y).store(c);
+                    float lum = c[0] * 0.2125f + c[1] * 0.7154f + c[2] * 0.0721f;
+                    Pixel(lum, lum, lum, c[3]).store(row + x * 4);
+                }
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Data/glsl/luminance_mipmap_fp.glsl
+//------------------------------------------------------------------------------
+class LuminanceMipmapKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            int level = context.getLevel();
+            const osg::Image* input = context.getInput(0, osg::maximum(0, level - 1));
+            if (!output || !input) return;
+
+            const float epsilon = 0.001f;
+            bool first = level == 1;
+            bool last = context.getNumLevels() - level < 2;
+
+            // the four texels of the previous level, which has twice the size of this level
+            float texelX = 1.0f / (output->s() * 2.0f), texelY = 1.0f / (output->t() * 2.0f);
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    float s = (x + 0.5f) / output->s() - texelX * 0.5f;
+                    float t = (y + 0.5f) / output->t() - texelY * 0.5f;
+
+                    float res = 0.0f;
+                    for (int i=0; i < 4; i++)
+                    {
+                        float si = osg::clampBetween(s + (i & 1) * texelX, 0.0f, 1.0f);
+                        float ti = osg::clampBetween(t + (i >> 1) * texelY, 0.0f, 1.0f);
+                        float c = CPUExecutor::sample(input, si, ti).x();
+                        res += first ? logf(epsilon + c) : c;
+                    }
+                    res *= 0.25f;
+                    if (last) res = expf(res);
+
+                    res = osg::minimum(res, 65504.0f);
+                    Pixel(res, res, res, res).store(row + x * 4);
+                }
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Data/glsl/gauss_convolution_1Dx_fp.glsl and gauss_convolution_1Dy_fp.glsl
+//------------------------------------------------------------------------------
+class GaussKernel : public CPUExecutor::Kernel
+{
+    public:
+        GaussKernel(bool vertical) : _vertical(vertical) {}
+
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            int index = osg::maximum(0, context.getSamplerIndex("texUnit0"));
+            const osg::Image* input = context.getInput(index);
+            if (!output || !input) return;
+
+            // weights as computed by gauss_convolution_vp.glsl
+            float radius = context.getFloat("radius", 0.0f);
+            float sigma = context.getFloat("sigma", 1.0f);
+            float sigma2 = 2.0f * sigma * sigma;
+            float c = sqrtf(1.0f / (sigma2 * osg::PI));
+
+            std::vector<float> offsets, weights;
+            float total = 0.0f;
+            bool integral = true;
+            for (float i=-radius; i < radius; i += 1.0f)
+            {
+                float weight = c * expf((i*i) / (-sigma2));
+                offsets.push_back(i);
+                weights.push_back(weight);
+                total += weight;
+                integral = integral && floorf(i) == i;
+            }
+            if (offsets.empty()) return;
+            for (unsigned i=0; i < weights.size(); i++) weights[i] /= total;
+
+            // the shader steps by the size of the viewport
+            float viewportWidth = context.getFloat("osgppu_ViewportWidth", (float)output->s());
+            float viewportHeight = context.getFloat("osgppu_ViewportHeight", (float)output->t());
+
+            // if the input texels are hit exactly, then the texels are read directly
+            bool direct = integral && input->s() == output->s() && input->t() == output->t()
+                && (int)viewportWidth == output->s() && (int)viewportHeight == output->t();
+
+            unsigned numTaps = offsets.size();
+            std::vector<int> taps(offsets.begin(), offsets.end());
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    Pixel sum;
+                    if (direct && _vertical)
+                    {
+                        for (unsigned k=0; k < numTaps; k++)
+                            sum = sum + Pixel::load(getTexel(input, x, y + taps[k])) * weights[k];
+                    }else if (direct)
+                    {
+                        // rows are contiguous, hence no clamping is needed inside the image
+                        if (x + taps[0] >= 0 && x + taps[numTaps - 1] < input->s())
+                        {
+                            const float* texel = getTexel(input, x + taps[0], y);
+                            for (unsigned k=0; k < numTaps; k++, texel += 4)
+                                sum = sum + Pixel::load(texel) * weights[k];
+                        }else
+                        {
+                            for (unsigned k=0; k < numTaps; k++)
+                                sum = sum + Pixel::load(getTexel(input, x + taps[k], y)) * weights[k];
+                        }
+                    }else
+                    {
+                        float s = (x + 0.5f) / output->s();
+                        float t = (y + 0.5f) / output->t();
+                        for (unsigned k=0; k < numTaps; k++)
+                        {
+                            osg::Vec4 c = _vertical ? context.sample(index, s, t + offsets[k] / viewportHeight) : context.sample(index, s + offsets[k] / viewportWidth, t);
+                            sum = sum + Pixel(c.x(), c.y(), c.z(), c.w()) * weights[k];
+                        }
+                    }
+                    sum.store(row + x * 4);
+                }
+            }
+        }
+
+    private:
+        bool _vertical;
+};
+
+//------------------------------------------------------------------------------
+static inline float computeScaledLuminance(float middleGray, float avg, float lum)
+{
+    float scaledLum = lum * (middleGray / (avg + 0.001f));
+    scaledLum = osg::minimum(scaledLum, 65504.0f);
+    return scaledLum / (1.0f + scaledLum);
+}
+
+//------------------------------------------------------------------------------
+// Data/glsl/brightpass_fp.glsl
+//------------------------------------------------------------------------------
+class BrightpassKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            if (!output) return;
+
+            InputReader hdr(context, context.getSamplerIndex("hdrInput"), output->s(), output->t());
+            InputReader lum(context, context.getSamplerIndex("lumInput"), output->s(), output->t());
+            const osg::Image* adapted = context.getSampler("texAdaptedLuminance");
+
+            float middleGray = context.getFloat("g_fMiddleGray", 0.18f);
+            float adaptedLum = adapted ? CPUExecutor::sample(adapted, 0.5f, 0.5f).w() : 0.0f;
+
+            const Pixel threshold(0.9f, 0.9f, 0.9f, 0.9f);
+            const Pixel offset(1.0f, 1.0f, 1.0f, 1.0f);
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    float l[4];
+                    lum(x, y).store(l);
+                    float scaledLum = computeScaledLuminance(middleGray, adaptedLum, l[0]);
+
+                    Pixel sample = (hdr(x, y) * scaledLum - threshold).max(Pixel());
+                    sample = sample / (offset + sample);
+
+                    float c[4];
+                    sample.store(c);
+                    c[3] = adaptedLum;
+                    Pixel::load(c).store(row + x * 4);
+                }
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Data/glsl/tonemap_hdr_fp.glsl
+//------------------------------------------------------------------------------
+class TonemapKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            if (!output) return;
+
+            InputReader blur(context, context.getSamplerIndex("blurInput"), output->s(), output->t());
+            InputReader hdr(context, context.getSamplerIndex("hdrInput"), output->s(), output->t());
+            InputReader lum(context, context.getSamplerIndex("lumInput"), output->s(), output->t());
+            const osg::Image* adapted = context.getSampler("texAdaptedLuminance");
+
+            float blurFactor = context.getFloat("fBlurFactor", 0.0f);
+            float middleGray = context.getFloat("g_fMiddleGray", 0.18f);
+            float adaptedLum = adapted ? CPUExecutor::sample(adapted, 0.5f, 0.5f).w() : 0.0f;
+
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                {
+                    float l[4];
+                    lum(x, y).store(l);
+                    float scaledLum = computeScaledLuminance(middleGray, adaptedLum, l[0]);
+
+                    float c[4];
+                    (blur(x, y) * blurFactor + hdr(x, y) * scaledLum).store(c);
+                    c[3] = 1.0f;
+                    Pixel::load(c).store(row + x * 4);
+                }
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+// Data/glsl/luminance_adapted_fp.glsl
+//------------------------------------------------------------------------------
+class AdaptedLuminanceKernel : public CPUExecutor::Kernel
+{
+    public:
+        void compute(const CPUExecutor::Context& context, int x0, int y0, int x1, int y1) const
+        {
+            osg::Image* output = context.getOutput(0);
+            if (!output) return;
+
+            // the current luminance is read from the last mipmap level
+            int index = context.getSamplerIndex("texLuminance");
+            const osg::Image* luminance = context.getInput(index, context.getNumInputLevels(index) - 1);
+            const osg::Image* adapted = context.getSampler("texAdaptedLuminance");
+
+            float current = luminance ? CPUExecutor::sample(luminance, 0.5f, 0.5f).x() : 0.0f;
+            float old = adapted ? CPUExecutor::sample(adapted, 0.5f, 0.5f).w() : 0.0f;
+
+            const float TauCone = 0.01f;
+            const float TauRod = 0.04f;
+            float sigma = osg::clampBetween(0.4f / (0.04f + current), 0.0f, 1.0f);
+            float tau = (TauCone + (TauRod - TauCone) * sigma) / context.getFloat("adaptScaleFactor", 1.0f);
+            float lum = old + (current - old) * (1.0f - expf(-context.getFloat("invFrameTime", 60.0f) / tau));
+            lum = osg::clampBetween(lum, context.getFloat("minLuminance", 0.0f), context.getFloat("maxLuminance", 65504.0f));
+
+            for (int y=y0; y < y1; y++)
+            {
+                float* row = getRow(output, y);
+                for (int x=x0; x < x1; x++)
+                    Pixel(lum, lum, lum, lum).store(row + x * 4);
+            }
+        }
+};
+
+//------------------------------------------------------------------------------
+typedef std::map<std::string, osg::ref_ptr<CPUExecutor::Kernel> > KernelMap;
+
+//------------------------------------------------------------------------------
+static OpenThreads::Mutex& getKernelMutex()
+{
+    static OpenThreads::Mutex mutex;
+    return mutex;
+}
+
+//------------------------------------------------------------------------------
+static KernelMap& getKernelMap()
+{
+    // kernels for the shaders used by the shipped pipelines
+    static KernelMap kernels;
+    if (kernels.empty())
+    {
+        kernels["LuminanceShader"] = new LuminanceKernel();
+        kernels["LuminanceShaderMipmap"] = new LuminanceMipmapKernel();
+        kernels["BrightpassShader"] = new BrightpassKernel();
+        kernels["BlurHorizontalShader"] = new GaussKernel(false);
+        kernels["BlurVerticalShader"] = new GaussKernel(true);
+        kernels["HDRResultShader"] = new TonemapKernel();
+        kernels["AdaptLuminanceShader"] = new AdaptedLuminanceKernel();
+    }
+    return kernels;
+}
+
+//------------------------------------------------------------------------------
+static const osg::Uniform* findUniform(const CPUExecutor::Context& context, const std::string& name)
+{
+    const osg::StateSet* stateset = context.getUnit()->getStateSet();
+    if (stateset && stateset->getUniform(name)) return stateset->getUniform(name);
+
+    if (context.getShader())
+    {
+        osg::StateSet::UniformList::const_iterator it = context.getShader()->getUniformList().find(name);
+        if (it != context.getShader()->getUniformList().end()) return it->second.first.get();
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+const osg::Image* CPUExecutor::Context::getInput(int index, int level) const
+{
+    std::map<int, Input>::const_iterator it = mInputs.find(index);
+    if (it == mInputs.end() || it->second.levels->empty()) return NULL;
+
+    const ImageLevels& levels = *it->second.levels;
+    level = osg::clampBetween(level, 0, (int)levels.size() - 1);
+    return levels[level].get();
+}
+
+//------------------------------------------------------------------------------
+int CPUExecutor::Context::getNumInputLevels(int index) const
+{
+    std::map<int, Input>::const_iterator it = mInputs.find(index);
+    if (it == mInputs.end()) return 0;
+    return it->second.levels->size();
+}
+
+//------------------------------------------------------------------------------
+int CPUExecutor::Context::getSamplerIndex(const std::string& name) const
+{
+    const osg::Uniform* uniform = findUniform(*this, name);
+    if (!uniform || !uniform->getIntArray() || uniform->getIntArray()->empty()) return -1;
+    return (*uniform->getIntArray())[0];
+}
+
+//------------------------------------------------------------------------------
+const osg::Image* CPUExecutor::Context::getSampler(const std::string& name, int level) const
+{
+    int index = getSamplerIndex(name);
+    return index < 0 ? NULL : getInput(index, level);
+}
+
+//------------------------------------------------------------------------------
+osg::Vec4 CPUExecutor::Context::sample(int index, float s, float t, int level) const
+{
+    const osg::Image* image = getInput(index, level);
+    if (!image) return osg::Vec4(0,0,0,0);
+    return samplePixel(image, s, t, mInputs.find(index)->second.nearest).toVec4();
+}
+
+//------------------------------------------------------------------------------
+float CPUExecutor::Context::getFloat(const std::string& name, float defaultValue) const
+{
+    const osg::Uniform* uniform = findUniform(*this, name);
+    if (!uniform || !uniform->getFloatArray() || uniform->getFloatArray()->empty()) return defaultValue;
+    return (*uniform->getFloatArray())[0];
+}
+
+//------------------------------------------------------------------------------
+osg::Image* CPUExecutor::Context::getOutput(int mrt) const
+{
+    if (mrt < 0 || mrt >= (int)mOutputs.size()) return NULL;
+    return mOutputs[mrt];
+}
+
+//------------------------------------------------------------------------------
+CPUExecutor::CPUExecutor(Processor* processor) : osg::Referenced(),
+    mProcessor(processor),
+    mNumThreads(0),
+    mTileSize(64),
+    mSuccess(true)
+{
+}
+
+//------------------------------------------------------------------------------
+CPUExecutor::~CPUExecutor()
+{
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::setNumThreads(unsigned int num)
+{
+    if (num == mNumThreads) return;
+    mNumThreads = num;
+    mThreadPool = NULL;
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::setInputImage(osg::Camera::BufferComponent buffer, osg::Image* image)
+{
+    if (image)
+        mInputImages[buffer] = image;
+    else
+        mInputImages.erase(buffer);
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::registerKernel(const std::string& shaderName, Kernel* kernel)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(getKernelMutex());
+    if (kernel)
+        getKernelMap()[shaderName] = kernel;
+    else
+        getKernelMap().erase(shaderName);
+}
+
+//------------------------------------------------------------------------------
+CPUExecutor::Kernel* CPUExecutor::getKernel(const std::string& shaderName)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(getKernelMutex());
+    KernelMap::iterator it = getKernelMap().find(shaderName);
+    return it == getKernelMap().end() ? NULL : it->second.get();
+}
+
+//------------------------------------------------------------------------------
+osg::Vec4 CPUExecutor::sample(const osg::Image* image, float s, float t)
+{
+    return samplePixel(image, s, t, false).toVec4();
+}
+
+//------------------------------------------------------------------------------
+osg::Image* CPUExecutor::getImage(const osg::Texture* texture, int level) const
+{
+    std::map<const osg::Texture*, Surface>::const_iterator it = mSurfaces.find(texture);
+    if (it == mSurfaces.end() || level < 0 || level >= (int)it->second.levels.size()) return NULL;
+    return it->second.levels[level].get();
+}
+
+//------------------------------------------------------------------------------
+osg::Image* CPUExecutor::getOutputImage(Unit* unit, int mrt, int level) const
+{
+    return getImage(unit->getOutputTexture(mrt), level);
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::updateSurface(Surface& surface, const osg::Image* image)
+{
+    if (surface.source.get() == image && surface.modifiedCount == image->getModifiedCount() && !surface.levels.empty()) return;
+
+    osg::Image* converted = createImage(image->s(), image->t());
+    float* data = reinterpret_cast<float*>(converted->data());
+    if (image->getPixelFormat() == GL_RGBA && image->getDataType() == GL_FLOAT)
+    {
+        for (int y=0; y < image->t(); y++)
+            memcpy(data + y * image->s() * 4, image->data(0, y), image->s() * 4 * sizeof(float));
+    }else
+    {
+        for (int y=0; y < image->t(); y++)
+            for (int x=0; x < image->s(); x++)
+            {
+                osg::Vec4 c = image->getColor(x, y);
+                Pixel(c.x(), c.y(), c.z(), c.w()).store(data + (y * image->s() + x) * 4);
+            }
+    }
+
+    surface.levels.assign(1, converted);
+    surface.source = image;
+    surface.modifiedCount = image->getModifiedCount();
+}
+
+//------------------------------------------------------------------------------
+CPUExecutor::Surface* CPUExecutor::getSurface(const osg::Texture* texture)
+{
+    if (!texture) return NULL;
+    Surface& surface = mSurfaces[texture];
+
+    // textures with an image (i.e. of UnitTexture) are read from the image
+    const osg::Image* image = texture->getNumImages() > 0 ? texture->getImage(0) : NULL;
+    if (image && image->data()) updateSurface(surface, image);
+
+    return &surface;
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::report(const Unit* unit, const std::string& message)
+{
+    mSuccess = false;
+    if (!mReportedUnits.insert(unit->getName()).second) return;
+    osg::notify(osg::WARN) << "osgPPU::CPUExecutor - " << unit->getName() << " " << message << std::endl;
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::run(const Kernel& kernel, const Context& context, int width, int height)
+{
+    if (!mThreadPool.valid())
+        mThreadPool = new CPUThreadPool(mNumThreads > 0 ? mNumThreads : osg::maximum(1, OpenThreads::GetNumberOfProcessors()));
+
+    KernelTask task(kernel, context);
+    static_cast<CPUThreadPool*>(mThreadPool.get())->run(task, width, height, mTileSize);
+}
+
+//------------------------------------------------------------------------------
+bool CPUExecutor::executeUnit(Unit* unit, const InputOverrides& overrides)
+{
+    // bypass units do only pass their inputs through and output units do not compute any texture
+    UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+    if (!unitIO) return true;
+
+    std::string className = unitIO->className();
+    UnitInMipmapOut* mipmapUnit = className == "UnitInMipmapOut" ? static_cast<UnitInMipmapOut*>(unitIO) : NULL;
+    if (!mipmapUnit && className != "UnitInOut" && className != "UnitInResampleOut" && className != "UnitInOutRepeat")
+    {
+        report(unit, "is a " + className + ", which is not supported");
+        return false;
+    }
+    if (unitIO->getOutputTextureType() != UnitInOut::TEXTURE_2D && unitIO->getOutputTextureType() != UnitInOut::TEXTURE_RECTANGLE)
+    {
+        report(unit, "has an output texture type, which is not supported");
+        return false;
+    }
+
+    // units with a shader are computed by the kernel of the shader
+    const ShaderAttribute* shader = NULL;
+    if (unit->getStateSet() && (!mipmapUnit || mipmapUnit->getUseShader()))
+        shader = dynamic_cast<const ShaderAttribute*>(unit->getStateSet()->getAttribute(osg::StateAttribute::PROGRAM));
+
+    osg::ref_ptr<Kernel> kernel = shader ? getKernel(shader->getName()) : NULL;
+    if (shader && !kernel.valid())
+    {
+        report(unit, "has no kernel for the shader " + shader->getName());
+        return false;
+    }
+
+    Context context(unit, shader);
+
+    // collect the inputs, the input of a repeated unit might be replaced
+    std::set<const osg::Texture*> inputTextures;
+    const Unit::TextureMap& inputs = unit->getInputTextureMap();
+    for (Unit::TextureMap::const_iterator it = inputs.begin(); it != inputs.end(); it++)
+    {
+        const osg::Texture* texture = it->second.get();
+        InputOverrides::const_iterator jt = overrides.find(unit);
+        if (it->first == 0 && jt != overrides.end()) texture = jt->second;
+
+        Surface* surface = getSurface(texture);
+        if (!surface) continue;
+
+        Context::Input input;
+        input.levels = &surface->levels;
+        input.nearest = texture->getFilter(osg::Texture::MAG_FILTER) == osg::Texture::NEAREST;
+        context.mInputs[it->first] = input;
+        inputTextures.insert(texture);
+    }
+
+    const Unit::TextureMap& outputs = unit->getOutputTextureMap();
+    if (outputs.empty()) return true;
+    context.mOutputs.assign(outputs.rbegin()->first + 1, NULL);
+
+    // mipmap levels are computed one after the other, each from the previous one
+    if (mipmapUnit)
+    {
+        const osg::Texture* texture = unitIO->getOutputTexture(0);
+        if (!texture || texture->getTextureWidth() <= 0) return true;
+
+        int width = texture->getTextureWidth();
+        int height = osg::maximum(1, texture->getTextureHeight());
+        int baseLevel = mipmapUnit->getGenerateMipmapForInputTextureIndex() < 0 ? 0 : 1;
+
+        Surface& surface = mSurfaces[texture];
+        context.mNumLevels = computeNumLevels(width, height);
+        surface.levels.resize(osg::maximum((int)surface.levels.size(), context.mNumLevels));
+        for (int level = baseLevel; level < context.mNumLevels; level++)
+        {
+            int w = osg::maximum(1, width >> level), h = osg::maximum(1, height >> level);
+            if (!surface.levels[level].valid() || surface.levels[level]->s() != w || surface.levels[level]->t() != h)
+                surface.levels[level] = createImage(w, h);
+        }
+        if (baseLevel == 0) surface.source = NULL;
+
+        static osg::ref_ptr<Kernel> resample = new ResampleKernel();
+        static osg::ref_ptr<Kernel> boxFilter = new BoxFilterKernel();
+        for (int level = baseLevel; level < context.mNumLevels; level++)
+        {
+            context.mLevel = level;
+            context.mOutputs.assign(1, surface.levels[level].get());
+
+            // the levels are computed from the previous level of the output
+            if (level > 0)
+            {
+                Context::Input input;
+                input.levels = &surface.levels;
+                context.mInputs[0] = input;
+            }
+
+            const Kernel* levelKernel = kernel.valid() ? kernel.get() : (level == 0 ? resample.get() : boxFilter.get());
+            run(*levelKernel, context, surface.levels[level]->s(), surface.levels[level]->t());
+        }
+        return true;
+    }
+
+    // outputs, which are read by the unit too, are computed into new images
+    int width = 0, height = 0;
+    std::vector<std::pair<Surface*, osg::ref_ptr<osg::Image> > > replaced;
+    for (Unit::TextureMap::const_iterator it = outputs.begin(); it != outputs.end(); it++)
+    {
+        const osg::Texture* texture = it->second.get();
+        if (!texture || texture->getTextureWidth() <= 0) continue;
+
+        int w = texture->getTextureWidth();
+        int h = osg::maximum(1, texture->getTextureHeight());
+        if (width == 0)
+        {
+            width = w;
+            height = h;
+        }
+
+        Surface& surface = mSurfaces[texture];
+        if (inputTextures.find(texture) != inputTextures.end())
+        {
+            osg::ref_ptr<osg::Image> image = createImage(w, h);
+            replaced.push_back(std::pair<Surface*, osg::ref_ptr<osg::Image> >(&surface, image));
+            context.mOutputs[it->first] = image.get();
+            continue;
+        }
+
+        if (surface.levels.empty()) surface.levels.resize(1);
+        if (!surface.levels[0].valid() || surface.levels[0]->s() != w || surface.levels[0]->t() != h)
+            surface.levels[0] = createImage(w, h);
+        surface.source = NULL;
+        context.mOutputs[it->first] = surface.levels[0].get();
+    }
+    if (width == 0) return true;
+
+    static osg::ref_ptr<Kernel> resample = new ResampleKernel();
+    run(kernel.valid() ? *kernel : *resample, context, width, height);
+
+    for (unsigned i=0; i < replaced.size(); i++)
+    {
+        Surface* surface = replaced[i].first;
+        if (surface->levels.empty()) surface->levels.resize(1);
+        surface->levels[0] = replaced[i].second;
+        surface->source = NULL;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void CPUExecutor::executePlan(const Processor::ExecutionPlan& plan, unsigned begin, unsigned end, InputOverrides& overrides)
+{
+    for (unsigned i = begin; i < end; )
+    {
+        const Processor::ExecutionStep& step = plan[i];
+
+        // disabled units disable the whole subgraph below them, like on the GPU
+        unsigned char skip = step.unit->getNodeMask() == 0 ? 1 : 0;
+        for (std::vector<unsigned>::const_iterator it = step.parents.begin(); it != step.parents.end() && !skip; it++)
+            skip = mSkipped[*it];
+        mSkipped[i] = skip;
+
+        bool execute = !skip && !step.dead && !step.fused && !step.duplicate && step.unit->getActive();
+
+        // repeatable segments are iterated, from the second iteration on the repeat unit
+        // reads the output of the last unit of the segment
+        if (step.repeat)
+        {
+            int iterations = osg::maximum(1, step.repeat->getNumIterations());
+            const Unit* last = step.repeat->getLastNode();
+            for (int k = 0; k < iterations; k++)
+            {
+                if (k > 0 && last)
+                {
+                    Unit::TextureMap::const_iterator it = last->getOutputTextureMap().find(step.repeat->getLastNodeOutputIndex());
+                    if (it != last->getOutputTextureMap().end()) overrides[step.unit.get()] = it->second.get();
+                }
+
+                if (execute) executeUnit(step.unit.get(), overrides);
+                executePlan(plan, i + 1, step.segmentEnd, overrides);
+            }
+            overrides.erase(step.unit.get());
+            i = step.segmentEnd;
+        }else
+        {
+            if (execute) executeUnit(step.unit.get(), overrides);
+            i++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CPUExecutor::execute()
+{
+    mSuccess = true;
+
+    // fused shaders can not be mapped to kernels, the processor is not changed behind the back of its user
+    if (mProcessor->getUseShaderFusion())
+    {
+        osg::notify(osg::WARN) << "osgPPU::CPUExecutor::execute() - shader fusion of " << mProcessor->getName() << " is enabled, disable it to execute the processor on the CPU" << std::endl;
+        mSuccess = false;
+        return false;
+    }
+
+    // the units are set up without any graphics context
+    Processor::DryRunResult setup;
+    if (!mProcessor->dryRun(setup)) return false;
+
+    // images of textures which are not used anymore are released
+    osg::ref_ptr<const Processor::PlanSnapshot> snapshot = mProcessor->getPlanSnapshot();
+    const Processor::ExecutionPlan& plan = snapshot->steps;
+    std::set<const osg::Texture*> used;
+    for (Processor::ExecutionPlan::const_iterator it = plan.begin(); it != plan.end(); it++)
+    {
+        const Unit::TextureMap& inputs = it->unit->getInputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = inputs.begin(); jt != inputs.end(); jt++) used.insert(jt->second.get());
+        const Unit::TextureMap& outputs = it->unit->getOutputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = outputs.begin(); jt != outputs.end(); jt++) used.insert(jt->second.get());
+    }
+    for (std::map<const osg::Texture*, Surface>::iterator it = mSurfaces.begin(); it != mSurfaces.end(); )
+    {
+        if (used.find(it->first) == used.end()) mSurfaces.erase(it++);
+        else it++;
+    }
+
+    // the camera attachments are the inputs of the pipeline
+    osg::Camera::BufferAttachmentMap& attachments = mProcessor->getCamera()->getBufferAttachmentMap();
+    for (std::map<osg::Camera::BufferComponent, osg::ref_ptr<osg::Image> >::iterator it = mInputImages.begin(); it != mInputImages.end(); it++)
+    {
+        osg::Camera::BufferAttachmentMap::iterator jt = attachments.find(it->first);
+        if (jt == attachments.end() || !jt->second._texture.valid())
+        {
+            osg::notify(osg::WARN) << "osgPPU::CPUExecutor::execute() - camera of " << mProcessor->getName() << " has no texture attached to buffer " << it->first << std::endl;
+            mSuccess = false;
+            continue;
+        }
+        updateSurface(mSurfaces[jt->second._texture.get()], it->second.get());
+    }
+
+    mSkipped.assign(plan.size(), 0);
+    InputOverrides overrides;
+    executePlan(plan, 0, plan.size(), overrides);
+
+    return mSuccess;
+}
+
+}; //end namespace
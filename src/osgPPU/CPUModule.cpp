@@ -0,0 +1,891 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/CPUModule.h>
+
+#include <osg/Notify>
+#include <osg/Image>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <deque>
+#include <sstream>
+#include <math.h>
+#include <string.h>
+
+#ifndef GL_HALF_FLOAT_ARB
+    #define GL_HALF_FLOAT_ARB 0x140B
+#endif
+
+// the instruction sets are used whenever the compiler provides them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OSGPPU_CPU_SSE
+    #include <emmintrin.h>
+#endif
+
+#if defined(__AVX__)
+    #define OSGPPU_CPU_AVX
+    #include <immintrin.h>
+#endif
+
+#if defined(__F16C__)
+    #define OSGPPU_CPU_F16C
+    #include <immintrin.h>
+#endif
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// Part of a stage which is run by the threads of the pool
+//------------------------------------------------------------------------------
+struct CPUModuleTask
+{
+    virtual ~CPUModuleTask() {}
+
+    //! Compute the rows [y0,y1)
+    virtual void operator()(int y0, int y1) const = 0;
+};
+
+//------------------------------------------------------------------------------
+// Threads processing the frames of a module. One thread takes the frames and runs
+// the stages, the others help to compute the bands of the stages.
+//------------------------------------------------------------------------------
+class CPUModulePool : public osg::Referenced
+{
+    public:
+        CPUModulePool(CPUModule* module, unsigned int numThreads) :
+            mModule(module), mNumThreads(numThreads), mTask(NULL), mRows(0), mBandRows(1),
+            mPending(0), mActive(0), mGeneration(0), mQuit(false)
+        {
+            mShares = new Share[mNumThreads];
+
+            mThreads.push_back(new Thread(this, 0));
+            for (unsigned int i=1; i < mNumThreads; i++)
+                mThreads.push_back(new Thread(this, i));
+
+            for (unsigned int i=0; i < mThreads.size(); i++)
+                mThreads[i]->start();
+        }
+
+        //! Queue a frame, it is released by the module when it is processed
+        void push(const UnitInOutModule::Frame& frame)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            mFrames.push_back(frame);
+            mWork.broadcast();
+        }
+
+        //! Run a task over the rows, the calling thread is the one taking the frames
+        void run(const CPUModuleTask& task, int rows, int bandRows)
+        {
+            int numBands = (rows + bandRows - 1) / bandRows;
+            if (mNumThreads == 1 || numBands <= 1)
+            {
+                for (int y=0; y < rows; y += bandRows)
+                    task(y, osg::minimum(y + bandRows, rows));
+                return;
+            }
+
+            // every thread gets a contiguous share of the bands
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                for (unsigned int i=0; i < mNumThreads; i++)
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> shareLock(mShares[i].mutex);
+                    mShares[i].begin = numBands * i / mNumThreads;
+                    mShares[i].end = numBands * (i + 1) / mNumThreads;
+                }
+                mTask = &task;
+                mRows = rows;
+                mBandRows = bandRows;
+                mPending = numBands;
+                mGeneration++;
+                mWork.broadcast();
+            }
+
+            work(0);
+
+            // wait for the bands and for all threads to leave the task
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            while (mPending > 0 || mActive > 0) mDone.wait(&mMutex);
+            mTask = NULL;
+        }
+
+    protected:
+        ~CPUModulePool()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                mQuit = true;
+                mWork.broadcast();
+            }
+            for (unsigned int i=0; i < mThreads.size(); i++)
+            {
+                mThreads[i]->join();
+                delete mThreads[i];
+            }
+            delete [] mShares;
+
+            // the slots of frames which were not processed anymore are given back unchanged
+            for (unsigned int i=0; i < mFrames.size(); i++)
+                mModule->_parent->releaseFrame(mFrames[i].slot);
+        }
+
+        //! Bands of a thread, the thread takes them from the front and others steal from the back
+        struct Share
+        {
+            Share() : begin(0), end(0) {}
+            OpenThreads::Mutex mutex;
+            int begin, end;
+        };
+
+        class Thread : public OpenThreads::Thread
+        {
+            public:
+                Thread(CPUModulePool* pool, unsigned int index) : _pool(pool), _index(index) {}
+                virtual void run()
+                {
+                    if (_index == 0) _pool->dispatch();
+                    else _pool->loop(_index);
+                }
+            private:
+                CPUModulePool* _pool;
+                unsigned int _index;
+        };
+        friend class Thread;
+
+        //! Take a band of the own share or steal one from another thread
+        int take(unsigned int index)
+        {
+            {
+                Share& share = mShares[index];
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(share.mutex);
+                if (share.begin < share.end) return share.begin++;
+            }
+            for (unsigned int i=1; i < mNumThreads; i++)
+            {
+                Share& share = mShares[(index + i) % mNumThreads];
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(share.mutex);
+                if (share.begin < share.end) return --share.end;
+            }
+            return -1;
+        }
+
+        //! Compute bands of the current task until there are no bands left
+        void work(unsigned int index)
+        {
+            const CPUModuleTask* task = NULL;
+            int rows, bandRows;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                if (!mTask) return;
+                task = mTask;
+                rows = mRows;
+                bandRows = mBandRows;
+                mActive++;
+            }
+
+            int band;
+            while ((band = take(index)) >= 0)
+            {
+                int y0 = band * bandRows;
+                (*task)(y0, osg::minimum(y0 + bandRows, rows));
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                if (--mPending == 0) mDone.broadcast();
+            }
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            if (--mActive == 0) mDone.broadcast();
+        }
+
+        //! Help with the tasks until the pool is released
+        void loop(unsigned int index)
+        {
+            unsigned int generation = 0;
+            while (true)
+            {
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    while (!mQuit && mGeneration == generation) mWork.wait(&mMutex);
+                    if (mQuit) return;
+                    generation = mGeneration;
+                }
+                work(index);
+            }
+        }
+
+        //! Process the queued frames until the pool is released
+        void dispatch()
+        {
+            while (true)
+            {
+                UnitInOutModule::Frame frame;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    while (!mQuit && mFrames.empty()) mWork.wait(&mMutex);
+                    if (mQuit) return;
+                    frame = mFrames.front();
+                    mFrames.pop_front();
+                }
+
+                mModule->processFrame(frame);
+                mModule->_parent->releaseFrame(frame.slot);
+            }
+        }
+
+        CPUModule* mModule;
+        unsigned int mNumThreads;
+        std::vector<Thread*> mThreads;
+        Share* mShares;
+        std::deque<UnitInOutModule::Frame> mFrames;
+        OpenThreads::Mutex mMutex;
+        OpenThreads::Condition mWork;
+        OpenThreads::Condition mDone;
+        const CPUModuleTask* mTask;
+        int mRows;
+        int mBandRows;
+        int mPending;
+        unsigned int mActive;
+        unsigned int mGeneration;
+        bool mQuit;
+};
+
+//------------------------------------------------------------------------------
+static inline float halfToFloat(unsigned short half)
+{
+    unsigned int sign = (half & 0x8000) << 16;
+    unsigned int exponent = (half >> 10) & 0x1f;
+    unsigned int mantissa = half & 0x03ff;
+    unsigned int bits;
+
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        // normalize the denormalized value
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x0400))
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x03ff) << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+//------------------------------------------------------------------------------
+static inline unsigned short floatToHalf(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, 4);
+
+    unsigned int sign = (bits >> 16) & 0x8000;
+    int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x007fffff;
+
+    // infinity, NaN and values too large for half
+    if (exponent >= 31)
+    {
+        if (((bits >> 23) & 0xff) == 0xff && mantissa) return (unsigned short)(sign | 0x7e00);
+        return (unsigned short)(sign | 0x7c00);
+    }
+
+    // denormalized values and zero
+    if (exponent <= 0)
+    {
+        if (exponent < -10) return (unsigned short)sign;
+        mantissa |= 0x00800000;
+        unsigned int shift = 14 - exponent;
+        unsigned int half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return (unsigned short)(sign | half);
+    }
+
+    // round to nearest even, a carry correctly increments the exponent
+    unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return (unsigned short)half;
+}
+
+//------------------------------------------------------------------------------
+// Layout of the buffer of a frame
+//------------------------------------------------------------------------------
+struct BufferLayout
+{
+    BufferLayout(const UnitInOutModule::Buffer& buffer) :
+        data(static_cast<unsigned char*>(buffer.data)),
+        width(buffer.width), height(buffer.height), type(buffer.type),
+        components(osg::Image::computeNumComponents(buffer.format)),
+        rowBytes(osg::Image::computeRowWidthInBytes(buffer.width, buffer.format, buffer.type, 1))
+    {
+    }
+
+    //! Check whenever the buffer can be converted from and to a surface
+    bool valid() const
+    {
+        return data && components >= 1 && components <= 4 &&
+            (type == GL_FLOAT || type == GL_HALF_FLOAT_ARB || type == GL_UNSIGNED_BYTE);
+    }
+
+    inline unsigned char* row(int y) const { return data + (size_t)y * rowBytes; }
+
+    unsigned char* data;
+    int width, height;
+    GLenum type;
+    unsigned int components;
+    unsigned int rowBytes;
+};
+
+//------------------------------------------------------------------------------
+// Convert a row of a buffer into RGBA float
+//------------------------------------------------------------------------------
+static void loadRow(const BufferLayout& buffer, const unsigned char* src, float* dst)
+{
+    int x = 0;
+    int width = buffer.width;
+
+    if (buffer.components == 4)
+    {
+        if (buffer.type == GL_FLOAT)
+        {
+            memcpy(dst, src, width * 16);
+            return;
+        }
+
+#ifdef OSGPPU_CPU_F16C
+        if (buffer.type == GL_HALF_FLOAT_ARB)
+        {
+            for (; x + 1 < width; x += 2)
+                _mm256_storeu_ps(dst + x * 4, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + x * 8))));
+            for (; x < width; x++)
+                _mm_storeu_ps(dst + x * 4, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + x * 8))));
+            return;
+        }
+#endif
+
+#ifdef OSGPPU_CPU_SSE
+        if (buffer.type == GL_UNSIGNED_BYTE)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+            for (; x < width; x++)
+            {
+                int pixel;
+                memcpy(&pixel, src + x * 4, 4);
+                __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+                _mm_storeu_ps(dst + x * 4, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+            }
+            return;
+        }
+#endif
+    }
+
+    for (; x < width; x++)
+    {
+        float* pixel = dst + x * 4;
+        pixel[0] = pixel[1] = pixel[2] = 0.0f;
+        pixel[3] = 1.0f;
+
+        for (unsigned int c=0; c < buffer.components; c++)
+        {
+            unsigned int i = x * buffer.components + c;
+            if (buffer.type == GL_FLOAT)
+                memcpy(pixel + c, src + i * 4, 4);
+            else if (buffer.type == GL_HALF_FLOAT_ARB)
+            {
+                unsigned short half;
+                memcpy(&half, src + i * 2, 2);
+                pixel[c] = halfToFloat(half);
+            }else
+                pixel[c] = src[i] / 255.0f;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Convert a row of RGBA float into a row of a buffer. The pixels of the row
+// are read from the given x coordinates, if the width of the surface differs.
+//------------------------------------------------------------------------------
+static void storeRow(const BufferLayout& buffer, const float* src, const int* columns, unsigned char* dst)
+{
+    int x = 0;
+    int width = buffer.width;
+
+    if (buffer.components == 4 && !columns)
+    {
+        if (buffer.type == GL_FLOAT)
+        {
+            memcpy(dst, src, width * 16);
+            return;
+        }
+
+#ifdef OSGPPU_CPU_F16C
+        if (buffer.type == GL_HALF_FLOAT_ARB)
+        {
+            for (; x + 1 < width; x += 2)
+                _mm_storeu_si128((__m128i*)(dst + x * 8), _mm256_cvtps_ph(_mm256_loadu_ps(src + x * 4), 0));
+            for (; x < width; x++)
+                _mm_storel_epi64((__m128i*)(dst + x * 8), _mm_cvtps_ph(_mm_loadu_ps(src + x * 4), 0));
+            return;
+        }
+#endif
+
+#ifdef OSGPPU_CPU_SSE
+        if (buffer.type == GL_UNSIGNED_BYTE)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 scale = _mm_set1_ps(255.0f);
+            for (; x < width; x++)
+            {
+                __m128 v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + x * 4), zero), one), scale);
+                __m128i i = _mm_cvtps_epi32(v);
+                i = _mm_packs_epi32(i, i);
+                int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+                memcpy(dst + x * 4, &pixel, 4);
+            }
+            return;
+        }
+#endif
+    }
+
+    for (; x < width; x++)
+    {
+        const float* pixel = src + (columns ? columns[x] : x) * 4;
+        for (unsigned int c=0; c < buffer.components; c++)
+        {
+            unsigned int i = x * buffer.components + c;
+            if (buffer.type == GL_FLOAT)
+                memcpy(dst + i * 4, pixel + c, 4);
+            else if (buffer.type == GL_HALF_FLOAT_ARB)
+            {
+                unsigned short half = floatToHalf(pixel[c]);
+                memcpy(dst + i * 2, &half, 2);
+            }else
+                // round to nearest even as _mm_cvtps_epi32, hence both paths give the same bytes
+                dst[i] = (unsigned char)lrintf(osg::clampBetween(pixel[c], 0.0f, 1.0f) * 255.0f);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Convert the input buffer into a surface
+//------------------------------------------------------------------------------
+struct LoadTask : public CPUModuleTask
+{
+    LoadTask(const BufferLayout& buffer, const CPUModule::Surface& surface) : _buffer(buffer), _surface(surface) {}
+
+    void operator()(int y0, int y1) const
+    {
+        for (int y=y0; y < y1; y++) loadRow(_buffer, _buffer.row(y), _surface.row(y));
+    }
+
+    const BufferLayout& _buffer;
+    const CPUModule::Surface& _surface;
+};
+
+//------------------------------------------------------------------------------
+// Convert a surface into an output buffer, resampled by the nearest pixel
+//------------------------------------------------------------------------------
+struct StoreTask : public CPUModuleTask
+{
+    StoreTask(const CPUModule::Surface& surface, const BufferLayout& buffer) : _surface(surface), _buffer(buffer)
+    {
+        if (buffer.width != surface.width)
+        {
+            _columns.resize(buffer.width);
+            for (int x=0; x < buffer.width; x++) _columns[x] = ((2 * x + 1) * surface.width) / (2 * buffer.width);
+        }
+    }
+
+    void operator()(int y0, int y1) const
+    {
+        for (int y=y0; y < y1; y++)
+        {
+            int sy = _buffer.height == _surface.height ? y : ((2 * y + 1) * _surface.height) / (2 * _buffer.height);
+            storeRow(_buffer, _surface.row(sy), _columns.empty() ? NULL : &_columns[0], _buffer.row(y));
+        }
+    }
+
+    const CPUModule::Surface& _surface;
+    const BufferLayout& _buffer;
+    std::vector<int> _columns;
+};
+
+//------------------------------------------------------------------------------
+// Run a pass of a kernel
+//------------------------------------------------------------------------------
+struct PassTask : public CPUModuleTask
+{
+    PassTask(const CPUModule::Kernel& kernel, unsigned int pass, const CPUModule::Surface& src, const CPUModule::Surface& dst) :
+        _kernel(kernel), _pass(pass), _src(src), _dst(dst) {}
+
+    void operator()(int y0, int y1) const
+    {
+        _kernel.compute(_pass, _src, _dst, y0, y1);
+    }
+
+    const CPUModule::Kernel& _kernel;
+    unsigned int _pass;
+    const CPUModule::Surface& _src;
+    const CPUModule::Surface& _dst;
+};
+
+//------------------------------------------------------------------------------
+CPUModule::BlurKernel::BlurKernel(float sigma, int radius)
+{
+    sigma = osg::maximum(sigma, 0.01f);
+    if (radius <= 0) radius = osg::maximum(1, (int)ceilf(3.0f * sigma));
+
+    float sum = 0.0f;
+    mWeights.resize(2 * radius + 1);
+    for (int i=-radius; i <= radius; i++)
+    {
+        mWeights[i + radius] = expf(-float(i * i) / (2.0f * sigma * sigma));
+        sum += mWeights[i + radius];
+    }
+    for (unsigned int i=0; i < mWeights.size(); i++) mWeights[i] /= sum;
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::BlurKernel::compute(unsigned int pass, const Surface& src, const Surface& dst, int y0, int y1) const
+{
+    int radius = getRadius();
+    int taps = (int)mWeights.size();
+    const float* w = &mWeights[0];
+
+    // horizontal pass, the edge pixels are clamped
+    if (pass == 0)
+    {
+        for (int y=y0; y < y1; y++)
+        {
+            const float* in = src.row(y);
+            float* out = dst.row(y);
+
+            for (int x=0; x < src.width; x++)
+            {
+#ifdef OSGPPU_CPU_AVX
+                // two pixels at once, where no pixel has to be clamped
+                if (x >= radius && x + 1 + radius < src.width)
+                {
+                    __m256 sum = _mm256_setzero_ps();
+                    for (int k=0; k < taps; k++)
+                        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(w[k]), _mm256_loadu_ps(in + (x + k - radius) * 4)));
+                    _mm256_storeu_ps(out + x * 4, sum);
+                    x++;
+                    continue;
+                }
+#endif
+#ifdef OSGPPU_CPU_SSE
+                __m128 sum = _mm_setzero_ps();
+                for (int k=0; k < taps; k++)
+                {
+                    int sx = osg::clampBetween(x + k - radius, 0, src.width - 1);
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(in + sx * 4)));
+                }
+                _mm_storeu_ps(out + x * 4, sum);
+#else
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int k=0; k < taps; k++)
+                {
+                    const float* p = in + osg::clampBetween(x + k - radius, 0, src.width - 1) * 4;
+                    for (int c=0; c < 4; c++) sum[c] += w[k] * p[c];
+                }
+                memcpy(out + x * 4, sum, 16);
+#endif
+            }
+        }
+        return;
+    }
+
+    // vertical pass, whole rows are weighted and summed up
+    std::vector<const float*> rows(taps);
+    int count = src.width * 4;
+    for (int y=y0; y < y1; y++)
+    {
+        for (int k=0; k < taps; k++) rows[k] = src.row(osg::clampBetween(y + k - radius, 0, src.height - 1));
+        float* out = dst.row(y);
+
+        int i = 0;
+#ifdef OSGPPU_CPU_AVX
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k=0; k < taps; k++) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(w[k]), _mm256_loadu_ps(rows[k] + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+#endif
+#ifdef OSGPPU_CPU_SSE
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k=0; k < taps; k++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(rows[k] + i)));
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            float sum = 0.0f;
+            for (int k=0; k < taps; k++) sum += w[k] * rows[k][i];
+            out[i] = sum;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::ColorMatrixKernel::compute(unsigned int, const Surface& src, const Surface& dst, int y0, int y1) const
+{
+    const float* m = mMatrix.ptr();
+
+    for (int y=y0; y < y1; y++)
+    {
+        const float* in = src.row(y);
+        float* out = dst.row(y);
+        int x = 0;
+
+#ifdef OSGPPU_CPU_AVX
+        __m256 r8[4];
+        for (int i=0; i < 4; i++)
+        {
+            __m128 r = _mm_loadu_ps(m + i * 4);
+            r8[i] = _mm256_insertf128_ps(_mm256_castps128_ps256(r), r, 1);
+        }
+        for (; x + 1 < src.width; x += 2)
+        {
+            __m256 v = _mm256_loadu_ps(in + x * 4);
+            __m256 sum = _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0x00), r8[0]);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0x55), r8[1]));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0xaa), r8[2]));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(v, v, 0xff), r8[3]));
+            _mm256_storeu_ps(out + x * 4, sum);
+        }
+#endif
+#ifdef OSGPPU_CPU_SSE
+        __m128 r0 = _mm_loadu_ps(m), r1 = _mm_loadu_ps(m + 4), r2 = _mm_loadu_ps(m + 8), r3 = _mm_loadu_ps(m + 12);
+        for (; x < src.width; x++)
+        {
+            __m128 v = _mm_loadu_ps(in + x * 4);
+            __m128 sum = _mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), r0);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0x55), r1));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xaa), r2));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(v, v, 0xff), r3));
+            _mm_storeu_ps(out + x * 4, sum);
+        }
+#endif
+        for (; x < src.width; x++)
+        {
+            const float* p = in + x * 4;
+            for (int c=0; c < 4; c++)
+                out[x * 4 + c] = p[0] * m[c] + p[1] * m[4 + c] + p[2] * m[8 + c] + p[3] * m[12 + c];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::ThresholdKernel::compute(unsigned int, const Surface& src, const Surface& dst, int y0, int y1) const
+{
+    const float* t = mThreshold.ptr();
+    int count = src.width * 4;
+
+    for (int y=y0; y < y1; y++)
+    {
+        const float* in = src.row(y);
+        float* out = dst.row(y);
+        int i = 0;
+
+        // the channels of a pixel start at multiples of 4, hence the thresholds repeat every 4 values
+#ifdef OSGPPU_CPU_AVX
+        __m256 t8 = _mm256_setr_ps(t[0], t[1], t[2], t[3], t[0], t[1], t[2], t[3]);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(in + i);
+            _mm256_storeu_ps(out + i, _mm256_and_ps(v, _mm256_cmp_ps(v, t8, _CMP_GE_OQ)));
+        }
+#endif
+#ifdef OSGPPU_CPU_SSE
+        __m128 t4 = _mm_setr_ps(t[0], t[1], t[2], t[3]);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(in + i);
+            _mm_storeu_ps(out + i, _mm_and_ps(v, _mm_cmpge_ps(v, t4)));
+        }
+#endif
+        for (; i < count; i++) out[i] = in[i] >= t[i & 3] ? in[i] : 0.0f;
+    }
+}
+
+//------------------------------------------------------------------------------
+CPUModule::CPUModule(UnitInOutModule* parent, unsigned int numThreads) :
+    UnitInOutModule::AsyncModule(parent),
+    mNumThreads(numThreads > 0 ? numThreads : osg::maximum(1, OpenThreads::GetNumberOfProcessors())),
+    mBandRows(16)
+{
+}
+
+//------------------------------------------------------------------------------
+CPUModule::~CPUModule()
+{
+    // stop the threads before the kernels and surfaces are gone
+    mPool = NULL;
+}
+
+//------------------------------------------------------------------------------
+bool CPUModule::init()
+{
+    if (!mPool.valid()) mPool = new CPUModulePool(this, mNumThreads);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::addKernel(Kernel* kernel)
+{
+    if (!kernel) return;
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mKernelMutex);
+    mKernels.push_back(kernel);
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::removeKernels()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mKernelMutex);
+    mKernels.clear();
+}
+
+//------------------------------------------------------------------------------
+unsigned int CPUModule::getNumKernels() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mKernelMutex);
+    return mKernels.size();
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::process(const UnitInOutModule::Frame& frame)
+{
+    if (!mPool.valid()) init();
+    static_cast<CPUModulePool*>(mPool.get())->push(frame);
+}
+
+//------------------------------------------------------------------------------
+void CPUModule::processFrame(const UnitInOutModule::Frame& frame)
+{
+    if (frame.inputs.empty() || frame.outputs.empty()) return;
+
+    BufferLayout input(frame.inputs.begin()->second);
+    if (!input.valid())
+    {
+        osg::notify(osg::WARN) << "osgPPU::CPUModule - " << _parent->getName() << " input format is not supported" << std::endl;
+        return;
+    }
+
+    std::vector<osg::ref_ptr<Kernel> > kernels;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mKernelMutex);
+        kernels = mKernels;
+    }
+
+    CPUModulePool* pool = static_cast<CPUModulePool*>(mPool.get());
+    size_t size = (size_t)input.width * input.height * 4;
+
+    Surface surfaces[2];
+    for (unsigned int i=0; i < 2; i++)
+    {
+        if (mSurfaces[i].size() < size) mSurfaces[i].resize(size);
+        surfaces[i].data = &mSurfaces[i][0];
+        surfaces[i].width = input.width;
+        surfaces[i].height = input.height;
+    }
+
+    // every stage reads one surface and writes the other one
+    unsigned int current = 0;
+    pool->run(LoadTask(input, surfaces[current]), input.height, mBandRows);
+
+    for (unsigned int i=0; i < kernels.size(); i++)
+    {
+        for (unsigned int pass=0; pass < kernels[i]->getNumPasses(); pass++)
+        {
+            pool->run(PassTask(*kernels[i], pass, surfaces[current], surfaces[1 - current]), input.height, mBandRows);
+            current = 1 - current;
+        }
+    }
+
+    for (std::map<int, UnitInOutModule::Buffer>::const_iterator it = frame.outputs.begin(); it != frame.outputs.end(); it++)
+    {
+        BufferLayout output(it->second);
+        if (!output.valid())
+        {
+            osg::notify(osg::WARN) << "osgPPU::CPUModule - " << _parent->getName() << " output " << it->first << " format is not supported" << std::endl;
+            continue;
+        }
+        pool->run(StoreTask(surfaces[current], output), output.height, mBandRows);
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CPUModule::create(UnitInOutModule* parent, const std::string& arguments)
+{
+    osg::ref_ptr<CPUModule> module = new CPUModule(parent);
+
+    std::istringstream words(arguments);
+    std::string kernel;
+    while (words >> kernel)
+    {
+        bool valid = false;
+        if (kernel == "blur")
+        {
+            float sigma = 0.0f;
+            valid = (words >> sigma) ? true : false;
+            if (valid) module->addKernel(new BlurKernel(sigma));
+        }else if (kernel == "threshold")
+        {
+            osg::Vec4 t;
+            valid = (words >> t[0] >> t[1] >> t[2] >> t[3]) ? true : false;
+            if (valid) module->addKernel(new ThresholdKernel(t));
+        }else if (kernel == "colormatrix")
+        {
+            osg::Matrixf m;
+            for (int i=0; i < 16; i++) words >> m.ptr()[i];
+            valid = words ? true : false;
+            if (valid) module->addKernel(new ColorMatrixKernel(m));
+        }else
+        {
+            osg::notify(osg::FATAL) << "osgPPU::CPUModule - unknown kernel " << kernel << std::endl;
+            return false;
+        }
+
+        if (!valid)
+        {
+            osg::notify(osg::FATAL) << "osgPPU::CPUModule - invalid parameters of kernel " << kernel << std::endl;
+            return false;
+        }
+    }
+
+    parent->setModule(module.get());
+    return parent->getModule() == module.get();
+}
+
+};
@@ -0,0 +1,855 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/CaptureSink.h>
+
+#include <osg/Notify>
+#include <osgDB/Registry>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+
+#include <sstream>
+#include <iomanip>
+#include <list>
+#include <string.h>
+
+#ifdef WIN32
+    #include <windows.h>
+    #define popen _popen
+    #define pclose _pclose
+    #define POPEN_WRITE_MODE "wb"
+#else
+    #define POPEN_WRITE_MODE "w"
+    #include <sys/mman.h>
+    #include <sys/types.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+bool ImageFileSink::write(int input, int number, const osg::Image& image)
+{
+    std::ostringstream filename;
+    filename << mPath << "/" << input << "_" << std::setw(4) << std::setfill('0') << number << "." << mExtension;
+
+    osgDB::ReaderWriter::WriteResult res = osgDB::Registry::instance()->writeImage(image, filename.str(), NULL);
+    if (res.success())
+    {
+        osg::notify(osg::INFO) << "osgPPU::ImageFileSink - captured " << number << " frame to " << filename.str() << std::endl;
+        return true;
+    }
+
+    osg::notify(osg::WARN) << "osgPPU::ImageFileSink - capture of " << number << " frame to " << filename.str() << " failed! (" << res.message() << ")" << std::endl;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Pool of threads processing the blocks of several frames at once
+//------------------------------------------------------------------------------
+class BlockPool : public osg::Referenced
+{
+    public:
+        struct Task
+        {
+            virtual ~Task() {}
+            virtual void operator()(unsigned int block) = 0;
+        };
+
+        BlockPool(unsigned int numThreads) : mQuit(false)
+        {
+            // the calling threads do work too
+            for (unsigned int i=1; i < numThreads; i++)
+            {
+                Worker* worker = new Worker(this);
+                mWorkers.push_back(worker);
+                worker->start();
+            }
+        }
+
+        //! Process all blocks of the task, returns when they are done
+        void run(Task& task, unsigned int numBlocks)
+        {
+            if (numBlocks == 0) return;
+            if (mWorkers.empty() || numBlocks == 1)
+            {
+                for (unsigned int i=0; i < numBlocks; i++) task(i);
+                return;
+            }
+
+            Job job(task, numBlocks);
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                mJobs.push_back(&job);
+                mWork.broadcast();
+            }
+
+            while (process(&job)) {}
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            while (job.pending > 0) mDone.wait(&mMutex);
+        }
+
+    protected:
+        ~BlockPool()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                mQuit = true;
+                mWork.broadcast();
+            }
+            for (std::vector<Worker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); it++)
+            {
+                (*it)->join();
+                delete *it;
+            }
+        }
+
+        struct Job
+        {
+            Job(Task& t, unsigned int num) : task(t), next(0), numBlocks(num), pending(num) {}
+            Task& task;
+            unsigned int next;
+            unsigned int numBlocks;
+            unsigned int pending;
+        };
+
+        class Worker;
+        friend class Worker;
+
+        class Worker : public OpenThreads::Thread
+        {
+            public:
+                Worker(BlockPool* pool) : _pool(pool) {}
+                virtual void run() { _pool->loop(); }
+            private:
+                BlockPool* _pool;
+        };
+
+        //! Process one block of the given job or of the oldest job, if none is given
+        bool process(Job* job)
+        {
+            unsigned int block = 0;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                if (!job && !mJobs.empty()) job = mJobs.front();
+                if (!job || job->next >= job->numBlocks) return false;
+
+                block = job->next++;
+                if (job->next == job->numBlocks) mJobs.remove(job);
+            }
+
+            job->task(block);
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            if (--job->pending == 0) mDone.broadcast();
+            return true;
+        }
+
+        //! Wait for new jobs
+        void loop()
+        {
+            while (true)
+            {
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    while (!mQuit && mJobs.empty()) mWork.wait(&mMutex);
+                    if (mQuit) return;
+                }
+                while (process(NULL)) {}
+            }
+        }
+
+        std::vector<Worker*> mWorkers;
+        OpenThreads::Mutex mMutex;
+        OpenThreads::Condition mWork;
+        OpenThreads::Condition mDone;
+        std::list<Job*> mJobs;
+        bool mQuit;
+};
+
+//------------------------------------------------------------------------------
+// Number of rows processed by a block of the pool
+//------------------------------------------------------------------------------
+static const int ROWS_PER_BLOCK = 16;
+
+//------------------------------------------------------------------------------
+static unsigned short floatToHalf(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, 4);
+
+    unsigned int sign = (bits >> 16) & 0x8000;
+    int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x007fffff;
+
+    // infinity, NaN and values too large for half
+    if (exponent >= 31)
+    {
+        if (((bits >> 23) & 0xff) == 0xff && mantissa) return (unsigned short)(sign | 0x7e00);
+        return (unsigned short)(sign | 0x7c00);
+    }
+
+    // denormalized values and zero
+    if (exponent <= 0)
+    {
+        if (exponent < -10) return (unsigned short)sign;
+        mantissa |= 0x00800000;
+        unsigned int shift = 14 - exponent;
+        unsigned int half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return (unsigned short)(sign | half);
+    }
+
+    // round to nearest even, a carry correctly increments the exponent
+    unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return (unsigned short)half;
+}
+
+//------------------------------------------------------------------------------
+// Convert a value of the frame to a little endian half or float
+//------------------------------------------------------------------------------
+static inline void encodeValue(const unsigned char* src, unsigned int srcBytes, unsigned char* dst, unsigned int dstBytes)
+{
+    unsigned int bits = 0;
+    if (srcBytes == 2)
+    {
+        unsigned short half;
+        memcpy(&half, src, 2);
+        bits = half;
+    }else
+    {
+        float value;
+        memcpy(&value, src, 4);
+        if (dstBytes == 2) bits = floatToHalf(value);
+        else memcpy(&bits, &value, 4);
+    }
+
+    for (unsigned int i=0; i < dstBytes; i++) dst[i] = (unsigned char)((bits >> (8 * i)) & 0xff);
+}
+
+//------------------------------------------------------------------------------
+static void appendInt(std::vector<unsigned char>& out, unsigned int value)
+{
+    for (unsigned int i=0; i < 4; i++) out.push_back((unsigned char)((value >> (8 * i)) & 0xff));
+}
+
+//------------------------------------------------------------------------------
+static void appendFloat(std::vector<unsigned char>& out, float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, 4);
+    appendInt(out, bits);
+}
+
+//------------------------------------------------------------------------------
+static void appendString(std::vector<unsigned char>& out, const std::string& str)
+{
+    out.insert(out.end(), str.begin(), str.end());
+    out.push_back(0);
+}
+
+//------------------------------------------------------------------------------
+static void appendAttribute(std::vector<unsigned char>& out, const char* name, const char* type, unsigned int size)
+{
+    appendString(out, name);
+    appendString(out, type);
+    appendInt(out, size);
+}
+
+//------------------------------------------------------------------------------
+// RLE compression of OpenEXR, the bytes are reordered and delta coded before
+//------------------------------------------------------------------------------
+static void compressRLE(const std::vector<unsigned char>& data, std::vector<unsigned char>& out)
+{
+    const int MIN_RUN_LENGTH = 3;
+    const int MAX_RUN_LENGTH = 127;
+
+    // split the low and high bytes of the values into two halves
+    size_t size = data.size();
+    std::vector<unsigned char> tmp(size);
+    unsigned char* t1 = &tmp[0];
+    unsigned char* t2 = &tmp[(size + 1) / 2];
+    for (size_t i=0; i < size; i++)
+    {
+        if (i & 1) *t2++ = data[i];
+        else *t1++ = data[i];
+    }
+
+    // store the differences of the neighbours
+    int p = tmp[0];
+    for (size_t i=1; i < size; i++)
+    {
+        int d = int(tmp[i]) - p + (128 + 256);
+        p = tmp[i];
+        tmp[i] = (unsigned char)d;
+    }
+
+    // runs are stored as count-1 and the value, other bytes as negative count and the bytes
+    const unsigned char* end = &tmp[0] + size;
+    const unsigned char* runStart = &tmp[0];
+    const unsigned char* runEnd = runStart + 1;
+    out.clear();
+    while (runStart < end)
+    {
+        while (runEnd < end && *runStart == *runEnd && runEnd - runStart - 1 < MAX_RUN_LENGTH) ++runEnd;
+
+        if (runEnd - runStart >= MIN_RUN_LENGTH)
+        {
+            out.push_back((unsigned char)((runEnd - runStart) - 1));
+            out.push_back(*runStart);
+            runStart = runEnd;
+        }else
+        {
+            while (runEnd < end &&
+                   ((runEnd + 1 >= end || *runEnd != *(runEnd + 1)) || (runEnd + 2 >= end || *(runEnd + 1) != *(runEnd + 2))) &&
+                   runEnd - runStart < MAX_RUN_LENGTH)
+                ++runEnd;
+
+            out.push_back((unsigned char)(runStart - runEnd));
+            while (runStart < runEnd) out.push_back(*runStart++);
+        }
+        ++runEnd;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Channels of a frame in the alphabetical order of OpenEXR
+//------------------------------------------------------------------------------
+struct HDRChannels
+{
+    std::vector<std::string> names;
+    std::vector<unsigned int> components;
+    unsigned int numComponents;
+
+    bool set(GLenum format)
+    {
+        names.clear();
+        components.clear();
+        switch (format)
+        {
+            case GL_RGBA: add("A", 3); add("B", 2); add("G", 1); add("R", 0); numComponents = 4; return true;
+            case GL_RGB: add("B", 2); add("G", 1); add("R", 0); numComponents = 3; return true;
+            case GL_LUMINANCE_ALPHA: add("A", 1); add("Y", 0); numComponents = 2; return true;
+            case GL_LUMINANCE: add("Y", 0); numComponents = 1; return true;
+            case GL_RED: add("R", 0); numComponents = 1; return true;
+            case GL_ALPHA: add("A", 0); numComponents = 1; return true;
+            default: return false;
+        }
+    }
+
+    void add(const char* name, unsigned int component)
+    {
+        names.push_back(name);
+        components.push_back(component);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Convert the rows of a block into interleaved top down rows
+//------------------------------------------------------------------------------
+struct RAWBlockTask : public BlockPool::Task
+{
+    RAWBlockTask(const osg::Image& image, unsigned int numComponents, unsigned int srcBytes, unsigned int dstBytes, unsigned char* data) :
+        _image(image), _numComponents(numComponents), _srcBytes(srcBytes), _dstBytes(dstBytes), _data(data) {}
+
+    void operator()(unsigned int block)
+    {
+        unsigned int values = _image.s() * _numComponents;
+        int y1 = osg::minimum(int(block + 1) * ROWS_PER_BLOCK, _image.t());
+        for (int y = block * ROWS_PER_BLOCK; y < y1; y++)
+        {
+            const unsigned char* src = _image.data(0, _image.t() - 1 - y);
+            unsigned char* dst = _data + size_t(y) * values * _dstBytes;
+            for (unsigned int i=0; i < values; i++, src += _srcBytes, dst += _dstBytes)
+                encodeValue(src, _srcBytes, dst, _dstBytes);
+        }
+    }
+
+    const osg::Image& _image;
+    unsigned int _numComponents, _srcBytes, _dstBytes;
+    unsigned char* _data;
+};
+
+//------------------------------------------------------------------------------
+// Encode the scanlines of a block into OpenEXR chunks of one scanline each
+//------------------------------------------------------------------------------
+struct EXRBlockTask : public BlockPool::Task
+{
+    EXRBlockTask(const osg::Image& image, const HDRChannels& channels, unsigned int srcBytes, unsigned int dstBytes,
+                 HDRFileSink::Compression compression, std::vector<std::vector<unsigned char> >& chunks) :
+        _image(image), _channels(channels), _srcBytes(srcBytes), _dstBytes(dstBytes), _compression(compression), _chunks(chunks) {}
+
+    void operator()(unsigned int block)
+    {
+        // the channels of a scanline are stored one after the other
+        unsigned int width = _image.s();
+        std::vector<unsigned char> line(width * _channels.names.size() * _dstBytes);
+        std::vector<unsigned char> packed;
+
+        int y1 = osg::minimum(int(block + 1) * ROWS_PER_BLOCK, _image.t());
+        for (int y = block * ROWS_PER_BLOCK; y < y1; y++)
+        {
+            const unsigned char* row = _image.data(0, _image.t() - 1 - y);
+            unsigned char* dst = &line[0];
+            for (unsigned int c=0; c < _channels.components.size(); c++)
+            {
+                const unsigned char* src = row + _channels.components[c] * _srcBytes;
+                for (unsigned int x=0; x < width; x++, src += _channels.numComponents * _srcBytes, dst += _dstBytes)
+                    encodeValue(src, _srcBytes, dst, _dstBytes);
+            }
+
+            // compressed data is only stored, if it is smaller
+            const std::vector<unsigned char>* data = &line;
+            if (_compression == HDRFileSink::RLE_COMPRESSION)
+            {
+                compressRLE(line, packed);
+                if (packed.size() < line.size()) data = &packed;
+            }
+
+            std::vector<unsigned char>& chunk = _chunks[y];
+            chunk.clear();
+            chunk.reserve(data->size() + 8);
+            appendInt(chunk, y);
+            appendInt(chunk, data->size());
+            chunk.insert(chunk.end(), data->begin(), data->end());
+        }
+    }
+
+    const osg::Image& _image;
+    const HDRChannels& _channels;
+    unsigned int _srcBytes, _dstBytes;
+    HDRFileSink::Compression _compression;
+    std::vector<std::vector<unsigned char> >& _chunks;
+};
+
+//------------------------------------------------------------------------------
+HDRFileSink::HDRFileSink(const std::string& path, Format format, unsigned int numThreads) : CaptureSink(),
+    mPath(path),
+    mFormat(format),
+    mCompression(RLE_COMPRESSION),
+    mStoreHalf(true)
+{
+    if (numThreads == 0) numThreads = osg::maximum(OpenThreads::GetNumberOfProcessors(), 1);
+    mPool = new BlockPool(numThreads);
+}
+
+//------------------------------------------------------------------------------
+HDRFileSink::~HDRFileSink()
+{
+}
+
+//------------------------------------------------------------------------------
+bool HDRFileSink::write(int input, int number, const osg::Image& image)
+{
+    GLenum type = image.getDataType();
+    HDRChannels channels;
+    if ((type != GL_HALF_FLOAT_ARB && type != GL_FLOAT) || !channels.set(image.getPixelFormat()))
+    {
+        osg::notify(osg::WARN) << "osgPPU::HDRFileSink - frames must be of type GL_HALF_FLOAT_ARB or GL_FLOAT" << std::endl;
+        return false;
+    }
+
+    unsigned int srcBytes = type == GL_FLOAT ? 4 : 2;
+    unsigned int dstBytes = (type == GL_FLOAT && !mStoreHalf) ? 4 : 2;
+    unsigned int width = image.s(), height = image.t();
+    unsigned int numBlocks = (height + ROWS_PER_BLOCK - 1) / ROWS_PER_BLOCK;
+    BlockPool* pool = static_cast<BlockPool*>(mPool.get());
+
+    std::ostringstream filename;
+    filename << mPath << "/" << input << "_" << std::setw(4) << std::setfill('0') << number << (mFormat == EXR ? ".exr" : ".raw");
+
+    std::vector<unsigned char> header;
+    std::vector<unsigned char> data;
+    std::vector<std::vector<unsigned char> > chunks;
+
+    if (mFormat == RAW)
+    {
+        appendInt(header, 0x46555050);
+        appendInt(header, 1);
+        appendInt(header, width);
+        appendInt(header, height);
+        appendInt(header, channels.numComponents);
+        appendInt(header, dstBytes);
+
+        data.resize(size_t(width) * height * channels.numComponents * dstBytes);
+        RAWBlockTask task(image, channels.numComponents, srcBytes, dstBytes, &data[0]);
+        pool->run(task, numBlocks);
+    }else
+    {
+        chunks.resize(height);
+        EXRBlockTask task(image, channels, srcBytes, dstBytes, mCompression, chunks);
+        pool->run(task, numBlocks);
+
+        // magic number and version of a single part scanline file
+        appendInt(header, 20000630);
+        appendInt(header, 2);
+
+        unsigned int chlistSize = 1;
+        for (unsigned int i=0; i < channels.names.size(); i++) chlistSize += channels.names[i].size() + 1 + 16;
+        appendAttribute(header, "channels", "chlist", chlistSize);
+        for (unsigned int i=0; i < channels.names.size(); i++)
+        {
+            appendString(header, channels.names[i]);
+            appendInt(header, dstBytes == 2 ? 1 : 2);
+            appendInt(header, 0);
+            appendInt(header, 1);
+            appendInt(header, 1);
+        }
+        header.push_back(0);
+
+        appendAttribute(header, "compression", "compression", 1);
+        header.push_back((unsigned char)mCompression);
+        appendAttribute(header, "dataWindow", "box2i", 16);
+        appendInt(header, 0); appendInt(header, 0); appendInt(header, width - 1); appendInt(header, height - 1);
+        appendAttribute(header, "displayWindow", "box2i", 16);
+        appendInt(header, 0); appendInt(header, 0); appendInt(header, width - 1); appendInt(header, height - 1);
+        appendAttribute(header, "lineOrder", "lineOrder", 1);
+        header.push_back(0);
+        appendAttribute(header, "pixelAspectRatio", "float", 4);
+        appendFloat(header, 1.0f);
+        appendAttribute(header, "screenWindowCenter", "v2f", 8);
+        appendFloat(header, 0.0f); appendFloat(header, 0.0f);
+        appendAttribute(header, "screenWindowWidth", "float", 4);
+        appendFloat(header, 1.0f);
+        header.push_back(0);
+
+        // table of the 64 bit offsets of the chunks
+        unsigned long long offset = header.size() + 8 * chunks.size();
+        for (unsigned int i=0; i < chunks.size(); i++)
+        {
+            appendInt(header, (unsigned int)(offset & 0xffffffff));
+            appendInt(header, (unsigned int)(offset >> 32));
+            offset += chunks[i].size();
+        }
+    }
+
+    FILE* file = fopen(filename.str().c_str(), "wb");
+    bool success = file != NULL;
+    if (success)
+    {
+        success = fwrite(&header[0], 1, header.size(), file) == header.size();
+        if (success && !data.empty()) success = fwrite(&data[0], 1, data.size(), file) == data.size();
+        for (unsigned int i=0; success && i < chunks.size(); i++)
+            success = fwrite(&chunks[i][0], 1, chunks[i].size(), file) == chunks[i].size();
+        success = (fclose(file) == 0) && success;
+    }
+
+    if (success)
+        osg::notify(osg::INFO) << "osgPPU::HDRFileSink - captured " << number << " frame to " << filename.str() << std::endl;
+    else
+        osg::notify(osg::WARN) << "osgPPU::HDRFileSink - capture of " << number << " frame to " << filename.str() << " failed!" << std::endl;
+    return success;
+}
+
+//------------------------------------------------------------------------------
+MappedFileSink::MappedFileSink(const std::string& filename, unsigned int maxFrames) : CaptureSink(),
+    mFilename(filename),
+    mMaxFrames(maxFrames),
+    mFrameSize(0),
+    mNumFrames(0),
+    mData(NULL),
+    mSize(0),
+#ifdef WIN32
+    mFile(INVALID_HANDLE_VALUE),
+    mMapping(NULL)
+#else
+    mFile(-1)
+#endif
+{
+}
+
+//------------------------------------------------------------------------------
+MappedFileSink::~MappedFileSink()
+{
+    unmap();
+}
+
+//------------------------------------------------------------------------------
+bool MappedFileSink::map(size_t size)
+{
+    if (size == 0) return false;
+
+#ifdef WIN32
+    mFile = CreateFileA(mFilename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFile == INVALID_HANDLE_VALUE) return false;
+
+    ULARGE_INTEGER fileSize;
+    fileSize.QuadPart = size;
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, NULL);
+    if (mMapping) mData = static_cast<unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, size));
+#else
+    // the file offsets might be smaller than the address space
+    off_t length = off_t(size);
+    if (length < 0 || size_t(length) != size) return false;
+
+    mFile = open(mFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFile < 0) return false;
+
+    if (ftruncate(mFile, length) == 0)
+    {
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+        if (data != MAP_FAILED) mData = static_cast<unsigned char*>(data);
+    }
+#endif
+
+    mSize = size;
+    return mData != NULL;
+}
+
+//------------------------------------------------------------------------------
+void MappedFileSink::unmap()
+{
+    // only the written frames are kept
+    size_t written = size_t(mFrameSize) * mNumFrames;
+
+#ifdef WIN32
+    if (mData) UnmapViewOfFile(mData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER offset;
+        offset.QuadPart = written;
+        SetFilePointerEx(mFile, offset, NULL, FILE_BEGIN);
+        SetEndOfFile(mFile);
+        CloseHandle(mFile);
+    }
+    mMapping = NULL;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if (mData) munmap(mData, mSize);
+    if (mFile >= 0)
+    {
+        if (ftruncate(mFile, written) != 0)
+            osg::notify(osg::WARN) << "osgPPU::MappedFileSink - cannot truncate " << mFilename << std::endl;
+        close(mFile);
+    }
+    mFile = -1;
+#endif
+
+    mData = NULL;
+    mSize = 0;
+}
+
+//------------------------------------------------------------------------------
+bool MappedFileSink::write(int input, int number, const osg::Image& image)
+{
+    unsigned int size = image.getTotalSizeInBytes();
+
+    // the file is allocated for the size of the first frame, the size is computed
+    // in 64 bit and rejected if it does not fit into the address space
+    if (mFrameSize == 0)
+    {
+        mFrameSize = size;
+        unsigned long long total = (unsigned long long)size * mMaxFrames;
+        if (total > (unsigned long long)(size_t)-1 || !map(size_t(total)))
+        {
+            osg::notify(osg::WARN) << "osgPPU::MappedFileSink - cannot map " << mFilename << " with " << total << " bytes" << std::endl;
+            unmap();
+        }
+    }
+
+    if (!mData || size != mFrameSize || mNumFrames >= mMaxFrames) return false;
+
+    memcpy(mData + size_t(mFrameSize) * mNumFrames, image.data(), size);
+    mNumFrames++;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void MappedFileSink::flush()
+{
+    if (!mData) return;
+
+#ifdef WIN32
+    FlushViewOfFile(mData, 0);
+#else
+    msync(mData, mSize, MS_ASYNC);
+#endif
+}
+
+//------------------------------------------------------------------------------
+StreamSink::StreamSink(const std::string& command, Format format, unsigned int framesPerSecond) : CaptureSink(),
+    mStream(NULL),
+    mIsProcess(true),
+    mFormat(format),
+    mFramesPerSecond(framesPerSecond),
+    mHeaderWritten(false),
+    mWidth(0),
+    mHeight(0)
+{
+    mStream = popen(command.c_str(), POPEN_WRITE_MODE);
+    if (!mStream)
+        osg::notify(osg::WARN) << "osgPPU::StreamSink - cannot start " << command << std::endl;
+}
+
+//------------------------------------------------------------------------------
+StreamSink::StreamSink(FILE* stream, Format format, unsigned int framesPerSecond) : CaptureSink(),
+    mStream(stream),
+    mIsProcess(false),
+    mFormat(format),
+    mFramesPerSecond(framesPerSecond),
+    mHeaderWritten(false),
+    mWidth(0),
+    mHeight(0)
+{
+}
+
+//------------------------------------------------------------------------------
+StreamSink::~StreamSink()
+{
+    if (mStream && mIsProcess) pclose(mStream);
+    else if (mStream) fflush(mStream);
+}
+
+//------------------------------------------------------------------------------
+bool StreamSink::write(int input, int number, const osg::Image& image)
+{
+    if (!mStream) return false;
+
+    if (mFormat == Y4M) return writeY4M(image);
+
+    return fwrite(image.data(), 1, image.getTotalSizeInBytes(), mStream) == image.getTotalSizeInBytes();
+}
+
+//------------------------------------------------------------------------------
+bool StreamSink::writeY4M(const osg::Image& image)
+{
+    unsigned int components = image.getPixelFormat() == GL_RGBA ? 4 : (image.getPixelFormat() == GL_RGB ? 3 : 0);
+    if (components == 0 || image.getDataType() != GL_UNSIGNED_BYTE)
+    {
+        osg::notify(osg::WARN) << "osgPPU::StreamSink - Y4M requires RGB or RGBA frames of type GL_UNSIGNED_BYTE" << std::endl;
+        return false;
+    }
+
+    // the size of the stream is defined by the first frame
+    if (!mHeaderWritten)
+    {
+        mWidth = image.s();
+        mHeight = image.t();
+        fprintf(mStream, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", mWidth, mHeight, mFramesPerSecond);
+        mHeaderWritten = true;
+    }
+    if (image.s() != mWidth || image.t() != mHeight) return false;
+
+    // convert to BT.601 planes, the rows are flipped
+    unsigned int planeSize = mWidth * mHeight;
+    mPlanes.resize(planeSize * 3);
+    unsigned char* Y = &mPlanes[0];
+    unsigned char* U = Y + planeSize;
+    unsigned char* V = U + planeSize;
+    for (int y=0; y < mHeight; y++)
+    {
+        const unsigned char* src = image.data(0, mHeight - 1 - y);
+        unsigned int row = y * mWidth;
+        for (int x=0; x < mWidth; x++, src += components)
+        {
+            int r = src[0], g = src[1], b = src[2];
+            Y[row + x] = (unsigned char)((66 * r + 129 * g + 25 * b + 128) / 256 + 16);
+            U[row + x] = (unsigned char)((-38 * r - 74 * g + 112 * b + 128) / 256 + 128);
+            V[row + x] = (unsigned char)((112 * r - 94 * g - 18 * b + 128) / 256 + 128);
+        }
+    }
+
+    if (fputs("FRAME\n", mStream) < 0) return false;
+    return fwrite(&mPlanes[0], 1, mPlanes.size(), mStream) == mPlanes.size();
+}
+
+//------------------------------------------------------------------------------
+void StreamSink::flush()
+{
+    if (mStream) fflush(mStream);
+}
+
+//------------------------------------------------------------------------------
+RingSink::RingSink(unsigned int capacity) : CaptureSink(),
+    mCapacity(capacity > 0 ? capacity : 1),
+    mNumOverwritten(0)
+{
+}
+
+//------------------------------------------------------------------------------
+bool RingSink::write(int input, int number, const osg::Image& image)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    // replace the oldest frame, if the ring is full
+    Entry entry;
+    if (mFrames.size() >= mCapacity)
+    {
+        entry = mFrames.front();
+        mFrames.pop_front();
+        mNumOverwritten++;
+    }else if (!mFreeImages.empty())
+    {
+        entry.image = mFreeImages.back();
+        mFreeImages.pop_back();
+    }
+
+    // the image of an entry is reused, if it has the size of the frame and nobody else holds it
+    if (!entry.image.valid() || entry.image->referenceCount() > 1 || entry.image->getTotalSizeInBytes() != image.getTotalSizeInBytes())
+        entry.image = new osg::Image();
+    if (entry.image->s() != image.s() || entry.image->t() != image.t() || entry.image->getPixelFormat() != image.getPixelFormat() || entry.image->getDataType() != image.getDataType())
+        entry.image->allocateImage(image.s(), image.t(), image.r(), image.getPixelFormat(), image.getDataType(), image.getPacking());
+
+    memcpy(entry.image->data(), image.data(), image.getTotalSizeInBytes());
+    entry.image->dirty();
+    entry.input = input;
+    entry.number = number;
+    mFrames.push_back(entry);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool RingSink::poll(osg::ref_ptr<osg::Image>& image, int& input, int& number)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    if (mFrames.empty()) return false;
+
+    Entry& entry = mFrames.front();
+    image = entry.image;
+    input = entry.input;
+    number = entry.number;
+
+    // the image is reused, when the application has released it
+    mFreeImages.push_back(entry.image);
+    if (mFreeImages.size() > mCapacity) mFreeImages.erase(mFreeImages.begin());
+    mFrames.pop_front();
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+unsigned int RingSink::getNumFrames() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mFrames.size();
+}
+
+//------------------------------------------------------------------------------
+unsigned int RingSink::getNumOverwritten() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mNumOverwritten;
+}
+
+}; //end namespace
@@ -0,0 +1,411 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/Fence.h>
+
+#include <osg/GLExtensions>
+#include <osg/BufferObject>
+#include <osg/Notify>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <map>
+#include <vector>
+
+#ifndef APIENTRY
+    #define APIENTRY
+#endif
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+    #define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+    #define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+
+#ifndef GL_ALREADY_SIGNALED
+    #define GL_ALREADY_SIGNALED 0x911A
+#endif
+
+#ifndef GL_CONDITION_SATISFIED
+    #define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+#ifndef GL_WAIT_FAILED
+    #define GL_WAIT_FAILED 0x911D
+#endif
+
+#ifndef GL_MAP_READ_BIT
+    #define GL_MAP_READ_BIT 0x0001
+    #define GL_MAP_WRITE_BIT 0x0002
+#endif
+
+#ifndef GL_MAP_PERSISTENT_BIT
+    #define GL_MAP_PERSISTENT_BIT 0x0040
+    #define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// Entry points of GL_ARB_sync of a context
+//------------------------------------------------------------------------------
+struct SyncFunctions
+{
+    typedef void* (APIENTRY * FenceSyncProc)(GLenum condition, GLbitfield flags);
+    typedef GLenum (APIENTRY * ClientWaitSyncProc)(void* sync, GLbitfield flags, GLuint64EXT timeout);
+    typedef void (APIENTRY * DeleteSyncProc)(void* sync);
+
+    SyncFunctions() : supported(false), glFenceSync(NULL), glClientWaitSync(NULL), glDeleteSync(NULL) {}
+
+    bool supported;
+    FenceSyncProc glFenceSync;
+    ClientWaitSyncProc glClientWaitSync;
+    DeleteSyncProc glDeleteSync;
+};
+
+//------------------------------------------------------------------------------
+static const SyncFunctions& getSyncFunctions(unsigned int contextID)
+{
+    static OpenThreads::Mutex mutex;
+    static std::map<unsigned int, SyncFunctions> functions;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+    std::map<unsigned int, SyncFunctions>::iterator it = functions.find(contextID);
+    if (it != functions.end()) return it->second;
+
+    // the entry points can only be queried while the context is current
+    SyncFunctions& sync = functions[contextID];
+    if (osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_sync", 3.2f))
+    {
+        osg::setGLExtensionFuncPtr(sync.glFenceSync, "glFenceSync");
+        osg::setGLExtensionFuncPtr(sync.glClientWaitSync, "glClientWaitSync");
+        osg::setGLExtensionFuncPtr(sync.glDeleteSync, "glDeleteSync");
+        sync.supported = sync.glFenceSync && sync.glClientWaitSync && sync.glDeleteSync;
+    }
+    if (!sync.supported)
+        osg::notify(osg::INFO) << "osgPPU::Fence - context " << contextID << " does not support fences" << std::endl;
+
+    return sync;
+}
+
+//------------------------------------------------------------------------------
+// Fence objects of every context, which are deleted when the context is current again
+//------------------------------------------------------------------------------
+typedef std::map<unsigned int, std::vector<void*> > DeletedFences;
+
+static DeletedFences& getDeletedFences(OpenThreads::Mutex*& mutex)
+{
+    static OpenThreads::Mutex s_mutex;
+    static DeletedFences s_fences;
+    mutex = &s_mutex;
+    return s_fences;
+}
+
+//------------------------------------------------------------------------------
+Fence::Fence() : osg::Referenced(),
+    mSync(NULL),
+    mContextID(0)
+{
+}
+
+//------------------------------------------------------------------------------
+Fence::~Fence()
+{
+    if (mSync)
+        osg::notify(osg::WARN) << "osgPPU::Fence - fence of context " << mContextID << " was not released" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+bool Fence::isSupported(unsigned int contextID)
+{
+    return getSyncFunctions(contextID).supported;
+}
+
+//------------------------------------------------------------------------------
+void Fence::insert(unsigned int contextID)
+{
+    release();
+    flushDeletedFences(contextID);
+
+    mContextID = contextID;
+    const SyncFunctions& sync = getSyncFunctions(contextID);
+    if (sync.supported) mSync = sync.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+//------------------------------------------------------------------------------
+bool Fence::isSignaled() const
+{
+    if (!mSync) return true;
+
+    // flush, otherwise the fence might never reach the GPU
+    GLenum result = getSyncFunctions(mContextID).glClientWaitSync(mSync, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED;
+}
+
+//------------------------------------------------------------------------------
+bool Fence::wait() const
+{
+    if (isSignaled()) return false;
+
+    const SyncFunctions& sync = getSyncFunctions(mContextID);
+    GLenum result;
+    do
+    {
+        result = sync.glClientWaitSync(mSync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+    }while (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED && result != GL_WAIT_FAILED);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void Fence::release()
+{
+    if (!mSync) return;
+
+    getSyncFunctions(mContextID).glDeleteSync(mSync);
+    mSync = NULL;
+}
+
+//------------------------------------------------------------------------------
+void Fence::releaseDeferred()
+{
+    if (!mSync) return;
+
+    OpenThreads::Mutex* mutex;
+    DeletedFences& deleted = getDeletedFences(mutex);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(*mutex);
+    deleted[mContextID].push_back(mSync);
+    mSync = NULL;
+}
+
+//------------------------------------------------------------------------------
+void Fence::flushDeletedFences(unsigned int contextID)
+{
+    OpenThreads::Mutex* mutex;
+    DeletedFences& deleted = getDeletedFences(mutex);
+
+    std::vector<void*> fences;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(*mutex);
+        DeletedFences::iterator it = deleted.find(contextID);
+        if (it == deleted.end()) return;
+        fences.swap(it->second);
+    }
+
+    const SyncFunctions& sync = getSyncFunctions(contextID);
+    for (unsigned int i=0; i < fences.size(); i++)
+        sync.glDeleteSync(fences[i]);
+}
+
+//------------------------------------------------------------------------------
+// Entry points of GL_ARB_buffer_storage of a context
+//------------------------------------------------------------------------------
+struct BufferStorageFunctions
+{
+    typedef void (APIENTRY * BufferStorageProc)(GLenum target, GLsizeiptrARB size, const GLvoid* data, GLbitfield flags);
+    typedef GLvoid* (APIENTRY * MapBufferRangeProc)(GLenum target, GLintptrARB offset, GLsizeiptrARB length, GLbitfield access);
+
+    BufferStorageFunctions() : supported(false), glBufferStorage(NULL), glMapBufferRange(NULL) {}
+
+    bool supported;
+    BufferStorageProc glBufferStorage;
+    MapBufferRangeProc glMapBufferRange;
+};
+
+//------------------------------------------------------------------------------
+static const BufferStorageFunctions& getBufferStorageFunctions(unsigned int contextID)
+{
+    static OpenThreads::Mutex mutex;
+    static std::map<unsigned int, BufferStorageFunctions> functions;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+    std::map<unsigned int, BufferStorageFunctions>::iterator it = functions.find(contextID);
+    if (it != functions.end()) return it->second;
+
+    // the entry points can only be queried while the context is current
+    BufferStorageFunctions& storage = functions[contextID];
+    if (osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_buffer_storage", 4.4f))
+    {
+        osg::setGLExtensionFuncPtr(storage.glBufferStorage, "glBufferStorage");
+        osg::setGLExtensionFuncPtr(storage.glMapBufferRange, "glMapBufferRange");
+        storage.supported = storage.glBufferStorage && storage.glMapBufferRange;
+    }
+
+    return storage;
+}
+
+//------------------------------------------------------------------------------
+PixelBufferRing::PixelBufferRing(GLenum target, GLenum usage) : osg::Referenced(),
+    mTarget(target),
+    mUsage(usage),
+    mContextID(0),
+    mNext(0)
+{
+}
+
+//------------------------------------------------------------------------------
+PixelBufferRing::~PixelBufferRing()
+{
+    releaseDeferred();
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::resize(unsigned int contextID, unsigned int num)
+{
+    if (contextID == mContextID && num == mBuffers.size()) return;
+
+    // buffers of another context can not be deleted here
+    if (contextID == mContextID) release();
+    else releaseDeferred();
+
+    mContextID = contextID;
+    mNext = 0;
+    mBuffers.resize(num);
+    for (unsigned int i=0; i < mBuffers.size(); i++) mBuffers[i].fence = new Fence();
+}
+
+//------------------------------------------------------------------------------
+unsigned int PixelBufferRing::advance()
+{
+    unsigned int index = mNext;
+    if (!mBuffers.empty()) mNext = (mNext + 1) % mBuffers.size();
+    return index;
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::bind(unsigned int index, unsigned int size, bool orphan)
+{
+    osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(mContextID, true);
+    Buffer& buffer = mBuffers[index];
+
+    if (!buffer.id) ext->glGenBuffers(1, &buffer.id);
+    ext->glBindBuffer(mTarget, buffer.id);
+    if (buffer.persistent) return;
+
+    if (orphan || buffer.size != size)
+    {
+        ext->glBufferData(mTarget, size, NULL, mUsage);
+        buffer.size = size;
+    }
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::unbind()
+{
+    osg::GLBufferObject::getExtensions(mContextID, true)->glBindBuffer(mTarget, 0);
+}
+
+//------------------------------------------------------------------------------
+bool PixelBufferRing::isPersistentMappingSupported(unsigned int contextID)
+{
+    return getBufferStorageFunctions(contextID).supported;
+}
+
+//------------------------------------------------------------------------------
+void* PixelBufferRing::allocatePersistent(unsigned int index, unsigned int size)
+{
+    const BufferStorageFunctions& storage = getBufferStorageFunctions(mContextID);
+    if (!storage.supported) return NULL;
+
+    // immutable storage can not be reallocated, hence a new buffer is created
+    osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(mContextID, true);
+    Buffer& buffer = mBuffers[index];
+    if (buffer.id) ext->glDeleteBuffers(1, &buffer.id);
+
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    ext->glGenBuffers(1, &buffer.id);
+    ext->glBindBuffer(mTarget, buffer.id);
+    storage.glBufferStorage(mTarget, size, NULL, flags);
+    buffer.data = storage.glMapBufferRange(mTarget, 0, size, flags);
+    ext->glBindBuffer(mTarget, 0);
+
+    buffer.size = size;
+    buffer.persistent = true;
+    return buffer.data;
+}
+
+//------------------------------------------------------------------------------
+void* PixelBufferRing::map(unsigned int index, GLenum access)
+{
+    Buffer& buffer = mBuffers[index];
+    if (buffer.data || !buffer.id) return buffer.data;
+
+    osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(mContextID, true);
+    ext->glBindBuffer(mTarget, buffer.id);
+    buffer.data = ext->glMapBuffer(mTarget, access);
+    ext->glBindBuffer(mTarget, 0);
+    return buffer.data;
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::unmap(unsigned int index)
+{
+    Buffer& buffer = mBuffers[index];
+    if (!buffer.data || buffer.persistent) return;
+
+    osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(mContextID, true);
+    ext->glBindBuffer(mTarget, buffer.id);
+    ext->glUnmapBuffer(mTarget);
+    ext->glBindBuffer(mTarget, 0);
+    buffer.data = NULL;
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::insertFence(unsigned int index)
+{
+    mBuffers[index].fence->insert(mContextID);
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::release()
+{
+    osg::GLBufferObject::Extensions* ext = NULL;
+    for (unsigned int i=0; i < mBuffers.size(); i++)
+    {
+        Buffer& buffer = mBuffers[i];
+        if (buffer.id)
+        {
+            // deleting a buffer unmaps it too
+            if (!ext) ext = osg::GLBufferObject::getExtensions(mContextID, true);
+            ext->glDeleteBuffers(1, &buffer.id);
+        }
+        if (buffer.fence.valid()) buffer.fence->release();
+        buffer = Buffer();
+    }
+    mBuffers.clear();
+    mNext = 0;
+}
+
+//------------------------------------------------------------------------------
+void PixelBufferRing::releaseDeferred()
+{
+    // osg deletes the buffers on its own, when the context is current again
+    for (unsigned int i=0; i < mBuffers.size(); i++)
+    {
+        Buffer& buffer = mBuffers[i];
+        if (buffer.id) osg::GLBufferObject::deleteBufferObject(mContextID, buffer.id);
+        if (buffer.fence.valid()) buffer.fence->releaseDeferred();
+        buffer = Buffer();
+    }
+    mBuffers.clear();
+    mNext = 0;
+}
+
+}; //end namespace
@@ -16,16 +16,29 @@
 
 #include <osgPPU/Processor.h>
 #include <osgPPU/Visitor.h>
+#include <osgPPU/UnitInOutRepeat.h>
+#include <osgPPU/BarrierNode.h>
+#include <osgPPU/UnitOut.h>
+#include <osgPPU/UnitBypass.h>
+#include <osgPPU/ShaderAttribute.h>
+#include <osgPPU/Utility.h>
+#include <osgPPU/TexturePool.h>
 #include <osg/Texture2D>
+#include <osg/Texture2DArray>
 #include <osg/Depth>
 #include <osg/Notify>
+#include <osg/Timer>
 #include <osg/ClampColor>
 //#include <osg/FrameBufferObject>
 #include <osg/BlendColor>
 #include <osg/BlendEquation>
 #include <osg/Material>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 
 #include <assert.h>
+#include <set>
+#include <sstream>
 
 #include <osgUtil/RenderBin>
 
@@ -35,45 +48,163 @@ namespace osgPPU
 //------------------------------------------------------------------------------
 // Helper class used as render bin
 //------------------------------------------------------------------------------
-class CollectLastUnitsCallback : public osg::NodeCallback
+class PPUProcessingBin : public osgUtil::RenderBin
 {
     public:
-        Processor* _processor;
+        PPUProcessingBin(const std::string& name) : osgUtil::RenderBin()
+        {
+            setName(name);
+            setSortMode(osgUtil::RenderBin::TRAVERSAL_ORDER);
+        }
+};
+
+//------------------------------------------------------------------------------
+// Drawable used in direct execution mode to draw all units of a processor
+//------------------------------------------------------------------------------
+class DirectExecutionDrawable : public osg::Drawable
+{
+    public:
+        DirectExecutionDrawable(Processor* proc) : osg::Drawable(), _processor(proc)
+        {
+            setUseDisplayList(false);
+            setSupportsDisplayList(false);
+            setDataVariance(osg::Object::DYNAMIC);
+        }
+
+        DirectExecutionDrawable(const DirectExecutionDrawable& dr, const osg::CopyOp& copyop=osg::CopyOp::SHALLOW_COPY) :
+            osg::Drawable(dr, copyop), _processor(dr._processor) {}
 
-        CollectLastUnitsCallback(Processor* proc) : _processor(proc){}
+        META_Object(osgPPU, DirectExecutionDrawable);
 
-        void operator() (osg::Node *node, osg::NodeVisitor *nv)
+        // the drawable has no bounds, hence it is never culled and does not affect near/far planes
+        osg::BoundingBox computeBound() const { return osg::BoundingBox(); }
+
+        // remember the plan the units were culled with, it is drawn even if the processor rebuilds its plan meanwhile.
+        // The drawable is dynamic, hence the next frame is not culled before the plan was drawn.
+        void setPlan(const Processor::PlanSnapshot* plan)
         {
-            _processor->addLastUnit(dynamic_cast<Unit*>(node));
-            //node->traverse(*nv);
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _plan = plan;
+        }
+
+        void drawImplementation(osg::RenderInfo& renderInfo) const
+        {
+            if (!_processor) return;
+            osg::State& state = *renderInfo.getState();
+
+            osg::ref_ptr<const Processor::PlanSnapshot> plan;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                plan = _plan;
+            }
+            if (!plan.valid()) return;
+
+            Processor::SkippedSteps skipped(plan->steps.size(), 0);
+            _processor->drawExecutionPlan(renderInfo, plan->steps, 0, plan->steps.size(), skipped);
+
+            // the units have changed the state, hence restore the state of the processor
+            state.apply();
         }
-};
 
+    private:
+        DirectExecutionDrawable() : _processor(NULL) {}
+        Processor* _processor;
+        osg::ref_ptr<const Processor::PlanSnapshot> _plan;
+        mutable OpenThreads::Mutex _mutex;
+};
 
 //------------------------------------------------------------------------------
-// Helper class used as render bin
+// Group of equal units, which share their outputs. Groups are registered process
+// wide, so that equal units of several processors can find each other.
 //------------------------------------------------------------------------------
-class PPUProcessingBin : public osgUtil::RenderBin
+class SharedUnitGroup : public osg::Referenced
 {
     public:
-        PPUProcessingBin(const std::string& name) : osgUtil::RenderBin()
+        //! Outputs computed by the units of the group
+        Unit::TextureMap outputs;
+
+        //! Processors having units in the group, the value is set if the processor knows that its unit is shared
+        std::map<Processor*, bool> members;
+
+        //! Lock which has to be held while the groups are changed
+        static OpenThreads::Mutex& registryMutex()
         {
-            setName(name);
-            setSortMode(osgUtil::RenderBin::TRAVERSAL_ORDER);
+            static OpenThreads::Mutex mutex;
+            return mutex;
+        }
+
+        //! Get group of units with the given signature, create a new one if there is none
+        static SharedUnitGroup* get(const std::string& signature)
+        {
+            osg::ref_ptr<SharedUnitGroup>& group = registry()[signature];
+            if (!group.valid()) group = new SharedUnitGroup(signature);
+            return group.get();
+        }
+
+        //! Remove all units of the processor from the group
+        void leave(Processor* processor)
+        {
+            members.erase(processor);
+            if (members.empty()) registry().erase(_signature);
+        }
+
+        //! Check if the group was not executed in the current frame by the visitor yet and mark it as executed
+        bool execute(const osg::NodeVisitor& nv)
+        {
+            if (!nv.getFrameStamp()) return true;
+            return execute(&nv, nv.getFrameStamp()->getFrameNumber());
+        }
+
+        //! Check if the group was not drawn in the current frame on the context of the state yet and mark it as drawn
+        bool execute(const osg::State& state)
+        {
+            if (!state.getFrameStamp()) return true;
+            return execute(&state, state.getFrameStamp()->getFrameNumber());
+        }
+
+    private:
+        SharedUnitGroup(const std::string& signature) : _signature(signature) {}
+
+        //! Check if the group was not executed in the frame by the executor (visitor or state) yet and mark it as executed
+        bool execute(const void* executor, int frame)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            std::map<const void*, int>::iterator it = _executed.find(executor);
+            if (it != _executed.end() && it->second == frame) return false;
+            _executed[executor] = frame;
+            return true;
+        }
+
+        typedef std::map<std::string, osg::ref_ptr<SharedUnitGroup> > Registry;
+        static Registry& registry()
+        {
+            static Registry groups;
+            return groups;
         }
+
+        std::string _signature;
+        OpenThreads::Mutex _mutex;
+        std::map<const void*, int> _executed;
 };
 
 // This is a default rendering bin which all units are usign
 static osg::ref_ptr<osgUtil::RenderBin> DefaultBin = new PPUProcessingBin("PPUProcessingBin");
 
 //------------------------------------------------------------------------------
-Processor::Processor()
+Processor::Processor() :
+    mDirtyFlags(DIRTY_INIT | DIRTY_UNIT_GRAPH | DIRTY_EXECUTION_PLAN)
 {
+    publishPlanSnapshot(new PlanSnapshot());
+
     // set some variables
-    mbDirty = true;
-    mbDirtyUnitGraph = true;
     mUseColorClamp = true;
-    mCollectLastUnitsCallback = new CollectLastUnitsCallback(this);
+    mbDirectExecution = false;
+    mbTextureAliasing = false;
+    mbDeadUnitElimination = false;
+    mbShaderFusion = false;
+    mbDuplicateUnitElimination = false;
+    mOutputMemory = 0;
+    mAliasedOutputMemory = 0;
 
     // first we have to create a render bin which will hold the units
     // of the subgraph.
@@ -94,15 +225,26 @@ Processor::Processor(const Processor& pp, const osg::CopyOp& copyop) :
     osg::Group(pp, copyop),
     mCamera(pp.mCamera),
     //mVisitor(pp.mVisitor),
-    mbDirty(pp.mbDirty),
-    mbDirtyUnitGraph(pp.mbDirtyUnitGraph),
-    mUseColorClamp(pp.mUseColorClamp)
+    mDirtyFlags((unsigned(pp.mDirtyFlags) & DIRTY_INIT) | DIRTY_UNIT_GRAPH | DIRTY_EXECUTION_PLAN),
+    mUseColorClamp(pp.mUseColorClamp),
+    mbDirectExecution(false),
+    mbTextureAliasing(pp.mbTextureAliasing),
+    mbDeadUnitElimination(pp.mbDeadUnitElimination),
+    mbShaderFusion(pp.mbShaderFusion),
+    mbDuplicateUnitElimination(pp.mbDuplicateUnitElimination),
+    mOutputMemory(0),
+    mAliasedOutputMemory(0)
 {
+    // units placed as last belong to the graph of the original, they have to be placed again for the copy
+    publishPlanSnapshot(new PlanSnapshot());
+    setUseDirectExecution(pp.mbDirectExecution);
 }
 
 //------------------------------------------------------------------------------
 Processor::~Processor()
 {
+    clearExecutionPlan();
+    restoreSharedUnits();
 }
 
 //------------------------------------------------------------------------------
@@ -149,7 +291,7 @@ void Processor::init()
     }
 
     // not dirty anymore
-    mbDirty = false;
+    mDirtyFlags.AND(~unsigned(DIRTY_INIT));
 }
 
 
@@ -175,14 +317,34 @@ Unit* Processor::findUnit(const std::string& name)
 //------------------------------------------------------------------------------
 bool Processor::removeUnit(Unit* unit)
 {
-    if (mbDirtyUnitGraph)
+    if (isDirtyUnitSubgraph())
     {
         osg::notify(osg::INFO) << "osgPPU::Processor::removeUnit(" << unit->getName() << ") - cannot remove unit because the graph is not valid. " << std::endl;
         return false;
     }
 
-    RemoveUnitVisitor uv;
-    uv.run(unit);
+    // the children get new inputs, hence they have to be initialized again
+    std::vector<osg::ref_ptr<Unit> > children;
+    for (unsigned int i=0; i < unit->getNumChildren(); i++)
+    {
+        Unit* child = dynamic_cast<Unit*>(unit->getChild(i));
+        if (child) children.push_back(child);
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitGraphMutex);
+
+        RemoveUnitVisitor uv;
+        uv.run(unit);
+
+        // the plan still references the removed unit, hence rebuild it
+        clearExecutionPlan();
+        publishPlanSnapshot(new PlanSnapshot());
+        dirtyExecutionPlan();
+    }
+
+    for (unsigned int i=0; i < children.size(); i++)
+        dirtyUnitSubgraph(children[i].get());
 
     return true;
 }
@@ -200,7 +362,34 @@ void Processor::onViewportChange()
 //------------------------------------------------------------------------------
 void Processor::dirtyUnitSubgraph()
 {
-    mbDirtyUnitGraph = true;
+    mDirtyFlags.OR(DIRTY_UNIT_GRAPH | DIRTY_EXECUTION_PLAN);
+}
+
+//------------------------------------------------------------------------------
+void Processor::dirtyExecutionPlan()
+{
+    mDirtyFlags.OR(DIRTY_EXECUTION_PLAN);
+}
+
+//------------------------------------------------------------------------------
+void Processor::dirtyUnitSubgraph(Unit* unit)
+{
+    if (!unit) return;
+
+    // lifetimes of all outputs might have changed, hence outputs has to be shared again
+    if (mbTextureAliasing)
+    {
+        dirtyUnitSubgraph();
+        return;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitGraphMutex);
+
+    // this marks the unit and every unit below it as dirty
+    unit->dirty();
+
+    mDirtyUnits.push_back(unit);
+    dirtyExecutionPlan();
 }
 
 //------------------------------------------------------------------------------
@@ -208,93 +397,1481 @@ void Processor::placeUnitAsLast(Unit* unit, bool enable)
 {
     if (!unit) return;
 
-    if (!enable)
-        unit->removeCullCallback(mCollectLastUnitsCallback);
-    else
-        unit->setCullCallback(mCollectLastUnitsCallback);    
+    // remove the unit from the list first, so that it is never added twice
+    for (std::list<osg::observer_ptr<Unit> >::iterator it = mLastUnits.begin(); it != mLastUnits.end(); )
+    {
+        if (!it->valid() || it->get() == unit)
+            it = mLastUnits.erase(it);
+        else
+            it++;
+    }
+
+    if (enable) mLastUnits.push_back(unit);
+
+    // only the order of execution has changed, so units need no reinitialization
+    dirtyExecutionPlan();
+
+    // however shared outputs depend on the order
+    if (mbTextureAliasing) dirtyUnitSubgraph();
 }
 
 //------------------------------------------------------------------------------
-void Processor::traverse(osg::NodeVisitor& nv)
+osg::ref_ptr<const Processor::PlanSnapshot> Processor::getPlanSnapshot() const
 {
-	if (!mCamera)
-		return;
+    // the plan is taken without locking, a replaced plan is kept until every thread taking it has referenced it
+    ++mPlanReaders;
+    osg::ref_ptr<const PlanSnapshot> plan = static_cast<const PlanSnapshot*>(mPublishedPlan.get());
+    --mPlanReaders;
+    return plan;
+}
 
-    // if not initialized before, then do it
-    if (mbDirty) init();
+//------------------------------------------------------------------------------
+void Processor::publishPlanSnapshot(const PlanSnapshot* plan)
+{
+    osg::ref_ptr<const PlanSnapshot> old = mPlanSnapshot;
+    mPlanSnapshot = plan;
+    mPublishedPlan.assign(const_cast<PlanSnapshot*>(plan), old.get());
 
-    // if subgraph is dirty, then we have to resetup it
-    // we do this on the first visitor which runs over the pipeline because this also removes cycles
-    if (mbDirtyUnitGraph)
+    // threads, which have just taken the old plan, reference it within a few instructions
+    while (unsigned(mPlanReaders) != 0)
+        OpenThreads::Thread::YieldCurrentThread();
+}
+
+//------------------------------------------------------------------------------
+void Processor::setUseDirectExecution(bool enable)
+{
+    if (enable && !mDirectGeode.valid())
     {
-        mbDirtyUnitGraph = false;
+        mDirectGeode = new osg::Geode();
+        mDirectGeode->setCullingActive(false);
+        mDirectGeode->addDrawable(new DirectExecutionDrawable(this));
+    }
+    mbDirectExecution = enable;
 
-        // first resolve all cycles in the set
-        ResolveUnitsCyclesVisitor rv;
-        rv.run(this);
+    // units' geodes are not part of the plan when executed directly
+    dirtyExecutionPlan();
+}
 
-        // mark every unit as dirty, so that they get updated on the next call
-        MarkUnitsDirtyVisitor nv;
-        nv.run(this);
+//------------------------------------------------------------------------------
+void Processor::setUseTextureAliasing(bool enable)
+{
+    if (mbTextureAliasing == enable) return;
+    mbTextureAliasing = enable;
+    dirtyUnitSubgraph();
+}
 
-        // debug information
-        osg::notify(osg::INFO) << "--------------------------------------------------------------------" << std::endl;
-        osg::notify(osg::INFO) << "BEGIN " << getName() << std::endl;
+//------------------------------------------------------------------------------
+void Processor::setUseDeadUnitElimination(bool enable)
+{
+    if (mbDeadUnitElimination == enable) return;
+    mbDeadUnitElimination = enable;
+    dirtyExecutionPlan();
 
-        SetupUnitRenderingVisitor sv(this);
-        sv.run(this);
+    // lifetimes of the outputs change with the units being executed
+    if (mbTextureAliasing) dirtyUnitSubgraph();
+}
 
-        osg::notify(osg::INFO) << "END " << getName() << std::endl;
-        osg::notify(osg::INFO) << "--------------------------------------------------------------------" << std::endl;
+//------------------------------------------------------------------------------
+void Processor::setUseShaderFusion(bool enable)
+{
+    if (mbShaderFusion == enable) return;
+    mbShaderFusion = enable;
+    dirtyExecutionPlan();
 
-        // optimize subgraph
-        OptimizeUnitsVisitor ov;
-        ov.run(this);
+    // fused units do not render their outputs anymore
+    if (mbTextureAliasing) dirtyUnitSubgraph();
+}
+
+//------------------------------------------------------------------------------
+void Processor::setUseDuplicateUnitElimination(bool enable)
+{
+    if (mbDuplicateUnitElimination == enable) return;
+    mbDuplicateUnitElimination = enable;
+    dirtyExecutionPlan();
+
+    // duplicates share the outputs of the units they are equal to
+    if (mbTextureAliasing) dirtyUnitSubgraph();
+}
+
+//------------------------------------------------------------------------------
+void Processor::setUseProfiler(bool enable)
+{
+    if (enable == mProfiler.valid()) return;
+    mProfiler = enable ? new Profiler() : NULL;
+}
+
+//------------------------------------------------------------------------------
+void Processor::clearExecutionPlan()
+{
+    for (ExecutionPlan::iterator it = mExecutionPlan.begin(); it != mExecutionPlan.end(); it++)
+    {
+        it->unit->mPlanProcessor = NULL;
+        it->unit->mPlanChildren.clear();
     }
+    mExecutionPlan.clear();
+    mPlanChildren.clear();
+}
 
-    // make sure we render only our own camera
-    if (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+//------------------------------------------------------------------------------
+void Processor::buildExecutionPlan()
+{
+    // the flag is cleared first, so that the plan is built again if it gets dirty meanwhile
+    mDirtyFlags.AND(~unsigned(DIRTY_EXECUTION_PLAN));
+
+    restoreFusedUnits();
+    restoreSharedUnits();
+
+    // units keep their plan state as long as they stay in the plan, since
+    // other threads might still execute them by the previous plan
+    ExecutionPlan previous;
+    previous.swap(mExecutionPlan);
+    mPlanChildren.clear();
+
+    BuildExecutionPlanVisitor bv(this);
+    bv.run(this);
+
+    std::set<Unit*> planned;
+    for (ExecutionPlan::iterator it = mExecutionPlan.begin(); it != mExecutionPlan.end(); it++)
+        planned.insert(it->unit.get());
+    for (ExecutionPlan::iterator it = previous.begin(); it != previous.end(); it++)
     {
-      osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor *>(&nv);
-      if (cv)
-      {
-        if (cv->getCurrentCamera() != getCamera())
+        if (planned.find(it->unit.get()) != planned.end()) continue;
+        it->unit->mPlanProcessor = NULL;
+        it->unit->mPlanChildren.clear();
+    }
+
+    eliminateDeadUnits();
+    if (mbDuplicateUnitElimination) eliminateDuplicateUnits();
+    if (mbShaderFusion) fuseUnits();
+
+    osg::notify(osg::INFO) << "osgPPU::Processor::buildExecutionPlan() - " << getName() << " executes " << mExecutionPlan.size() << " units" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// Edge from a consumer to the output of a producer used by the dead unit elimination
+//------------------------------------------------------------------------------
+struct LivenessEdge
+{
+    Unit* consumer;
+    Unit* producer;
+    int mrt;
+};
+
+//------------------------------------------------------------------------------
+void Processor::eliminateDeadUnits()
+{
+    // outputs of every unit, which are read by a living unit
+    std::map<Unit*, std::set<int> > readOutputs;
+
+    std::vector<LivenessEdge> edges;
+
+    for (ExecutionPlan::iterator it = mExecutionPlan.begin(); it != mExecutionPlan.end(); it++)
+    {
+        Unit* unit = it->unit.get();
+        it->dead = false;
+        if (!mbDeadUnitElimination) continue;
+
+        // outputs leaving the pipeline are always alive
+        bool sink = unit->getKeepAlive() || dynamic_cast<UnitOut*>(unit) != NULL;
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+        if (unitIO)
         {
-          return;
+            for (std::set<int>::const_iterator jt = unitIO->mUserOutputTex.begin(); jt != unitIO->mUserOutputTex.end(); jt++)
+            {
+                // outputs borrowed from other units are not read by the application
+                bool aliased = false;
+                for (std::vector<AliasedOutput>::const_iterator kt = mAliasedOutputs.begin(); kt != mAliasedOutputs.end(); kt++)
+                    if (kt->unit.get() == unitIO && kt->mrt == *jt) aliased = true;
+                if (!aliased) sink = true;
+            }
+        }
+        if (sink)
+        {
+            std::set<int>& read = readOutputs[unit];
+            const Unit::TextureMap& map = unit->getOutputTextureMap();
+            for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+                read.insert(jt->first);
+            read.insert(0);
+        }
+
+        // the inputs of the unit which are not ignored
+        CollectInputSourcesVisitor cv(unit);
+        cv.run(unit);
+        for (unsigned k=0; k < cv.getSources().size(); k++)
+        {
+            const CollectInputSourcesVisitor::Source& source = cv.getSources()[k];
+            if (source.first == NULL || unit->getIgnoreInput(k)) continue;
+            LivenessEdge edge = {unit, source.first, source.second};
+            edges.push_back(edge);
+        }
+
+        // inputs mapped to uniforms
+        const Unit::InputToUniformMap& umap = unit->getInputToUniformMap();
+        for (Unit::InputToUniformMap::const_iterator jt = umap.begin(); jt != umap.end(); jt++)
+        {
+            LivenessEdge edge = {unit, jt->first.get(), 0};
+            edges.push_back(edge);
+        }
+
+        // children behind barrier nodes read the output of the unit in the next frame
+        for (unsigned i=0; i < unit->getNumChildren(); i++)
+        {
+            BarrierNode* br = dynamic_cast<BarrierNode*>(unit->getChild(i));
+            Unit* child = br ? dynamic_cast<Unit*>(br->getBlockedChild()) : NULL;
+            if (!child) continue;
+            LivenessEdge edge = {child, unit, 0};
+            edges.push_back(edge);
         }
-      }
     }
 
-    // first we need to clear traversion bit of every unit
-    if (nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR)
+    // propagate the liveness from the consumers to the producers, edges of barrier
+    // nodes point backwards in the plan, hence iterate until nothing changes anymore
+    bool changed = mbDeadUnitElimination;
+    while (changed)
     {
-        CleanUpdateTraversedVisitor::sVisitor->run(this);
+        changed = false;
+        for (std::vector<LivenessEdge>::reverse_iterator it = edges.rbegin(); it != edges.rend(); it++)
+        {
+            if (readOutputs.find(it->consumer) == readOutputs.end()) continue;
+            if (readOutputs[it->producer].insert(it->mrt).second) changed = true;
+        }
     }
 
-    // if processor is propagated by a cull visitor, hence first clean the traverse bit
-    if (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+    // mark dead steps and detach unread MRT outputs
+    unsigned numDead = 0;
+    for (ExecutionPlan::iterator it = mExecutionPlan.begin(); it != mExecutionPlan.end(); it++)
+    {
+        Unit* unit = it->unit.get();
+        std::map<Unit*, std::set<int> >::const_iterator read = readOutputs.find(unit);
+        it->dead = mbDeadUnitElimination && read == readOutputs.end();
+
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+        if (!unitIO) continue;
+
+        std::set<int> deadOutputs;
+        if (mbDeadUnitElimination && !it->dead && !read->second.empty())
+        {
+            int lastRead = *read->second.rbegin();
+            const Unit::TextureMap& map = unit->getOutputTextureMap();
+            for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+                if (jt->first > lastRead) deadOutputs.insert(jt->first);
+            for (int mrt = lastRead + 1; mrt < (int)unitIO->getOutputDepth(); mrt++)
+                deadOutputs.insert(mrt);
+        }
+        unitIO->setDeadOutputs(deadOutputs);
+
+        if (it->dead)
+        {
+            numDead++;
+            osg::notify(osg::INFO) << "osgPPU::Processor::eliminateDeadUnits() - " << unit->getName() << " is not read by anyone" << std::endl;
+        }
+    }
+
+    if (mbDeadUnitElimination)
+        osg::notify(osg::INFO) << "osgPPU::Processor::eliminateDeadUnits() - " << getName() << " does not execute " << numDead << " dead units" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// Compute a string identifying everything the outputs of the unit depend on. Units with
+// equal signatures compute equal outputs. Returns an empty string if the unit cannot be shared.
+//------------------------------------------------------------------------------
+static std::string getUnitSignature(UnitInOut* unit, const std::map<Unit*, std::string>& ids)
+{
+    std::string className(unit->className());
+    if (className != "UnitInOut" && className != "UnitInResampleOut") return "";
+    if (unit->getKeepAlive()) return "";
+    if (unit->getInputBypass() >= 0 || unit->getBeginDrawCallback() || unit->getEndDrawCallback() || !unit->getViewport()) return "";
+    if (unit->getOutputTextureType() != UnitInOut::TEXTURE_2D && unit->getOutputTextureType() != UnitInOut::TEXTURE_RECTANGLE) return "";
+
+    const Unit::PixelDataBufferObjectMap& pbos = unit->getOutputPBOMap();
+    for (Unit::PixelDataBufferObjectMap::const_iterator it = pbos.begin(); it != pbos.end(); it++)
+        if (it->second.valid()) return "";
+
+    // outputs read in the next frame are bound to the unit
+    for (unsigned i=0; i < unit->getNumChildren(); i++)
+        if (dynamic_cast<BarrierNode*>(unit->getChild(i))) return "";
+
+    std::ostringstream sig;
+    sig.precision(10);
+    const osg::Viewport* vp = unit->getViewport();
+    sig << className << " vp " << vp->x() << " " << vp->y() << " " << vp->width() << " " << vp->height();
+
+    // inputs in the order they are bound
+    sig << " in";
+    for (unsigned i=0; i < unit->getNumParents(); i++)
+    {
+        std::map<Unit*, std::string>::const_iterator it = ids.find(dynamic_cast<Unit*>(unit->getParent(i)));
+        if (it == ids.end()) return "";
+        sig << " " << it->second;
+    }
+    for (unsigned i=0; i < unit->getIgnoreInputList().size(); i++)
+        sig << " ignore " << unit->getIgnoreInputList()[i];
+    for (Unit::InputToUniformMap::const_iterator it = unit->getInputToUniformMap().begin(); it != unit->getInputToUniformMap().end(); it++)
     {
-        osg::notify(osg::DEBUG_INFO) << "--------------------------------------------------------------------" << std::endl;
-        osg::notify(osg::DEBUG_INFO) << "BEGIN FRAME " << getName() << std::endl;
+        std::map<Unit*, std::string>::const_iterator jt = ids.find(it->first.get());
+        if (jt == ids.end()) return "";
+        sig << " uniform " << jt->second << " " << it->second.first << " " << it->second.second;
+    }
 
-        CleanCullTraversedVisitor::sVisitor->run(this);
+    // output format
+    sig << " out " << unit->getOutputDepth() << " " << unit->getOutputTextureType();
+    for (Unit::TextureMap::const_iterator it = unit->getOutputTextureMap().begin(); it != unit->getOutputTextureMap().end(); it++)
+    {
+        osg::Texture* tex = it->second.get();
+        if (!tex) return "";
+        sig << " " << it->first << ":" << tex->className() << " " << tex->getInternalFormat() << " " << tex->getSourceType()
+            << " " << tex->getFilter(osg::Texture::MIN_FILTER) << " " << tex->getFilter(osg::Texture::MAG_FILTER);
     }
 
-    if (mbDirtyUnitGraph == false || nv.getVisitorType() == osg::NodeVisitor::NODE_VISITOR)
+    // state of the unit, textures are the inputs and osgPPU's own uniforms are derived from the inputs and the viewport
+    const osg::StateSet* ss = unit->getStateSet();
+    if (ss)
     {
-        osg::Group::traverse(nv);
+        for (osg::StateSet::AttributeList::const_iterator it = ss->getAttributeList().begin(); it != ss->getAttributeList().end(); it++)
+        {
+            // every unit has its own viewport, color and empty program, hence they are compared by value
+            const osg::StateAttribute* attribute = it->second.first.get();
+            if (attribute == unit->getViewport()) continue;
+            if (attribute == unit->getColorAttribute())
+            {
+                const ColorAttribute* color = unit->getColorAttribute();
+                if (color->getEndTime() > 0.00001) return "";
+                const osg::Vec4& start = color->getStartColor();
+                const osg::Vec4& end = color->getEndColor();
+                sig << " color " << start.r() << " " << start.g() << " " << start.b() << " " << start.a()
+                    << " " << end.r() << " " << end.g() << " " << end.b() << " " << end.a();
+                continue;
+            }
+            const osg::Program* program = dynamic_cast<const osg::Program*>(attribute);
+            if (program && !dynamic_cast<const ShaderAttribute*>(program) && program->getNumShaders() == 0)
+            {
+                sig << " attr program none " << it->second.second;
+                continue;
+            }
+            sig << " attr " << it->first.first << " " << attribute << " " << it->second.second;
+        }
+        for (osg::StateSet::ModeList::const_iterator it = ss->getModeList().begin(); it != ss->getModeList().end(); it++)
+            sig << " mode " << it->first << " " << it->second;
+        for (osg::StateSet::UniformList::const_iterator it = ss->getUniformList().begin(); it != ss->getUniformList().end(); it++)
+        {
+            if (it->first.compare(0, 7, "osgppu_") == 0) continue;
+            const osg::Uniform* uniform = it->second.first.get();
+            sig << " uniform " << it->first << " " << uniform->getType();
+            if (uniform->getFloatArray())
+                for (unsigned i=0; i < uniform->getFloatArray()->size(); i++) sig << " " << (*uniform->getFloatArray())[i];
+            if (uniform->getIntArray())
+                for (unsigned i=0; i < uniform->getIntArray()->size(); i++) sig << " " << (*uniform->getIntArray())[i];
+        }
     }
 
-    // check if we have units that want to be executed last, then do so
-    if (mbDirtyUnitGraph == false && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+    return sig.str();
+}
+
+//------------------------------------------------------------------------------
+void Processor::eliminateDuplicateUnits()
+{
+    // units of repeatable segments are executed several times, hence they are not shared
+    std::vector<bool> inSegment(mExecutionPlan.size(), false);
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+        if (mExecutionPlan[i].repeat)
+            for (unsigned j=i; j < mExecutionPlan[i].segmentEnd; j++) inSegment[j] = true;
+
+    // identifiers of the computed outputs, equal units get equal identifiers
+    std::map<Unit*, std::string> ids;
+    std::map<SharedUnitGroup*, unsigned> firstStep;
+    unsigned numDuplicates = 0;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(SharedUnitGroup::registryMutex());
+
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
     {
-        for (std::list<Unit*>::iterator it = mLastUnits.begin(); it != mLastUnits.end(); it++)
+        ExecutionStep& step = mExecutionPlan[i];
+        Unit* unit = step.unit.get();
+        std::ostringstream id;
+
+        // bypassing units are identified by the bypassed textures, i.e. camera attachments
+        if (dynamic_cast<UnitBypass*>(unit))
         {
-            placeUnitAsLast(*it, false);
-            (*it)->accept(nv);
-            placeUnitAsLast(*it, true);
+            id << "T";
+            for (Unit::TextureMap::const_iterator it = unit->getOutputTextureMap().begin(); it != unit->getOutputTextureMap().end(); it++)
+                id << " " << it->first << ":" << it->second.get();
+            ids[unit] = id.str();
+            continue;
+        }
+
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+        std::string signature;
+        if (unitIO && !step.dead && !inSegment[i] && unitIO->mUserOutputTex.empty() && unitIO->mDeadOutputs.empty())
+            signature = getUnitSignature(unitIO, ids);
+
+        // directly executed units are claimed on draw and the others on cull, hence they are never shared with each other
+        if (!signature.empty() && mbDirectExecution) signature += " direct";
+        if (signature.empty())
+        {
+            id << "U" << unit;
+            ids[unit] = id.str();
+            continue;
+        }
+
+        SharedUnitGroup* group = SharedUnitGroup::get(signature);
+        id << "G" << group;
+        ids[unit] = id.str();
+
+        // an equal unit of this processor is executed before, hence this one is a duplicate
+        std::map<SharedUnitGroup*, unsigned>::const_iterator it = firstStep.find(group);
+        if (it != firstStep.end())
+        {
+            ExecutionStep& first = mExecutionPlan[it->second];
+            if (!first.sharedGroup.valid())
+            {
+                first.sharedGroup = group;
+                group->members[this] = true;
+                shareUnitOutputs(dynamic_cast<UnitInOut*>(first.unit.get()), group->outputs);
+            }
+            step.duplicate = true;
+            step.sharedGroup = group;
+            shareUnitOutputs(unitIO, group->outputs);
+            numDuplicates++;
+            continue;
+        }
+        firstStep[group] = i;
+        mSharedGroups.push_back(group);
+
+        // the first unit of the group provides the outputs
+        if (group->members.empty())
+        {
+            group->outputs = unitIO->getOutputTextureMap();
+            group->members[this] = false;
+            continue;
+        }
+
+        // processors, which do not know that their unit is shared now, have to rebuild their plan
+        for (std::map<Processor*, bool>::iterator jt = group->members.begin(); jt != group->members.end(); jt++)
+        {
+            if (jt->second) continue;
+            if (jt->first->mbTextureAliasing) jt->first->dirtyUnitSubgraph();
+            else jt->first->dirtyExecutionPlan();
+            jt->second = true;
         }
-        mLastUnits.clear();
+
+        group->members[this] = true;
+        step.sharedGroup = group;
+        shareUnitOutputs(unitIO, group->outputs);
+
+        osg::notify(osg::INFO) << "osgPPU::Processor::eliminateDuplicateUnits() - " << unit->getName() << " shares its outputs with other processors" << std::endl;
+    }
+
+    if (numDuplicates)
+        osg::notify(osg::INFO) << "osgPPU::Processor::eliminateDuplicateUnits() - " << getName() << " does not execute " << numDuplicates << " duplicate units" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+void Processor::shareUnitOutputs(UnitInOut* unit, const Unit::TextureMap& outputs)
+{
+    mSharedOutputs.push_back(SharedOutput(unit, unit->mOutputTex));
+
+    // shared outputs must not be exchanged by the unit itself, hence they are not owned by it anymore
+    unit->mOutputTex = outputs;
+    for (Unit::TextureMap::const_iterator it = outputs.begin(); it != outputs.end(); it++)
+        unit->mUserOutputTex.insert(it->first);
+    unit->dirty();
+}
+
+//------------------------------------------------------------------------------
+void Processor::restoreSharedUnits()
+{
+    for (std::vector<SharedOutput>::iterator it = mSharedOutputs.begin(); it != mSharedOutputs.end(); it++)
+    {
+        if (!it->first.valid()) continue;
+        UnitInOut* unit = it->first.get();
+
+        unit->mOutputTex = it->second;
+        unit->mUserOutputTex.clear();
+        unit->dirty();
+    }
+    mSharedOutputs.clear();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(SharedUnitGroup::registryMutex());
+    for (unsigned i=0; i < mSharedGroups.size(); i++)
+        static_cast<SharedUnitGroup*>(mSharedGroups[i].get())->leave(this);
+    mSharedGroups.clear();
+}
+
+//------------------------------------------------------------------------------
+// Maximal number of sibling units rendered in one pass, every sibling requires one render target
+//------------------------------------------------------------------------------
+static const unsigned MAX_MERGED_OUTPUTS = 4;
+
+//------------------------------------------------------------------------------
+// Check whenever the stateset of the unit holds nothing but its shader, its inputs and the state
+// set up by osgPPU. Other state would be lost, since the stateset is not applied when the unit is fused.
+//------------------------------------------------------------------------------
+static bool hasOnlyFusableState(const UnitInOut* unit)
+{
+    const osg::StateSet* ss = unit->getStateSet();
+    if (ss->getUpdateCallback() || ss->getEventCallback() || !ss->getModeList().empty()) return false;
+
+    // the viewport is the one of the unit and the color must not be animated, since it is read by the shader as gl_Color
+    const osg::StateSet::AttributeList& attributes = ss->getAttributeList();
+    for (osg::StateSet::AttributeList::const_iterator it = attributes.begin(); it != attributes.end(); it++)
+    {
+        const osg::StateAttribute* attribute = it->second.first.get();
+        if (it->first.first == osg::StateAttribute::PROGRAM) continue;
+        if (attribute == unit->getViewport()) continue;
+        if (attribute == unit->getColorAttribute() && unit->getColorAttribute()->getEndTime() < 0.00001) continue;
+        return false;
+    }
+
+    // textures are the inputs of the unit or bound by the shader
+    const osg::StateSet::TextureAttributeList& textures = ss->getTextureAttributeList();
+    for (unsigned i=0; i < textures.size(); i++)
+        for (osg::StateSet::AttributeList::const_iterator it = textures[i].begin(); it != textures[i].end(); it++)
+            if (it->first.first != osg::StateAttribute::TEXTURE) return false;
+
+    // only uniforms set by osgPPU itself are allowed, the uniforms of the shader are part of the shader attribute
+    const osg::StateSet::UniformList& uniforms = ss->getUniformList();
+    for (osg::StateSet::UniformList::const_iterator it = uniforms.begin(); it != uniforms.end(); it++)
+        if (it->first.compare(0, 7, "osgppu_") != 0) return false;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Check whenever the unit is a simple unit, which renders its shader into one output texture
+//------------------------------------------------------------------------------
+static ShaderAttribute* getFusableShader(Unit* unit)
+{
+    UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+    if (!unitIO || std::string(unitIO->className()) != "UnitInOut") return NULL;
+    if (unitIO->getOutputDepth() != 1 || unitIO->getInputBypass() >= 0) return NULL;
+    if (unitIO->getOutputTextureType() != UnitInOut::TEXTURE_2D && unitIO->getOutputTextureType() != UnitInOut::TEXTURE_RECTANGLE) return NULL;
+    if (unitIO->getBeginDrawCallback() || unitIO->getEndDrawCallback()) return NULL;
+    if (!unitIO->getStateSet() || !unitIO->getOutputTexture(0)) return NULL;
+
+    const Unit::PixelDataBufferObjectMap& pbos = unitIO->getOutputPBOMap();
+    for (Unit::PixelDataBufferObjectMap::const_iterator it = pbos.begin(); it != pbos.end(); it++)
+        if (it->second.valid()) return NULL;
+
+    if (!hasOnlyFusableState(unitIO)) return NULL;
+
+    return dynamic_cast<ShaderAttribute*>(unitIO->getStateSet()->getAttribute(osg::StateAttribute::PROGRAM));
+}
+
+//------------------------------------------------------------------------------
+void Processor::fuseUnits()
+{
+    // units of repeatable segments are executed several times, hence they are not fused
+    std::vector<bool> inSegment(mExecutionPlan.size(), false);
+    std::map<Unit*, unsigned> index;
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        index[mExecutionPlan[i].unit.get()] = i;
+        if (mExecutionPlan[i].repeat)
+            for (unsigned j=i; j < mExecutionPlan[i].segmentEnd; j++) inSegment[j] = true;
+    }
+
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        ExecutionStep& step = mExecutionPlan[i];
+        if (step.dead || step.fused || step.duplicate || step.sharedGroup.valid() || inSegment[i]) continue;
+
+        // first unit of the chain writes the output of the last unit, hence its own output must not be used by the application
+        UnitInOut* first = dynamic_cast<UnitInOut*>(step.unit.get());
+        ShaderAttribute* firstShader = getFusableShader(first);
+        if (!firstShader || first->getKeepAlive() || !first->mUserOutputTex.empty()) continue;
+
+        osg::Texture* firstOutput = first->getOutputTexture(0);
+        std::vector<ShaderAttribute*> shaders(1, firstShader);
+        std::vector<unsigned> chain(1, i);
+        osg::ref_ptr<ShaderAttribute> fused;
+
+        // extend the chain as long as the unit has only one consumer which can be fused
+        UnitInOut* unit = first;
+        while (true)
+        {
+            Unit* next = NULL;
+            unsigned numConsumers = 0;
+            for (unsigned j=0; j < unit->getNumChildren(); j++)
+            {
+                if (dynamic_cast<BarrierNode*>(unit->getChild(j))) numConsumers += 2;
+                Unit* child = dynamic_cast<Unit*>(unit->getChild(j));
+                if (child) { next = child; numConsumers++; }
+            }
+            if (numConsumers != 1 || (unit != first && (unit->getKeepAlive() || !unit->mUserOutputTex.empty()))) break;
+
+            // the consumer must read only this unit
+            std::map<Unit*, unsigned>::const_iterator it = index.find(next);
+            const ExecutionStep& nextStep = mExecutionPlan[it->second];
+            if (nextStep.dead || nextStep.fused || nextStep.duplicate || nextStep.sharedGroup.valid() || inSegment[it->second]) break;
+            if (next->getNumParents() != 1 || next->getIgnoreInput(0) || !next->getInputToUniformMap().empty()) break;
+
+            ShaderAttribute* nextShader = getFusableShader(next);
+            UnitInOut* nextIO = dynamic_cast<UnitInOut*>(next);
+            if (!nextShader) break;
+
+            // outputs must be equal, otherwise the result differs
+            osg::Texture* output = nextIO->getOutputTexture(0);
+            if (output->getTextureWidth() != firstOutput->getTextureWidth() || output->getTextureHeight() != firstOutput->getTextureHeight()) break;
+            if (output->getInternalFormat() != firstOutput->getInternalFormat()) break;
+            if (nextIO->getOutputTextureType() != first->getOutputTextureType()) break;
+
+            shaders.push_back(nextShader);
+            osg::ref_ptr<ShaderAttribute> candidate = ShaderAttribute::createFusedShader(shaders);
+            if (!candidate.valid())
+            {
+                shaders.pop_back();
+                break;
+            }
+
+            fused = candidate;
+            chain.push_back(it->second);
+            unit = nextIO;
+        }
+        if (chain.size() < 2) continue;
+
+        // the first unit renders the fused shader into the output of the last unit
+        osg::StateSet* ss = first->getStateSet();
+        FusedChain fc;
+        fc.unit = first;
+        fc.output = firstOutput;
+        fc.shader = firstShader;
+        fc.value = ss->getAttributePair(osg::StateAttribute::PROGRAM)->second;
+        fc.fused = fused;
+        mFusedChains.push_back(fc);
+
+        ss->setAttribute(fused.get(), fc.value);
+        first->mOutputTex[0] = unit->getOutputTexture(0);
+        first->mUserOutputTex.insert(0);
+        first->dirty();
+
+        for (unsigned j=1; j < chain.size(); j++)
+            mExecutionPlan[chain[j]].fused = true;
+
+        osg::notify(osg::INFO) << "osgPPU::Processor::fuseUnits() - " << first->getName() << " executes " << chain.size() << " units in one pass (" << fused->getName() << ")" << std::endl;
+    }
+
+    // siblings reading the same inputs are rendered by the first of them into multiple render targets
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        ExecutionStep& step = mExecutionPlan[i];
+        if (step.dead || step.fused || step.duplicate || step.sharedGroup.valid() || inSegment[i]) continue;
+
+        UnitInOut* first = dynamic_cast<UnitInOut*>(step.unit.get());
+        ShaderAttribute* firstShader = getFusableShader(first);
+        if (!firstShader || !first->mUserOutputTex.empty() || first->getNumParents() == 0) continue;
+        if (!first->getInputToUniformMap().empty()) continue;
+
+        osg::Texture* firstOutput = first->getOutputTexture(0);
+        std::vector<ShaderAttribute*> shaders(1, firstShader);
+        std::vector<unsigned> siblings(1, i);
+        osg::ref_ptr<ShaderAttribute> merged;
+
+        for (unsigned j=i+1; j < mExecutionPlan.size() && siblings.size() < MAX_MERGED_OUTPUTS; j++)
+        {
+            const ExecutionStep& sibling = mExecutionPlan[j];
+            if (sibling.dead || sibling.fused || sibling.duplicate || sibling.sharedGroup.valid() || inSegment[j]) continue;
+
+            // sibling has to read exactly the same inputs
+            Unit* unit = mExecutionPlan[j].unit.get();
+            if (unit->getNumParents() != first->getNumParents() || !unit->getInputToUniformMap().empty()) continue;
+            if (unit->getIgnoreInputList() != first->getIgnoreInputList()) continue;
+            bool sameInputs = true;
+            for (unsigned k=0; k < unit->getNumParents(); k++)
+                if (unit->getParent(k) != first->getParent(k) || !dynamic_cast<Unit*>(unit->getParent(k))) sameInputs = false;
+            if (!sameInputs) continue;
+
+            ShaderAttribute* shader = getFusableShader(unit);
+            UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+            if (!shader) continue;
+
+            // outputs must be equal, since they are rendered with the same viewport
+            osg::Texture* output = unitIO->getOutputTexture(0);
+            if (output->getTextureWidth() != firstOutput->getTextureWidth() || output->getTextureHeight() != firstOutput->getTextureHeight()) continue;
+            if (output->getInternalFormat() != firstOutput->getInternalFormat()) continue;
+            if (unitIO->getOutputTextureType() != first->getOutputTextureType()) continue;
+
+            shaders.push_back(shader);
+            osg::ref_ptr<ShaderAttribute> candidate = ShaderAttribute::createMergedShader(shaders);
+            if (!candidate.valid())
+            {
+                shaders.pop_back();
+                continue;
+            }
+
+            merged = candidate;
+            siblings.push_back(j);
+        }
+        if (siblings.size() < 2) continue;
+
+        // the first unit renders the outputs of the siblings as additional render targets
+        osg::StateSet* ss = first->getStateSet();
+        FusedChain fc;
+        fc.unit = first;
+        fc.output = firstOutput;
+        fc.shader = firstShader;
+        fc.value = ss->getAttributePair(osg::StateAttribute::PROGRAM)->second;
+        fc.fused = merged;
+        mFusedChains.push_back(fc);
+
+        ss->setAttribute(merged.get(), fc.value);
+        for (unsigned j=1; j < siblings.size(); j++)
+        {
+            first->mOutputTex[j] = mExecutionPlan[siblings[j]].unit->getOutputTexture(0);
+            first->mUserOutputTex.insert(j);
+            mExecutionPlan[siblings[j]].fused = true;
+        }
+        first->mOutputDepth = siblings.size();
+        first->dirty();
+
+        osg::notify(osg::INFO) << "osgPPU::Processor::fuseUnits() - " << first->getName() << " renders " << siblings.size() << " sibling units in one pass (" << merged->getName() << ")" << std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+void Processor::restoreFusedUnits()
+{
+    for (std::vector<FusedChain>::iterator it = mFusedChains.begin(); it != mFusedChains.end(); it++)
+    {
+        if (!it->unit.valid()) continue;
+        UnitInOut* unit = it->unit.get();
+
+        osg::StateSet* ss = unit->getOrCreateStateSet();
+        if (ss->getAttribute(osg::StateAttribute::PROGRAM) == it->fused.get())
+            ss->setAttribute(it->shader.get(), it->value);
+
+        // chains render into the output of their last unit
+        if (unit->mOutputTex[0] != it->output)
+        {
+            unit->mOutputTex[0] = it->output;
+            unit->mUserOutputTex.erase(0);
+        }
+
+        // merged siblings are rendered as additional render targets
+        for (unsigned mrt=1; mrt < unit->mOutputDepth; mrt++)
+        {
+            unit->mOutputTex.erase(mrt);
+            unit->mUserOutputTex.erase(mrt);
+        }
+        unit->mOutputDepth = 1;
+        unit->dirty();
+    }
+    mFusedChains.clear();
+}
+
+//------------------------------------------------------------------------------
+void Processor::executeStep(osg::NodeVisitor& nv, const ExecutionPlan& plan, unsigned index, SkippedSteps& skipped)
+{
+    const ExecutionStep& step = plan[index];
+
+    // a unit is executed only if all its parents were executed before,
+    // hence disabled units (node mask) disable the whole subgraph below them.
+    // This holds also for steps not executed on their own, since their children read outputs computed for them.
+    unsigned char skip = nv.validNodeMask(*step.unit) ? 0 : 1;
+    for (std::vector<unsigned>::const_iterator it = step.parents.begin(); it != step.parents.end() && !skip; it++)
+        skip = skipped[*it];
+    skipped[index] = skip;
+    if (skip || step.dead) return;
+
+    // the unit itself is not rendered, however its children, which are no units (i.e. cameras), are
+    if (step.fused || step.duplicate)
+    {
+        for (osg::NodeList::const_iterator it = step.unit->mPlanChildren.begin(); it != step.unit->mPlanChildren.end(); it++)
+            if (it->get() != step.unit->getGeode()) (*it)->accept(nv);
+        return;
+    }
+
+    // when drawn directly, the unit must be culled only if it has other children
+    if (mbDirectExecution && step.unit->mPlanChildren.empty() && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+        return;
+
+    // units shared with other processors are culled only by the first processor, the others read its outputs.
+    // Directly executed units are drawn only by the first processor instead, @see drawStep()
+    if (step.sharedGroup.valid() && !mbDirectExecution && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR && !static_cast<SharedUnitGroup*>(step.sharedGroup.get())->execute(nv))
+        return;
+
+    // the profiler is taken once, since it might be exchanged while we are running
+    osg::ref_ptr<Profiler> profiler = nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR ? mProfiler.get() : NULL;
+    osg::Timer_t start = profiler.valid() ? osg::Timer::instance()->tick() : 0;
+
+    step.unit->accept(nv);
+
+    if (profiler.valid())
+        profiler->addCullTime(step.unit.get(), osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()));
+
+    if (nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR)
+        onUnitUpdate(step.unit.get());
+}
+
+//------------------------------------------------------------------------------
+void Processor::executePlan(osg::NodeVisitor& nv, const ExecutionPlan& plan, unsigned begin, unsigned end, SkippedSteps& skipped)
+{
+    bool cull = nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR;
+
+    for (unsigned i = begin; i < end; )
+    {
+        const ExecutionStep& step = plan[i];
+
+        // repeatable segments are iterated only while rendering
+        if (step.repeat && cull)
+        {
+            int iterations = osg::maximum(1, step.repeat->getNumIterations());
+            for (int k = 0; k < iterations; k++)
+            {
+                executeStep(nv, plan, i, skipped);
+                executePlan(nv, plan, i + 1, step.segmentEnd, skipped);
+            }
+            i = step.segmentEnd;
+        }else
+        {
+            executeStep(nv, plan, i, skipped);
+            i++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void Processor::drawStep(osg::RenderInfo& renderInfo, const ExecutionPlan& plan, unsigned index, SkippedSteps& skipped) const
+{
+    const ExecutionStep& step = plan[index];
+    Unit* unit = step.unit.get();
+
+    // same as on cull, units below a disabled unit are not executed
+    unsigned char skip = unit->getNodeMask() ? 0 : 1;
+    for (std::vector<unsigned>::const_iterator it = step.parents.begin(); it != step.parents.end() && !skip; it++)
+        skip = skipped[*it];
+    skipped[index] = skip;
+    if (skip || step.dead || step.fused || step.duplicate) return;
+
+    // units shared with other processors are drawn only by the processor drawing them first on the context
+    osg::State& state = *renderInfo.getState();
+    if (step.sharedGroup.valid() && !static_cast<SharedUnitGroup*>(step.sharedGroup.get())->execute(state))
+        return;
+
+    // apply the states as the render bin would do and draw the unit
+    osg::Geode* geode = unit->getGeode();
+    if (unit->getStateSet()) state.pushStateSet(unit->getStateSet());
+    if (geode->getStateSet()) state.pushStateSet(geode->getStateSet());
+
+    for (unsigned i=0; i < geode->getNumDrawables(); i++)
+    {
+        osg::Drawable* drawable = geode->getDrawable(i);
+        if (drawable->getStateSet()) state.pushStateSet(drawable->getStateSet());
+        state.apply();
+        drawable->draw(renderInfo);
+        if (drawable->getStateSet()) state.popStateSet();
+    }
+
+    if (geode->getStateSet()) state.popStateSet();
+    if (unit->getStateSet()) state.popStateSet();
+}
+
+//------------------------------------------------------------------------------
+void Processor::drawExecutionPlan(osg::RenderInfo& renderInfo, const ExecutionPlan& plan, unsigned begin, unsigned end, SkippedSteps& skipped) const
+{
+    for (unsigned i = begin; i < end; )
+    {
+        const ExecutionStep& step = plan[i];
+
+        if (step.repeat)
+        {
+            int iterations = osg::maximum(1, step.repeat->getNumIterations());
+            for (int k = 0; k < iterations; k++)
+            {
+                drawStep(renderInfo, plan, i, skipped);
+                drawExecutionPlan(renderInfo, plan, i + 1, step.segmentEnd, skipped);
+            }
+            i = step.segmentEnd;
+        }else
+        {
+            drawStep(renderInfo, plan, i, skipped);
+            i++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Check whenever two output textures can be exchanged by each other
+//------------------------------------------------------------------------------
+static bool isCompatibleOutputTexture(osg::Texture* a, osg::Texture* b)
+{
+    return std::string(a->className()) == std::string(b->className())
+        && a->getTextureWidth() == b->getTextureWidth()
+        && a->getTextureHeight() == b->getTextureHeight()
+        && a->getTextureDepth() == b->getTextureDepth()
+        && a->getInternalFormat() == b->getInternalFormat()
+        && a->getSourceFormat() == b->getSourceFormat()
+        && a->getSourceType() == b->getSourceType()
+        && a->getFilter(osg::Texture::MIN_FILTER) == b->getFilter(osg::Texture::MIN_FILTER)
+        && a->getFilter(osg::Texture::MAG_FILTER) == b->getFilter(osg::Texture::MAG_FILTER);
+}
+
+//------------------------------------------------------------------------------
+void Processor::restoreOutputTextures()
+{
+    // the units and their children have to assign their own textures again
+    for (std::vector<AliasedOutput>::iterator it = mAliasedOutputs.begin(); it != mAliasedOutputs.end(); it++)
+    {
+        if (!it->unit.valid()) continue;
+        UnitInOut* unit = it->unit.get();
+        unit->mOutputTex[it->mrt] = it->texture;
+        unit->mUserOutputTex.erase(it->mrt);
+        unit->dirty();
+    }
+    mAliasedOutputs.clear();
+}
+
+//------------------------------------------------------------------------------
+// Peak memory of the textures alive at the same step, every texture is alive from the first to the last step of its range
+//------------------------------------------------------------------------------
+typedef std::map<osg::Texture*, std::pair<unsigned, unsigned> > LiveRanges;
+static unsigned int computePeakMemory(const LiveRanges& ranges, unsigned numSteps)
+{
+    unsigned int peak = 0;
+    for (unsigned i=0; i < numSteps; i++)
+    {
+        unsigned int live = 0;
+        for (LiveRanges::const_iterator it = ranges.begin(); it != ranges.end(); it++)
+            if (it->second.first <= i && i <= it->second.second) live += computeTextureSizeInBytes(it->first);
+        peak = osg::maximum(peak, live);
+    }
+    return peak;
+}
+
+//------------------------------------------------------------------------------
+void Processor::aliasOutputTextures()
+{
+    restoreOutputTextures();
+    mOutputMemory = 0;
+    mAliasedOutputMemory = 0;
+
+    // units in repeatable segments are executed several times, hence their inputs
+    // are alive until the end of the outermost segment
+    std::map<Unit*, unsigned> lastStep;
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+        lastStep[mExecutionPlan[i].unit.get()] = i;
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        if (!mExecutionPlan[i].repeat) continue;
+        for (unsigned j=i; j < mExecutionPlan[i].segmentEnd; j++)
+        {
+            unsigned& last = lastStep[mExecutionPlan[j].unit.get()];
+            last = osg::maximum(last, mExecutionPlan[i].segmentEnd - 1);
+        }
+    }
+
+    // outputs of a unit are alive until its last child has read them, outputs read by the
+    // application or in the next frame are alive until the end of the plan
+    std::map<Unit*, unsigned> lastRead;
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        Unit* unit = mExecutionPlan[i].unit.get();
+        unsigned last = i;
+        bool read = false;
+        bool external = unit->getKeepAlive();
+        for (unsigned j=0; j < unit->getNumChildren() && !external; j++)
+        {
+            if (dynamic_cast<BarrierNode*>(unit->getChild(j))) external = true;
+
+            Unit* child = dynamic_cast<Unit*>(unit->getChild(j));
+            if (!child) continue;
+
+            std::map<Unit*, unsigned>::const_iterator it = lastStep.find(child);
+            if (it == lastStep.end()) external = true;
+            else last = osg::maximum(last, it->second);
+            read = true;
+        }
+        if (!read || external) last = mExecutionPlan.size() - 1;
+        lastRead[unit] = osg::maximum(last, lastStep[unit]);
+    }
+
+    // peak memory of the outputs, which are written by the plan
+    LiveRanges ranges;
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        const ExecutionStep& step = mExecutionPlan[i];
+        if (step.dead || step.fused) continue;
+
+        const Unit::TextureMap& map = step.unit->getOutputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+        {
+            if (!jt->second.valid()) continue;
+            LiveRanges::iterator range = ranges.insert(LiveRanges::value_type(jt->second.get(), std::make_pair(i, i))).first;
+            range->second.first = osg::minimum(range->second.first, i);
+            range->second.second = osg::maximum(range->second.second, lastRead[step.unit.get()]);
+        }
+    }
+    mOutputMemory = computePeakMemory(ranges, mExecutionPlan.size());
+
+    // physical textures and the last step reading them
+    typedef std::pair<osg::ref_ptr<osg::Texture>, unsigned> Slot;
+    std::vector<Slot> slots;
+
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        // only simple units rendering their outputs are supported
+        UnitInOut* unit = dynamic_cast<UnitInOut*>(mExecutionPlan[i].unit.get());
+        const ExecutionStep& step = mExecutionPlan[i];
+        if (!unit || step.dead || step.fused || step.duplicate || step.sharedGroup.valid() || unit->getKeepAlive() || lastStep[unit] != i) continue;
+        if (std::string(unit->className()) != "UnitInOut" && std::string(unit->className()) != "UnitInResampleOut") continue;
+        if (unit->getInputBypass() >= 0 || unit->mOutputPBO.size()) continue;
+        if (unit->getOutputTextureType() != UnitInOut::TEXTURE_2D && unit->getOutputTextureType() != UnitInOut::TEXTURE_RECTANGLE) continue;
+
+        // find the last step reading the outputs of the unit, outputs read by the application
+        // (no child units) or read in the next frame (barrier) are never shared
+        bool valid = true;
+        unsigned lastUse = i;
+        std::vector<Unit*> consumers;
+        for (unsigned j=0; j < unit->getNumChildren() && valid; j++)
+        {
+            if (dynamic_cast<BarrierNode*>(unit->getChild(j))) valid = false;
+
+            Unit* child = dynamic_cast<Unit*>(unit->getChild(j));
+            if (!child) continue;
+
+            std::map<Unit*, unsigned>::const_iterator it = lastStep.find(child);
+            if (it == lastStep.end()) valid = false;
+            else lastUse = osg::maximum(lastUse, it->second);
+            consumers.push_back(child);
+        }
+        if (!valid || consumers.empty()) continue;
+
+        for (Unit::TextureMap::iterator it = unit->mOutputTex.begin(); it != unit->mOutputTex.end(); it++)
+        {
+            osg::Texture* texture = it->second.get();
+            if (!texture || unit->mUserOutputTex.find(it->first) != unit->mUserOutputTex.end()) continue;
+
+            // the texture must not be passed through by any of the consumers
+            bool passed = false;
+            for (std::vector<Unit*>::iterator jt = consumers.begin(); jt != consumers.end() && !passed; jt++)
+            {
+                const Unit::TextureMap& map = (*jt)->getOutputTextureMap();
+                for (Unit::TextureMap::const_iterator kt = map.begin(); kt != map.end(); kt++)
+                    if (kt->second.get() == texture) passed = true;
+            }
+            if (passed) continue;
+
+            // reuse a texture which is not alive anymore
+            std::vector<Slot>::iterator slot = slots.begin();
+            for (; slot != slots.end(); slot++)
+                if (slot->second < i && isCompatibleOutputTexture(slot->first.get(), texture)) break;
+
+            if (slot == slots.end())
+            {
+                slots.push_back(Slot(texture, lastUse));
+                continue;
+            }
+
+            osg::notify(osg::INFO) << "osgPPU::Processor::aliasOutputTextures() - " << unit->getName() << " (mrt " << it->first << ") shares its output" << std::endl;
+
+            AliasedOutput aliased;
+            aliased.unit = unit;
+            aliased.mrt = it->first;
+            aliased.texture = texture;
+            mAliasedOutputs.push_back(aliased);
+
+            it->second = slot->first;
+            unit->mUserOutputTex.insert(it->first);
+            slot->second = lastUse;
+        }
+    }
+
+    // units have to reassign their outputs and the children their inputs
+    for (std::vector<AliasedOutput>::iterator it = mAliasedOutputs.begin(); it != mAliasedOutputs.end(); it++)
+        it->unit.get()->dirty();
+
+    // a shared texture is alive as long as any of the outputs using it
+    ranges.clear();
+    for (unsigned i=0; i < mExecutionPlan.size(); i++)
+    {
+        const ExecutionStep& step = mExecutionPlan[i];
+        if (step.dead || step.fused) continue;
+
+        const Unit::TextureMap& map = step.unit->getOutputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+        {
+            if (!jt->second.valid()) continue;
+            LiveRanges::iterator range = ranges.insert(LiveRanges::value_type(jt->second.get(), std::make_pair(i, i))).first;
+            range->second.first = osg::minimum(range->second.first, i);
+            range->second.second = osg::maximum(range->second.second, lastRead[step.unit.get()]);
+        }
+    }
+    mAliasedOutputMemory = computePeakMemory(ranges, mExecutionPlan.size());
+
+    osg::notify(osg::INFO) << "osgPPU::Processor::aliasOutputTextures() - " << getName() << " output textures require at most " << mAliasedOutputMemory << " bytes at once instead of " << mOutputMemory << " bytes" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+Processor::MemoryStatistics Processor::getMemoryStatistics() const
+{
+    MemoryStatistics stats;
+    osg::ref_ptr<const PlanSnapshot> plan = getPlanSnapshot();
+
+    // count how many executed units output the same texture
+    std::map<osg::Texture*, unsigned> users;
+    for (ExecutionPlan::const_iterator it = plan->steps.begin(); it != plan->steps.end(); it++)
+    {
+        if (it->dead || it->fused) continue;
+
+        std::set<osg::Texture*> textures;
+        const Unit::TextureMap& map = it->unit->getOutputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+            if (jt->second.valid() && textures.insert(jt->second.get()).second)
+                users[jt->second.get()]++;
+    }
+
+    std::set<osg::Texture*> counted;
+    std::set<const osg::PixelDataBufferObject*> countedPBOs;
+    for (ExecutionPlan::const_iterator it = plan->steps.begin(); it != plan->steps.end(); it++)
+    {
+        Unit* unit = it->unit.get();
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+
+        UnitMemory memory;
+        memory.name = unit->getName();
+        memory.className = unit->className();
+        memory.executed = !it->dead && !it->fused;
+        if (memory.executed)
+        {
+            std::set<osg::Texture*> textures;
+            const Unit::TextureMap& map = unit->getOutputTextureMap();
+            for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+            {
+                osg::Texture* texture = jt->second.get();
+                if (!texture || !textures.insert(texture).second) continue;
+
+                // outputs nobody reads are not attached, hence not allocated
+                if (unitIO && unitIO->mDeadOutputs.find(jt->first) != unitIO->mDeadOutputs.end()) continue;
+
+                unsigned int size = computeTextureSizeInBytes(texture);
+                unsigned int mipmaps = computeTextureSizeInBytes(texture, true) - size;
+
+                memory.numTextures++;
+                memory.textureBytes += size;
+                memory.mipmapBytes += mipmaps;
+                if (users[texture] > 1) memory.sharedBytes += size + mipmaps;
+                stats.unsharedBytes += size + mipmaps;
+
+                if (counted.insert(texture).second)
+                {
+                    stats.numTextures++;
+                    stats.textureBytes += size;
+                    stats.mipmapBytes += mipmaps;
+                }
+            }
+        }
+
+        // PBOs are allocated with the size of their texture, each pbo has a ring of buffers
+        const Unit::PixelDataBufferObjectMap* pbos[2] = {&unit->getInputPBOMap(), &unit->getOutputPBOMap()};
+        for (unsigned i=0; i < 2; i++)
+            for (Unit::PixelDataBufferObjectMap::const_iterator jt = pbos[i]->begin(); jt != pbos[i]->end(); jt++)
+            {
+                if (!jt->second.valid()) continue;
+                unsigned int size = jt->second->getDataSize() * unit->getNumPBOBuffers();
+                memory.pboBytes += size;
+                if (countedPBOs.insert(jt->second.get()).second)
+                    stats.pboBytes += size;
+            }
+
+        stats.units.push_back(memory);
+    }
+
+    stats.poolBytes = TexturePool::instance()->getBytesHeld();
+    return stats;
+}
+
+//------------------------------------------------------------------------------
+void Processor::MemoryStatistics::writeJSON(std::ostream& out) const
+{
+    out << "{" << std::endl;
+    out << "  \"num_textures\": " << numTextures << "," << std::endl;
+    out << "  \"texture_bytes\": " << textureBytes << "," << std::endl;
+    out << "  \"mipmap_bytes\": " << mipmapBytes << "," << std::endl;
+    out << "  \"unshared_bytes\": " << unsharedBytes << "," << std::endl;
+    out << "  \"pbo_bytes\": " << pboBytes << "," << std::endl;
+    out << "  \"pool_bytes\": " << poolBytes << "," << std::endl;
+    out << "  \"total_bytes\": " << getTotalBytes() << "," << std::endl;
+    out << "  \"units\": [" << std::endl;
+    for (unsigned i=0; i < units.size(); i++)
+    {
+        const UnitMemory& unit = units[i];
+        out << "    {\"name\": " << toJSONString(unit.name)
+            << ", \"class\": " << toJSONString(unit.className)
+            << ", \"executed\": " << (unit.executed ? "true" : "false")
+            << ", \"num_textures\": " << unit.numTextures
+            << ", \"texture_bytes\": " << unit.textureBytes
+            << ", \"mipmap_bytes\": " << unit.mipmapBytes
+            << ", \"shared_bytes\": " << unit.sharedBytes
+            << ", \"pbo_bytes\": " << unit.pboBytes << "}"
+            << (i + 1 < units.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+void Processor::setupUnitGraph()
+{
+    // if not initialized before, then do it
+    if (unsigned(mDirtyFlags) & DIRTY_INIT) init();
+
+    // if subgraph is dirty, then we have to resetup it
+    // we do this on the first visitor which runs over the pipeline because this also removes cycles
+    if (unsigned(mDirtyFlags) & DIRTY_UNIT_GRAPH)
+    {
+        // the plan is invalidated first, so that no other thread sees a clean but empty pipeline
+        mDirtyFlags.OR(DIRTY_EXECUTION_PLAN);
+        mDirtyFlags.AND(~unsigned(DIRTY_UNIT_GRAPH));
+
+        // the graph might have been changed, hence the old plan is not valid anymore
+        clearExecutionPlan();
+        restoreFusedUnits();
+        restoreSharedUnits();
+        restoreOutputTextures();
+
+        // first resolve all cycles in the set
+        ResolveUnitsCyclesVisitor rv;
+        rv.run(this);
+
+        // mark every unit as dirty, so that they get updated on the next call
+        MarkUnitsDirtyVisitor nv;
+        nv.run(this);
+
+        // debug information
+        osg::notify(osg::INFO) << "--------------------------------------------------------------------" << std::endl;
+        osg::notify(osg::INFO) << "BEGIN " << getName() << std::endl;
+
+        SetupUnitRenderingVisitor sv(this);
+        sv.run(this);
+
+        osg::notify(osg::INFO) << "END " << getName() << std::endl;
+        osg::notify(osg::INFO) << "--------------------------------------------------------------------" << std::endl;
+
+        // optimize subgraph
+        OptimizeUnitsVisitor ov;
+        ov.run(this);
+
+        // everything is initialized, hence the changed parts need no extra setup
+        mDirtyUnits.clear();
+        mDirtyFlags.OR(DIRTY_EXECUTION_PLAN);
+    }
+    else if (!mDirtyUnits.empty())
+    {
+        // only some parts of the graph have changed, hence initialize only the units below them
+        clearExecutionPlan();
+
+        // cycles can only be introduced by the changed parts
+        for (unsigned int i=0; i < mDirtyUnits.size(); i++)
+        {
+            if (!mDirtyUnits[i].valid()) continue;
+            ResolveUnitsCyclesVisitor rv;
+            mDirtyUnits[i]->accept(rv);
+        }
+        mDirtyUnits.clear();
+
+        // the order has to be computed over the whole graph, however only dirty units are initialized
+        SetupUnitRenderingVisitor sv(this);
+        sv.setInitDirtyUnitsOnly(true);
+        sv.run(this);
+
+        OptimizeUnitsVisitor ov;
+        ov.run(this);
+    }
+
+    // the order of units has changed, hence rebuild the plan
+    if (unsigned(mDirtyFlags) & DIRTY_EXECUTION_PLAN)
+    {
+        // outputs are shared for the new plan only
+        restoreOutputTextures();
+        buildExecutionPlan();
+        if (mbTextureAliasing) aliasOutputTextures();
+
+        // traversals take the new plan from now on, running ones keep the old one
+        publishPlanSnapshot(new PlanSnapshot(mExecutionPlan, mPlanChildren));
+    }
+}
+
+//------------------------------------------------------------------------------
+static unsigned int computeNumMipmapLevels(osg::Texture* texture)
+{
+    GLenum minFilter = texture->getFilter(osg::Texture::MIN_FILTER);
+    if (minFilter == osg::Texture::LINEAR || minFilter == osg::Texture::NEAREST) return 1;
+
+    int size = osg::maximum(texture->getTextureWidth(), texture->getTextureHeight());
+    if (!dynamic_cast<osg::Texture2DArray*>(texture)) size = osg::maximum(size, texture->getTextureDepth());
+
+    unsigned int levels = 1;
+    while (size > 1)
+    {
+        size /= 2;
+        levels++;
+    }
+    return levels;
+}
+
+//------------------------------------------------------------------------------
+bool Processor::dryRun(DryRunResult& result)
+{
+    if (!mCamera.valid())
+    {
+        osg::notify(osg::WARN) << "osgPPU::Processor::dryRun() - " << getName() << " has no camera attached" << std::endl;
+        return false;
+    }
+
+    result.units.clear();
+
+    osg::ref_ptr<const PlanSnapshot> plan;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitGraphMutex);
+        setupUnitGraph();
+        plan = mPlanSnapshot;
+
+        // units might be dirty again after the plan was built (e.g. by aliasing), hence
+        // initialize them as the update traversal would do it
+        for (ExecutionPlan::const_iterator it = plan->steps.begin(); it != plan->steps.end(); it++)
+            if (!it->dead && !it->fused && !it->duplicate) it->unit->update();
+    }
+
+    for (ExecutionPlan::const_iterator it = plan->steps.begin(); it != plan->steps.end(); it++)
+    {
+        const Unit* unit = it->unit.get();
+
+        UnitDescription desc;
+        desc.name = unit->getName();
+        desc.className = unit->className();
+        desc.executed = !it->dead && !it->fused;
+        if (unit->getViewport())
+        {
+            desc.viewportWidth = (int)unit->getViewport()->width();
+            desc.viewportHeight = (int)unit->getViewport()->height();
+        }
+
+        for (std::vector<unsigned>::const_iterator jt = it->parents.begin(); jt != it->parents.end(); jt++)
+            desc.inputs.push_back(plan->steps[*jt].unit->getName());
+
+        const Unit::TextureMap& map = unit->getOutputTextureMap();
+        for (Unit::TextureMap::const_iterator jt = map.begin(); jt != map.end(); jt++)
+        {
+            osg::Texture* texture = jt->second.get();
+            if (!texture) continue;
+
+            OutputDescription output;
+            output.mrt = jt->first;
+            output.width = texture->getTextureWidth();
+            output.height = texture->getTextureHeight();
+            output.depth = osg::maximum(1, texture->getTextureDepth());
+            output.internalFormat = texture->getInternalFormat();
+            output.target = texture->getTextureTarget();
+            output.numLevels = computeNumMipmapLevels(texture);
+            desc.outputs.push_back(output);
+        }
+
+        result.units.push_back(desc);
+    }
+
+    result.memory = getMemoryStatistics();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void Processor::DryRunResult::writeJSON(std::ostream& out) const
+{
+    out << "{" << std::endl;
+    out << "  \"units\": [" << std::endl;
+    for (unsigned i=0; i < units.size(); i++)
+    {
+        const UnitDescription& unit = units[i];
+        out << "    {\"name\": " << toJSONString(unit.name)
+            << ", \"class\": " << toJSONString(unit.className)
+            << ", \"executed\": " << (unit.executed ? "true" : "false")
+            << ", \"viewport\": [" << unit.viewportWidth << ", " << unit.viewportHeight << "]"
+            << ", \"inputs\": [";
+        for (unsigned j=0; j < unit.inputs.size(); j++)
+            out << (j ? ", " : "") << toJSONString(unit.inputs[j]);
+        out << "], \"outputs\": [";
+        for (unsigned j=0; j < unit.outputs.size(); j++)
+        {
+            const OutputDescription& output = unit.outputs[j];
+            out << (j ? ", " : "") << "{\"mrt\": " << output.mrt
+                << ", \"width\": " << output.width << ", \"height\": " << output.height << ", \"depth\": " << output.depth
+                << ", \"internal_format\": " << output.internalFormat << ", \"target\": " << output.target
+                << ", \"levels\": " << output.numLevels << "}";
+        }
+        out << "]}" << (i + 1 < units.size() ? "," : "") << std::endl;
+    }
+    out << "  ]," << std::endl;
+    out << "  \"memory\": ";
+    memory.writeJSON(out);
+    out << "}" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+void Processor::releaseGLObjects(osg::State* state) const
+{
+    if (mProfiler.valid()) mProfiler->releaseGLObjects(state);
+    if (mDirectGeode.valid()) mDirectGeode->releaseGLObjects(state);
+    osg::Group::releaseGLObjects(state);
+}
+
+//------------------------------------------------------------------------------
+void Processor::traverse(osg::NodeVisitor& nv)
+{
+	if (!mCamera)
+		return;
+
+    // the processor might be traversed by several cull threads at once (e.g. when
+    // the same pipeline is shared between views), hence changes of the unit graph
+    // are done under the lock. The lock is taken only while the processor is dirty,
+    // clean pipelines just take the published plan without locking. The plan is never
+    // changed, even if another thread rebuilds the plan meanwhile.
+    // Setup is only done by update and cull traversals, so that the internal visitors
+    // running over the processor during the setup do not re-enter it.
+    bool pipelineVisitor = nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR || nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR;
+    osg::ref_ptr<const PlanSnapshot> plan;
+    if (pipelineVisitor)
+    {
+        if (unsigned(mDirtyFlags))
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mUnitGraphMutex);
+            if (unsigned(mDirtyFlags)) setupUnitGraph();
+        }
+        plan = getPlanSnapshot();
+    }
+
+    // make sure we render only our own camera
+    if (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+    {
+      osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor *>(&nv);
+      if (cv)
+      {
+        if (cv->getCurrentCamera() != getCamera())
+        {
+          return;
+        }
+      }
+
+      osg::notify(osg::DEBUG_INFO) << "--------------------------------------------------------------------" << std::endl;
+      osg::notify(osg::DEBUG_INFO) << "BEGIN FRAME " << getName() << std::endl;
+    }
+
+    // update and cull traversals run over the precompiled plan,
+    // other visitors see the subgraph as usual
+    if (pipelineVisitor)
+    {
+        for (osg::NodeList::const_iterator it = plan->children.begin(); it != plan->children.end(); it++)
+            (*it)->accept(nv);
+
+        SkippedSteps skipped(plan->steps.size(), 0);
+        executePlan(nv, plan->steps, 0, plan->steps.size(), skipped);
+
+        // all units are drawn by one single drawable, which draws the plan culled here
+        if (mbDirectExecution && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
+        {
+            static_cast<DirectExecutionDrawable*>(mDirectGeode->getDrawable(0))->setPlan(plan.get());
+            mDirectGeode->accept(nv);
+        }
+    }else
+    {
+        osg::Group::traverse(nv);
     }
 }
 
@@ -0,0 +1,314 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/Profiler.h>
+#include <osgPPU/Unit.h>
+
+#include <osg/Drawable>
+#include <osg/Timer>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#ifndef GL_TIME_ELAPSED
+    #define GL_TIME_ELAPSED 0x88BF
+#endif
+
+#ifndef GL_QUERY_RESULT
+    #define GL_QUERY_RESULT 0x8866
+#endif
+
+#ifndef GL_QUERY_RESULT_AVAILABLE
+    #define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// Timer queries of every context, which are deleted when the context is current again
+//------------------------------------------------------------------------------
+typedef std::map<unsigned int, std::vector<GLuint> > DeletedQueries;
+
+static DeletedQueries& getDeletedQueries(OpenThreads::Mutex*& mutex)
+{
+    static OpenThreads::Mutex s_mutex;
+    static DeletedQueries s_queries;
+    mutex = &s_mutex;
+    return s_queries;
+}
+
+//------------------------------------------------------------------------------
+void Profiler::Samples::add(double value, unsigned int num)
+{
+    if (values.size() < num)
+    {
+        values.push_back(value);
+        sum += value;
+        return;
+    }
+
+    // replace the oldest sample
+    next = next % values.size();
+    sum += value - values[next];
+    values[next] = value;
+    next++;
+}
+
+//------------------------------------------------------------------------------
+Profiler::Profiler() : osg::Referenced(),
+    mNumSamples(30),
+    mNumQueries(4),
+    mGeneration(0)
+{
+}
+
+//------------------------------------------------------------------------------
+Profiler::~Profiler()
+{
+    releaseGLObjects();
+}
+
+//------------------------------------------------------------------------------
+void Profiler::releaseGLObjects(osg::State* state) const
+{
+    // the context is current, hence its queries can be deleted directly
+    if (state)
+    {
+        unsigned int contextID = state->getContextID();
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(contextID, true);
+        ContextQueries& context = mContextQueries[contextID];
+        for (std::map<const Unit*, Queries>::iterator it = context.units.begin(); it != context.units.end(); it++)
+            if (ext && ext->isTimerQuerySupported() && !it->second.ids.empty()) ext->glDeleteQueries(it->second.ids.size(), &it->second.ids[0]);
+        context.units.clear();
+        return;
+    }
+
+    OpenThreads::Mutex* mutex;
+    DeletedQueries& deleted = getDeletedQueries(mutex);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(*mutex);
+    for (unsigned int i=0; i < mContextQueries.size(); i++)
+    {
+        ContextQueries& context = mContextQueries[i];
+        for (std::map<const Unit*, Queries>::iterator it = context.units.begin(); it != context.units.end(); it++)
+            deleted[i].insert(deleted[i].end(), it->second.ids.begin(), it->second.ids.end());
+        context.units.clear();
+    }
+}
+
+//------------------------------------------------------------------------------
+void Profiler::flushDeletedQueries(unsigned int contextID, osg::Drawable::Extensions* ext)
+{
+    OpenThreads::Mutex* mutex;
+    DeletedQueries& deleted = getDeletedQueries(mutex);
+
+    std::vector<GLuint> queries;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(*mutex);
+        DeletedQueries::iterator it = deleted.find(contextID);
+        if (it == deleted.end()) return;
+        queries.swap(it->second);
+    }
+
+    if (!queries.empty()) ext->glDeleteQueries(queries.size(), &queries[0]);
+}
+
+//------------------------------------------------------------------------------
+void Profiler::setNumSamples(unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    mNumSamples = std::max(1u, num);
+}
+
+//------------------------------------------------------------------------------
+void Profiler::setNumQueries(unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    mNumQueries = std::max(1u, num);
+}
+
+//------------------------------------------------------------------------------
+Profiler::Record& Profiler::getRecord(const Unit* unit)
+{
+    RecordMap::iterator it = mRecords.find(unit);
+    if (it != mRecords.end()) return it->second;
+
+    Record& record = mRecords[unit];
+    record.name = unit->getName();
+    record.order = mRecords.size();
+    return record;
+}
+
+//------------------------------------------------------------------------------
+Profiler::Timing Profiler::getTiming(const Record& record)
+{
+    Timing timing;
+    timing.name = record.name;
+    timing.cullTime = record.cull.average();
+    timing.drawTime = record.draw.average();
+    timing.gpuTime = record.gpu.average();
+    timing.numDraws = record.numDraws;
+    return timing;
+}
+
+//------------------------------------------------------------------------------
+bool Profiler::getTiming(const Unit* unit, Timing& timing) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    RecordMap::const_iterator it = mRecords.find(unit);
+    if (it == mRecords.end()) return false;
+
+    timing = getTiming(it->second);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+Profiler::TimingList Profiler::getTimings() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    TimingList list(mRecords.size());
+    for (RecordMap::const_iterator it = mRecords.begin(); it != mRecords.end(); it++)
+        list[it->second.order - 1] = getTiming(it->second);
+    return list;
+}
+
+//------------------------------------------------------------------------------
+void Profiler::writeCSV(std::ostream& out) const
+{
+    TimingList list = getTimings();
+
+    out << "unit,cull_ms,draw_ms,gpu_ms,draws" << std::endl;
+    for (TimingList::const_iterator it = list.begin(); it != list.end(); it++)
+        out << it->name << "," << it->cullTime << "," << it->drawTime << "," << it->gpuTime << "," << it->numDraws << std::endl;
+}
+
+//------------------------------------------------------------------------------
+void Profiler::reset()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    // queries can only be deleted while their context is current, hence every
+    // context deletes its queries on its next draw as soon as it sees the new generation
+    mGeneration++;
+    mRecords.clear();
+}
+
+//------------------------------------------------------------------------------
+void Profiler::addCullTime(const Unit* unit, double time)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    getRecord(unit).cull.add(time * 1000.0, mNumSamples);
+}
+
+//------------------------------------------------------------------------------
+void Profiler::beginDraw(const Unit* unit, osg::RenderInfo& info)
+{
+    unsigned int numQueries, numSamples, generation;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+        numQueries = mNumQueries;
+        numSamples = mNumSamples;
+        generation = mGeneration;
+    }
+
+    // the queries of the context are used by its draw thread only, hence they need no lock
+    unsigned int contextID = info.getContextID();
+    ContextQueries& context = mContextQueries[contextID];
+    osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(contextID, true);
+    bool supported = ext && ext->isTimerQuerySupported();
+    if (supported) flushDeletedQueries(contextID, ext);
+
+    // delete queries of previous runs, queries never overlap, hence none of them is running
+    if (context.generation != generation)
+    {
+        for (std::map<const Unit*, Queries>::iterator it = context.units.begin(); it != context.units.end(); it++)
+            if (supported && !it->second.ids.empty()) ext->glDeleteQueries(it->second.ids.size(), &it->second.ids[0]);
+        context.units.clear();
+        context.generation = generation;
+    }
+
+    Queries& queries = context.units[unit];
+    queries.drawStart = osg::Timer::instance()->time_s();
+    if (!supported) return;
+
+    // setup ring of queries
+    if (queries.ids.size() != numQueries)
+    {
+        if (!queries.ids.empty()) ext->glDeleteQueries(queries.ids.size(), &queries.ids[0]);
+        queries.ids.resize(numQueries);
+        queries.pending.assign(numQueries, false);
+        queries.next = 0;
+        ext->glGenQueries(numQueries, &queries.ids[0]);
+    }
+
+    // read the result of the query, which was started a ring length before
+    GLuint id = queries.ids[queries.next];
+    if (queries.pending[queries.next])
+    {
+        // never wait for the gpu, hence drop the sample if the result is not there yet
+        GLint available = 0;
+        ext->glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            queries.next = (queries.next + 1) % numQueries;
+            return;
+        }
+
+        GLuint64EXT elapsed = 0;
+        ext->glGetQueryObjectui64v(id, GL_QUERY_RESULT, &elapsed);
+        queries.pending[queries.next] = false;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+        getRecord(unit).gpu.add(double(elapsed) * 1e-6, numSamples);
+    }
+
+    ext->glBeginQuery(GL_TIME_ELAPSED, id);
+    queries.pending[queries.next] = true;
+    queries.active = true;
+}
+
+//------------------------------------------------------------------------------
+void Profiler::endDraw(const Unit* unit, osg::RenderInfo& info)
+{
+    unsigned int contextID = info.getContextID();
+    ContextQueries& context = mContextQueries[contextID];
+    std::map<const Unit*, Queries>::iterator it = context.units.find(unit);
+    if (it == context.units.end()) return;
+    Queries& queries = it->second;
+
+    // stop the query started by beginDraw()
+    if (queries.active)
+    {
+        osg::Drawable::Extensions* ext = osg::Drawable::getExtensions(contextID, true);
+        ext->glEndQuery(GL_TIME_ELAPSED);
+        queries.next = (queries.next + 1) % queries.ids.size();
+        queries.active = false;
+    }
+
+    double drawTime = (osg::Timer::instance()->time_s() - queries.drawStart) * 1000.0;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    Record& record = getRecord(unit);
+    record.draw.add(drawTime, mNumSamples);
+    record.numDraws++;
+}
+
+}; //end namespace
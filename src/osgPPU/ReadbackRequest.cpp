@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/ReadbackRequest.h>
+
+#include <OpenThreads/ScopedLock>
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+ReadbackRequest::ReadbackRequest(int mrt, int level, int x, int y, int width, int height, GLenum format, GLenum type) :
+    mMRT(mrt),
+    mLevel(level),
+    mFormat(format),
+    mType(type),
+    mStatus(PENDING),
+    mResult(PENDING),
+    mContextID(0),
+    mAge(0)
+{
+    mRegion[0] = x;
+    mRegion[1] = y;
+    mRegion[2] = width;
+    mRegion[3] = height;
+}
+
+//------------------------------------------------------------------------------
+ReadbackRequest::Status ReadbackRequest::getStatus() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mStatus;
+}
+
+//------------------------------------------------------------------------------
+bool ReadbackRequest::isDone() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mStatus == COMPLETE || mStatus == FAILED;
+}
+
+//------------------------------------------------------------------------------
+osg::Image* ReadbackRequest::getImage()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mStatus == COMPLETE ? mImage.get() : NULL;
+}
+
+//------------------------------------------------------------------------------
+const osg::Image* ReadbackRequest::getImage() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mStatus == COMPLETE ? mImage.get() : NULL;
+}
+
+//------------------------------------------------------------------------------
+bool ReadbackRequest::wait() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    while (mStatus != COMPLETE && mStatus != FAILED) mCondition.wait(&mMutex);
+    return mStatus == COMPLETE;
+}
+
+//------------------------------------------------------------------------------
+void ReadbackRequest::complete()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+        mStatus = mResult;
+        mCondition.broadcast();
+    }
+
+    if (mCallback.valid()) (*mCallback)(this);
+}
+
+};
@@ -16,7 +16,12 @@
 
 #include <osgPPU/ShaderAttribute.h>
 #include <osg/StateAttribute>
+#include <osg/Notify>
 #include <assert.h>
+#include <ctype.h>
+#include <sstream>
+#include <set>
+#include <map>
 
 #define DEBUG_SH 0
 
@@ -28,6 +33,7 @@ ShaderAttribute::ShaderAttribute()
 {
     mDirtyTextureBindings = true;
     mMaxTextureUnits = 8;
+    mbPointwise = false;
 }
 
 //--------------------------------------------------------------------------
@@ -35,7 +41,8 @@ ShaderAttribute::ShaderAttribute(const ShaderAttribute& sh, const osg::CopyOp& c
     osg::Program(sh, copyop),
     mTexUnits(sh.mTexUnits),
     mDirtyTextureBindings(sh.mDirtyTextureBindings),
-    mMaxTextureUnits(sh.mMaxTextureUnits)
+    mMaxTextureUnits(sh.mMaxTextureUnits),
+    mbPointwise(sh.mbPointwise)
 {
     setName(sh.getName());
 
@@ -457,5 +464,467 @@ void ShaderAttribute::resetTextureUniforms()
     mDirtyTextureBindings = false;
 }
 
+//--------------------------------------------------------------------------
+// Helper functions to rewrite the sources of point-wise shaders
+//--------------------------------------------------------------------------
+static bool isIdentifierChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+//--------------------------------------------------------------------------
+static size_t findIdentifier(const std::string& src, const std::string& id, size_t pos = 0)
+{
+    for (size_t found = src.find(id, pos); found != std::string::npos; found = src.find(id, found + 1))
+    {
+        bool begin = found == 0 || !isIdentifierChar(src[found - 1]);
+        bool end = found + id.size() >= src.size() || !isIdentifierChar(src[found + id.size()]);
+        if (begin && end) return found;
+    }
+    return std::string::npos;
+}
+
+//--------------------------------------------------------------------------
+static std::string replaceIdentifier(const std::string& src, const std::string& id, const std::string& by)
+{
+    std::string result;
+    size_t pos = 0;
+    for (size_t found = findIdentifier(src, id); found != std::string::npos; found = findIdentifier(src, id, pos))
+    {
+        result += src.substr(pos, found - pos) + by;
+        pos = found + id.size();
+    }
+    return result + src.substr(pos);
+}
+
+//--------------------------------------------------------------------------
+static bool isSamplerType(osg::Uniform::Type type)
+{
+    return type == osg::Uniform::SAMPLER_1D || type == osg::Uniform::SAMPLER_2D
+        || type == osg::Uniform::SAMPLER_3D || type == osg::Uniform::SAMPLER_CUBE
+        || type == osg::Uniform::SAMPLER_1D_ARRAY || type == osg::Uniform::SAMPLER_2D_ARRAY;
+}
+
+//--------------------------------------------------------------------------
+// Check whenever two uniforms of the same name can be shared by one program. This is the case
+// for the same uniform and for samplers bound to the same texture unit, i.e. texUnit0 of every shader.
+//--------------------------------------------------------------------------
+static bool isSharableUniform(const osg::Uniform* a, const osg::Uniform* b)
+{
+    if (a == b) return true;
+    if (!isSamplerType(a->getType()) || a->getType() != b->getType()) return false;
+
+    int unitA = -1, unitB = -1;
+    return a->get(unitA) && b->get(unitB) && unitA == unitB;
+}
+
+//--------------------------------------------------------------------------
+static size_t skipSpaces(const std::string& src, size_t pos)
+{
+    while (pos < src.size() && isspace((unsigned char)src[pos])) pos++;
+    return pos;
+}
+
+//--------------------------------------------------------------------------
+// Replace every texture lookup of the given sampler (texture2D(sampler, ...) and alike) by an expression
+//--------------------------------------------------------------------------
+static std::string replaceTextureLookups(const std::string& src, const std::string& sampler, const std::string& by)
+{
+    std::string result;
+    size_t pos = 0;
+    for (size_t found = src.find("texture"); found != std::string::npos; found = src.find("texture", found + 1))
+    {
+        if (found < pos || (found > 0 && isIdentifierChar(src[found - 1]))) continue;
+
+        // function name followed by the sampler as first argument
+        size_t i = found;
+        while (i < src.size() && isIdentifierChar(src[i])) i++;
+        size_t open = skipSpaces(src, i);
+        if (open >= src.size() || src[open] != '(') continue;
+        size_t arg = skipSpaces(src, open + 1);
+        if (src.compare(arg, sampler.size(), sampler) != 0) continue;
+        size_t comma = skipSpaces(src, arg + sampler.size());
+        if (comma >= src.size() || src[comma] != ',') continue;
+
+        // find the closing bracket of the call
+        int depth = 0;
+        size_t close = open;
+        for (; close < src.size(); close++)
+        {
+            if (src[close] == '(') depth++;
+            else if (src[close] == ')' && --depth == 0) break;
+        }
+        if (close >= src.size()) break;
+
+        result += src.substr(pos, found - pos) + by;
+        pos = close + 1;
+    }
+    return result + src.substr(pos);
+}
+
+//--------------------------------------------------------------------------
+// Remove the declaration of a single uniform, i.e. "uniform sampler2D name;"
+//--------------------------------------------------------------------------
+static std::string removeUniformDeclaration(const std::string& src, const std::string& name)
+{
+    for (size_t found = findIdentifier(src, "uniform"); found != std::string::npos; found = findIdentifier(src, "uniform", found + 1))
+    {
+        size_t end = src.find(';', found);
+        if (end == std::string::npos) break;
+
+        std::string decl = src.substr(found, end - found);
+        if (decl.find(',') != std::string::npos) continue;
+
+        // the name has to be the last identifier of the declaration
+        size_t last = decl.size();
+        while (last > 0 && isspace((unsigned char)decl[last - 1])) last--;
+        if (last < name.size() || decl.compare(last - name.size(), name.size(), name) != 0) continue;
+        if (last > name.size() && isIdentifierChar(decl[last - name.size() - 1])) continue;
+
+        return src.substr(0, found) + src.substr(end + 1);
+    }
+    return src;
+}
+
+//--------------------------------------------------------------------------
+// Add the name declared by a statement of the global scope, except uniforms and inputs
+//--------------------------------------------------------------------------
+static void addDeclaredName(const std::string& statement, std::set<std::string>& names)
+{
+    size_t first = skipSpaces(statement, 0);
+    const char* qualifiers[] = {"uniform", "varying", "in", "precision", "#"};
+    for (unsigned i=0; i < sizeof(qualifiers) / sizeof(qualifiers[0]); i++)
+    {
+        std::string q(qualifiers[i]);
+        if (statement.compare(first, q.size(), q) == 0 && (q == "#" || !isIdentifierChar(statement[first + q.size()]))) return;
+    }
+
+    // the name is the identifier in front of the first bracket or assignment
+    size_t last = statement.find_first_of("([=");
+    if (last == std::string::npos) last = statement.size();
+    while (last > 0 && isspace((unsigned char)statement[last - 1])) last--;
+    size_t begin = last;
+    while (begin > 0 && isIdentifierChar(statement[begin - 1])) begin--;
+
+    if (begin < last && statement.substr(begin, last - begin) != "main")
+        names.insert(statement.substr(begin, last - begin));
+}
+
+//--------------------------------------------------------------------------
+// Collect names of functions and variables declared in the global scope of a shader
+//--------------------------------------------------------------------------
+static void collectGlobalNames(const std::string& src, std::set<std::string>& names)
+{
+    int depth = 0;
+    std::string statement;
+    for (size_t i=0; i < src.size(); i++)
+    {
+        // skip comments and preprocessor directives
+        if (src.compare(i, 2, "//") == 0 || src[i] == '#')
+        {
+            i = src.find('\n', i);
+            if (i == std::string::npos) break;
+            continue;
+        }
+        if (src.compare(i, 2, "/*") == 0)
+        {
+            i = src.find("*/", i);
+            if (i == std::string::npos) break;
+            i++;
+            continue;
+        }
+
+        if (src[i] == '{')
+        {
+            if (depth == 0) addDeclaredName(statement, names);
+            statement.clear();
+            depth++;
+        }else if (src[i] == '}')
+        {
+            depth--;
+            statement.clear();
+        }else if (depth == 0 && src[i] == ';')
+        {
+            addDeclaredName(statement, names);
+            statement.clear();
+        }else if (depth == 0)
+            statement += src[i];
+    }
+}
+
+//--------------------------------------------------------------------------
+// Insert declarations behind the #version and #extension directives of a shader
+//--------------------------------------------------------------------------
+static std::string insertDeclarations(const std::string& src, const std::string& decl)
+{
+    size_t insert = 0;
+    size_t line = 0;
+    while (line < src.size())
+    {
+        size_t next = src.find('\n', line);
+        if (next == std::string::npos) next = src.size(); else next++;
+
+        size_t begin = skipSpaces(src, line);
+        if (src.compare(begin, 8, "#version") == 0 || src.compare(begin, 10, "#extension") == 0) insert = next;
+        line = next;
+    }
+    return src.substr(0, insert) + decl + src.substr(insert);
+}
+
+//--------------------------------------------------------------------------
+// Get the only fragment shader of the attribute, vertex shaders must be equal to the ones of the first attribute
+//--------------------------------------------------------------------------
+static osg::Shader* getCombinableFragmentShader(const ShaderAttribute* first, const ShaderAttribute* attr)
+{
+    osg::Shader* fragment = NULL;
+    unsigned numVertex = 0, numFirstVertex = 0;
+    for (unsigned j=0; j < first->getNumShaders(); j++)
+        if (first->getShader(j)->getType() == osg::Shader::VERTEX) numFirstVertex++;
+
+    for (unsigned j=0; j < attr->getNumShaders(); j++)
+    {
+        osg::Shader* shader = const_cast<osg::Shader*>(attr->getShader(j));
+        if (shader->getType() == osg::Shader::FRAGMENT)
+        {
+            if (fragment) return NULL;
+            fragment = shader;
+        }else if (shader->getType() == osg::Shader::VERTEX)
+        {
+            if (first->getShaderIndex(shader) >= first->getNumShaders()) return NULL;
+            numVertex++;
+        }else
+            return NULL;
+    }
+    if (attr != first && numVertex > 0 && numVertex != numFirstVertex) return NULL;
+    if (!fragment) return NULL;
+
+    // only shaders writing one color can be combined
+    const std::string& src = fragment->getShaderSource();
+    if (findIdentifier(src, "gl_FragColor") == std::string::npos || findIdentifier(src, "gl_FragData") != std::string::npos)
+        return NULL;
+
+    return fragment;
+}
+
+//--------------------------------------------------------------------------
+ShaderAttribute* ShaderAttribute::createFusedShader(const std::vector<ShaderAttribute*>& stages)
+{
+    if (stages.size() < 2) return NULL;
+
+    const char* colorVar = "osgppu_FusedColor";
+    const char* inputVar = "osgppu_FusedInput";
+
+    osg::ref_ptr<ShaderAttribute> fused = new ShaderAttribute();
+    osg::StateSet::UniformList uniforms;
+    std::set<std::string> globalNames;
+    std::ostringstream mainSrc;
+    std::string name;
+
+    // vertex shaders of the first stage are used for the fused shader
+    for (unsigned j=0; stages[0] && j < stages[0]->getNumShaders(); j++)
+        if (stages[0]->getShader(j)->getType() == osg::Shader::VERTEX)
+            fused->addShader(stages[0]->getShader(j));
+
+    for (unsigned i=0; i < stages.size(); i++)
+    {
+        ShaderAttribute* stage = stages[i];
+        if (!stage) return NULL;
+
+        osg::Shader* fragment = getCombinableFragmentShader(stages[0], stage);
+        if (!fragment) return NULL;
+        std::string src = fragment->getShaderSource();
+
+        // input of the point-wise stages is the result of the previous stage
+        std::string input;
+        if (i > 0)
+        {
+            if (!stage->getPointwise() || !stage->mTexUnits.empty()) return NULL;
+
+            for (osg::StateSet::UniformList::const_iterator it = stage->mUniforms.begin(); it != stage->mUniforms.end() && input.empty(); it++)
+            {
+                int unit = -1;
+                if (isSamplerType(it->second.first->getType()) && it->second.first->get(unit) && unit == 0)
+                    input = it->first;
+            }
+            if (input.empty()) return NULL;
+
+            src = replaceTextureLookups(src, input, inputVar);
+            src = removeUniformDeclaration(src, input);
+            if (findIdentifier(src, input) != std::string::npos)
+            {
+                osg::notify(osg::INFO) << "osgPPU::ShaderAttribute::createFusedShader() - " << stage->getName() << " uses its input " << input << " not only point-wise" << std::endl;
+                return NULL;
+            }
+        }
+
+        // all stages are linked into one program, hence functions and globals must not clash
+        std::set<std::string> names;
+        collectGlobalNames(src, names);
+        for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); it++)
+            if (!globalNames.insert(*it).second) return NULL;
+
+        // uniforms are shared, hence names must not clash
+        for (osg::StateSet::UniformList::const_iterator it = stage->mUniforms.begin(); it != stage->mUniforms.end(); it++)
+        {
+            if (it->first == input) continue;
+            osg::StateSet::UniformList::const_iterator jt = uniforms.find(it->first);
+            if (jt != uniforms.end() && !isSharableUniform(jt->second.first.get(), it->second.first.get())) return NULL;
+            uniforms[it->first] = it->second;
+        }
+
+        // every stage becomes a function writing to the shared color variable
+        std::ostringstream function;
+        function << "osgppu_FusedStage" << i;
+        src = replaceIdentifier(src, "main", function.str());
+        src = replaceIdentifier(src, "gl_FragColor", colorVar);
+        src = insertDeclarations(src, std::string("vec4 ") + colorVar + ";\nvec4 " + inputVar + ";\n");
+        fused->addShader(new osg::Shader(osg::Shader::FRAGMENT, src));
+
+        mainSrc << "void " << function.str() << "();\n";
+        name += (i > 0 ? "+" : "") + stage->getName();
+    }
+
+    mainSrc << "vec4 " << colorVar << ";\n";
+    mainSrc << "vec4 " << inputVar << ";\n";
+    mainSrc << "void main()\n{\n";
+    for (unsigned i=0; i < stages.size(); i++)
+    {
+        if (i > 0) mainSrc << "    " << inputVar << " = " << colorVar << ";\n";
+        mainSrc << "    osgppu_FusedStage" << i << "();\n";
+    }
+    mainSrc << "    gl_FragColor = " << colorVar << ";\n}\n";
+    fused->addShader(new osg::Shader(osg::Shader::FRAGMENT, mainSrc.str()));
+
+    // texture bindings and attributes of the first stage
+    ShaderAttribute* first = stages[0];
+    fused->setName(name);
+    fused->mUniforms = uniforms;
+    fused->mTexUnits = first->mTexUnits;
+    fused->mMaxTextureUnits = first->mMaxTextureUnits;
+    for (osg::Program::AttribBindingList::const_iterator it = first->getAttribBindingList().begin(); it != first->getAttribBindingList().end(); it++)
+        fused->addBindAttribLocation(it->first, it->second);
+
+    return fused.release();
+}
+
+//--------------------------------------------------------------------------
+ShaderAttribute* ShaderAttribute::createMergedShader(const std::vector<ShaderAttribute*>& shaders)
+{
+    if (shaders.size() < 2 || !shaders[0]) return NULL;
+
+    const char* inputVar = "osgppu_MergedInput";
+
+    osg::ref_ptr<ShaderAttribute> merged = new ShaderAttribute();
+    osg::StateSet::UniformList uniforms;
+    std::map<int, const osg::Uniform*> samplerUniforms;
+    std::map<int, std::string> samplers;
+    unsigned numSharedFetches = 0;
+    std::set<std::string> globalNames;
+    std::ostringstream mainSrc;
+    std::string name;
+
+    // vertex shaders of the first shader are used for the merged shader
+    ShaderAttribute* first = shaders[0];
+    for (unsigned j=0; j < first->getNumShaders(); j++)
+        if (first->getShader(j)->getType() == osg::Shader::VERTEX)
+            merged->addShader(first->getShader(j));
+
+    for (unsigned i=0; i < shaders.size(); i++)
+    {
+        ShaderAttribute* shader = shaders[i];
+        if (!shader || !shader->mTexUnits.empty()) return NULL;
+
+        osg::Shader* fragment = getCombinableFragmentShader(first, shader);
+        if (!fragment) return NULL;
+        std::string src = fragment->getShaderSource();
+
+        // samplers reading the same texture unit are replaced by the sampler of the first shader reading it
+        std::set<std::string> replaced;
+        bool readsInput = false;
+        for (osg::StateSet::UniformList::const_iterator it = shader->mUniforms.begin(); it != shader->mUniforms.end(); it++)
+        {
+            int unit = -1;
+            if (!isSamplerType(it->second.first->getType()) || !it->second.first->get(unit)) continue;
+            if (unit == 0) readsInput = true;
+
+            std::map<int, std::string>::const_iterator jt = samplers.find(unit);
+            if (jt == samplers.end())
+            {
+                samplers[unit] = it->first;
+                samplerUniforms[unit] = it->second.first.get();
+            }
+            else if (jt->second != it->first)
+            {
+                src = removeUniformDeclaration(src, it->first);
+                src = replaceIdentifier(src, it->first, jt->second);
+                replaced.insert(it->first);
+            }
+        }
+
+        // point-wise shaders read the input of unit 0 at the current fragment only, hence
+        // it is fetched once by the main function and passed to all of them
+        bool sharesInput = false;
+        if (readsInput && shader->getPointwise() && samplerUniforms[0]->getType() == osg::Uniform::SAMPLER_2D)
+        {
+            const std::string& input = samplers[0];
+            std::string shared = removeUniformDeclaration(replaceTextureLookups(src, input, inputVar), input);
+            if (findIdentifier(shared, input) == std::string::npos)
+            {
+                src = shared;
+                sharesInput = true;
+                numSharedFetches++;
+            }
+        }
+
+        // all shaders are linked into one program, hence functions and globals must not clash
+        std::set<std::string> names;
+        collectGlobalNames(src, names);
+        for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); it++)
+            if (!globalNames.insert(*it).second) return NULL;
+        if (sharesInput) src = insertDeclarations(src, std::string("vec4 ") + inputVar + ";\n");
+
+        // uniforms are shared, hence names must not clash
+        for (osg::StateSet::UniformList::const_iterator it = shader->mUniforms.begin(); it != shader->mUniforms.end(); it++)
+        {
+            if (replaced.find(it->first) != replaced.end()) continue;
+            osg::StateSet::UniformList::const_iterator jt = uniforms.find(it->first);
+            if (jt != uniforms.end() && !isSharableUniform(jt->second.first.get(), it->second.first.get())) return NULL;
+            uniforms[it->first] = it->second;
+        }
+
+        // every shader becomes a function writing to its own render target
+        std::ostringstream function, output;
+        function << "osgppu_MergedStage" << i;
+        output << "gl_FragData[" << i << "]";
+        src = replaceIdentifier(src, "main", function.str());
+        src = replaceIdentifier(src, "gl_FragColor", output.str());
+        merged->addShader(new osg::Shader(osg::Shader::FRAGMENT, src));
+
+        mainSrc << "void " << function.str() << "();\n";
+        name += (i > 0 ? "|" : "") + shader->getName();
+    }
+
+    if (numSharedFetches)
+    {
+        mainSrc << "uniform sampler2D " << samplers[0] << ";\n";
+        mainSrc << "vec4 " << inputVar << ";\n";
+    }
+    mainSrc << "void main()\n{\n";
+    if (numSharedFetches)
+        mainSrc << "    " << inputVar << " = texture2D(" << samplers[0] << ", gl_TexCoord[0].st);\n";
+    for (unsigned i=0; i < shaders.size(); i++)
+        mainSrc << "    osgppu_MergedStage" << i << "();\n";
+    mainSrc << "}\n";
+    merged->addShader(new osg::Shader(osg::Shader::FRAGMENT, mainSrc.str()));
+
+    merged->setName(name);
+    merged->mUniforms = uniforms;
+    merged->mMaxTextureUnits = first->mMaxTextureUnits;
+    for (osg::Program::AttribBindingList::const_iterator it = first->getAttribBindingList().begin(); it != first->getAttribBindingList().end(); it++)
+        merged->addBindAttribLocation(it->first, it->second);
+
+    return merged.release();
+}
+
 }; //end namespace
 
@@ -0,0 +1,194 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+#include <osgPPU/TexturePool.h>
+#include <osgPPU/Utility.h>
+
+#include <osg/Math>
+#include <OpenThreads/ScopedLock>
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+bool TexturePool::Key::operator< (const Key& key) const
+{
+    if (_target != key._target) return _target < key._target;
+    if (_width != key._width) return _width < key._width;
+    if (_height != key._height) return _height < key._height;
+    if (_depth != key._depth) return _depth < key._depth;
+    if (_internalFormat != key._internalFormat) return _internalFormat < key._internalFormat;
+    return _numMipmaps < key._numMipmaps;
+}
+
+//------------------------------------------------------------------------------
+TexturePool* TexturePool::instance()
+{
+    static osg::ref_ptr<TexturePool> s_pool = new TexturePool();
+    return s_pool.get();
+}
+
+//------------------------------------------------------------------------------
+TexturePool::TexturePool() : osg::Referenced(),
+    mNumHits(0),
+    mNumMisses(0),
+    mBytesHeld(0),
+    mMaxBytesHeld(128 * 1024 * 1024),
+    mStamp(0)
+{
+}
+
+//------------------------------------------------------------------------------
+TexturePool::~TexturePool()
+{
+}
+
+//------------------------------------------------------------------------------
+TexturePool::Key TexturePool::computeKey(osg::Texture* texture)
+{
+    if (texture == NULL) return Key();
+
+    return computeKey(texture->getTextureTarget(), texture->getTextureWidth(), texture->getTextureHeight(),
+        texture->getTextureDepth(), texture->getInternalFormat(), texture->getFilter(osg::Texture::MIN_FILTER));
+}
+
+//------------------------------------------------------------------------------
+TexturePool::Key TexturePool::computeKey(GLenum target, int width, int height, int depth, GLenum internalFormat, osg::Texture::FilterMode minFilter)
+{
+    // mipmap levels are only used if the filter does require them
+    unsigned numMipmaps = 0;
+    if (minFilter != osg::Texture::LINEAR && minFilter != osg::Texture::NEAREST)
+    {
+        int size = osg::maximum(width, height);
+        for (; size > 1; size >>= 1) numMipmaps++;
+    }
+
+    return Key(target, width, height, osg::maximum(1, depth), internalFormat, numMipmaps);
+}
+
+//------------------------------------------------------------------------------
+osg::ref_ptr<osg::Texture> TexturePool::acquire(const Key& key)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    TextureMap::iterator it = mTextures.find(key);
+    if (it == mTextures.end())
+    {
+        mNumMisses++;
+        return NULL;
+    }
+
+    // the caller holds the reference from now on
+    osg::ref_ptr<osg::Texture> texture = it->second.texture;
+    mTextures.erase(it);
+
+    mBytesHeld -= computeTextureSizeInBytes(texture.get(), true);
+    mNumHits++;
+
+    return texture;
+}
+
+//------------------------------------------------------------------------------
+void TexturePool::release(osg::Texture* texture)
+{
+    if (texture == NULL) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    // the same texture must not be twice in the pool
+    Key key = computeKey(texture);
+    std::pair<TextureMap::iterator, TextureMap::iterator> range = mTextures.equal_range(key);
+    for (TextureMap::iterator it = range.first; it != range.second; it++)
+        if (it->second.texture.get() == texture) return;
+
+    Entry entry;
+    entry.texture = texture;
+    entry.stamp = mStamp++;
+    mTextures.insert(TextureMap::value_type(key, entry));
+    mBytesHeld += computeTextureSizeInBytes(texture, true);
+
+    trim();
+}
+
+//------------------------------------------------------------------------------
+void TexturePool::setMaxBytesHeld(unsigned int bytes)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    mMaxBytesHeld = bytes;
+    trim();
+}
+
+//------------------------------------------------------------------------------
+void TexturePool::trim()
+{
+    // textures nobody asked for since long are not likely to be asked for anymore
+    while (mBytesHeld > mMaxBytesHeld && !mTextures.empty())
+    {
+        TextureMap::iterator oldest = mTextures.begin();
+        for (TextureMap::iterator it = mTextures.begin(); it != mTextures.end(); it++)
+            if (it->second.stamp < oldest->second.stamp) oldest = it;
+
+        mBytesHeld -= computeTextureSizeInBytes(oldest->second.texture.get(), true);
+        mTextures.erase(oldest);
+    }
+}
+
+//------------------------------------------------------------------------------
+void TexturePool::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+    mTextures.clear();
+    mBytesHeld = 0;
+}
+
+//------------------------------------------------------------------------------
+unsigned int TexturePool::getMaxBytesHeld() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mMaxBytesHeld;
+}
+
+//------------------------------------------------------------------------------
+unsigned int TexturePool::getNumHits() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mNumHits;
+}
+
+//------------------------------------------------------------------------------
+unsigned int TexturePool::getNumMisses() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mNumMisses;
+}
+
+//------------------------------------------------------------------------------
+unsigned int TexturePool::getBytesHeld() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mBytesHeld;
+}
+
+//------------------------------------------------------------------------------
+unsigned int TexturePool::getNumTexturesHeld() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+    return mTextures.size();
+}
+
+}; //end namespace
@@ -29,7 +29,9 @@
 #include <osg/Program>
 #include <osg/FrameBufferObject>
 #include <osg/Geometry>
+#include <OpenThreads/ScopedLock>
 #include <math.h>
+#include <string.h>
 
 namespace osgPPU
 {
@@ -38,13 +40,18 @@ namespace osgPPU
 Unit::Unit() : osg::Group(),
     mbDirty(true),
     mInputTexIndexForViewportReference(0),
+    mNumPBOBuffers(1),
+    mMaxReadbackLatency(2),
     mbActive(true),
-    mbUpdateTraversed(false),
-    mbCullTraversed(false)
+    mbKeepAlive(false),
+    mPlanProcessor(NULL)
 {
     // set default name
     setName("__Nameless_PPU_");
 
+    // pbos transfer the whole textures by default
+    for (unsigned int i=0; i < 4; i++) mPBORegion[i] = 0;
+
     // create default geode
     mGeode = new osg::Geode();
     mGeode->setCullingActive(false);
@@ -99,16 +106,30 @@ Unit::Unit(const Unit& ppu, const osg::CopyOp& copyop) :
     mbDirty(ppu.mbDirty),
     mInputTexIndexForViewportReference(ppu.mInputTexIndexForViewportReference),
     mbActive(ppu.mbActive),
-    mbUpdateTraversed(ppu.mbUpdateTraversed),
-    mbCullTraversed(ppu.mbCullTraversed),
-    mPushedFBO(ppu.mPushedFBO)
+    mbKeepAlive(ppu.mbKeepAlive),
+    mPlanProcessor(NULL),
+    mPushedFBO(ppu.mPushedFBO),
+    mNumPBOBuffers(ppu.mNumPBOBuffers),
+    mMaxReadbackLatency(ppu.mMaxReadbackLatency)
 {
-
+    for (unsigned int i=0; i < 4; i++) mPBORegion[i] = ppu.mPBORegion[i];
 }
 
 //------------------------------------------------------------------------------
 Unit::~Unit()
 {
+    // requests which are not serviced anymore fail, their buffers and fences are deleted
+    // when their context is current the next time, as osg does with its own objects
+    for (std::list<osg::ref_ptr<ReadbackRequest> >::iterator it = mReadbacks.begin(); it != mReadbacks.end(); it++)
+    {
+        ReadbackRequest& request = *(it->get());
+        if (request.mBuffer.valid()) request.mBuffer->releaseDeferred();
+        request.mBuffer = NULL;
+        request.mResult = ReadbackRequest::FAILED;
+    }
+
+    mFinishedReadbacks.splice(mFinishedReadbacks.end(), mReadbacks);
+    completeReadbacks();
 }
 
 //------------------------------------------------------------------------------
@@ -137,6 +158,382 @@ void Unit::setUsePBOForOutputTexture(int mrt, bool use)
     }
 }
 
+//------------------------------------------------------------------------------
+void Unit::setNumPBOBuffers(unsigned int num)
+{
+    mNumPBOBuffers = num > 0 ? num : 1;
+}
+
+//------------------------------------------------------------------------------
+void Unit::setPBORegion(int x, int y, int width, int height)
+{
+    mPBORegion[0] = x;
+    mPBORegion[1] = y;
+    mPBORegion[2] = width;
+    mPBORegion[3] = height;
+}
+
+//------------------------------------------------------------------------------
+void Unit::computePBORegion(osg::Texture* texture, int& x, int& y, int& width, int& height) const
+{
+    int texWidth = texture->getTextureWidth();
+    int texHeight = texture->getTextureHeight();
+
+    if (mPBORegion[2] <= 0 || mPBORegion[3] <= 0)
+    {
+        x = 0; y = 0; width = texWidth; height = texHeight;
+        return;
+    }
+
+    x = osg::clampBetween(mPBORegion[0], 0, texWidth);
+    y = osg::clampBetween(mPBORegion[1], 0, texHeight);
+    width = osg::minimum(mPBORegion[2], texWidth - x);
+    height = osg::minimum(mPBORegion[3], texHeight - y);
+}
+
+//------------------------------------------------------------------------------
+void Unit::clearPBORing(PBORing& ring)
+{
+    if (ring.transfers.valid()) ring.transfers->release();
+
+    ring.buffers.clear();
+    ring.size = 0;
+    ring.current = 0;
+    ring.count = 0;
+}
+
+//------------------------------------------------------------------------------
+bool Unit::updatePBORing(PBORing& ring, osg::PixelDataBufferObject* pbo, osg::State& state)
+{
+    if (!pbo)
+    {
+        clearPBORing(ring);
+        return false;
+    }
+
+    // the pbo given out last time is a buffer of the ring, unless the pbo was replaced or resized
+    bool member = false;
+    for (unsigned int i=0; i < ring.buffers.size() && !member; i++)
+        member = ring.buffers[i].get() == pbo;
+    if (member && pbo->getDataSize() == ring.size && ring.buffers.size() == mNumPBOBuffers) return true;
+
+    // the buffers are compiled here once, not on every draw
+    clearPBORing(ring);
+    ring.size = pbo->getDataSize();
+    ring.buffers.push_back(pbo);
+    for (unsigned int i=1; i < mNumPBOBuffers; i++)
+    {
+        osg::PixelDataBufferObject* buffer = new osg::PixelDataBufferObject();
+        buffer->setDataSize(pbo->getDataSize());
+        ring.buffers.push_back(buffer);
+    }
+    for (unsigned int i=0; i < ring.buffers.size(); i++)
+        ring.buffers[i]->compileBuffer(state);
+
+    if (!ring.transfers.valid()) ring.transfers = new PixelBufferRing(GL_PIXEL_PACK_BUFFER_ARB, GL_STREAM_READ_ARB);
+    ring.transfers->resize(state.getContextID(), ring.buffers.size());
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void Unit::beginPBOTransfer(osg::RenderInfo& ri)
+{
+    osg::State& state = *ri.getState();
+    unsigned int contextID = ri.getContextID();
+
+    // read the input textures into the next buffer of their ring
+    for (PixelDataBufferObjectMap::iterator it = mInputPBO.begin(); it != mInputPBO.end(); it++)
+    {
+        PBORing& ring = mInputPBORing[it->first];
+        osg::Texture* texture = mInputTex[it->first].get();
+        if (!texture || !updatePBORing(ring, it->second.get(), state)) continue;
+
+        // the fbo reads the texture attached to it, hence it is rebuilt if the input has changed
+        if (ring.fbo.valid() && ring.fbo->getAttachment(osg::Camera::COLOR_BUFFER0).getTexture() != texture)
+            ring.fbo = NULL;
+
+        // 2D textures are read through a fbo, which allows to read parts of them asynchronously
+        if (!ring.fbo.valid())
+        {
+            osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(texture);
+            osg::TextureRectangle* texRect = dynamic_cast<osg::TextureRectangle*>(texture);
+            if (tex2D || texRect)
+            {
+                ring.fbo = new osg::FrameBufferObject();
+                if (tex2D) ring.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(tex2D));
+                else ring.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(texRect));
+            }
+        }
+
+        GLenum format = osg::Image::computePixelFormat(texture->getInternalFormat());
+        GLenum type = osg::Image::computeFormatDataType(texture->getInternalFormat());
+        unsigned int next = ring.transfers->advance();
+        osg::PixelDataBufferObject* buffer = ring.buffers[next].get();
+
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        if (ring.fbo.valid())
+        {
+            int x, y, width, height;
+            computePBORegion(texture, x, y, width, height);
+
+            pushFrameBufferObject(state);
+            ring.fbo->apply(state);
+            buffer->bindBufferInWriteMode(state);
+            glReadPixels(x, y, width, height, format, type, NULL);
+            buffer->unbindBuffer(contextID);
+            popFrameBufferObject(state);
+        }else
+        {
+            buffer->bindBufferInWriteMode(state);
+            state.applyTextureAttribute(it->first, texture);
+            glGetTexImage(texture->getTextureTarget(), 0, format, type, NULL);
+            buffer->unbindBuffer(contextID);
+        }
+        ring.transfers->insertFence(next);
+
+        // with several buffers the newest input, which transfer is done, is given out. The GPU is never waited for,
+        // if none of the newer transfers is done, the buffer given out previously is given out again
+        unsigned int num = ring.buffers.size();
+        unsigned int written = osg::minimum(ring.count, num - 1);
+        unsigned int current = next;
+        for (unsigned int k=1; k <= written; k++)
+        {
+            unsigned int index = (next + num - k) % num;
+            if (!ring.transfers->getFence(index)->isSignaled() && index != ring.current) continue;
+            current = index;
+            break;
+        }
+        ring.current = current;
+        it->second = ring.buffers[current];
+        ring.count++;
+    }
+
+    // give out output buffers, which are not read by the GPU anymore
+    for (PixelDataBufferObjectMap::iterator it = mOutputPBO.begin(); it != mOutputPBO.end(); it++)
+    {
+        PBORing& ring = mOutputPBORing[it->first];
+        if (!updatePBORing(ring, it->second.get(), state)) continue;
+
+        // the first buffer, which is not read by the GPU anymore, is given out. If all are still in use,
+        // the GPU is not waited for, the driver synchronizes when the buffer is mapped instead
+        unsigned int num = ring.buffers.size();
+        unsigned int next = ring.transfers->getNext();
+        ring.current = next;
+        for (unsigned int k=0; k < num; k++)
+        {
+            if (!ring.transfers->getFence((next + k) % num)->isSignaled()) continue;
+            ring.current = (next + k) % num;
+            break;
+        }
+        it->second = ring.buffers[ring.current];
+    }
+}
+
+//------------------------------------------------------------------------------
+void Unit::endPBOTransfer(osg::RenderInfo& ri)
+{
+    osg::State& state = *ri.getState();
+    unsigned int contextID = ri.getContextID();
+
+    // upload the output buffers into the textures, the upload is finished by the GPU later
+    for (PixelDataBufferObjectMap::iterator it = mOutputPBO.begin(); it != mOutputPBO.end(); it++)
+    {
+        PBORing& ring = mOutputPBORing[it->first];
+        osg::Texture* texture = mOutputTex[it->first].get();
+        if (!it->second || ring.buffers.empty() || !texture) continue;
+        if (!dynamic_cast<osg::Texture2D*>(texture) && !dynamic_cast<osg::TextureRectangle*>(texture)) continue;
+
+        int x, y, width, height;
+        computePBORegion(texture, x, y, width, height);
+
+        it->second->bindBufferInReadMode(state);
+        state.applyTextureAttribute(it->first, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(texture->getTextureTarget(), 0, x, y, width, height,
+            osg::Image::computePixelFormat(texture->getInternalFormat()),
+            osg::Image::computeFormatDataType(texture->getInternalFormat()), NULL);
+        it->second->unbindBuffer(contextID);
+
+        ring.transfers->insertFence(ring.current);
+        ring.transfers->setNext(ring.current + 1);
+        ring.count++;
+    }
+}
+
+//------------------------------------------------------------------------------
+ReadbackRequest* Unit::requestReadback(int mrt, int level, int x, int y, int width, int height, GLenum format, GLenum type)
+{
+    ReadbackRequest* request = new ReadbackRequest(mrt, level, x, y, width, height, format, type);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mReadbackMutex);
+    mReadbacks.push_back(request);
+    return request;
+}
+
+//------------------------------------------------------------------------------
+unsigned int Unit::getNumPendingReadbacks() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mReadbackMutex);
+    return mReadbacks.size() + mFinishedReadbacks.size();
+}
+
+//------------------------------------------------------------------------------
+bool Unit::issueReadback(osg::RenderInfo& ri, ReadbackRequest& request)
+{
+    osg::State& state = *ri.getState();
+    unsigned int contextID = ri.getContextID();
+
+    TextureMap::iterator jt = mOutputTex.find(request.mMRT);
+    osg::Texture* texture = jt != mOutputTex.end() ? jt->second.get() : NULL;
+    osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(texture);
+    osg::TextureRectangle* texRect = dynamic_cast<osg::TextureRectangle*>(texture);
+    if ((!tex2D && !texRect) || request.mLevel < 0 || (texRect && request.mLevel > 0))
+    {
+        osg::notify(osg::WARN) << "osgPPU::Unit::requestReadback() - " << getName() << " output " << request.mMRT << " level " << request.mLevel << " can not be read back" << std::endl;
+        return false;
+    }
+
+    // clamp the rectangle to the mipmap level
+    int levelWidth = osg::maximum(1, texture->getTextureWidth() >> request.mLevel);
+    int levelHeight = osg::maximum(1, texture->getTextureHeight() >> request.mLevel);
+    int* region = request.mRegion;
+    if (region[2] <= 0 || region[3] <= 0)
+    {
+        region[0] = 0; region[1] = 0; region[2] = levelWidth; region[3] = levelHeight;
+    }else
+    {
+        region[0] = osg::clampBetween(region[0], 0, levelWidth - 1);
+        region[1] = osg::clampBetween(region[1], 0, levelHeight - 1);
+        region[2] = osg::minimum(region[2], levelWidth - region[0]);
+        region[3] = osg::minimum(region[3], levelHeight - region[1]);
+    }
+
+    // take a buffer of the pool of the context, which is large enough
+    unsigned int size = osg::Image::computeRowWidthInBytes(region[2], request.mFormat, request.mType, 1) * region[3];
+    std::vector<osg::ref_ptr<PixelBufferRing> >& buffers = mReadbackBuffers[contextID];
+    request.mContextID = contextID;
+    request.mBuffer = NULL;
+    for (unsigned int i=0; i < buffers.size(); i++)
+    {
+        if (buffers[i]->getBufferSize(0) < size) continue;
+        request.mBuffer = buffers[i];
+        size = buffers[i]->getBufferSize(0);
+        buffers.erase(buffers.begin() + i);
+        break;
+    }
+    if (!request.mBuffer.valid())
+    {
+        request.mBuffer = new PixelBufferRing(GL_PIXEL_PACK_BUFFER_ARB, GL_STREAM_READ_ARB);
+        request.mBuffer->resize(contextID, 1);
+    }
+
+    osg::ref_ptr<osg::FrameBufferObject>& fbo = mReadbackFBO[std::make_pair(request.mMRT, request.mLevel)];
+    if (!fbo.valid() || fbo->getAttachment(osg::Camera::COLOR_BUFFER0).getTexture() != texture)
+    {
+        fbo = new osg::FrameBufferObject();
+        if (tex2D) fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(tex2D, request.mLevel));
+        else fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(texRect));
+    }
+
+    pushFrameBufferObject(state);
+    fbo->apply(state);
+    request.mBuffer->bind(0, size);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(region[0], region[1], region[2], region[3], request.mFormat, request.mType, NULL);
+    request.mBuffer->unbind();
+    popFrameBufferObject(state);
+
+    request.mBuffer->insertFence(0);
+    request.mAge = 0;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void Unit::finishReadback(osg::RenderInfo& ri, ReadbackRequest& request)
+{
+    PixelBufferRing* buffer = request.mBuffer.get();
+
+    // only waits if the maximal latency is reached
+    buffer->getFence(0)->wait();
+    buffer->getFence(0)->release();
+
+    osg::ref_ptr<osg::Image> image = new osg::Image();
+    image->allocateImage(request.mRegion[2], request.mRegion[3], 1, request.mFormat, request.mType, 1);
+
+    void* data = buffer->map(0, GL_READ_ONLY_ARB);
+    if (data) memcpy(image->data(), data, image->getTotalSizeInBytes());
+    buffer->unmap(0);
+
+    // a few buffers are kept for the next requests
+    std::vector<osg::ref_ptr<PixelBufferRing> >& buffers = mReadbackBuffers[ri.getContextID()];
+    if (buffers.size() < 4) buffers.push_back(buffer);
+    else buffer->release();
+    request.mBuffer = NULL;
+
+    request.mImage = image;
+    request.mResult = data ? ReadbackRequest::COMPLETE : ReadbackRequest::FAILED;
+}
+
+//------------------------------------------------------------------------------
+void Unit::serviceReadbacks(osg::RenderInfo& ri)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mReadbackMutex);
+    if (mReadbacks.empty()) return;
+
+    osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(ri.getContextID(), true);
+    bool supported = ext && ext->isPBOSupported();
+
+    std::list<osg::ref_ptr<ReadbackRequest> >::iterator it = mReadbacks.begin();
+    while (it != mReadbacks.end())
+    {
+        ReadbackRequest& request = *(it->get());
+
+        // new requests read the output of this frame
+        if (request.mStatus == ReadbackRequest::PENDING)
+        {
+            if (!supported || !issueReadback(ri, request))
+            {
+                request.mResult = ReadbackRequest::FAILED;
+                mFinishedReadbacks.push_back(*it);
+                it = mReadbacks.erase(it);
+                continue;
+            }
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> requestLock(request.mMutex);
+            request.mStatus = ReadbackRequest::IN_FLIGHT;
+        }else if (request.mContextID != ri.getContextID())
+        {
+            // the buffer and the fence belong to the context the transfer was issued in
+            it++;
+            continue;
+        }else
+            request.mAge++;
+
+        if (request.mBuffer->getFence(0)->isSignaled() || request.mAge >= mMaxReadbackLatency)
+        {
+            finishReadback(ri, request);
+            mFinishedReadbacks.push_back(*it);
+            it = mReadbacks.erase(it);
+        }else
+            it++;
+    }
+}
+
+//------------------------------------------------------------------------------
+void Unit::completeReadbacks()
+{
+    std::list<osg::ref_ptr<ReadbackRequest> > finished;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mReadbackMutex);
+        finished.swap(mFinishedReadbacks);
+    }
+
+    // the callbacks may request new readbacks
+    for (std::list<osg::ref_ptr<ReadbackRequest> >::iterator it = finished.begin(); it != finished.end(); it++)
+        (*it)->complete();
+}
+
 //------------------------------------------------------------------------------
 void Unit::setColorAttribute(ColorAttribute* ca)
 {
@@ -460,41 +857,42 @@ void Unit::update()
         updateUniforms();
         mbDirty = false;
     }
+
+    // hand out the images read back on the last draws
+    completeReadbacks();
 }
 
 //------------------------------------------------------------------------------
 void Unit::traverse(osg::NodeVisitor& nv)
 {
-    // check if we have to update it
-    if (nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR)
+    bool updateVisitor = nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR;
+    bool cullVisitor = nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR;
+
+    // if the unit is planned, then it is executed by the processor only
+    if (mPlanProcessor && (updateVisitor || cullVisitor))
     {
-        if (mbUpdateTraversed) return;
+        // the unit is executed only if it was accepted by the processor directly,
+        // checking the node path keeps the traversal free of any shared state
+        const osg::NodePath& path = nv.getNodePath();
+        if (path.size() < 2 || path[path.size() - 2] != mPlanProcessor) return;
 
-        const osg::Node::ParentList& parents = getParents();
-        for (osg::Node::ParentList::const_iterator it = parents.begin(); it != parents.end(); it++)
+        if (updateVisitor)
         {
-            Unit* unit = dynamic_cast<osgPPU::Unit*>(*it);
-            if (unit && !unit->mbUpdateTraversed) return;
+            update();
+            getStateSet()->runUpdateCallbacks(&nv);
         }
 
-        mbUpdateTraversed = true;
+        // child units are executed by the processor on their own
+        for (osg::NodeList::iterator it = mPlanChildren.begin(); it != mPlanChildren.end(); it++)
+            (*it)->accept(nv);
+        return;
+    }
 
+    // check if we have to update it
+    if (updateVisitor)
+    {
         update();
         getStateSet()->runUpdateCallbacks(&nv);
-
-    }else if (nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR)
-    {
-        if (mbCullTraversed) return;
-
-        const osg::Node::ParentList& parents = getParents();
-        for (osg::Node::ParentList::const_iterator it = parents.begin(); it != parents.end(); it++)
-        {
-            Unit* unit = dynamic_cast<osgPPU::Unit*>(*it);
-            if (unit && !unit->mbCullTraversed) return;
-        }
-
-        // mark this unit as has been traversed and traverse
-        mbCullTraversed = true;        
     }
 
     // default traversion
@@ -684,6 +1082,8 @@ void Unit::EmptyDrawCallback::drawImplementation (osg::RenderInfo& ri, const osg
         // notice that we will start rendering soon
         if (_parent->getEndDrawCallback())
             (*_parent->getEndDrawCallback())(ri, _parent);
+
+        _parent->serviceReadbacks(ri);
     }
 }
 
@@ -696,26 +1096,13 @@ void Unit::DrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Dra
     {   
         _parent->printDebugInfo(dr);
 
-        // precompile input and output pbos, so that they are valid for hte next execution
-        for (PixelDataBufferObjectMap::iterator it = _parent->mInputPBO.begin(); it != _parent->mInputPBO.end(); it++)
-            if (it->second && it->second->getOrCreateGLBufferObject(ri.getContextID())->isDirty()) it->second->compileBuffer(*ri.getState());
-        for (PixelDataBufferObjectMap::iterator it = _parent->mOutputPBO.begin(); it != _parent->mOutputPBO.end(); it++)
-            if (it->second && it->second->getOrCreateGLBufferObject(ri.getContextID())->isDirty()) it->second->compileBuffer(*ri.getState());
+        // measure the unit, if the processor executing it is profiled
+        osg::ref_ptr<Profiler> profiler = _parent->mPlanProcessor ? _parent->mPlanProcessor->getProfiler() : NULL;
+        if (profiler.valid()) profiler->beginDraw(_parent, ri);
 
-        // copy content of the input textures into pbo, if such are specified
-        for (PixelDataBufferObjectMap::iterator it = _parent->mInputPBO.begin(); it != _parent->mInputPBO.end(); it++)
-        {
-            if (!it->second) continue;
-            osg::Texture* texture = _parent->mInputTex[it->first].get();
-
-            // bind buffer in write mode and copy texture content into the buffer
-            it->second->bindBufferInWriteMode(*ri.getState());
-            ri.getState()->applyTextureAttribute(it->first, texture);
-            glGetTexImage(texture->getTextureTarget(), 0, 
-                osg::Image::computePixelFormat(texture->getInternalFormat()), 
-                osg::Image::computeFormatDataType(texture->getInternalFormat()), NULL);
-            it->second->unbindBuffer(ri.getContextID());
-        }
+        // copy content of the input textures into pbos and select the output pbos, if such are specified
+        if (!_parent->mInputPBO.empty() || !_parent->mOutputPBO.empty())
+            _parent->beginPBOTransfer(ri);
 
         // unit should know that we are about to render it and let us know if we should render 
         if (_parent->noticeBeginRendering(ri, dr))
@@ -737,28 +1124,14 @@ void Unit::DrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Dra
         // ok rendering is done, unit can do other stuff.
         _parent->noticeFinishRendering(ri, dr);
 
-        // copy content of the output textures into output pbos
-        for (PixelDataBufferObjectMap::iterator it = _parent->mOutputPBO.begin(); it != _parent->mOutputPBO.end(); it++)
-        {
-            if (!it->second) continue;
-
-            // bind buffer in read mode and copy texture content into the buffer
-            it->second->bindBufferInReadMode(*ri.getState());
+        // copy content of the output pbos into the output textures
+        if (!_parent->mOutputPBO.empty())
+            _parent->endPBOTransfer(ri);
 
-            // upload buffer content into the texture
-            osg::Texture2D* tex = dynamic_cast<osg::Texture2D*>(_parent->mOutputTex[it->first].get());
-            if (tex)
-            {
-                ri.getState()->applyTextureAttribute(it->first, tex);
-                glTexSubImage2D(tex->getTextureTarget(), 0, 0, 0, 
-                    tex->getTextureWidth(), tex->getTextureHeight(), 
-                    osg::Image::computePixelFormat(tex->getInternalFormat()), 
-                    osg::Image::computeFormatDataType(tex->getInternalFormat()), NULL);
-            }
-
-            it->second->unbindBuffer(ri.getContextID());
-        }
+        if (profiler.valid()) profiler->endDraw(_parent, ri);
 
+        // read the outputs requested by the application
+        _parent->serviceReadbacks(ri);
     }
 }
 
@@ -22,6 +22,7 @@
 #include <osgPPU/UnitInOut.h>
 #include <osgPPU/Processor.h>
 #include <osgPPU/Utility.h>
+#include <osgPPU/TexturePool.h>
 
 #include <osg/TextureCubeMap>
 #include <osg/Texture2D>
@@ -245,7 +246,9 @@ namespace osgPPU
         mOutputZSlice(unit.mOutputZSlice),
         mOutputDepth(unit.mOutputDepth),
         mOutputType(unit.mOutputType),
-        mOutputInternalFormat(unit.mOutputInternalFormat)
+        mOutputInternalFormat(unit.mOutputInternalFormat),
+        mUserOutputTex(unit.mUserOutputTex),
+        mDeadOutputs(unit.mDeadOutputs)
     {
     }
 
@@ -266,7 +269,10 @@ namespace osgPPU
     //------------------------------------------------------------------------------
     UnitInOut::~UnitInOut()
     {
-
+        // own outputs can be used by other units further on
+        for (TextureMap::iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+            if (it->second.valid() && isOutputTextureReleasable(it->first))
+                TexturePool::instance()->release(it->second.get());
     }
 
     //------------------------------------------------------------------------------
@@ -345,9 +351,26 @@ namespace osgPPU
     void UnitInOut::setOutputTexture(osg::Texture* outTex, int mrt)
     {
         if (outTex)
+        {
             mOutputTex[mrt] = outTex;
-        else
+            mUserOutputTex.insert(mrt);
+        }else
+        {
             mOutputTex[mrt] = osg::ref_ptr<osg::Texture>(NULL);
+            mUserOutputTex.erase(mrt);
+        }
+
+        dirty();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitInOut::setOutputTextureMap(const TextureMap& map)
+    {
+        mOutputTex = map;
+
+        mUserOutputTex.clear();
+        for (TextureMap::const_iterator it = map.begin(); it != map.end(); it++)
+            if (it->second.valid()) mUserOutputTex.insert(it->first);
 
         dirty();
     }
@@ -364,6 +387,7 @@ namespace osgPPU
             if (it->second.valid()){
                 it->second->setInternalFormat(mOutputInternalFormat);
                 it->second->setSourceFormat(createSourceTextureFormat(mOutputInternalFormat));
+                it->second->dirtyTextureObject();
             }
         }
 
@@ -384,37 +408,69 @@ namespace osgPPU
         if (tex) return tex;
 
         // if not exists, then allocate it
-        osg::Texture* mTex = NULL;
-        if (mOutputType == TEXTURE_2D)
+        osg::ref_ptr<osg::Texture> mTex;
+        if (mViewport.valid())
+            mTex = createOutputTexture(int(mViewport->width()), int(mViewport->height()));
+        else
+            mTex = createOutputTexture(0, 0);
+
+        // set new texture
+        mOutputTex[mrt] = mTex;
+
+        return mTex.get();
+    }
+
+    //------------------------------------------------------------------------------
+    osg::ref_ptr<osg::Texture> UnitInOut::createOutputTexture(int width, int height)
+    {
+        int depth = (mOutputType == TEXTURE_3D || mOutputType == TEXTURE_2D_ARRAY) ? mOutputDepth : 1;
+
+        // the output is filtered as the input 0
+        osg::Texture::FilterMode minFilter = osg::Texture::LINEAR;
+        osg::Texture::FilterMode magFilter = osg::Texture::LINEAR;
+        if (getInputTexture(0) && getInputTexture(0)->getFilter(osg::Texture2D::MIN_FILTER) == osg::Texture2D::NEAREST)
+            minFilter = osg::Texture::NEAREST;
+        if (getInputTexture(0) && getInputTexture(0)->getFilter(osg::Texture2D::MAG_FILTER) == osg::Texture2D::NEAREST)
+            magFilter = osg::Texture::NEAREST;
+
+        // reuse a texture released by another unit if possible, the key is computed as for the released textures
+        osg::ref_ptr<osg::Texture> mTex;
+        if (width > 0 && height > 0)
+            mTex = TexturePool::instance()->acquire(TexturePool::computeKey(getOutputTextureTarget(), width, height, depth, getOutputInternalFormat(), minFilter));
+
+        if (mTex.valid())
+        {
+            // parameters are setted up below
+        }else if (mOutputType == TEXTURE_2D)
         {
             mTex = new osg::Texture2D();
-            dynamic_cast<osg::Texture2D*>(mTex)->setSubloadCallback(new Subload2DCallback());
-            if (mViewport.valid())
-                dynamic_cast<osg::Texture2D*>(mTex)->setTextureSize(int(mViewport->width()), int(mViewport->height()) );
+            dynamic_cast<osg::Texture2D*>(mTex.get())->setSubloadCallback(new Subload2DCallback());
+            if (width > 0 && height > 0)
+                dynamic_cast<osg::Texture2D*>(mTex.get())->setTextureSize(width, height);
         }else if (mOutputType == TEXTURE_RECTANGLE)
         {
             mTex = new osg::TextureRectangle();
-            dynamic_cast<osg::TextureRectangle*>(mTex)->setSubloadCallback(new SubloadRectangleCallback());
-            if (mViewport.valid())
-                dynamic_cast<osg::TextureRectangle*>(mTex)->setTextureSize(int(mViewport->width()), int(mViewport->height()) );
+            dynamic_cast<osg::TextureRectangle*>(mTex.get())->setSubloadCallback(new SubloadRectangleCallback());
+            if (width > 0 && height > 0)
+                dynamic_cast<osg::TextureRectangle*>(mTex.get())->setTextureSize(width, height);
         }else if (mOutputType == TEXTURE_CUBEMAP)
         {
             mTex = new osg::TextureCubeMap();
-            dynamic_cast<osg::TextureCubeMap*>(mTex)->setSubloadCallback(new SubloadCubeMapCallback());
-            if (mViewport.valid())
-                dynamic_cast<osg::TextureCubeMap*>(mTex)->setTextureSize(int(mViewport->width()), int(mViewport->height()) );
+            dynamic_cast<osg::TextureCubeMap*>(mTex.get())->setSubloadCallback(new SubloadCubeMapCallback());
+            if (width > 0 && height > 0)
+                dynamic_cast<osg::TextureCubeMap*>(mTex.get())->setTextureSize(width, height);
         }else if (mOutputType == TEXTURE_3D)
         {
             mTex = new osg::Texture3D();
-            dynamic_cast<osg::Texture3D*>(mTex)->setSubloadCallback(new Subload3DCallback());
-            if (mViewport.valid())
-                dynamic_cast<osg::Texture3D*>(mTex)->setTextureSize(int(mViewport->width()), int(mViewport->height()), mOutputDepth);
+            dynamic_cast<osg::Texture3D*>(mTex.get())->setSubloadCallback(new Subload3DCallback());
+            if (width > 0 && height > 0)
+                dynamic_cast<osg::Texture3D*>(mTex.get())->setTextureSize(width, height, depth);
         }else if (mOutputType == TEXTURE_2D_ARRAY)
         {
             mTex = new osg::Texture2DArray();
-            dynamic_cast<osg::Texture2DArray*>(mTex)->setSubloadCallback(new Subload2DArrayCallback());
-            if (mViewport.valid())
-                dynamic_cast<osg::Texture2DArray*>(mTex)->setTextureSize(int(mViewport->width()), int(mViewport->height()), mOutputDepth);
+            dynamic_cast<osg::Texture2DArray*>(mTex.get())->setSubloadCallback(new Subload2DArrayCallback());
+            if (width > 0 && height > 0)
+                dynamic_cast<osg::Texture2DArray*>(mTex.get())->setTextureSize(width, height, depth);
         }else
         {
             osg::notify(osg::FATAL) << "osgPPU::UnitInOut::getOrCreateOutputTexture() - " << getName() << " non-supported texture type specified!" << std::endl;
@@ -431,21 +487,40 @@ namespace osgPPU
         mTex->setSourceFormat(createSourceTextureFormat(getOutputInternalFormat()));
         mTex->setSourceType(osg::Image::computeFormatDataType(getOutputInternalFormat()));
 
-        // check if the input texture was in nearest mode
-        if (getInputTexture(0) && getInputTexture(0)->getFilter(osg::Texture2D::MIN_FILTER) == osg::Texture2D::NEAREST)
-            mTex->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::NEAREST);
-        else
-            mTex->setFilter(osg::Texture2D::MIN_FILTER,osg::Texture2D::LINEAR);
+        // filters of the input 0, a texture from the pool has them already as they are part of its key
+        mTex->setFilter(osg::Texture2D::MIN_FILTER, minFilter);
+        mTex->setFilter(osg::Texture2D::MAG_FILTER, magFilter);
 
-        if (getInputTexture(0) && getInputTexture(0)->getFilter(osg::Texture2D::MAG_FILTER) == osg::Texture2D::NEAREST)
-            mTex->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::NEAREST);
-        else
-            mTex->setFilter(osg::Texture2D::MAG_FILTER,osg::Texture2D::LINEAR);
+        return mTex;
+    }
 
-        // set new texture
-        mOutputTex[mrt] = mTex;
+    //------------------------------------------------------------------------------
+    GLenum UnitInOut::getOutputTextureTarget() const
+    {
+        switch (mOutputType)
+        {
+            case TEXTURE_2D: return GL_TEXTURE_2D;
+            case TEXTURE_CUBEMAP: return GL_TEXTURE_CUBE_MAP;
+            case TEXTURE_3D: return GL_TEXTURE_3D;
+            case TEXTURE_2D_ARRAY: return GL_TEXTURE_2D_ARRAY_EXT;
+            case TEXTURE_RECTANGLE: return GL_TEXTURE_RECTANGLE;
+        }
+        return GL_TEXTURE_2D;
+    }
 
-        return mTex;
+    //------------------------------------------------------------------------------
+    bool UnitInOut::isOutputTextureReleasable(int mrt) const
+    {
+        // outputs which might be referenced from outside can not be given away
+        if (getKeepAlive() || mBypassedInput >= 0) return false;
+        if (mUserOutputTex.find(mrt) != mUserOutputTex.end()) return false;
+        if (mOutputPBO.find(mrt) != mOutputPBO.end()) return false;
+
+        // outputs of units without child units are usually read by the application
+        for (unsigned int i=0; i < getNumChildren(); i++)
+            if (dynamic_cast<const Unit*>(getChild(i))) return true;
+
+        return false;
     }
 
     //------------------------------------------------------------------------------
@@ -455,6 +530,9 @@ namespace osgPPU
         TextureMap::iterator it = mOutputTex.begin();
         for (int i = 0; it != mOutputTex.end(); it++, i++)
         {
+            // outputs nobody reads are not rendered
+            if (mDeadOutputs.find(it->first) != mDeadOutputs.end()) continue;
+
             // get output texture
             osg::Texture* texture = it->second.get();
 
@@ -504,6 +582,7 @@ namespace osgPPU
                 // for each mrt to slice mapping do
                 for (OutputSliceMap::const_iterator jt = getOutputZSliceMap().begin(); jt != getOutputZSliceMap().end(); jt++)
                 {
+                    if (mDeadOutputs.find(jt->first) != mDeadOutputs.end()) continue;
                     mFBO->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + jt->first), osg::FrameBufferAttachment(tex3D, jt->second));
                 }
                 continue;
@@ -516,6 +595,7 @@ namespace osgPPU
                 // for each mrt to slice mapping do
                 for (OutputSliceMap::const_iterator jt = getOutputZSliceMap().begin(); jt != getOutputZSliceMap().end(); jt++)
                 {
+                    if (mDeadOutputs.find(jt->first) != mDeadOutputs.end()) continue;
                     mFBO->setAttachment(osg::Camera::BufferComponent(osg::Camera::COLOR_BUFFER0 + jt->first), osg::FrameBufferAttachment(tex2DArray, jt->second));
                 }
                 continue;
@@ -526,6 +606,19 @@ namespace osgPPU
         }
     }
 
+    //------------------------------------------------------------------------------
+    void UnitInOut::setDeadOutputs(const std::set<int>& mrts)
+    {
+        if (mrts == mDeadOutputs) return;
+        mDeadOutputs = mrts;
+
+        // attachments can not be removed, hence setup a new fbo
+        mFBO = new FrameBufferObject();
+
+        // dirty units will assign their outputs on the next update anyway
+        if (!isDirty()) assignOutputTexture();
+    }
+
     //------------------------------------------------------------------------------
     void UnitInOut::assignOutputPBO()
     {
@@ -564,13 +657,24 @@ namespace osgPPU
 		mFBO->dirty();
 
         // change size of the result texture according to the viewport
+        bool exchanged = false;
         TextureMap::iterator it = mOutputTex.begin();
         for (; it != mOutputTex.end(); it++)
         {
             if (it->second.valid())
             {
+                // own outputs are exchanged by textures of the new size, old ones go back to the pool
+                if (isOutputTextureReleasable(it->first))
+                {
+                    TexturePool::Key key = TexturePool::computeKey(it->second.get());
+                    if (key._width == int(vp->width()) && key._height == int(vp->height())) continue;
+
+                    TexturePool::instance()->release(it->second.get());
+                    it->second = createOutputTexture(int(vp->width()), int(vp->height()));
+                    exchanged = true;
+                }
                 // if texture type is a 2d texture
-                if (dynamic_cast<osg::Texture2D*>(it->second.get()) != NULL)
+                else if (dynamic_cast<osg::Texture2D*>(it->second.get()) != NULL)
                 {
                     // change size
                     osg::Texture2D* mTex = dynamic_cast<osg::Texture2D*>(it->second.get());
@@ -617,6 +721,10 @@ namespace osgPPU
             }
         }
 
+        // the children units will collect the new outputs as soon as they get initialized,
+        // however the fbo has to be attached to them right now
+        if (exchanged) assignOutputTexture();
+
     }
 
     //------------------------------------------------------------------------------
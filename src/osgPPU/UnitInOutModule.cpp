@@ -15,16 +15,27 @@
  ***************************************************************************/
 
 #include <osgPPU/UnitInOutModule.h>
+#include <osgPPU/CPUModule.h>
 
 #include <osg/Texture2D>
 #include <osg/TextureCubeMap>
+#include <osg/TextureRectangle>
+#include <osg/GLExtensions>
+#include <OpenThreads/ScopedLock>
+
+#include <sstream>
 
 namespace osgPPU
 {
 
     //-------------------------------------------------------------------------
     UnitInOutModule::UnitInOutModule() : UnitInOut(),
-        _moduleDirty(false)
+        _moduleDirty(false),
+        _numSlots(2),
+        _persistent(false),
+        _frameNumber(0),
+        _numProcessed(0),
+        _numSkipped(0)
     {
     }
 
@@ -33,7 +44,12 @@ namespace osgPPU
         UnitInOut(unit, copyop),
         _moduleDirty(unit._moduleDirty),
         _module(unit._module),
-        _moduleLib(unit._moduleLib)
+        _moduleLib(unit._moduleLib),
+        _numSlots(unit._numSlots),
+        _persistent(false),
+        _frameNumber(0),
+        _numProcessed(0),
+        _numSkipped(0)
     {
 
     }
@@ -41,14 +57,342 @@ namespace osgPPU
     //-------------------------------------------------------------------------
     UnitInOutModule::~UnitInOutModule()
     {
-        // first remove the module and then close the dynamic library
+        // first remove the module and then close the dynamic library.
+        // the buffer rings of the slots delete their buffers with the context.
         removeModule();
         _moduleLib = NULL;
     }
 
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::setNumSlots(unsigned int num)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_slotMutex);
+        _numSlots = num > 0 ? num : 1;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::releaseFrame(unsigned int slot)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_slotMutex);
+        if (slot >= _slots.size() || _slots[slot].state != SLOT_PROCESSING)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitInOutModule::releaseFrame() - " << getName() << " slot " << slot << " is not owned by the module" << std::endl;
+            return;
+        }
+        _slots[slot].state = SLOT_RELEASED;
+    }
+
+    //-------------------------------------------------------------------------
+    unsigned int UnitInOutModule::getNumProcessedFrames() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_slotMutex);
+        return _numProcessed;
+    }
+
+    //-------------------------------------------------------------------------
+    unsigned int UnitInOutModule::getNumSkippedFrames() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_slotMutex);
+        return _numSkipped;
+    }
+
+    //-------------------------------------------------------------------------
+    static bool getBufferLayout(osg::Texture* texture, UnitInOutModule::Buffer& buffer)
+    {
+        if (!dynamic_cast<osg::Texture2D*>(texture) && !dynamic_cast<osg::TextureRectangle*>(texture)) return false;
+
+        buffer.width = texture->getTextureWidth();
+        buffer.height = texture->getTextureHeight();
+        buffer.format = osg::Image::computePixelFormat(texture->getInternalFormat());
+        buffer.type = osg::Image::computeFormatDataType(texture->getInternalFormat());
+        buffer.size = osg::Image::computeRowWidthInBytes(buffer.width, buffer.format, buffer.type, 1) * buffer.height;
+        return buffer.size > 0;
+    }
+
+    //-------------------------------------------------------------------------
+    bool UnitInOutModule::updateSlots(osg::State& state)
+    {
+        // layout of the buffers required by the current textures
+        std::map<int, Buffer> inputs, outputs;
+        for (TextureMap::iterator it = mInputTex.begin(); it != mInputTex.end(); it++)
+        {
+            Buffer buffer;
+            if (it->second.valid() && getBufferLayout(it->second.get(), buffer)) inputs[it->first] = buffer;
+        }
+        for (TextureMap::iterator it = mOutputTex.begin(); it != mOutputTex.end(); it++)
+        {
+            Buffer buffer;
+            if (it->second.valid() && getBufferLayout(it->second.get(), buffer)) outputs[it->first] = buffer;
+        }
+
+        bool changed = _slots.size() != _numSlots;
+        if (!changed)
+        {
+            const Frame& frame = _slots[0].frame;
+            changed = frame.inputs.size() != inputs.size() || frame.outputs.size() != outputs.size();
+            for (std::map<int, Buffer>::iterator it = inputs.begin(); it != inputs.end() && !changed; it++)
+                changed = frame.inputs.find(it->first) == frame.inputs.end() || frame.inputs.find(it->first)->second.size != it->second.size;
+            for (std::map<int, Buffer>::iterator it = outputs.begin(); it != outputs.end() && !changed; it++)
+                changed = frame.outputs.find(it->first) == frame.outputs.end() || frame.outputs.find(it->first)->second.size != it->second.size;
+        }
+        if (!changed) return true;
+
+        // the memory of a slot owned by the module must stay valid
+        for (unsigned int i=0; i < _slots.size(); i++)
+            if (_slots[i].state == SLOT_PROCESSING) return false;
+
+        // deleting the buffers unmaps them too
+        for (unsigned int i=0; i < _slots.size(); i++) _slots[i].fence->release();
+        for (BufferRingMap::iterator it = _inputRings.begin(); it != _inputRings.end(); it++) it->second->release();
+        for (BufferRingMap::iterator it = _outputRings.begin(); it != _outputRings.end(); it++) it->second->release();
+        _inputRings.clear();
+        _outputRings.clear();
+
+        // every input and output has a ring with a buffer per slot
+        unsigned int contextID = state.getContextID();
+        for (std::map<int, Buffer>::iterator it = inputs.begin(); it != inputs.end(); it++)
+        {
+            _inputRings[it->first] = new PixelBufferRing(GL_PIXEL_PACK_BUFFER_ARB, GL_STREAM_READ_ARB);
+            _inputRings[it->first]->resize(contextID, _numSlots);
+        }
+        for (std::map<int, Buffer>::iterator it = outputs.begin(); it != outputs.end(); it++)
+        {
+            _outputRings[it->first] = new PixelBufferRing(GL_PIXEL_UNPACK_BUFFER_ARB, GL_STREAM_DRAW_ARB);
+            _outputRings[it->first]->resize(contextID, _numSlots);
+        }
+
+        // with buffer storage the buffers are mapped once for their whole life
+        _persistent = PixelBufferRing::isPersistentMappingSupported(contextID);
+
+        _slots.clear();
+        _slots.resize(_numSlots);
+        _frameNumber = 0;
+        for (unsigned int i=0; i < _slots.size(); i++)
+        {
+            Slot& slot = _slots[i];
+            slot.fence = new Fence();
+            slot.frame.slot = i;
+            slot.frame.inputs = inputs;
+            slot.frame.outputs = outputs;
+
+            for (unsigned int j=0; j < 2; j++)
+            {
+                std::map<int, Buffer>& buffers = j == 0 ? slot.frame.inputs : slot.frame.outputs;
+                BufferRingMap& rings = j == 0 ? _inputRings : _outputRings;
+
+                for (std::map<int, Buffer>::iterator it = buffers.begin(); it != buffers.end(); it++)
+                {
+                    PixelBufferRing* ring = rings[it->first].get();
+                    if (_persistent)
+                        it->second.data = ring->allocatePersistent(i, it->second.size);
+                    else
+                    {
+                        ring->bind(i, it->second.size);
+                        ring->unbind();
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::mapSlot(Slot& slot)
+    {
+        if (_persistent) return;
+
+        for (std::map<int, Buffer>::iterator it = slot.frame.inputs.begin(); it != slot.frame.inputs.end(); it++)
+            it->second.data = _inputRings[it->first]->map(slot.frame.slot, GL_READ_ONLY_ARB);
+
+        // the outputs are orphaned, so that mapping them does not wait for their last upload
+        for (std::map<int, Buffer>::iterator it = slot.frame.outputs.begin(); it != slot.frame.outputs.end(); it++)
+        {
+            PixelBufferRing* ring = _outputRings[it->first].get();
+            ring->bind(slot.frame.slot, it->second.size, true);
+            it->second.data = ring->map(slot.frame.slot, GL_WRITE_ONLY_ARB);
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::unmapSlot(Slot& slot)
+    {
+        if (_persistent) return;
+
+        for (std::map<int, Buffer>::iterator it = slot.frame.inputs.begin(); it != slot.frame.inputs.end(); it++)
+        {
+            if (!it->second.data) continue;
+            _inputRings[it->first]->unmap(slot.frame.slot);
+            it->second.data = NULL;
+        }
+
+        for (std::map<int, Buffer>::iterator it = slot.frame.outputs.begin(); it != slot.frame.outputs.end(); it++)
+        {
+            if (!it->second.data) continue;
+            _outputRings[it->first]->unmap(slot.frame.slot);
+            it->second.data = NULL;
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::processSlots(osg::RenderInfo& ri)
+    {
+        osg::State& state = *ri.getState();
+        unsigned int contextID = ri.getContextID();
+        osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+        if (!ext || !ext->isPBOSupported()) return;
+
+        std::vector<Frame> frames;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_slotMutex);
+            if (!updateSlots(state))
+            {
+                _numSkipped++;
+                return;
+            }
+
+            // upload the outputs of the newest released frame, older released frames are outdated
+            Slot* newest = NULL;
+            for (unsigned int i=0; i < _slots.size(); i++)
+            {
+                Slot& slot = _slots[i];
+                if (slot.state != SLOT_RELEASED) continue;
+                unmapSlot(slot);
+                if (newest && newest->frame.number > slot.frame.number)
+                {
+                    slot.state = SLOT_FREE;
+                    continue;
+                }
+                if (newest) newest->state = SLOT_FREE;
+                newest = &slot;
+            }
+            if (newest)
+            {
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                for (std::map<int, Buffer>::iterator it = newest->frame.outputs.begin(); it != newest->frame.outputs.end(); it++)
+                {
+                    osg::Texture* texture = mOutputTex[it->first].get();
+                    PixelBufferRing* ring = _outputRings[it->first].get();
+                    ring->bind(newest->frame.slot, it->second.size);
+                    state.applyTextureAttribute(0, texture);
+                    glTexSubImage2D(texture->getTextureTarget(), 0, 0, 0, it->second.width, it->second.height, it->second.format, it->second.type, NULL);
+                    ring->unbind();
+                }
+                newest->fence->insert(contextID);
+                newest->state = SLOT_UPLOADING;
+            }
+
+            // hand the frames read back to the module and free the slots whose upload is done
+            for (unsigned int i=0; i < _slots.size(); i++)
+            {
+                Slot& slot = _slots[i];
+                if (slot.state == SLOT_UPLOADING && slot.fence->isSignaled())
+                {
+                    slot.fence->release();
+                    slot.state = SLOT_FREE;
+                }else if (slot.state == SLOT_READBACK && slot.fence->isSignaled())
+                {
+                    slot.fence->release();
+                    mapSlot(slot);
+                    slot.state = SLOT_PROCESSING;
+                    frames.push_back(slot.frame);
+                    _numProcessed++;
+                }
+            }
+
+            // read the inputs of this frame into a free slot, the GPU does the transfer later
+            Slot* free = NULL;
+            for (unsigned int i=0; i < _slots.size() && !free; i++)
+                if (_slots[i].state == SLOT_FREE) free = &_slots[i];
+
+            if (free)
+            {
+                glPixelStorei(GL_PACK_ALIGNMENT, 1);
+                for (std::map<int, Buffer>::iterator it = free->frame.inputs.begin(); it != free->frame.inputs.end(); it++)
+                {
+                    osg::ref_ptr<osg::FrameBufferObject>& fbo = _readFBO[it->first];
+                    osg::Texture* texture = mInputTex[it->first].get();
+                    if (!fbo.valid() || fbo->getAttachment(osg::Camera::COLOR_BUFFER0).getTexture() != texture)
+                    {
+                        fbo = new osg::FrameBufferObject();
+                        if (dynamic_cast<osg::Texture2D*>(texture)) fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(static_cast<osg::Texture2D*>(texture)));
+                        else fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(static_cast<osg::TextureRectangle*>(texture)));
+                    }
+
+                    pushFrameBufferObject(state);
+                    fbo->apply(state);
+                    PixelBufferRing* ring = _inputRings[it->first].get();
+                    ring->bind(free->frame.slot, it->second.size);
+                    glReadPixels(0, 0, it->second.width, it->second.height, it->second.format, it->second.type, NULL);
+                    ring->unbind();
+                    popFrameBufferObject(state);
+                }
+                free->fence->insert(contextID);
+                free->frame.number = _frameNumber++;
+                free->state = SLOT_READBACK;
+            }else
+                _numSkipped++;
+        }
+
+        // the module may release the frames right away, hence the slots are not locked
+        AsyncModule* module = static_cast<AsyncModule*>(_module.get());
+        for (unsigned int i=0; i < frames.size(); i++) module->process(frames[i]);
+    }
+
+    //-------------------------------------------------------------------------
+    // Built-in modules by their name
+    //-------------------------------------------------------------------------
+    typedef std::map<std::string, UnitInOutModule::BuiltinModuleEntry> BuiltinModuleMap;
+
+    static OpenThreads::Mutex& getBuiltinModuleMutex()
+    {
+        static OpenThreads::Mutex mutex;
+        return mutex;
+    }
+
+    static BuiltinModuleMap createBuiltinModules()
+    {
+        BuiltinModuleMap modules;
+        modules["cpu"] = &CPUModule::create;
+        return modules;
+    }
+
+    static BuiltinModuleMap& getBuiltinModules()
+    {
+        static BuiltinModuleMap modules = createBuiltinModules();
+        return modules;
+    }
+
+    //-------------------------------------------------------------------------
+    void UnitInOutModule::registerBuiltinModule(const std::string& name, BuiltinModuleEntry entry)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(getBuiltinModuleMutex());
+        if (entry) getBuiltinModules()[name] = entry;
+        else getBuiltinModules().erase(name);
+    }
+
     //-------------------------------------------------------------------------
     bool UnitInOutModule::loadModule(const std::string& moduleFile)
     {
+        // built-in modules do not need any library
+        std::istringstream words(moduleFile);
+        std::string name, arguments;
+        words >> name;
+        std::getline(words, arguments);
+
+        BuiltinModuleEntry builtin = NULL;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(getBuiltinModuleMutex());
+            BuiltinModuleMap::iterator it = getBuiltinModules().find(name);
+            if (it != getBuiltinModules().end()) builtin = it->second;
+        }
+        if (builtin)
+        {
+            _moduleLib = NULL;
+            _moduleFile = moduleFile;
+            return builtin(this, arguments);
+        }
+
         _moduleLib = osgDB::DynamicLibrary::loadLibrary(moduleFile);
 
         if (!_moduleLib.valid())
@@ -94,13 +438,20 @@ namespace osgPPU
         if (!_module.get()) return false;
         if (_moduleDirty) setModule(_module.get());
 
+        // an asynchronous module works on mapped buffers, nothing is rendered
+        if (dynamic_cast<AsyncModule*>(_module.get()))
+        {
+            processSlots(ri);
+            return false;
+        }
+
         return _module->beginAndProcess();
     }
 
     //-------------------------------------------------------------------------
     void UnitInOutModule::noticeFinishRendering(osg::RenderInfo& ri, const osg::Drawable*)
     {
-        if (!_module.get()) return;
+        if (!_module.get() || dynamic_cast<AsyncModule*>(_module.get())) return;
         _module->end();
     }
 
@@ -19,6 +19,7 @@
 #include <osgPPU/BarrierNode.h>
 #include <osgPPU/Visitor.h>
 #include <osgPPU/UnitInOut.h>
+#include <osg/buffered_value>
 
 namespace osgPPU
 {
@@ -28,7 +29,6 @@ namespace osgPPU
     struct ChangeInputsCallback : public Unit::NotifyCallback
     {
         ChangeInputsCallback(osg::Texture* texture, unsigned unit, unsigned changeOn, unsigned numIterations) : 
-            _iteration(0),
             _unit(unit),
             _changeOnIteration(changeOn),
             _numIterations(numIterations),
@@ -37,15 +37,17 @@ namespace osgPPU
 
         void operator()(osg::RenderInfo& ri, const Unit* unit) const
         {
-            if (_iteration >= _changeOnIteration)
+            // iterations are counted per context, since every context draws the repeated units on its own
+            unsigned& iteration = _iteration[ri.getContextID()];
+            if (iteration >= _changeOnIteration)
             {
                 //glAccum(GL_ADD, 1.0);
                 ri.getState()->applyTextureAttribute(_unit, _texture);
             }
-            _iteration = (_iteration + 1) % _numIterations;
+            iteration = (iteration + 1) % _numIterations;
         }
 
-        mutable unsigned _iteration;
+        mutable osg::buffered_value<unsigned> _iteration;
         unsigned _unit;
         unsigned _changeOnIteration;
         unsigned _numIterations;
@@ -83,50 +85,6 @@ namespace osgPPU
         dirty();        
     }
 
-    //------------------------------------------------------------------------------
-    void UnitInOutRepeat::traverse(osg::NodeVisitor& nv)
-    {
-        // the repeatable traversion is only interesting for cull visitors
-        if (nv.getVisitorType() != osg::NodeVisitor::CULL_VISITOR || _lastNode == NULL || _numIterations <= 1)
-        {
-            UnitInOut::traverse(nv);
-            return;
-        }
-
-        // disable access to all child units
-		std::vector<unsigned> nodeMasks(_lastNode->getNumChildren(), 0);
-        for (unsigned i=0; i < _lastNode->getNumChildren(); i++)
-        {
-            Unit* unit = dynamic_cast<Unit*>(_lastNode->getChild(i));
-            if (unit)
-			{
-				nodeMasks[i] = unit->getNodeMask();
-				unit->setNodeMask(0x0);
-			}
-        }
-
-        // for every iteration we do
-        for (int i=0; i < _numIterations; i++)
-        {
-            // mark every unit as not being culled before
-            CleanCullTraversedVisitor::sVisitor->run(this);
-
-            // run cull visitor which will stop after the last unit
-            UnitInOut::traverse(nv);
-        }
-
-        // continue traversing after last unit (start traversion on every child unit)
-        for (unsigned i=0; i < _lastNode->getNumChildren(); i++)
-        {
-            Unit* unit = dynamic_cast<Unit*>(_lastNode->getChild(i));
-            if (unit)
-            {
-                unit->setNodeMask(nodeMasks[i]);
-                unit->accept(nv);
-            }
-        }
-    }
-
     //------------------------------------------------------------------------------
     void UnitInOutRepeat::init()
     {
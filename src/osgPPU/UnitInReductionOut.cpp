@@ -0,0 +1,818 @@
+/***************************************************************************
+ *   Copyright (c) 2008   Art Tevs                                         *
+ *                                                                         *
+ *   This library is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 3 of        *
+ *   the License, or (at your option) any later version.                   *
+ *                                                                         *
+ *   This library is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesse General Public License for more details.                    *
+ *                                                                         *
+ *   The full license is in LICENSE file included with this distribution.  *
+ ***************************************************************************/
+
+// base includes handling gcc++ compiler issues
+// with memset dependency up from version 4.3.x
+#include <stdio.h>
+#include <string.h>
+
+#include <osgPPU/UnitInReductionOut.h>
+#include <osgPPU/Processor.h>
+
+#include <osg/GLExtensions>
+#include <osg/GL2Extensions>
+#include <osg/Program>
+#include <osg/Notify>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+
+#ifndef APIENTRY
+    #define APIENTRY
+#endif
+
+#ifndef GL_COMPUTE_SHADER
+    #define GL_COMPUTE_SHADER 0x91B9
+#endif
+
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+    #define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#endif
+
+#ifndef GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+    #define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+
+#ifndef GL_PIXEL_BUFFER_BARRIER_BIT
+    #define GL_PIXEL_BUFFER_BARRIER_BIT 0x00000080
+#endif
+
+#ifndef GL_FRAMEBUFFER_BARRIER_BIT
+    #define GL_FRAMEBUFFER_BARRIER_BIT 0x00000400
+#endif
+
+#ifndef GL_READ_ONLY
+    #define GL_READ_ONLY 0x88B8
+#endif
+
+#ifndef GL_WRITE_ONLY
+    #define GL_WRITE_ONLY 0x88B9
+#endif
+
+#ifndef GL_READ_WRITE
+    #define GL_READ_WRITE 0x88BA
+#endif
+
+#ifndef GL_R32UI
+    #define GL_R32UI 0x8236
+#endif
+
+#ifndef GL_RED_INTEGER
+    #define GL_RED_INTEGER 0x8D94
+#endif
+
+// size of the blocks reduced by a fragment and of the tiles reduced by a work group
+#define REDUCTION_BLOCK_SIZE 8
+#define REDUCTION_TILE_SIZE 32
+
+// maximal size of the sample grid of the histogram on the fragment path
+#define REDUCTION_HISTOGRAM_GRID 256
+
+namespace osgPPU
+{
+
+//------------------------------------------------------------------------------
+// Shaders of the fragment path. Every pass reads texels at their centers, so the
+// filtering of the textures does not matter.
+//------------------------------------------------------------------------------
+static const char* sReduceFragmentSource =
+    "uniform sampler2D source;\n"
+    "uniform vec2 sourceSize;\n"
+    "uniform vec3 weights;\n"
+    "void main(void)\n"
+    "{\n"
+    "    vec2 base = floor(gl_FragCoord.xy) * 8.0;\n"
+    "    vec4 s = vec4(1e30, -1e30, 0.0, 0.0);\n"
+    "    for (int j = 0; j < 8; j++)\n"
+    "    {\n"
+    "        for (int i = 0; i < 8; i++)\n"
+    "        {\n"
+    "            vec2 p = base + vec2(float(i), float(j));\n"
+    "            if (p.x >= sourceSize.x || p.y >= sourceSize.y) continue;\n"
+    "            vec4 texel = texture2D(source, (p + 0.5) / sourceSize);\n"
+    "#ifdef FIRST_PASS\n"
+    "            float l = dot(texel.rgb, weights);\n"
+    "            texel = vec4(l, l, l, log2(max(l, 1e-6)));\n"
+    "#endif\n"
+    "            s = vec4(min(s.x, texel.x), max(s.y, texel.y), s.zw + texel.zw);\n"
+    "        }\n"
+    "    }\n"
+    "    gl_FragColor = s;\n"
+    "}\n";
+
+// every fragment counts 4 bins over one row of the sample grid
+static const char* sHistogramRowsFragmentSource =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform vec2 gridSize;\n"
+    "uniform vec2 histogramRange;\n"
+    "uniform int numBins;\n"
+    "uniform vec3 weights;\n"
+    "void main(void)\n"
+    "{\n"
+    "    float row = floor(gl_FragCoord.y);\n"
+    "    vec4 bins = floor(gl_FragCoord.x) * 4.0 + vec4(0.0, 1.0, 2.0, 3.0);\n"
+    "    float scale = float(numBins) / (histogramRange.y - histogramRange.x);\n"
+    "    vec4 counts = vec4(0.0);\n"
+    "    for (int i = 0; i < 256; i++)\n"
+    "    {\n"
+    "        if (float(i) >= gridSize.x) break;\n"
+    "        float l = dot(texture2D(source, (vec2(float(i), row) + 0.5) / gridSize).rgb, weights);\n"
+    "        float b = clamp(floor((log2(max(l, 1e-6)) - histogramRange.x) * scale), 0.0, float(numBins - 1));\n"
+    "        counts += vec4(equal(vec4(b), bins));\n"
+    "    }\n"
+    "    gl_FragColor = counts;\n"
+    "}\n";
+
+// sum up the rows of the counts
+static const char* sHistogramSumFragmentSource =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform vec2 sourceSize;\n"
+    "void main(void)\n"
+    "{\n"
+    "    float x = floor(gl_FragCoord.x);\n"
+    "    vec4 counts = vec4(0.0);\n"
+    "    for (int i = 0; i < 256; i++)\n"
+    "    {\n"
+    "        if (float(i) >= sourceSize.y) break;\n"
+    "        counts += texture2D(source, (vec2(x, float(i)) + 0.5) / sourceSize);\n"
+    "    }\n"
+    "    gl_FragColor = counts;\n"
+    "}\n";
+
+// write the statistics into row 0 and the histogram into row 1 of the output
+static const char* sResolveFragmentSource =
+    "#version 120\n"
+    "uniform sampler2D reduction;\n"
+    "uniform sampler2D counts;\n"
+    "uniform float countsWidth;\n"
+    "uniform float numPixels;\n"
+    "uniform float numSamples;\n"
+    "uniform vec2 histogramRange;\n"
+    "uniform int numBins;\n"
+    "float binCount(float b)\n"
+    "{\n"
+    "    vec4 c = texture2D(counts, vec2((floor(b / 4.0) + 0.5) / countsWidth, 0.5));\n"
+    "    return dot(c, vec4(equal(vec4(mod(b, 4.0)), vec4(0.0, 1.0, 2.0, 3.0))));\n"
+    "}\n"
+    "void main(void)\n"
+    "{\n"
+    "    vec2 p = floor(gl_FragCoord.xy);\n"
+    "    vec4 result = vec4(0.0);\n"
+    "    if (p.y < 0.5)\n"
+    "    {\n"
+    "        vec4 s = texture2D(reduction, vec2(0.5));\n"
+    "        if (p.x < 0.5) result = vec4(s.x, s.y, s.z, s.z / numPixels);\n"
+    "        else if (p.x < 1.5) result = vec4(exp2(s.w / numPixels), numPixels, 0.0, 0.0);\n"
+    "    }else if (p.x < float(numBins))\n"
+    "    {\n"
+    "        float cumulative = 0.0;\n"
+    "        for (int i = 0; i < 256; i++)\n"
+    "        {\n"
+    "            if (float(i) > p.x) break;\n"
+    "            cumulative += binCount(float(i));\n"
+    "        }\n"
+    "        float binWidth = (histogramRange.y - histogramRange.x) / float(numBins);\n"
+    "        float lower = histogramRange.x + p.x * binWidth;\n"
+    "        result = vec4(binCount(p.x) / numSamples, cumulative / numSamples, lower, lower + binWidth);\n"
+    "    }\n"
+    "    gl_FragColor = result;\n"
+    "}\n";
+
+//------------------------------------------------------------------------------
+// Shaders of the compute path. The first one reduces tiles of 32x32 pixels and
+// adds the histogram of the tile to the bins, the second one combines the tiles,
+// writes the output and clears the bins for the next frame.
+//------------------------------------------------------------------------------
+static const char* sReduceComputeSource =
+    "#version 430\n"
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "uniform sampler2D source;\n"
+    "layout(rgba32f, binding = 0) writeonly uniform image2D partials;\n"
+    "layout(r32ui, binding = 1) uniform uimage2D bins;\n"
+    "uniform ivec2 inputSize;\n"
+    "uniform int numBins;\n"
+    "uniform vec2 histogramRange;\n"
+    "uniform vec3 weights;\n"
+    "shared vec4 stats[256];\n"
+    "shared uint histogram[256];\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    histogram[t] = 0u;\n"
+    "    barrier();\n"
+    "    float scale = float(numBins) / (histogramRange.y - histogramRange.x);\n"
+    "    ivec2 base = ivec2(gl_WorkGroupID.xy) * 32 + ivec2(gl_LocalInvocationID.xy);\n"
+    "    vec4 s = vec4(1e30, -1e30, 0.0, 0.0);\n"
+    "    for (int j = 0; j < 2; j++)\n"
+    "    {\n"
+    "        for (int i = 0; i < 2; i++)\n"
+    "        {\n"
+    "            ivec2 p = base + ivec2(i, j) * 16;\n"
+    "            if (any(greaterThanEqual(p, inputSize))) continue;\n"
+    "            float l = dot(texelFetch(source, p, 0).rgb, weights);\n"
+    "            float lg = log2(max(l, 1e-6));\n"
+    "            s = vec4(min(s.x, l), max(s.y, l), s.z + l, s.w + lg);\n"
+    "            int b = clamp(int(floor((lg - histogramRange.x) * scale)), 0, numBins - 1);\n"
+    "            atomicAdd(histogram[b], 1u);\n"
+    "        }\n"
+    "    }\n"
+    "    stats[t] = s;\n"
+    "    barrier();\n"
+    "    for (uint n = 128u; n > 0u; n >>= 1)\n"
+    "    {\n"
+    "        if (t < n)\n"
+    "        {\n"
+    "            vec4 o = stats[t + n];\n"
+    "            stats[t] = vec4(min(stats[t].x, o.x), max(stats[t].y, o.y), stats[t].zw + o.zw);\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "    if (t == 0u) imageStore(partials, ivec2(gl_WorkGroupID.xy), stats[0]);\n"
+    "    if (t < uint(numBins) && histogram[t] != 0u) imageAtomicAdd(bins, ivec2(int(t), 0), histogram[t]);\n"
+    "}\n";
+
+static const char* sResolveComputeSource =
+    "#version 430\n"
+    "layout(local_size_x = 256) in;\n"
+    "layout(rgba32f, binding = 0) readonly uniform image2D partials;\n"
+    "layout(r32ui, binding = 1) uniform uimage2D bins;\n"
+    "layout(rgba32f, binding = 2) writeonly uniform image2D result;\n"
+    "uniform ivec2 partialsSize;\n"
+    "uniform int numBins;\n"
+    "uniform vec2 histogramRange;\n"
+    "uniform float numPixels;\n"
+    "uniform int outputWidth;\n"
+    "shared vec4 stats[256];\n"
+    "shared float histogram[256];\n"
+    "void main(void)\n"
+    "{\n"
+    "    int t = int(gl_LocalInvocationIndex);\n"
+    "    vec4 s = vec4(1e30, -1e30, 0.0, 0.0);\n"
+    "    for (int i = t; i < partialsSize.x * partialsSize.y; i += 256)\n"
+    "    {\n"
+    "        vec4 o = imageLoad(partials, ivec2(i % partialsSize.x, i / partialsSize.x));\n"
+    "        s = vec4(min(s.x, o.x), max(s.y, o.y), s.zw + o.zw);\n"
+    "    }\n"
+    "    stats[t] = s;\n"
+    "    histogram[t] = t < numBins ? float(imageLoad(bins, ivec2(t, 0)).r) : 0.0;\n"
+    "    if (t < numBins) imageStore(bins, ivec2(t, 0), uvec4(0u));\n"
+    "    barrier();\n"
+    "    for (int n = 128; n > 0; n >>= 1)\n"
+    "    {\n"
+    "        if (t < n)\n"
+    "        {\n"
+    "            vec4 o = stats[t + n];\n"
+    "            stats[t] = vec4(min(stats[t].x, o.x), max(stats[t].y, o.y), stats[t].zw + o.zw);\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "    if (t < numBins)\n"
+    "    {\n"
+    "        float cumulative = 0.0;\n"
+    "        for (int b = 0; b <= t; b++) cumulative += histogram[b];\n"
+    "        float binWidth = (histogramRange.y - histogramRange.x) / float(numBins);\n"
+    "        float lower = histogramRange.x + float(t) * binWidth;\n"
+    "        imageStore(result, ivec2(t, 1), vec4(histogram[t] / numPixels, cumulative / numPixels, lower, lower + binWidth));\n"
+    "    }else if (t < outputWidth)\n"
+    "        imageStore(result, ivec2(t, 1), vec4(0.0));\n"
+    "    if (t == 0)\n"
+    "    {\n"
+    "        vec4 r = stats[0];\n"
+    "        imageStore(result, ivec2(0, 0), vec4(r.x, r.y, r.z, r.z / numPixels));\n"
+    "        imageStore(result, ivec2(1, 0), vec4(exp2(r.w / numPixels), numPixels, 0.0, 0.0));\n"
+    "    }else if (t >= 2 && t < outputWidth)\n"
+    "        imageStore(result, ivec2(t, 0), vec4(0.0));\n"
+    "}\n";
+
+//------------------------------------------------------------------------------
+// Entry points of GL_ARB_compute_shader and GL_ARB_shader_image_load_store of a context
+//------------------------------------------------------------------------------
+struct ComputeFunctions
+{
+    typedef void (APIENTRY * DispatchComputeProc)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+    typedef void (APIENTRY * BindImageTextureProc)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+    typedef void (APIENTRY * MemoryBarrierProc)(GLbitfield barriers);
+
+    ComputeFunctions() : supported(false), glDispatchCompute(NULL), glBindImageTexture(NULL), glMemoryBarrier(NULL) {}
+
+    bool supported;
+    DispatchComputeProc glDispatchCompute;
+    BindImageTextureProc glBindImageTexture;
+    MemoryBarrierProc glMemoryBarrier;
+};
+
+//------------------------------------------------------------------------------
+static const ComputeFunctions& getComputeFunctions(unsigned int contextID)
+{
+    static OpenThreads::Mutex mutex;
+    static std::map<unsigned int, ComputeFunctions> functions;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+    std::map<unsigned int, ComputeFunctions>::iterator it = functions.find(contextID);
+    if (it != functions.end()) return it->second;
+
+    // the entry points can only be queried while the context is current
+    ComputeFunctions& compute = functions[contextID];
+    if (osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_compute_shader", 4.3f)
+        && osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_shader_image_load_store", 4.2f))
+    {
+        osg::setGLExtensionFuncPtr(compute.glDispatchCompute, "glDispatchCompute");
+        osg::setGLExtensionFuncPtr(compute.glBindImageTexture, "glBindImageTexture", "glBindImageTextureEXT");
+        osg::setGLExtensionFuncPtr(compute.glMemoryBarrier, "glMemoryBarrier", "glMemoryBarrierEXT");
+        compute.supported = compute.glDispatchCompute && compute.glBindImageTexture && compute.glMemoryBarrier;
+    }
+    if (!compute.supported)
+        osg::notify(osg::INFO) << "osgPPU::UnitInReductionOut - context " << contextID << " does not support compute shaders" << std::endl;
+
+    return compute;
+}
+
+//------------------------------------------------------------------------------
+static GLuint buildComputeProgram(osg::GL2Extensions* gl2, const char* source)
+{
+    GLint status = 0;
+    GLuint shader = gl2->glCreateShader(GL_COMPUTE_SHADER);
+    gl2->glShaderSource(shader, 1, &source, NULL);
+    gl2->glCompileShader(shader);
+    gl2->glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        std::string log;
+        gl2->getShaderInfoLog(shader, log);
+        osg::notify(osg::WARN) << "osgPPU::UnitInReductionOut - cannot compile compute shader:" << std::endl << log << std::endl;
+        gl2->glDeleteShader(shader);
+        return 0;
+    }
+
+    GLuint program = gl2->glCreateProgram();
+    gl2->glAttachShader(program, shader);
+    gl2->glLinkProgram(program);
+    gl2->glDeleteShader(shader);
+    gl2->glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        std::string log;
+        gl2->getProgramInfoLog(program, log);
+        osg::notify(osg::WARN) << "osgPPU::UnitInReductionOut - cannot link compute shader:" << std::endl << log << std::endl;
+        gl2->glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+//------------------------------------------------------------------------------
+static osg::Texture2D* createPassTexture(int width, int height)
+{
+    osg::Texture2D* tex = new osg::Texture2D();
+    tex->setTextureSize(width, height);
+    tex->setResizeNonPowerOfTwoHint(false);
+    tex->setInternalFormat(GL_RGBA32F_ARB);
+    tex->setSourceFormat(GL_RGBA);
+    tex->setSourceType(GL_FLOAT);
+    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    tex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    tex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    return tex;
+}
+
+//------------------------------------------------------------------------------
+UnitInReductionOut::UnitInReductionOut(const UnitInReductionOut& unit, const osg::CopyOp& copyop) :
+    UnitInOut(unit, copyop),
+    mPasses(unit.mPasses),
+    mPartialsTex(unit.mPartialsTex),
+    mBinsTex(unit.mBinsTex),
+    mRangeUniform(unit.mRangeUniform),
+    mWeightsUniform(unit.mWeightsUniform),
+    mProjectionMatrix(unit.mProjectionMatrix),
+    mModelviewMatrix(unit.mModelviewMatrix),
+    mNumBins(unit.mNumBins),
+    mHistogramMin(unit.mHistogramMin),
+    mHistogramMax(unit.mHistogramMax),
+    mLuminanceWeights(unit.mLuminanceWeights),
+    mUseComputeShader(unit.mUseComputeShader),
+    mInputWidth(unit.mInputWidth),
+    mInputHeight(unit.mInputHeight)
+{
+}
+
+//------------------------------------------------------------------------------
+UnitInReductionOut::UnitInReductionOut() : UnitInOut()
+{
+    mNumBins = 64;
+    mHistogramMin = -10.0f;
+    mHistogramMax = 10.0f;
+    mLuminanceWeights = osg::Vec3(0.2125f, 0.7154f, 0.0721f);
+    mUseComputeShader = true;
+    mInputWidth = 0;
+    mInputHeight = 0;
+    mProjectionMatrix = new osg::RefMatrix(osg::Matrix::ortho(0,1,0,1,0,1));
+    mModelviewMatrix = new osg::RefMatrix(osg::Matrixf::identity());
+
+    // sums of millions of pixels require full floats
+    mOutputInternalFormat = GL_RGBA32F_ARB;
+
+    mRangeUniform = new osg::Uniform("histogramRange", osg::Vec2(mHistogramMin, mHistogramMax));
+    mWeightsUniform = new osg::Uniform("weights", mLuminanceWeights);
+}
+
+//------------------------------------------------------------------------------
+UnitInReductionOut::~UnitInReductionOut()
+{
+    // programs of the compute path are deleted when their context flushes the orphaned objects
+    for (unsigned int i=0; i < mComputePrograms.size(); i++)
+        releaseComputePrograms(i, NULL);
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::releaseComputePrograms(unsigned int contextID, osg::State* state) const
+{
+    ComputePrograms& programs = mComputePrograms[contextID];
+    GLuint handles[2] = {programs.reduce, programs.resolve};
+    for (unsigned int i=0; i < 2; i++)
+    {
+        if (!handles[i]) continue;
+        if (state)
+            osg::GL2Extensions::Get(contextID, true)->glDeleteProgram(handles[i]);
+        else
+            osg::Program::deleteGlProgram(contextID, handles[i]);
+    }
+    programs = ComputePrograms();
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::releaseGLObjects(osg::State* state) const
+{
+    if (state)
+        releaseComputePrograms(state->getContextID(), state);
+    else
+        for (unsigned int i=0; i < mComputePrograms.size(); i++)
+            releaseComputePrograms(i, NULL);
+
+    UnitInOut::releaseGLObjects(state);
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::setNumBins(unsigned int bins)
+{
+    bins = std::max(1u, std::min(bins, (unsigned int)OSGPPU_REDUCTION_MAX_BINS));
+    if (bins == mNumBins) return;
+    mNumBins = bins;
+    dirty();
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::setHistogramRange(float minLog2, float maxLog2)
+{
+    if (maxLog2 <= minLog2)
+    {
+        osg::notify(osg::WARN) << "osgPPU::UnitInReductionOut::setHistogramRange() - " << getName() << " empty range [" << minLog2 << ", " << maxLog2 << "] is ignored" << std::endl;
+        return;
+    }
+    mHistogramMin = minLog2;
+    mHistogramMax = maxLog2;
+    mRangeUniform->set(osg::Vec2(mHistogramMin, mHistogramMax));
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::setLuminanceWeights(const osg::Vec3& weights)
+{
+    mLuminanceWeights = weights;
+    mWeightsUniform->set(mLuminanceWeights);
+}
+
+//------------------------------------------------------------------------------
+osg::Texture* UnitInReductionOut::getOrCreateOutputTexture(int mrt)
+{
+    // if already exists, then return back
+    osg::Texture* tex = mOutputTex[mrt].get();
+    if (tex) return tex;
+
+    // the output is of the size of the histogram and not of the input
+    mOutputTex[mrt] = createOutputTexture(getOutputWidth(), 2);
+    return mOutputTex[mrt].get();
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::noticeChangeViewport(osg::Viewport* vp)
+{
+    // the viewport gives the size of the input, the output is of the size of the histogram
+    mInputWidth = int(vp->width());
+    mInputHeight = int(vp->height());
+
+    osg::ref_ptr<osg::Viewport> outputVp = new osg::Viewport(0, 0, getOutputWidth(), 2);
+    UnitInOut::noticeChangeViewport(outputVp.get());
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::init()
+{
+    // default initialization
+    UnitInOut::init();
+
+    // the output is read at the texel centers
+    osg::Texture* output = getOrCreateOutputTexture(0);
+    if (output)
+    {
+        output->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        output->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    }
+
+    createFragmentPasses();
+
+    // setup the textures of the compute path, they are only allocated if used
+    if (mInputWidth > 0 && mInputHeight > 0)
+    {
+        int pw = (mInputWidth + REDUCTION_TILE_SIZE - 1) / REDUCTION_TILE_SIZE;
+        int ph = (mInputHeight + REDUCTION_TILE_SIZE - 1) / REDUCTION_TILE_SIZE;
+        if (!mPartialsTex.valid() || mPartialsTex->getTextureWidth() != pw || mPartialsTex->getTextureHeight() != ph)
+            mPartialsTex = createPassTexture(pw, ph);
+    }
+
+    if (!mBinsTex.valid() || mBinsTex->getTextureWidth() != (int)mNumBins)
+    {
+        // the bins are cleared by the compute shader after reading, hence only initially here
+        osg::ref_ptr<osg::Image> img = new osg::Image();
+        img->allocateImage(mNumBins, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT);
+        memset(img->data(), 0, img->getTotalSizeInBytes());
+
+        mBinsTex = new osg::Texture2D(img.get());
+        mBinsTex->setResizeNonPowerOfTwoHint(false);
+        mBinsTex->setInternalFormat(GL_R32UI);
+        mBinsTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        mBinsTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    }
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::createFragmentPasses()
+{
+    mPasses.clear();
+
+    // check if the textures are 2D textures
+    osg::Texture2D* input = dynamic_cast<osg::Texture2D*>(getInputTexture(0));
+    osg::Texture2D* output = dynamic_cast<osg::Texture2D*>(mOutputTex[0].get());
+    if (input == NULL || output == NULL)
+    {
+        osg::notify(osg::WARN) << "osgPPU::UnitInReductionOut::createFragmentPasses() - " << getName() << " currently only 2D textures are supported" << std::endl;
+        return;
+    }
+    if (mInputWidth <= 0 || mInputHeight <= 0) return;
+
+    osg::ref_ptr<osg::Program> reduceFirst = new osg::Program();
+    reduceFirst->addShader(new osg::Shader(osg::Shader::FRAGMENT, std::string("#version 120\n#define FIRST_PASS\n") + sReduceFragmentSource));
+    osg::ref_ptr<osg::Program> reduce = new osg::Program();
+    reduce->addShader(new osg::Shader(osg::Shader::FRAGMENT, std::string("#version 120\n") + sReduceFragmentSource));
+    osg::ref_ptr<osg::Program> histogramRows = new osg::Program();
+    histogramRows->addShader(new osg::Shader(osg::Shader::FRAGMENT, sHistogramRowsFragmentSource));
+    osg::ref_ptr<osg::Program> histogramSum = new osg::Program();
+    histogramSum->addShader(new osg::Shader(osg::Shader::FRAGMENT, sHistogramSumFragmentSource));
+    osg::ref_ptr<osg::Program> resolve = new osg::Program();
+    resolve->addShader(new osg::Shader(osg::Shader::FRAGMENT, sResolveFragmentSource));
+
+    // reduce blocks of 8x8 texels until a single texel is left
+    osg::ref_ptr<osg::Texture2D> source = input;
+    int sw = mInputWidth, sh = mInputHeight;
+    std::vector<osg::ref_ptr<osg::Texture2D> > targets;
+    do
+    {
+        int dw = (sw + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE;
+        int dh = (sh + REDUCTION_BLOCK_SIZE - 1) / REDUCTION_BLOCK_SIZE;
+        osg::ref_ptr<osg::Texture2D> target = createPassTexture(dw, dh);
+
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttribute(source == input ? reduceFirst.get() : reduce.get(), osg::StateAttribute::ON);
+        ss->setTextureAttribute(0, source.get());
+        ss->getOrCreateUniform("source", osg::Uniform::INT)->set(0);
+        ss->getOrCreateUniform("sourceSize", osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(sw, sh));
+        ss->addUniform(mWeightsUniform.get());
+        ss->setAttribute(new osg::Viewport(0, 0, dw, dh), osg::StateAttribute::ON);
+        targets.push_back(target);
+
+        Pass pass;
+        pass.fbo = new FrameBufferObject();
+        pass.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(target.get(), 0));
+        pass.drawable = createTexturedQuadDrawable();
+        pass.drawable->setStateSet(ss);
+        mPasses.push_back(pass);
+
+        source = target;
+        sw = dw; sh = dh;
+    }while (sw > 1 || sh > 1);
+    osg::ref_ptr<osg::Texture2D> reduction = source;
+
+    // count the histogram of a sample grid, each texel holds 4 bins of a row of the grid.
+    // larger inputs are only sampled, which approximates the histogram, @see setNumBins()
+    int gw = std::min(mInputWidth, REDUCTION_HISTOGRAM_GRID);
+    int gh = std::min(mInputHeight, REDUCTION_HISTOGRAM_GRID);
+    int cw = ((int)mNumBins + 3) / 4;
+    osg::ref_ptr<osg::Texture2D> rows = createPassTexture(cw, gh);
+    osg::ref_ptr<osg::Texture2D> counts = createPassTexture(cw, 1);
+    {
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttribute(histogramRows.get(), osg::StateAttribute::ON);
+        ss->setTextureAttribute(0, input);
+        ss->getOrCreateUniform("source", osg::Uniform::INT)->set(0);
+        ss->getOrCreateUniform("gridSize", osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(gw, gh));
+        ss->getOrCreateUniform("numBins", osg::Uniform::INT)->set((int)mNumBins);
+        ss->addUniform(mRangeUniform.get());
+        ss->addUniform(mWeightsUniform.get());
+        ss->setAttribute(new osg::Viewport(0, 0, cw, gh), osg::StateAttribute::ON);
+
+        Pass pass;
+        pass.fbo = new FrameBufferObject();
+        pass.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(rows.get(), 0));
+        pass.drawable = createTexturedQuadDrawable();
+        pass.drawable->setStateSet(ss);
+        mPasses.push_back(pass);
+    }
+    {
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttribute(histogramSum.get(), osg::StateAttribute::ON);
+        ss->setTextureAttribute(0, rows.get());
+        ss->getOrCreateUniform("source", osg::Uniform::INT)->set(0);
+        ss->getOrCreateUniform("sourceSize", osg::Uniform::FLOAT_VEC2)->set(osg::Vec2(cw, gh));
+        ss->setAttribute(new osg::Viewport(0, 0, cw, 1), osg::StateAttribute::ON);
+
+        Pass pass;
+        pass.fbo = new FrameBufferObject();
+        pass.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(counts.get(), 0));
+        pass.drawable = createTexturedQuadDrawable();
+        pass.drawable->setStateSet(ss);
+        mPasses.push_back(pass);
+    }
+
+    // resolve statistics and histogram into the output
+    {
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttribute(resolve.get(), osg::StateAttribute::ON);
+        ss->setTextureAttribute(0, reduction.get());
+        ss->setTextureAttribute(1, counts.get());
+        ss->getOrCreateUniform("reduction", osg::Uniform::INT)->set(0);
+        ss->getOrCreateUniform("counts", osg::Uniform::INT)->set(1);
+        ss->getOrCreateUniform("countsWidth", osg::Uniform::FLOAT)->set((float)cw);
+        ss->getOrCreateUniform("numPixels", osg::Uniform::FLOAT)->set((float)mInputWidth * (float)mInputHeight);
+        ss->getOrCreateUniform("numSamples", osg::Uniform::FLOAT)->set((float)gw * (float)gh);
+        ss->getOrCreateUniform("numBins", osg::Uniform::INT)->set((int)mNumBins);
+        ss->addUniform(mRangeUniform.get());
+        ss->setAttribute(new osg::Viewport(0, 0, getOutputWidth(), 2), osg::StateAttribute::ON);
+
+        Pass pass;
+        pass.fbo = new FrameBufferObject();
+        pass.fbo->setAttachment(osg::Camera::COLOR_BUFFER0, osg::FrameBufferAttachment(output, 0));
+        pass.drawable = createTexturedQuadDrawable();
+        pass.drawable->setStateSet(ss);
+        mPasses.push_back(pass);
+    }
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::drawFragmentPasses(osg::RenderInfo& info)
+{
+    osg::State& state = *info.getState();
+
+    // setup matricies, they must be setted up correctly in order
+    // to have correct rendering of the passes
+    state.applyProjectionMatrix(mProjectionMatrix.get());
+    state.applyModelViewMatrix(mModelviewMatrix.get());
+
+    for (unsigned i=0; i < mPasses.size(); i++)
+    {
+        state.apply(mPasses[i].drawable->getStateSet());
+        mPasses[i].fbo->apply(state);
+        mPasses[i].drawable->drawImplementation(info);
+    }
+}
+
+//------------------------------------------------------------------------------
+bool UnitInReductionOut::dispatchComputePasses(osg::RenderInfo& info)
+{
+    osg::State& state = *info.getState();
+    unsigned int contextID = state.getContextID();
+
+    const ComputeFunctions& compute = getComputeFunctions(contextID);
+    if (!compute.supported) return false;
+
+    // images of the output are written as rgba32f
+    osg::Texture2D* input = dynamic_cast<osg::Texture2D*>(getInputTexture(0));
+    osg::Texture2D* output = dynamic_cast<osg::Texture2D*>(mOutputTex[0].get());
+    if (!input || !output || !mPartialsTex.valid() || output->getInternalFormat() != GL_RGBA32F_ARB) return false;
+
+    osg::GL2Extensions* gl2 = osg::GL2Extensions::Get(contextID, true);
+
+    // build the programs on the first use in the context
+    ComputePrograms& programs = mComputePrograms[contextID];
+    if (!programs.built)
+    {
+        programs.built = true;
+        programs.reduce = buildComputeProgram(gl2, sReduceComputeSource);
+        programs.resolve = buildComputeProgram(gl2, sResolveComputeSource);
+        if (programs.reduce)
+        {
+            programs.reduceInputSize = gl2->glGetUniformLocation(programs.reduce, "inputSize");
+            programs.reduceNumBins = gl2->glGetUniformLocation(programs.reduce, "numBins");
+            programs.reduceRange = gl2->glGetUniformLocation(programs.reduce, "histogramRange");
+            programs.reduceWeights = gl2->glGetUniformLocation(programs.reduce, "weights");
+            gl2->glUseProgram(programs.reduce);
+            gl2->glUniform1i(gl2->glGetUniformLocation(programs.reduce, "source"), 0);
+        }
+        if (programs.resolve)
+        {
+            programs.resolvePartialsSize = gl2->glGetUniformLocation(programs.resolve, "partialsSize");
+            programs.resolveNumBins = gl2->glGetUniformLocation(programs.resolve, "numBins");
+            programs.resolveRange = gl2->glGetUniformLocation(programs.resolve, "histogramRange");
+            programs.resolveNumPixels = gl2->glGetUniformLocation(programs.resolve, "numPixels");
+            programs.resolveOutputWidth = gl2->glGetUniformLocation(programs.resolve, "outputWidth");
+        }
+    }
+    if (!programs.reduce || !programs.resolve) return false;
+
+    // make sure all textures are allocated, the input stays bound to unit 0
+    state.applyTextureAttribute(0, mPartialsTex.get());
+    state.applyTextureAttribute(0, mBinsTex.get());
+    state.applyTextureAttribute(0, output);
+    state.applyTextureAttribute(0, input);
+
+    osg::Texture::TextureObject* partialsObj = mPartialsTex->getTextureObject(contextID);
+    osg::Texture::TextureObject* binsObj = mBinsTex->getTextureObject(contextID);
+    osg::Texture::TextureObject* outputObj = output->getTextureObject(contextID);
+    if (!partialsObj || !binsObj || !outputObj) return false;
+
+    int pw = mPartialsTex->getTextureWidth();
+    int ph = mPartialsTex->getTextureHeight();
+
+    // reduce the tiles and count the histogram
+    gl2->glUseProgram(programs.reduce);
+    gl2->glUniform2i(programs.reduceInputSize, mInputWidth, mInputHeight);
+    gl2->glUniform1i(programs.reduceNumBins, (GLint)mNumBins);
+    gl2->glUniform2f(programs.reduceRange, mHistogramMin, mHistogramMax);
+    gl2->glUniform3f(programs.reduceWeights, mLuminanceWeights.x(), mLuminanceWeights.y(), mLuminanceWeights.z());
+    compute.glBindImageTexture(0, partialsObj->id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F_ARB);
+    compute.glBindImageTexture(1, binsObj->id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    compute.glDispatchCompute(pw, ph, 1);
+    compute.glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    // combine the tiles into the output
+    gl2->glUseProgram(programs.resolve);
+    gl2->glUniform2i(programs.resolvePartialsSize, pw, ph);
+    gl2->glUniform1i(programs.resolveNumBins, (GLint)mNumBins);
+    gl2->glUniform2f(programs.resolveRange, mHistogramMin, mHistogramMax);
+    gl2->glUniform1f(programs.resolveNumPixels, (float)mInputWidth * (float)mInputHeight);
+    gl2->glUniform1i(programs.resolveOutputWidth, getOutputWidth());
+    compute.glBindImageTexture(0, partialsObj->id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F_ARB);
+    compute.glBindImageTexture(2, outputObj->id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F_ARB);
+    compute.glDispatchCompute(1, 1, 1);
+
+    // the output is read by the children, the readbacks and the next frame
+    compute.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    // the program was changed behind the back of osg
+    gl2->glUseProgram(0);
+    state.setLastAppliedProgramObject(NULL);
+    state.haveAppliedAttribute(osg::StateAttribute::PROGRAM);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool UnitInReductionOut::noticeBeginRendering (osg::RenderInfo& info, const osg::Drawable* )
+{
+    if (mInputWidth <= 0 || mInputHeight <= 0) return false;
+
+    // use the compute shaders if possible, otherwise render the fragment passes
+    if (!mUseComputeShader || !dispatchComputePasses(info))
+    {
+        pushFrameBufferObject(*info.getState());
+        drawFragmentPasses(info);
+        popFrameBufferObject(*info.getState());
+    }
+
+    // return false, so that parent drawable will not be rendered
+    // this unit does the handling of the passes manually
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void UnitInReductionOut::noticeFinishRendering(osg::RenderInfo&, const osg::Drawable* )
+{
+    // the fbo was restored already by noticeBeginRendering
+}
+
+}; // end namespace
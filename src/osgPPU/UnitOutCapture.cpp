@@ -16,12 +16,18 @@
 
 #include <osgPPU/Processor.h>
 #include <osgPPU/UnitOutCapture.h>
+#include <osgPPU/CaptureSink.h>
 
 #include <osg/Texture2D>
+#include <osg/BufferObject>
 #include <osgDB/WriteFile>
 #include <osgDB/Registry>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
 
 #include <iostream>
+#include <deque>
 
 namespace osgPPU
 {
@@ -47,12 +53,162 @@ namespace osgPPU
         UnitOutCapture* _parent;
     };
 
+    //------------------------------------------------------------------------------
+    // Pool of threads passing the captured frames to the sink
+    //------------------------------------------------------------------------------
+    class CaptureWriter : public osg::Referenced
+    {
+        public:
+            //! Captured frame
+            struct Job
+            {
+                Job() : input(0), number(0), sequence(0) {}
+                osg::ref_ptr<osg::Image> image;
+                int input;
+                int number;
+                unsigned int sequence;
+            };
+
+            CaptureWriter(unsigned int numWorkers, unsigned int queueDepth, CaptureSink* sink) :
+                mQueueDepth(queueDepth), mSink(sink), mBusy(0), mNextQueued(0), mNextWritten(0), mQuit(false)
+            {
+                for (unsigned int i=0; i < numWorkers; i++)
+                {
+                    Worker* worker = new Worker(this);
+                    mWorkers.push_back(worker);
+                    worker->start();
+                }
+            }
+
+            inline CaptureSink* getSink() { return mSink.get(); }
+
+            //! Queue a frame. If the queue is full, then the frame is dropped or it is waited for a free place.
+            void push(Job job, bool block)
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                if (mJobs.size() >= mQueueDepth && !block)
+                {
+                    mStatistics.numDropped++;
+                    return;
+                }
+                while (mJobs.size() >= mQueueDepth) mNotFull.wait(&mMutex);
+
+                job.sequence = mNextQueued++;
+                mJobs.push_back(job);
+                mStatistics.numQueued++;
+                mNotEmpty.signal();
+            }
+
+            //! Wait until all queued frames are written
+            void waitUntilIdle()
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                while (!mJobs.empty() || mBusy > 0) mIdle.wait(&mMutex);
+            }
+
+            //! Wait until the sink does not use the image anymore
+            void waitForRelease(const osg::Image* image)
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                while (image->referenceCount() > 1) mReleased.wait(&mMutex);
+            }
+
+            UnitOutCapture::Statistics getStatistics()
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                return mStatistics;
+            }
+
+        protected:
+            ~CaptureWriter()
+            {
+                // the queued frames are written before the workers quit
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    mQuit = true;
+                    mNotEmpty.broadcast();
+                }
+                for (std::vector<Worker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); it++)
+                {
+                    (*it)->join();
+                    delete *it;
+                }
+            }
+
+            class Worker;
+            friend class Worker;
+
+            class Worker : public OpenThreads::Thread
+            {
+                public:
+                    Worker(CaptureWriter* writer) : _writer(writer) {}
+                    virtual void run() { _writer->loop(); }
+                private:
+                    CaptureWriter* _writer;
+            };
+
+            void loop()
+            {
+                bool sequential = mSink->isSequential();
+                while (true)
+                {
+                    Job job;
+                    {
+                        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                        while (!mQuit && mJobs.empty()) mNotEmpty.wait(&mMutex);
+                        if (mJobs.empty()) return;
+
+                        job = mJobs.front();
+                        mJobs.pop_front();
+                        mBusy++;
+                        mNotFull.signal();
+
+                        // sequential sinks get the frames one after the other
+                        while (sequential && mNextWritten != job.sequence) mTurn.wait(&mMutex);
+                    }
+
+                    bool success = mSink->write(job.input, job.number, *job.image);
+                    job.image = NULL;
+
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    if (success) mStatistics.numWritten++;
+                    else mStatistics.numFailed++;
+                    mBusy--;
+                    mNextWritten++;
+                    mTurn.broadcast();
+                    mReleased.broadcast();
+                    if (mJobs.empty() && mBusy == 0) mIdle.broadcast();
+                }
+            }
+
+            std::vector<Worker*> mWorkers;
+            OpenThreads::Mutex mMutex;
+            OpenThreads::Condition mNotEmpty;
+            OpenThreads::Condition mNotFull;
+            OpenThreads::Condition mIdle;
+            OpenThreads::Condition mTurn;
+            OpenThreads::Condition mReleased;
+            std::deque<Job> mJobs;
+            unsigned int mQueueDepth;
+            osg::ref_ptr<CaptureSink> mSink;
+            unsigned int mBusy;
+            unsigned int mNextQueued;
+            unsigned int mNextWritten;
+            bool mQuit;
+            UnitOutCapture::Statistics mStatistics;
+    };
+
     //------------------------------------------------------------------------------
     UnitOutCapture::UnitOutCapture(const UnitOutCapture& unit, const osg::CopyOp& copyop) :
         UnitOut(unit, copyop),
         mPath(unit.mPath),
         mExtension(unit.mExtension),
-        mShotOnce(unit.mShotOnce)
+        mShotOnce(unit.mShotOnce),
+        mNumBuffers(unit.mNumBuffers),
+        mNumWorkers(unit.mNumWorkers),
+        mQueueDepth(unit.mQueueDepth),
+        mQueuePolicy(unit.mQueuePolicy),
+        mDataType(unit.mDataType)
     {
     
     }
@@ -62,11 +218,18 @@ namespace osgPPU
         mPath = ".";
         mExtension = "png";
         mShotOnce = false;
+        mNumBuffers = 3;
+        mNumWorkers = 2;
+        mQueueDepth = 8;
+        mQueuePolicy = DROP_FRAMES;
+        mDataType = 0;
     }
     
     //------------------------------------------------------------------------------
     UnitOutCapture::~UnitOutCapture()
     {
+        // queued frames are still written, frames in flight on the GPU are lost
+        releaseWriter();
     }
     
     //------------------------------------------------------------------------------
@@ -82,41 +245,261 @@ namespace osgPPU
         mGeode->addDrawable(mDrawable.get());
     }
 
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::setNumBuffers(unsigned int num)
+    {
+        mNumBuffers = num > 0 ? num : 1;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::setNumWorkers(unsigned int num)
+    {
+        if (num == mNumWorkers) return;
+        mNumWorkers = num > 0 ? num : 1;
+        releaseWriter();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::setQueueDepth(unsigned int depth)
+    {
+        if (depth == mQueueDepth) return;
+        mQueueDepth = depth > 0 ? depth : 1;
+        releaseWriter();
+    }
+
+    //------------------------------------------------------------------------------
+    UnitOutCapture::Statistics UnitOutCapture::getStatistics() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+
+        Statistics stats = mStatistics;
+        CaptureWriter* writer = static_cast<CaptureWriter*>(mWriter.get());
+        if (writer)
+        {
+            Statistics current = writer->getStatistics();
+            stats.numQueued += current.numQueued;
+            stats.numDropped += current.numDropped;
+            stats.numWritten += current.numWritten;
+            stats.numFailed += current.numFailed;
+        }
+        return stats;
+    }
+
+    //------------------------------------------------------------------------------
+    osg::Referenced* UnitOutCapture::getWriter()
+    {
+        // without a sink the frames are written into files at the current path
+        CaptureSink* sink = mSink.get();
+        if (!sink)
+        {
+            if (!mFileSink.valid() || mFileSink->getPath() != mPath || mFileSink->getFileExtension() != mExtension)
+                mFileSink = new ImageFileSink(mPath, mExtension);
+            sink = mFileSink.get();
+        }
+
+        // the workers do write into the sink given when they were created
+        CaptureWriter* writer = static_cast<CaptureWriter*>(mWriter.get());
+        if (writer && writer->getSink() != sink)
+            releaseWriter();
+
+        if (!mWriter.valid())
+        {
+            osg::ref_ptr<osg::Referenced> created = new CaptureWriter(mNumWorkers, mQueueDepth, sink);
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            mWriter = created;
+        }
+        return mWriter.get();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::releaseWriter()
+    {
+        osg::ref_ptr<osg::Referenced> writer;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+            writer.swap(mWriter);
+        }
+        if (!writer.valid()) return;
+
+        CaptureWriter* pool = static_cast<CaptureWriter*>(writer.get());
+        pool->waitUntilIdle();
+        Statistics stats = pool->getStatistics();
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+        mStatistics.numQueued += stats.numQueued;
+        mStatistics.numDropped += stats.numDropped;
+        mStatistics.numWritten += stats.numWritten;
+        mStatistics.numFailed += stats.numFailed;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::queue(osg::Image* image, int input, int number)
+    {
+        CaptureWriter::Job job;
+        job.image = image;
+        job.input = input;
+        job.number = number;
+        static_cast<CaptureWriter*>(getWriter())->push(job, mQueuePolicy == BLOCK);
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::retire(ReadbackRing& ring, bool wait, bool all)
+    {
+        while (!ring.frames.empty() && ring.frames[ring.retire].pending)
+        {
+            Readback& readback = ring.frames[ring.retire];
+            Fence* fence = ring.buffers->getFence(ring.retire);
+            if (!wait && !fence->isSignaled()) break;
+            fence->wait();
+
+            // the buffer stays mapped, while the sink reads the frame directly out of it
+            void* data = ring.buffers->map(ring.retire, GL_READ_ONLY_ARB);
+            if (data)
+            {
+                readback.view = new osg::Image();
+                readback.view->setImage(readback.width, readback.height, 1, readback.format, readback.format, readback.type,
+                    static_cast<unsigned char*>(data), osg::Image::NO_DELETE, 1);
+            }
+
+            readback.pending = false;
+            fence->release();
+            ring.retire = (ring.retire + 1) % ring.frames.size();
+
+            if (data) queue(readback.view.get(), readback.input, readback.number);
+            if (!all) break;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    bool UnitOutCapture::unmap(ReadbackRing& ring, unsigned int index, bool wait)
+    {
+        Readback& readback = ring.frames[index];
+        if (!readback.view.valid()) return true;
+
+        // the sink might still read the frame
+        if (readback.view->referenceCount() > 1)
+        {
+            CaptureWriter* writer = static_cast<CaptureWriter*>(mWriter.get());
+            if (!wait || !writer) return false;
+            writer->waitForRelease(readback.view.get());
+        }
+
+        ring.buffers->unmap(index);
+        readback.view = NULL;
+
+        return true;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitOutCapture::flush(osg::State* state)
+    {
+        if (state)
+        {
+            for (std::map<std::pair<unsigned int, int>, ReadbackRing>::iterator it = mReadbacks.begin(); it != mReadbacks.end(); it++)
+                if (it->first.first == state->getContextID()) retire(it->second, true, true);
+        }
+
+        CaptureWriter* writer = static_cast<CaptureWriter*>(mWriter.get());
+        if (writer) writer->waitUntilIdle();
+
+        if (state)
+        {
+            for (std::map<std::pair<unsigned int, int>, ReadbackRing>::iterator it = mReadbacks.begin(); it != mReadbacks.end(); it++)
+            {
+                if (it->first.first != state->getContextID()) continue;
+                for (unsigned int i=0; i < it->second.frames.size(); i++) unmap(it->second, i, true);
+            }
+        }
+
+        if (writer) writer->getSink()->flush();
+    }
 
     //------------------------------------------------------------------------------
     void UnitOutCapture::captureInput(osg::State* state)
     {
+        unsigned int contextID = state->getContextID();
+        osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+
         // for each input texture do
-        for (unsigned int i=0; i < mInputTex.size(); i++)
+        for (TextureMap::iterator it = mInputTex.begin(); it != mInputTex.end(); it++)
         {
-            // create file name (allocate memory big enough to be just safe)
-            char* filename = (char*)malloc(sizeof(char) * (mPath.length() + mExtension.length() + 32));
-            sprintf( filename, "%s/%d_%04d.%s", mPath.c_str(), i, mCaptureNumber[i], mExtension.c_str());
-            osg::notify(osg::WARN) << "osgPPU::UnitOutCapture::Capture " << mCaptureNumber[i] << " frame to " << filename << " ...";
-            osg::notify(osg::WARN).flush();
-        
-            mCaptureNumber[i]++;
-
             // input texture 
-            osg::Texture* input = getInputTexture(i);
+            osg::Texture* input = it->second.get();
+            if (input == NULL) continue;
+
+            int number = mCaptureNumber[it->first];
+            GLenum format = osg::Image::computePixelFormat(input->getInternalFormat());
+            GLenum type = mDataType ? mDataType : osg::Image::computeFormatDataType(input->getInternalFormat());
 
             // bind input texture, so that we can get image from it
-            if (input != NULL) 
-                state->applyTextureAttribute(0, input);
-            
-            // retrieve texture content
-            osg::ref_ptr<osg::Image> img = new osg::Image();
-            img->readImageFromCurrentTexture(state->getContextID(), false, osg::Image::computeFormatDataType(input->getInternalFormat()));
-            osgDB::ReaderWriter::WriteResult res = osgDB::Registry::instance()->writeImage(*img, filename, NULL);
-            if (res.success())
-                osg::notify(osg::WARN) << " OK" << std::endl;
-            else
-                osg::notify(osg::WARN) << " failed! (" << res.message() << ")" << std::endl;
-                        
-            // release character memory
-            free(filename);
+            state->applyTextureAttribute(0, input);
+
+            // without pixel buffers the texture content is retrieved directly
+            if (!ext || !ext->isPBOSupported())
+            {
+                osg::ref_ptr<osg::Image> img = new osg::Image();
+                img->readImageFromCurrentTexture(contextID, false, type);
+                queue(img.get(), it->first, number);
+                mCaptureNumber[it->first]++;
+                continue;
+            }
+
+            ReadbackRing& ring = mReadbacks[std::pair<unsigned int, int>(contextID, it->first)];
+            if (!ring.buffers.valid()) ring.buffers = new PixelBufferRing(GL_PIXEL_PACK_BUFFER_ARB, GL_STREAM_READ_ARB);
+            if (ring.frames.size() != mNumBuffers)
+            {
+                retire(ring, true, true);
+                for (unsigned int i=0; i < ring.frames.size(); i++) unmap(ring, i, true);
+
+                ring.buffers->resize(contextID, mNumBuffers);
+                ring.frames.assign(mNumBuffers, Readback());
+                ring.retire = 0;
+            }
+
+            // pass all frames, which are already read back, and unmap the frames written by the sink
+            retire(ring, false, true);
+            for (unsigned int i=0; i < ring.frames.size(); i++) unmap(ring, i, false);
+
+            // if all buffers are in use, then either this frame is dropped or the oldest frame is waited for
+            unsigned int index = ring.buffers->getNext();
+            Readback& readback = ring.frames[index];
+            if (readback.pending || readback.view.valid())
+            {
+                if (mQueuePolicy == DROP_FRAMES)
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mMutex);
+                    mStatistics.numDropped++;
+                    continue;
+                }
+                retire(ring, true, false);
+                unmap(ring, index, true);
+            }
+
+            int width = input->getTextureWidth();
+            int height = input->getTextureHeight();
+            unsigned int size = osg::Image::computeRowWidthInBytes(width, format, type, 1) * height;
+
+            // start the transfer, it is finished by the GPU later
+            ring.buffers->bind(index, size);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glGetTexImage(input->getTextureTarget(), 0, format, type, NULL);
+            ring.buffers->unbind();
+            ring.buffers->insertFence(index);
+
+            readback.pending = true;
+            readback.input = it->first;
+            readback.number = number;
+            readback.width = width;
+            readback.height = height;
+            readback.format = format;
+            readback.type = type;
+            ring.buffers->advance();
+
+            mCaptureNumber[it->first]++;
         }
-    
+
+        // a single shot is not continued by the next frames, hence it is finished here
+        if (mShotOnce) flush(state);
     }
 
 }; // end namespace
@@ -22,23 +22,47 @@
 #include <osg/Texture3D>
 #include <osg/TextureCubeMap>
 #include <osg/TextureRectangle>
+#include <osg/BufferObject>
+#include <OpenThreads/ScopedLock>
 
 namespace osgPPU
 {
     //------------------------------------------------------------------------------
-    UnitTexture::UnitTexture() : UnitBypass()
+    UnitTexture::UnitTexture() : UnitBypass(),
+        mNumStreamBuffers(0),
+        mStreamFormat(GL_RGBA),
+        mStreamType(GL_UNSIGNED_BYTE),
+        mStreamFrameSize(0),
+        mStreamSequence(0),
+        mNumUploadedFrames(0),
+        mNumReplacedFrames(0)
     {
     }
 
     //------------------------------------------------------------------------------
     UnitTexture::UnitTexture(const UnitTexture& u, const osg::CopyOp& copyop) : 
         UnitBypass(u, copyop),
+        mNumStreamBuffers(0),
+        mStreamFormat(u.mStreamFormat),
+        mStreamType(u.mStreamType),
+        mStreamFrameSize(0),
+        mStreamSequence(0),
+        mNumUploadedFrames(0),
+        mNumReplacedFrames(0),
         _externTexture(u._externTexture)
     {
+        if (u.mNumStreamBuffers) setStreaming(u.mNumStreamBuffers, u.mStreamFormat, u.mStreamType);
     }
     
     //------------------------------------------------------------------------------
-    UnitTexture::UnitTexture(osg::Texture* tex)
+    UnitTexture::UnitTexture(osg::Texture* tex) : UnitBypass(),
+        mNumStreamBuffers(0),
+        mStreamFormat(GL_RGBA),
+        mStreamType(GL_UNSIGNED_BYTE),
+        mStreamFrameSize(0),
+        mStreamSequence(0),
+        mNumUploadedFrames(0),
+        mNumReplacedFrames(0)
     {
         setTexture(tex);
     }
@@ -46,7 +70,8 @@ namespace osgPPU
     //------------------------------------------------------------------------------
     UnitTexture::~UnitTexture()
     {
-
+        // the pixel buffers can not be deleted here, since there is no context.
+        // the stream ring hands them over to be deleted with the context.
     }
 
     //------------------------------------------------------------------------------
@@ -111,5 +136,225 @@ namespace osgPPU
         noticeChangeViewport(mViewport);
     }
 
+    //------------------------------------------------------------------------------
+    void UnitTexture::setStreaming(unsigned int numBuffers, GLenum format, GLenum type)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+            mNumStreamBuffers = numBuffers;
+            mStreamFormat = format;
+            mStreamType = type;
+            mStreamMapped.broadcast();
+        }
+
+        // the buffers are handled on draw, the draw callback is kept, so that
+        // the buffers are released on the next draw, if the streaming was disabled
+        if (numBuffers > 0 && mGeode->getNumDrawables() > 0)
+            mGeode->getDrawable(0)->setDrawCallback(new StreamDrawCallback(this));
+    }
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitTexture::getStreamFrameSize() const
+    {
+        if (!_externTexture.valid()) return 0;
+        return osg::Image::computeRowWidthInBytes(_externTexture->getTextureWidth(), mStreamFormat, mStreamType, 1) * _externTexture->getTextureHeight();
+    }
+
+    //------------------------------------------------------------------------------
+    UnitTexture::StreamBuffer* UnitTexture::findStreamBuffer(void* data)
+    {
+        for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+            if (mStreamBuffers[i].data == data && mStreamBuffers[i].state == STREAM_WRITING) return &mStreamBuffers[i];
+        return NULL;
+    }
+
+    //------------------------------------------------------------------------------
+    void* UnitTexture::acquireFrame(bool wait)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+        while (mNumStreamBuffers > 0)
+        {
+            for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+            {
+                if (mStreamBuffers[i].state != STREAM_MAPPED) continue;
+                mStreamBuffers[i].state = STREAM_WRITING;
+                return mStreamBuffers[i].data;
+            }
+
+            // a published frame is replaced rather than waiting for the next draw
+            StreamBuffer* oldest = NULL;
+            for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+                if (mStreamBuffers[i].state == STREAM_READY && (!oldest || mStreamBuffers[i].sequence < oldest->sequence)) oldest = &mStreamBuffers[i];
+            if (oldest)
+            {
+                mNumReplacedFrames++;
+                oldest->state = STREAM_WRITING;
+                return oldest->data;
+            }
+
+            if (!wait) break;
+            mStreamMapped.wait(&mStreamMutex);
+        }
+        return NULL;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTexture::publishFrame(void* data)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+        StreamBuffer* buffer = findStreamBuffer(data);
+        if (!buffer)
+        {
+            osg::notify(osg::WARN) << "osgPPU::UnitTexture::publishFrame() - " << getName() << " the memory was not acquired!" << std::endl;
+            return;
+        }
+        buffer->state = STREAM_READY;
+        buffer->sequence = ++mStreamSequence;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTexture::cancelFrame(void* data)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+        StreamBuffer* buffer = findStreamBuffer(data);
+        if (!buffer) return;
+        buffer->state = STREAM_MAPPED;
+        mStreamMapped.signal();
+    }
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitTexture::getNumUploadedFrames() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+        return mNumUploadedFrames;
+    }
+
+    //------------------------------------------------------------------------------
+    unsigned int UnitTexture::getNumReplacedFrames() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+        return mNumReplacedFrames;
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTexture::uploadStreamFrame(osg::RenderInfo& ri)
+    {
+        osg::State& state = *ri.getState();
+        unsigned int contextID = state.getContextID();
+        osg::GLBufferObject::Extensions* ext = osg::GLBufferObject::getExtensions(contextID, true);
+        bool usePBO = ext && ext->isPBOSupported();
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mStreamMutex);
+
+        // recreate the ring if its size or the size of the frames changed. The memory given to
+        // the producer stays valid until it is published, since its buffer is unmapped later.
+        unsigned int frameSize = getStreamFrameSize();
+        if (mStreamBuffers.size() != mNumStreamBuffers || mStreamFrameSize != frameSize)
+        {
+            for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+                if (mStreamBuffers[i].state == STREAM_WRITING) return;
+
+            if (mStreamRing.valid()) mStreamRing->release();
+            if (usePBO)
+            {
+                if (!mStreamRing.valid()) mStreamRing = new PixelBufferRing(GL_PIXEL_UNPACK_BUFFER_ARB, GL_STREAM_DRAW_ARB);
+                mStreamRing->resize(contextID, mNumStreamBuffers);
+            }
+
+            mStreamBuffers.clear();
+            mStreamBuffers.resize(mNumStreamBuffers);
+            mStreamFrameSize = frameSize;
+        }
+        if (mStreamBuffers.empty() || frameSize == 0) return;
+
+        // take the newest published frame, the older ones are replaced by it
+        StreamBuffer* newest = NULL;
+        for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+        {
+            StreamBuffer& buffer = mStreamBuffers[i];
+            if (buffer.state != STREAM_READY) continue;
+            if (newest && newest->sequence > buffer.sequence)
+            {
+                buffer.state = STREAM_MAPPED;
+                mNumReplacedFrames++;
+                continue;
+            }
+            if (newest)
+            {
+                newest->state = STREAM_MAPPED;
+                mNumReplacedFrames++;
+            }
+            newest = &buffer;
+        }
+
+        if (newest)
+        {
+            // the texture is bound, so that its object is created if not done before
+            state.applyTextureAttribute(0, _externTexture.get());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+            // the upload reads out of the buffer asynchronously, so the buffer is unmapped before
+            unsigned int index = newest - &mStreamBuffers[0];
+            const GLvoid* pixels = newest->data;
+            if (usePBO)
+            {
+                mStreamRing->unmap(index);
+                mStreamRing->bind(index, frameSize);
+                newest->data = NULL;
+                pixels = NULL;
+            }
+            glTexSubImage2D(_externTexture->getTextureTarget(), 0, 0, 0, _externTexture->getTextureWidth(), _externTexture->getTextureHeight(),
+                mStreamFormat, mStreamType, pixels);
+            if (usePBO)
+            {
+                mStreamRing->unbind();
+                mStreamRing->insertFence(index);
+                newest->state = STREAM_UPLOADING;
+            }else
+                newest->state = STREAM_MAPPED;
+
+            mNumUploadedFrames++;
+        }
+
+        // buffers, whose upload is finished, are orphaned and mapped again for the producer
+        bool mapped = false;
+        for (unsigned int i=0; i < mStreamBuffers.size(); i++)
+        {
+            StreamBuffer& buffer = mStreamBuffers[i];
+            if (buffer.state == STREAM_UPLOADING && mStreamRing->getFence(i)->isSignaled())
+            {
+                mStreamRing->getFence(i)->release();
+                buffer.state = STREAM_FREE;
+            }
+            if (buffer.state != STREAM_FREE) continue;
+
+            if (usePBO)
+            {
+                mStreamRing->bind(i, frameSize, true);
+                buffer.data = mStreamRing->map(i, GL_WRITE_ONLY_ARB);
+            }else
+            {
+                buffer.memory.resize(frameSize);
+                buffer.data = &buffer.memory[0];
+            }
+
+            if (buffer.data)
+            {
+                buffer.state = STREAM_MAPPED;
+                mapped = true;
+            }
+        }
+        if (mapped) mStreamMapped.broadcast();
+    }
+
+    //------------------------------------------------------------------------------
+    void UnitTexture::StreamDrawCallback::drawImplementation (osg::RenderInfo& ri, const osg::Drawable* dr) const
+    {
+        if (_parent->getActive())
+            static_cast<UnitTexture*>(_parent)->uploadStreamFrame(ri);
+
+        EmptyDrawCallback::drawImplementation(ri, dr);
+    }
+
 
 }; // end namespace
@@ -90,7 +90,7 @@ osg::Uniform::Type convertTextureToUniformType(osg::Texture* tex)
 }
 
 //--------------------------------------------------------------------------
-unsigned int computeTextureSizeInBytes(osg::Texture* tex)
+unsigned int computeTextureSizeInBytes(osg::Texture* tex, bool withMipmaps)
 {
     if (tex == NULL) return 0;
 
@@ -102,9 +102,40 @@ unsigned int computeTextureSizeInBytes(osg::Texture* tex)
 
     GLint intFormat = tex->getInternalFormat();
     GLenum type = osg::Image::computeFormatDataType(intFormat);
-    unsigned int rowWidth = osg::Image::computeRowWidthInBytes(w, intFormat, type, 1);
 
-    return rowWidth*h*d;
+    // each face of a cubemap is an own image, layers of an array are not reduced by mipmapping
+    unsigned int faces = dynamic_cast<osg::TextureCubeMap*>(tex) ? 6 : 1;
+    bool layered = dynamic_cast<osg::Texture2DArray*>(tex) != NULL;
+
+    GLenum minFilter = tex->getFilter(osg::Texture::MIN_FILTER);
+    withMipmaps = withMipmaps && minFilter != osg::Texture::LINEAR && minFilter != osg::Texture::NEAREST;
+
+    unsigned int size = 0;
+    while (w > 0)
+    {
+        unsigned int rowWidth = osg::Image::computeRowWidthInBytes(w, intFormat, type, 1);
+        size += rowWidth*h*d*faces;
+
+        if (!withMipmaps || (w == 1 && h == 1 && (d == 1 || layered))) break;
+        w = osg::maximum(1, w / 2);
+        h = osg::maximum(1, h / 2);
+        if (!layered) d = osg::maximum(1, d / 2);
+    }
+
+    return size;
+}
+
+//--------------------------------------------------------------------------
+std::string toJSONString(const std::string& str)
+{
+    std::string result = "\"";
+    for (unsigned i=0; i < str.size(); i++)
+    {
+        if ((unsigned char)str[i] < 0x20) continue;
+        if (str[i] == '"' || str[i] == '\\') result += '\\';
+        result += str[i];
+    }
+    return result + "\"";
 }
 
 
@@ -17,6 +17,7 @@
 #include <osgPPU/Visitor.h>
 #include <osgPPU/UnitBypass.h>
 #include <osgPPU/UnitInOut.h>
+#include <osgPPU/UnitInOutRepeat.h>
 #include <osgPPU/BarrierNode.h>
 #include <osgUtil/CullVisitor>
 
@@ -25,43 +26,9 @@
 
 namespace osgPPU
 {
-// Mutex used to let threads only change data values of Units in serialized manner
-OpenThreads::Mutex    UnitVisitor::s_mutex_changeUnitSubgraph;
-
-// just an instance for faster access
-osg::ref_ptr<CleanUpdateTraversedVisitor> CleanUpdateTraversedVisitor::sVisitor = new CleanUpdateTraversedVisitor;
-osg::ref_ptr<CleanCullTraversedVisitor> CleanCullTraversedVisitor::sVisitor = new CleanCullTraversedVisitor;
-
-//------------------------------------------------------------------------------
-void CleanUpdateTraversedVisitor::run (osg::Group* root)
-{
-    if (root == NULL) return;
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    apply(*root);
-}
-
-//------------------------------------------------------------------------------
-void CleanCullTraversedVisitor::run (osg::Group* root)
-{
-    if (root == NULL) return;
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    apply(*root);
-}
-
-//------------------------------------------------------------------------------
-void CleanCullTraversedVisitor::apply (osg::Group &node)
-{
-    Unit* unit = dynamic_cast<Unit*>(&node);
-    if (unit) unit->mbCullTraversed = false;
-    node.traverse(*this);
-}
-
 //------------------------------------------------------------------------------
 void RemoveUnitVisitor::run (osg::Group* root)
 {
-    // remove operation must be atomic
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
-
     // the specified root should be the unit which we would like to remove
     Unit* unit = dynamic_cast<Unit*>(root);
     if (unit == NULL)
@@ -118,8 +85,6 @@ void SetMaximumInputsVisitor::apply (osg::Group &node)
 //------------------------------------------------------------------------------
 void SetMaximumInputsVisitor::run (osg::Group* root)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
-
     root->traverse(*this);
 }
 
@@ -153,9 +118,6 @@ void OptimizeUnitsVisitor::run (osg::Group* root)
 
     // set the unit's input texture attributes accordingly
     {
-        // the opration change some unit values, hence make it atomic
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
-
         osg::notify(osg::INFO) << "osgPPU::OptimizeUnitsVisitor::run() - maximum possible texture index is " << _maxUnitInputIndex << "." << std::endl;
         SetMaximumInputsVisitor sm(_maxUnitInputIndex);
         root->traverse(sm);
@@ -205,8 +167,6 @@ void ResolveUnitsCyclesVisitor::apply (osg::Group &node)
 //------------------------------------------------------------------------------
 void ResolveUnitsCyclesVisitor::run (osg::Group* root)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
-
     root->traverse(*this);
 }
 
@@ -214,8 +174,6 @@ void ResolveUnitsCyclesVisitor::run (osg::Group* root)
 //------------------------------------------------------------------------------
 void SetupUnitRenderingVisitor::run (osg::Group* root)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex_changeUnitSubgraph);
-
     // setup unit list
     mUnitSet.clear();
     root->traverse(*this);
@@ -231,6 +189,9 @@ void SetupUnitRenderingVisitor::run (osg::Group* root)
         //(*it)->getOrCreateStateSet()->setRenderBinDetails(index++, binName);
         (*it)->getOrCreateStateSet()->setRenderBinToInherit();
 
+        // units which are not dirty keep their current setup
+        if (_initDirtyUnitsOnly && !(*it)->isDirty()) continue;
+
         // initialize units by updating them (the initialization process is called automagically
         if (_initUnits && _proc) _proc->onUnitInit(*it);
         if (_initUnits) (*it)->update();
@@ -271,6 +232,149 @@ void SetupUnitRenderingVisitor::apply (osg::Group &node)
     }
 }
 
+//------------------------------------------------------------------------------
+bool BuildExecutionPlanVisitor::isLastUnit(Unit* unit) const
+{
+    for (std::list<osg::observer_ptr<Unit> >::const_iterator it = _proc->mLastUnits.begin(); it != _proc->mLastUnits.end(); it++)
+        if (it->get() == unit) return true;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void BuildExecutionPlanVisitor::run (osg::Group* root)
+{
+    _planIndex.clear();
+    _blockedUnits.clear();
+
+    // remember all children of the processor which are not part of the plan
+    for (unsigned i=0; i < root->getNumChildren(); i++)
+    {
+        if (dynamic_cast<Unit*>(root->getChild(i)) == NULL)
+            _proc->mPlanChildren.push_back(root->getChild(i));
+    }
+
+    // collect all units in their correct order, except the last units
+    _deferLastUnits = true;
+    root->traverse(*this);
+
+    // now place the last units and everything what depends on them
+    _deferLastUnits = false;
+    for (std::list<osg::observer_ptr<Unit> >::iterator it = _proc->mLastUnits.begin(); it != _proc->mLastUnits.end(); it++)
+    {
+        if (it->valid()) (*it)->accept(*this);
+    }
+}
+
+//------------------------------------------------------------------------------
+void BuildExecutionPlanVisitor::apply (osg::Group &node)
+{
+    Unit* unit = dynamic_cast<Unit*>(&node);
+
+    // non-unit nodes are just traversed to find the units below them
+    if (unit == NULL)
+    {
+        node.traverse(*this);
+        return;
+    }
+
+    // skip units already placed or blocked by an unfinished repeatable segment
+    if (_planIndex.find(unit) != _planIndex.end()) return;
+    if (_blockedUnits.find(unit) != _blockedUnits.end()) return;
+
+    // all parent units have to be placed before
+    Processor::ExecutionStep step;
+    for (unsigned i=0; i < unit->getNumParents(); i++)
+    {
+        Unit* parent = dynamic_cast<Unit*>(unit->getParent(i));
+        if (parent == NULL) continue;
+
+        std::map<Unit*, unsigned>::const_iterator it = _planIndex.find(parent);
+        if (it == _planIndex.end()) return;
+        step.parents.push_back(it->second);
+    }
+
+    // units forced to be last are placed after all others
+    if (_deferLastUnits && isLastUnit(unit)) return;
+
+    // place the unit and remember its children which are no units
+    unsigned index = _proc->mExecutionPlan.size();
+    step.unit = unit;
+    _planIndex[unit] = index;
+    osg::NodeList children;
+    for (unsigned i=0; i < unit->getNumChildren(); i++)
+    {
+        osg::Node* child = unit->getChild(i);
+        if (dynamic_cast<Unit*>(child) || dynamic_cast<BarrierNode*>(child)) continue;
+
+        // the geode is drawn by the processor itself when executing directly
+        if (_proc->getUseDirectExecution() && child == unit->getGeode()) continue;
+
+        children.push_back(child);
+    }
+
+    // other threads might still traverse the unit by the previous plan, hence it is changed only if required
+    if (unit->mPlanProcessor != _proc) unit->mPlanProcessor = _proc;
+    if (unit->mPlanChildren != children) unit->mPlanChildren = children;
+
+    // the subgraph of a repeat unit up to its last node builds a segment,
+    // hence the children of the last node are placed after the segment
+    UnitInOutRepeat* repeat = dynamic_cast<UnitInOutRepeat*>(unit);
+    Unit* lastNode = repeat ? repeat->getLastNode() : NULL;
+    if (lastNode)
+    {
+        step.repeat = repeat;
+        _proc->mExecutionPlan.push_back(step);
+
+        std::vector<Unit*> blocked;
+        for (unsigned i=0; i < lastNode->getNumChildren(); i++)
+        {
+            Unit* child = dynamic_cast<Unit*>(lastNode->getChild(i));
+            if (child && _blockedUnits.insert(child).second) blocked.push_back(child);
+        }
+
+        for (unsigned i=0; i < unit->getNumChildren(); i++)
+            if (dynamic_cast<Unit*>(unit->getChild(i))) unit->getChild(i)->accept(*this);
+
+        for (std::vector<Unit*>::iterator it = blocked.begin(); it != blocked.end(); it++)
+            _blockedUnits.erase(*it);
+        _proc->mExecutionPlan[index].segmentEnd = _proc->mExecutionPlan.size();
+
+        for (std::vector<Unit*>::iterator it = blocked.begin(); it != blocked.end(); it++)
+            (*it)->accept(*this);
+        return;
+    }
+
+    _proc->mExecutionPlan.push_back(step);
+
+    // continue with the child units
+    for (unsigned i=0; i < unit->getNumChildren(); i++)
+        if (dynamic_cast<Unit*>(unit->getChild(i))) unit->getChild(i)->accept(*this);
+}
+
+//------------------------------------------------------------------------------
+void CollectInputSourcesVisitor::apply (osg::Group &node)
+{
+    Unit* unit = dynamic_cast<Unit*>(&node);
+    Processor* proc = dynamic_cast<Processor*>(&node);
+
+    // same order as used by Unit::setupInputsFromParents()
+    if (unit != NULL && unit != _caller)
+    {
+        _sources.push_back(Source(unit, 0));
+
+        UnitInOut* unitIO = dynamic_cast<UnitInOut*>(unit);
+        if (unitIO)
+        {
+            for (unsigned i=1; i < unitIO->getOutputDepth(); i++)
+                _sources.push_back(Source(unit, i));
+        }
+    }else if (proc != NULL && proc->getCamera())
+    {
+        _sources.push_back(Source(NULL, 0));
+    }else
+        traverse(node);
+}
+
 //------------------------------------------------------------------------------
 void MarkUnitsDirtyVisitor::apply (osg::Group &node)
 {
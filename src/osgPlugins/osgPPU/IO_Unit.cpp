@@ -30,6 +30,7 @@
 #include <osgPPU/ColorAttribute.h>
 #include <osgPPU/ShaderAttribute.h>
 #include <osgPPU/UnitInOutRepeat.h>
+#include <osgPPU/UnitInReductionOut.h>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -51,6 +52,13 @@ bool readShaderAttribute(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int pointwise = 0;
+    if (fr.readSequence("pointwise", pointwise))
+    {
+        sh.setPointwise(pointwise?true:false);
+        itAdvanced = true;
+    }
+
     // read uniform
     if (fr.matchSequence("RefUniformPair {"))
     {
@@ -278,6 +286,45 @@ bool readUnitInMipmapOut(osg::Object& obj, osgDB::Input& fr)
     return itAdvanced;
 }
 
+//--------------------------------------------------------------------------
+bool readUnitInReductionOut(osg::Object& obj, osgDB::Input& fr)
+{
+    // convert given object to unit
+    osgPPU::UnitInReductionOut& unit = static_cast<osgPPU::UnitInReductionOut&>(obj);
+
+    bool itAdvanced = false;
+
+    unsigned int numBins = 0;
+    if (fr.readSequence("numBins", numBins))
+    {
+        unit.setNumBins(numBins);
+        itAdvanced = true;
+    }
+
+    osg::Vec2 range;
+    if (fr.readSequence("histogramRange", range))
+    {
+        unit.setHistogramRange(range.x(), range.y());
+        itAdvanced = true;
+    }
+
+    osg::Vec3 weights;
+    if (fr.readSequence("luminanceWeights", weights))
+    {
+        unit.setLuminanceWeights(weights);
+        itAdvanced = true;
+    }
+
+    int useComputeShader = 0;
+    if (fr.readSequence("useComputeShader", useComputeShader))
+    {
+        unit.setUseComputeShader(useComputeShader?true:false);
+        itAdvanced = true;
+    }
+
+    return itAdvanced;
+}
+
 //--------------------------------------------------------------------------
 bool readUnitInOutModule(osg::Object& obj, osgDB::Input& fr)
 {
@@ -381,6 +428,44 @@ bool readUnitOutCapture(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int numBuffers = 0;
+    if (fr.readSequence("numBuffers", numBuffers))
+    {
+        unit.setNumBuffers(numBuffers);
+        itAdvanced = true;
+    }
+
+    int numWorkers = 0;
+    if (fr.readSequence("numWorkers", numWorkers))
+    {
+        unit.setNumWorkers(numWorkers);
+        itAdvanced = true;
+    }
+
+    int queueDepth = 0;
+    if (fr.readSequence("queueDepth", queueDepth))
+    {
+        unit.setQueueDepth(queueDepth);
+        itAdvanced = true;
+    }
+
+    std::string queuePolicy;
+    if (fr.readSequence("queuePolicy", queuePolicy))
+    {
+        unit.setQueuePolicy(queuePolicy == "BLOCK" ? osgPPU::UnitOutCapture::BLOCK : osgPPU::UnitOutCapture::DROP_FRAMES);
+        itAdvanced = true;
+    }
+
+    std::string dataType;
+    if (fr.readSequence("dataType", dataType))
+    {
+        if (dataType == "HALF_FLOAT") unit.setDataType(GL_HALF_FLOAT_ARB);
+        else if (dataType == "FLOAT") unit.setDataType(GL_FLOAT);
+        else if (dataType == "UNSIGNED_BYTE") unit.setDataType(GL_UNSIGNED_BYTE);
+        else unit.setDataType(0);
+        itAdvanced = true;
+    }
+
     return itAdvanced;
 }
 
@@ -406,6 +491,13 @@ bool readUnit(osg::Object& obj, osgDB::Input& fr)
         itAdvanced = true;
     }
 
+    int keepAlive = 0;
+    if (fr.readSequence("keepAlive", keepAlive))
+    {
+        unit.setKeepAlive(keepAlive?true:false);
+        itAdvanced = true;
+    }
+
     int inputTextureIndexForViewportReference = 0;
     if (fr.readSequence("inputTextureIndexForViewportReference", inputTextureIndexForViewportReference))
     {
@@ -542,6 +634,7 @@ bool writeShaderAttribute(const osg::Object& obj, osgDB::Output& fout)
     const osgPPU::ShaderAttribute& sh = static_cast<const osgPPU::ShaderAttribute&>(obj);
 
     fout.indent() << "maximalSupportedTextureUnits " << sh.getMaximalSupportedTextureUnits() << std::endl;
+    if (sh.getPointwise()) fout.indent() << "pointwise " << sh.getPointwise() << std::endl;
 
     // write uniform list
     osg::StateSet::UniformList::const_iterator jt = sh.getUniformList().begin();
@@ -596,6 +689,7 @@ bool writeUnit(const osg::Object& obj, osgDB::Output& fout)
     // retrieve default parameters and sotre them
     fout.indent() << "name " <<  fout.wrapString(unit.getName()) << std::endl;
     fout.indent() << "isActive " <<  unit.getActive() << std::endl;
+    if (unit.getKeepAlive()) fout.indent() << "keepAlive " <<  unit.getKeepAlive() << std::endl;
     fout.indent() << "inputTextureIndexForViewportReference " <<  unit.getInputTextureIndexForViewportReference() << std::endl;
 
     // write ignore input indices
@@ -728,6 +822,13 @@ bool writeUnitOutCapture(const osg::Object& obj, osgDB::Output& fout)
 
     fout.indent() << "Path " <<  fout.wrapString(unit.getPath()) << std::endl;
     fout.indent() << "Extension " <<  fout.wrapString(unit.getFileExtension()) << std::endl;
+    fout.indent() << "numBuffers " << unit.getNumBuffers() << std::endl;
+    fout.indent() << "numWorkers " << unit.getNumWorkers() << std::endl;
+    fout.indent() << "queueDepth " << unit.getQueueDepth() << std::endl;
+    fout.indent() << "queuePolicy " << (unit.getQueuePolicy() == osgPPU::UnitOutCapture::BLOCK ? "BLOCK" : "DROP_FRAMES") << std::endl;
+    if (unit.getDataType() == GL_HALF_FLOAT_ARB) fout.indent() << "dataType HALF_FLOAT" << std::endl;
+    else if (unit.getDataType() == GL_FLOAT) fout.indent() << "dataType FLOAT" << std::endl;
+    else if (unit.getDataType() == GL_UNSIGNED_BYTE) fout.indent() << "dataType UNSIGNED_BYTE" << std::endl;
 
     return true;
 }
@@ -810,6 +911,20 @@ bool writeUnitInResampleOut(const osg::Object& obj, osgDB::Output& fout)
     return true;
 }
 
+//--------------------------------------------------------------------------
+bool writeUnitInReductionOut(const osg::Object& obj, osgDB::Output& fout)
+{
+    // convert given object to unit
+    const osgPPU::UnitInReductionOut& unit = static_cast<const osgPPU::UnitInReductionOut&>(obj);
+
+    fout.indent() << "numBins " << unit.getNumBins() << std::endl;
+    fout.indent() << "histogramRange " << unit.getHistogramMin() << " " << unit.getHistogramMax() << std::endl;
+    fout.indent() << "luminanceWeights " << unit.getLuminanceWeights() << std::endl;
+    fout.indent() << "useComputeShader " << unit.getUseComputeShader() << std::endl;
+
+    return true;
+}
+
 //--------------------------------------------------------------------------
 bool writeUnitInOutModule(const osg::Object& obj, osgDB::Output& fout)
 {
@@ -976,6 +1091,16 @@ osgDB::RegisterDotOsgWrapperProxy g_UnitInMipmapOutProxy
     &writeUnitInMipmapOut
 );
 
+// register the read and write functions with the osgDB::Registry.
+osgDB::RegisterDotOsgWrapperProxy g_UnitInReductionOutProxy
+(
+    new osgPPU::UnitInReductionOut,
+    "UnitInReductionOut",
+    "Unit UnitInOut UnitInReductionOut",
+    &readUnitInReductionOut,
+    &writeUnitInReductionOut
+);
+
 // register the read and write functions with the osgDB::Registry.
 osgDB::RegisterDotOsgWrapperProxy g_UnitMipmapInMipmapOutProxy
 (